@@ -0,0 +1,282 @@
+/*==========================================================================
+
+  jpegtofb
+  scalebench.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A micro-benchmark for the scaler, which compares it, sampling and
+  smoothing, with the nearest-neighbour sampling that came before it:
+  both the original transform(), which scaled a whole decoded image in
+  memory, and the row-at-a-time version of it that came before the 
+  scaler. They are all given the same RGB888 pixels, and the 
+  row-at-a-time ones hand each finished row to a function that does
+  nothing much, so only the scaling is timed.
+
+  The sizes are the ones the scaler really gets: the decoder has
+  already scaled the picture by N/8 in the IDCT, so the ratio that is
+  left is between 1 and 2, or enlargement of a small picture.
+
+  Build with "make bench", and run on the hardware in question; the
+  results on a desktop machine say little about a Raspberry Pi.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "defs.h"
+#include "scaler.h"
+
+// Each test is repeated for this long
+#define BENCH_SECONDS 0.5
+
+typedef struct _BenchCase
+  {
+  const char *name;
+  int in_width;
+  int in_height;
+  int out_width;
+  int out_height;
+  } BenchCase;
+
+static const BenchCase bench_cases[] =
+  {
+  { "4000x3000 at 2/8 on 800x480",   1000, 750, 640, 480 },
+  { "4000x3000 at 2/8 on 1024x600",  1000, 750, 800, 600 },
+  { "4000x3000 at 2/8 on 1280x720",  1000, 750, 960, 720 },
+  { "4000x3000 at 3/8 on 1920x1080", 1500, 1125, 1440, 1080 },
+  { "3000x2000 at 3/8 on 1920x1080", 1125, 750, 1080, 720 },
+  { "400x300 enlarged on 800x600",   400, 300, 800, 600 },
+  };
+
+// Something for the row functions to do, so they aren't optimized away
+static volatile unsigned bench_sink;
+
+
+/*==========================================================================
+
+  bench_now
+
+==========================================================================*/
+static double bench_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+
+/*==========================================================================
+
+  bench_row
+
+==========================================================================*/
+static void bench_row (const BYTE *row, int y, void *user_data)
+  {
+  bench_sink += row[0] + y;
+  }
+
+
+/*==========================================================================
+
+  transform
+
+  As it was in jpegtofb.c, apart from logging
+
+==========================================================================*/
+static void transform (char *in, int in_height, int in_width, char *out, 
+    int out_height, int out_width)
+  {
+  if (in_height == out_height && in_width == out_width)
+    {
+    // No need to scale -- just copy the input to the 
+    //   output
+    int size = in_width * in_height * 3;
+    memcpy (out, in, size);
+    }
+  else
+    {
+    double scale = (double)in_width / (double)out_width;
+    for (int i = 0; i < out_height; i++)
+      {
+      int new_y = i * scale;
+      for (int j = 0; j < out_width; j++)
+        {
+        int new_x = j * scale; 
+        int index24in = (new_y * in_width + new_x) * 3;
+        int index24out = (i * out_width + j) * 3;
+        char r = in[index24in + 0];
+        char g = in[index24in + 1];
+        char b = in[index24in + 2];
+        out[index24out + 0] = r;
+        out[index24out + 1] = g;
+        out[index24out + 2] = b;
+        }
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  bench_transform
+
+  One frame through transform(). The input rows are all in one block
+
+==========================================================================*/
+static void bench_transform (const BenchCase *c, BYTE * const *in_rows)
+  {
+  char *out = malloc (c->out_width * c->out_height * 3);
+  transform ((char *)in_rows[0], c->in_height, c->in_width, out, 
+    c->out_height, c->out_width);
+  bench_sink += out[0];
+  free (out);
+  }
+
+
+/*==========================================================================
+
+  bench_sampled
+
+  One frame of nearest-neighbour scaling, a row at a time, as it was 
+  done just before the scaler: each output column takes the input 
+  pixel under its left edge, and each input row is repeated, or 
+  skipped, as necessary
+
+==========================================================================*/
+static void bench_sampled (const BenchCase *c, BYTE * const *in_rows)
+  {
+  double scale = (double)c->in_width / (double)c->out_width;
+  int *x_map = malloc (c->out_width * sizeof (int));
+  for (int j = 0; j < c->out_width; j++)
+    {
+    int x = j * scale;
+    x_map[j] = x < c->in_width ? x : c->in_width - 1;
+    }
+  BYTE *rgb_row = malloc (c->out_width * 3);
+
+  int next_row = 0;
+  for (int y = 0; y < c->in_height; y++)
+    {
+    const BYTE *row = in_rows[y];
+    BOOL last_row = (y == c->in_height - 1);
+    while (next_row < c->out_height
+            && ((int)(next_row * scale) <= y || last_row))
+      {
+      BYTE *out = rgb_row;
+      for (int j = 0; j < c->out_width; j++, out += 3)
+        {
+        const BYTE *p = row + x_map[j] * 3;
+        out[0] = p[0];
+        out[1] = p[1];
+        out[2] = p[2];
+        }
+      bench_row (rgb_row, next_row, NULL);
+      next_row++;
+      }
+    }
+
+  free (rgb_row);
+  free (x_map);
+  }
+
+
+/*==========================================================================
+
+  bench_scaler, bench_sampler, bench_smoother
+
+  One frame through the scaler, including setting it up
+
+==========================================================================*/
+static void bench_scaler (const BenchCase *c, BYTE * const *in_rows,
+      BOOL smooth)
+  {
+  Scaler *scaler = scaler_create (c->in_width, c->in_height,
+    c->out_width, c->out_height, 0, c->out_width, 0, c->out_height,
+    smooth, bench_row, NULL);
+  for (int y = 0; y < c->in_height; y++)
+    scaler_push_row (scaler, in_rows[y]);
+  scaler_destroy (scaler);
+  }
+
+static void bench_sampler (const BenchCase *c, BYTE * const *in_rows)
+  {
+  bench_scaler (c, in_rows, FALSE);
+  }
+
+static void bench_smoother (const BenchCase *c, BYTE * const *in_rows)
+  {
+  bench_scaler (c, in_rows, TRUE);
+  }
+
+
+/*==========================================================================
+
+  bench_run
+
+  Output megapixels per second, from the fastest of as many frames as
+  can be done in BENCH_SECONDS, so that other things running on the
+  machine have as little effect as possible
+
+==========================================================================*/
+static double bench_run (const BenchCase *c, BYTE * const *in_rows,
+      void (*fn) (const BenchCase *c, BYTE * const *in_rows))
+  {
+  fn (c, in_rows); // Warm up
+  double best = 1e9;
+  double start = bench_now (), end = start + BENCH_SECONDS;
+  while (start < end)
+    {
+    fn (c, in_rows);
+    double now = bench_now ();
+    if (now - start < best) best = now - start;
+    start = now;
+    }
+  return c->out_width * c->out_height / best / 1e6;
+  }
+
+
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  printf ("Output Mpixels/s\n\n");
+  printf ("%-30s %20s %9s %9s %9s %9s\n", "", "", "transform", "sampled",
+    "scaler", "--smooth");
+  for (int i = 0; i < sizeof (bench_cases) / sizeof (bench_cases[0]); i++)
+    {
+    const BenchCase *c = &bench_cases[i];
+    // Something like a photograph: smooth, with some noise
+    BYTE *image = malloc (c->in_width * c->in_height * 3);
+    BYTE **in_rows = malloc (c->in_height * sizeof (BYTE *));
+    srand (1);
+    for (int y = 0; y < c->in_height; y++)
+      {
+      BYTE *row = image + y * c->in_width * 3;
+      for (int x = 0; x < c->in_width * 3; x++)
+        row[x] = (x / 3 + y + x % 3 * 50 + rand () % 16) & 0xFF;
+      in_rows[y] = row;
+      }
+
+    double t = bench_run (c, in_rows, bench_transform);
+    double n = bench_run (c, in_rows, bench_sampled);
+    double s = bench_run (c, in_rows, bench_sampler);
+    double f = bench_run (c, in_rows, bench_smoother);
+    char size[32];
+    snprintf (size, sizeof (size), "%dx%d->%dx%d", c->in_width,
+      c->in_height, c->out_width, c->out_height);
+    printf ("%-30s %20s %9.0f %9.0f %9.0f %9.0f\n", c->name, size, t, n, 
+      s, f);
+
+    free (in_rows);
+    free (image);
+    }
+  return 0;
+  }
+
@@ -0,0 +1,370 @@
+/*==========================================================================
+
+  jpegtofb
+  bands.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Decoding an image as a set of horizontal bands, on several threads
+  at once. How a band is decoded is up to the caller (see restart.c
+  and progressive.c); this file cuts the image into bands, runs the
+  worker threads, and hands the finished rows to the caller's row 
+  function, in order, on the calling thread.
+
+  Fancy (smooth) chroma upsampling looks at the chroma rows either
+  side of the one being expanded, so where it is in use the bands are
+  decoded with an extra strip of rows above and below, which is then 
+  thrown away. That way the output is exactly the same as a 
+  single-threaded decode.
+
+  If the caller wants only part of the image, bands that lie wholly 
+  outside it are not decoded at all, and the others are decoded only
+  as wide as they need to be -- again with a little extra either side,
+  if the upsampler needs it.
+
+  Only a few bands are allowed to be in flight at once, so the memory
+  used stays well short of a full image.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include "log.h"
+#include "jpeglib.h"
+#include "bands.h"
+
+// Aim for this many bands per thread, so that the threads can
+//   balance out bands that take longer than others to decode
+#define BANDS_PER_THREAD 4
+
+typedef struct _BandsJob
+  {
+  BandDecodeFn decode_fn;
+  void *decode_data;
+  Band *bands;
+  int n_bands;
+  // Bands are taken by the workers in order. A worker may not start
+  //   a band more than window bands ahead of the last one that
+  //   was delivered
+  int next_band;
+  int delivered;
+  int window;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  } BandsJob;
+
+
+/*==========================================================================
+
+  bands_threads
+
+  The number of threads worth running. Band decoding is pointless if
+  this is less than two
+
+==========================================================================*/
+int bands_threads (void)
+  {
+  return sysconf (_SC_NPROCESSORS_ONLN);
+  }
+
+
+/*==========================================================================
+
+  bands_thread
+
+==========================================================================*/
+static void *bands_thread (void *arg)
+  {
+  BandsJob *job = arg;
+  pthread_mutex_lock (&job->mutex);
+  for (;;)
+    {
+    if (job->next_band < job->n_bands
+         && job->next_band >= job->delivered + job->window)
+      {
+      pthread_cond_wait (&job->cond, &job->mutex);
+      continue;
+      }
+    if (job->next_band >= job->n_bands) break;
+    Band *band = &job->bands[job->next_band++];
+    pthread_mutex_unlock (&job->mutex);
+
+    job->decode_fn (band, job->decode_data);
+
+    pthread_mutex_lock (&job->mutex);
+    band->done = TRUE;
+    pthread_cond_broadcast (&job->cond);
+    }
+  pthread_mutex_unlock (&job->mutex);
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  bands_context
+
+  Work out whether the upsampler looks at the chroma samples above and
+  below, and either side, of the one being expanded. If it does, a 
+  piece of the image that is decoded on its own comes out differently
+  at its edges. jdsample turns fancy upsampling off when the IDCT is
+  scaled right down
+
+==========================================================================*/
+static void bands_context (const struct jpeg_decompress_struct *cinfo,
+      BOOL *rows, BOOL *cols)
+  {
+  *rows = FALSE;
+  *cols = FALSE;
+  if (cinfo->do_fancy_upsampling && cinfo->min_DCT_scaled_size > 1)
+    {
+    for (int ci = 0; ci < cinfo->num_components; ci++)
+      {
+      if (cinfo->comp_info[ci].v_samp_factor < cinfo->max_v_samp_factor)
+        *rows = TRUE;
+      if (cinfo->comp_info[ci].h_samp_factor < cinfo->max_h_samp_factor)
+        *cols = TRUE;
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  bands_window
+
+  Fill in the rows and columns of window that have to be decoded to 
+  produce region of the output, including an extra iMCU row or column
+  on each side where the upsampler needs it. cinfo's output dimensions
+  must be set
+
+==========================================================================*/
+void bands_window (const struct jpeg_decompress_struct *cinfo, 
+      const JpegReaderRegion *region, Band *window)
+  {
+  BOOL row_context, col_context;
+  bands_context (cinfo, &row_context, &col_context);
+  int out_row_height = cinfo->max_v_samp_factor 
+    * cinfo->min_DCT_scaled_size;
+  int out_col_width = cinfo->max_h_samp_factor 
+    * cinfo->min_DCT_scaled_size;
+  int mcu_rows = cinfo->total_iMCU_rows;
+  int mcu_cols = (cinfo->image_width 
+    + cinfo->max_h_samp_factor * DCTSIZE - 1)
+    / (cinfo->max_h_samp_factor * DCTSIZE);
+
+  memset (window, 0, sizeof (Band));
+  window->first_row = region->y / out_row_height;
+  window->last_row = (region->y + region->height + out_row_height - 1) 
+    / out_row_height;
+  window->dec_first = window->first_row - (row_context ? 1 : 0);
+  if (window->dec_first < 0) window->dec_first = 0;
+  window->dec_last = window->last_row + (row_context ? 1 : 0);
+  if (window->dec_last > mcu_rows) window->dec_last = mcu_rows;
+
+  int first_col = region->x / out_col_width - (col_context ? 1 : 0);
+  if (first_col < 0) first_col = 0;
+  int last_col = (region->x + region->width + out_col_width - 1) 
+    / out_col_width + (col_context ? 1 : 0);
+  if (last_col > mcu_cols) last_col = mcu_cols;
+  if (first_col > 0 || last_col < mcu_cols)
+    {
+    window->first_col = first_col;
+    window->n_cols = last_col - first_col;
+    }
+  }
+
+
+/*==========================================================================
+
+  bands_plan
+
+  Cut the part of the image that region covers into bands whose edges
+  fall at the start of every step'th iMCU row. Returns FALSE if there
+  are too few such places in the image to be worth splitting it
+
+==========================================================================*/
+static BOOL bands_plan (BandsJob *job, 
+      const struct jpeg_decompress_struct *cinfo, int step, int n_threads,
+      const JpegReaderRegion *region)
+  {
+  int mcu_rows = cinfo->total_iMCU_rows;
+  int n_steps = (mcu_rows + step - 1) / step;
+  if (n_steps < 2) return FALSE;
+
+  // Overlap is only needed when the upsampler uses the chroma rows
+  //  above and below
+  BOOL context, col_context;
+  bands_context (cinfo, &context, &col_context);
+  int overlap = context ? step : 0;
+
+  // Only the steps that the region touches are decoded
+  Band window;
+  bands_window (cinfo, region, &window);
+  int first_step = window.first_row / step;
+  int last_step = (window.last_row + step - 1) / step;
+  if (last_step > n_steps) last_step = n_steps;
+  n_steps = last_step - first_step;
+
+  job->n_bands = n_threads * BANDS_PER_THREAD;
+  if (job->n_bands > n_steps) job->n_bands = n_steps;
+  job->bands = calloc (job->n_bands, sizeof (Band));
+
+  int out_row_height = cinfo->max_v_samp_factor 
+    * cinfo->min_DCT_scaled_size;
+  for (int i = 0; i < job->n_bands; i++)
+    {
+    Band *band = &job->bands[i];
+    band->first_row = (first_step 
+      + (long)i * n_steps / job->n_bands) * step;
+    band->last_row = (first_step 
+      + (long)(i + 1) * n_steps / job->n_bands) * step;
+    if (band->last_row > mcu_rows) band->last_row = mcu_rows;
+    band->dec_first = band->first_row - overlap;
+    if (band->dec_first < 0) band->dec_first = 0;
+    band->dec_last = band->last_row + overlap;
+    if (band->dec_last > mcu_rows) band->dec_last = mcu_rows;
+    band->first_col = window.first_col;
+    band->n_cols = window.n_cols;
+    band->skip = (band->first_row - band->dec_first) * out_row_height;
+    // The bottom band may be a part-row; its size is whatever is left
+    int bottom = band->last_row * out_row_height;
+    if (bottom > (int)cinfo->output_height) bottom = cinfo->output_height;
+    band->n_rows = bottom - band->first_row * out_row_height;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  bands_read_scanlines
+
+  Read all the output of a started decompressor into band->pixels, 
+  which is allocated here. For use by band decoding functions
+
+==========================================================================*/
+void bands_read_scanlines (struct jpeg_decompress_struct *cinfo, 
+      Band *band)
+  {
+  int row_stride = cinfo->output_width * cinfo->output_components;
+  int batch = cinfo->rec_outbuf_height;
+  band->pixels = malloc ((size_t)cinfo->output_height * row_stride);
+  JSAMPROW row_pointers[batch];
+  while (cinfo->output_scanline < cinfo->output_height)
+    {
+    for (int i = 0; i < batch; i++)
+      row_pointers[i] = band->pixels
+        + (size_t)(cinfo->output_scanline + i) * row_stride;
+    jpeg_read_scanlines (cinfo, row_pointers,
+      cinfo->output_height - cinfo->output_scanline < (JDIMENSION)batch
+        ? cinfo->output_height - cinfo->output_scanline : batch);
+    }
+  }
+
+
+/*==========================================================================
+
+  bands_decode
+
+  Decode region of the image described by cinfo, whose output 
+  dimensions must be set, in bands. Band edges fall only at the start
+  of every step'th iMCU row. decode_fn is called on worker threads to
+  decode each band.
+
+  Returns FALSE, without calling row_fn, if the image has too few 
+  places it can be split. Otherwise the rows of the region are passed
+  to row_fn, in order, on the calling thread.
+
+==========================================================================*/
+BOOL bands_decode (const struct jpeg_decompress_struct *cinfo, int step,
+       BandDecodeFn decode_fn, void *decode_data, 
+       const JpegReaderRegion *region, JpegReaderRowFn row_fn, 
+       void *user_data)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  int n_threads = bands_threads ();
+
+  BandsJob job;
+  memset (&job, 0, sizeof (job));
+  job.decode_fn = decode_fn;
+  job.decode_data = decode_data;
+  if (bands_plan (&job, cinfo, step, n_threads, region))
+    {
+    if (n_threads > job.n_bands) n_threads = job.n_bands;
+    job.window = n_threads + 1;
+    log_debug ("bands: %d bands, %d threads", job.n_bands, n_threads);
+
+    pthread_mutex_init (&job.mutex, NULL);
+    pthread_cond_init (&job.cond, NULL);
+    pthread_t threads[n_threads];
+    sigset_t all, old;
+    sigfillset (&all);
+    // Except SIGBUS, which is how a mapped file that has been cut 
+    //   short shows up, and which jpegreader handles
+    sigdelset (&all, SIGBUS);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+    for (int i = 0; i < n_threads; i++)
+      pthread_create (&threads[i], NULL, bands_thread, &job);
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+    // All the bands are the same width. If they are narrower than the
+    //   image, their left edge is at the start of an iMCU column
+    int out_row_height = cinfo->max_v_samp_factor 
+      * cinfo->min_DCT_scaled_size;
+    int left = 0, width = cinfo->output_width;
+    if (job.bands[0].n_cols > 0)
+      {
+      int out_col_width = cinfo->max_h_samp_factor 
+        * cinfo->min_DCT_scaled_size;
+      left = job.bands[0].first_col * out_col_width;
+      width = (job.bands[0].first_col + job.bands[0].n_cols) 
+        * out_col_width;
+      if (width > (int)cinfo->output_width) width = cinfo->output_width;
+      width -= left;
+      }
+    int row_stride = width * cinfo->output_components;
+    int x_offset = (region->x - left) * cinfo->output_components;
+    int region_bottom = region->y + region->height;
+
+    for (int i = 0; i < job.n_bands; i++)
+      {
+      Band *band = &job.bands[i];
+      pthread_mutex_lock (&job.mutex);
+      while (!band->done)
+        pthread_cond_wait (&job.cond, &job.mutex);
+      pthread_mutex_unlock (&job.mutex);
+
+      const BYTE *row = band->pixels + (size_t)band->skip * row_stride;
+      int y = band->first_row * out_row_height;
+      for (int j = 0; j < band->n_rows; j++, y++, row += row_stride)
+        {
+        if (y >= region->y && y < region_bottom)
+          row_fn (row + x_offset, y, user_data);
+        }
+      free (band->pixels);
+      band->pixels = NULL;
+
+      pthread_mutex_lock (&job.mutex);
+      job.delivered = i + 1;
+      pthread_cond_broadcast (&job.cond);
+      pthread_mutex_unlock (&job.mutex);
+      }
+
+    for (int i = 0; i < n_threads; i++)
+      pthread_join (threads[i], NULL);
+    pthread_cond_destroy (&job.cond);
+    pthread_mutex_destroy (&job.mutex);
+    ret = TRUE;
+    }
+
+  free (job.bands);
+  LOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,54 @@
+/*============================================================================
+
+  jpegtofb
+  bands.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdio.h>
+#include "defs.h"
+#include "jpeglib.h"
+#include "jpegreader.h"
+
+// A horizontal band of the image, in iMCU rows
+typedef struct _Band
+  {
+  // Rows that this band delivers, [first_row, last_row)
+  int first_row;
+  int last_row;
+  // Rows that have to be decoded, including any overlap
+  int dec_first;
+  int dec_last;
+  // iMCU columns that have to be decoded, [first_col, first_col + 
+  //   n_cols), or n_cols is zero for the full width
+  int first_col;
+  int n_cols;
+  // Decoded output, of which skip rows at the top are overlap, and
+  //   the n_rows after that are kept
+  BYTE *pixels;
+  int skip;
+  int n_rows;
+  BOOL done;
+  } Band;
+
+// Decode iMCU rows [dec_first, dec_last) into band->pixels. Called on 
+//   a worker thread
+typedef void (*BandDecodeFn) (Band *band, void *user_data);
+
+BEGIN_DECLS
+
+int   bands_threads (void);
+BOOL  bands_decode (const struct jpeg_decompress_struct *cinfo, int step,
+        BandDecodeFn decode_fn, void *decode_data, 
+        const JpegReaderRegion *region, JpegReaderRowFn row_fn, 
+        void *user_data);
+void  bands_window (const struct jpeg_decompress_struct *cinfo, 
+        const JpegReaderRegion *region, Band *window);
+void  bands_read_scanlines (struct jpeg_decompress_struct *cinfo, 
+        Band *band);
+
+END_DECLS
+
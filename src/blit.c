@@ -0,0 +1,299 @@
+/*==========================================================================
+
+  jpegtofb
+  blit.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Row converters from packed RGB888 to the pixel formats that 
+  framebuffers commonly use. The converter is chosen once, from the
+  bitfields reported by the driver, and then converts whole rows --
+  clipping is the caller's job, so the loops here have no bounds
+  checks, and the compiler is free to vectorize them. The names
+  follow the DRM convention: XRGB8888 is a 32-bit value with red in
+  bits 16-23, and so on. 16- and 32-bit pixels are stored as native 
+  integers, so the bitfield offsets mean the same thing whatever the
+  byte order of the CPU. The 16-bit converters also come in a version
+  that dithers, which hides the banding in skies and other smooth
+  gradients.
+
+  Any layout that doesn't match one of the specialized converters is
+  handled by a generic one, which works out every pixel from the
+  bitfield offsets and lengths. It's slow, but it's a lot better
+  than garbage on the screen.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <linux/fb.h>
+#include "log.h" 
+#include "blit.h" 
+
+
+/*==========================================================================
+
+  blit_xrgb8888
+
+==========================================================================*/
+static void blit_xrgb8888 (BYTE *dest, const BYTE *rgb, int n, 
+      const struct fb_var_screeninfo *vinfo)
+  {
+  uint32_t *d = (uint32_t *)dest;
+  for (int i = 0; i < n; i++, rgb += 3)
+    d[i] = 0xFF000000 | (uint32_t)rgb[0] << 16 
+      | (uint32_t)rgb[1] << 8 | rgb[2];
+  }
+
+
+/*==========================================================================
+
+  blit_xbgr8888
+
+==========================================================================*/
+static void blit_xbgr8888 (BYTE *dest, const BYTE *rgb, int n, 
+      const struct fb_var_screeninfo *vinfo)
+  {
+  uint32_t *d = (uint32_t *)dest;
+  for (int i = 0; i < n; i++, rgb += 3)
+    d[i] = 0xFF000000 | (uint32_t)rgb[2] << 16 
+      | (uint32_t)rgb[1] << 8 | rgb[0];
+  }
+
+
+/*==========================================================================
+
+  blit_rgb888
+
+  24-bit pixels are assumed to be stored little-endian, as they
+  are on every framebuffer I know of 
+
+==========================================================================*/
+static void blit_rgb888 (BYTE *dest, const BYTE *rgb, int n, 
+      const struct fb_var_screeninfo *vinfo)
+  {
+  for (int i = 0; i < n; i++, rgb += 3, dest += 3)
+    {
+    dest[0] = rgb[2];
+    dest[1] = rgb[1];
+    dest[2] = rgb[0];
+    }
+  }
+
+
+/*==========================================================================
+
+  blit_bgr888
+
+==========================================================================*/
+static void blit_bgr888 (BYTE *dest, const BYTE *rgb, int n, 
+      const struct fb_var_screeninfo *vinfo)
+  {
+  memcpy (dest, rgb, n * 3);
+  }
+
+
+/*==========================================================================
+
+  blit_rgb565
+
+==========================================================================*/
+static void blit_rgb565 (BYTE *dest, const BYTE *rgb, int n, 
+      const struct fb_var_screeninfo *vinfo)
+  {
+  uint16_t *d = (uint16_t *)dest;
+  for (int i = 0; i < n; i++, rgb += 3)
+    d[i] = (rgb[0] & 0xF8) << 8 | (rgb[1] & 0xFC) << 3 | rgb[2] >> 3;
+  }
+
+
+/*==========================================================================
+
+  blit_bgr565
+
+==========================================================================*/
+static void blit_bgr565 (BYTE *dest, const BYTE *rgb, int n, 
+      const struct fb_var_screeninfo *vinfo)
+  {
+  uint16_t *d = (uint16_t *)dest;
+  for (int i = 0; i < n; i++, rgb += 3)
+    d[i] = (rgb[2] & 0xF8) << 8 | (rgb[1] & 0xFC) << 3 | rgb[0] >> 3;
+  }
+
+
+// 4x4 ordered (Bayer) dither for 16-bit pixels: biases of 0..7, four 
+//   bits to an entry and sixteen to a row. The bias is added to red and
+//   blue before their low three bits are dropped, and half of it to 
+//   green, which loses only two. The decoder uses the same pattern when
+//   it writes RGB565 itself, so the two ways of drawing look the same
+#define BLIT_DITHER_ROW(y) \
+  ((unsigned)(0x2637405137265140ULL >> (((y) & 3) * 16)) & 0xFFFF)
+#define BLIT_DITHER(drow,x) (((drow) >> (((x) & 3) * 4)) & 7)
+
+static inline BYTE blit_add_clamp (BYTE c, int d)
+  {
+  int v = c + d;
+  return v > 255 ? 255 : v;
+  }
+
+
+/*==========================================================================
+
+  blit_rgb565_dither
+
+==========================================================================*/
+static void blit_rgb565_dither (BYTE *dest, const BYTE *rgb, int n, 
+      int x, int y)
+  {
+  uint16_t *d = (uint16_t *)dest;
+  unsigned drow = BLIT_DITHER_ROW (y);
+  for (int i = 0; i < n; i++, rgb += 3)
+    {
+    int b = BLIT_DITHER (drow, x + i);
+    d[i] = (blit_add_clamp (rgb[0], b) & 0xF8) << 8 
+      | (blit_add_clamp (rgb[1], b >> 1) & 0xFC) << 3 
+      | blit_add_clamp (rgb[2], b) >> 3;
+    }
+  }
+
+
+/*==========================================================================
+
+  blit_bgr565_dither
+
+==========================================================================*/
+static void blit_bgr565_dither (BYTE *dest, const BYTE *rgb, int n, 
+      int x, int y)
+  {
+  uint16_t *d = (uint16_t *)dest;
+  unsigned drow = BLIT_DITHER_ROW (y);
+  for (int i = 0; i < n; i++, rgb += 3)
+    {
+    int b = BLIT_DITHER (drow, x + i);
+    d[i] = (blit_add_clamp (rgb[2], b) & 0xF8) << 8 
+      | (blit_add_clamp (rgb[1], b >> 1) & 0xFC) << 3 
+      | blit_add_clamp (rgb[0], b) >> 3;
+    }
+  }
+
+
+/*==========================================================================
+
+  blit_channel
+
+  Scale an 8-bit channel value to a bitfield, and move it into place
+
+==========================================================================*/
+static inline uint32_t blit_channel (BYTE c, 
+      const struct fb_bitfield *field)
+  {
+  uint32_t v = field->length <= 8 
+    ? c >> (8 - field->length) : (uint32_t)c << (field->length - 8);
+  return v << field->offset;
+  }
+
+
+/*==========================================================================
+
+  blit_generic
+
+==========================================================================*/
+static void blit_generic (BYTE *dest, const BYTE *rgb, int n, 
+      const struct fb_var_screeninfo *vinfo)
+  {
+  int bytes = vinfo->bits_per_pixel / 8;
+  uint32_t alpha = vinfo->transp.length 
+    ? ((1U << vinfo->transp.length) - 1) << vinfo->transp.offset : 0;
+  for (int i = 0; i < n; i++, rgb += 3, dest += bytes)
+    {
+    uint32_t v = alpha | blit_channel (rgb[0], &vinfo->red)
+      | blit_channel (rgb[1], &vinfo->green) 
+      | blit_channel (rgb[2], &vinfo->blue);
+    switch (bytes)
+      {
+      case 4: *(uint32_t *)dest = v; break;
+      case 2: *(uint16_t *)dest = v; break;
+      default:
+        for (int b = 0; b < bytes; b++)
+          dest[b] = v >> (8 * b);
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  blit_is
+
+  Does vinfo have the specified depth and red/green/blue offsets?
+
+==========================================================================*/
+static BOOL blit_is (const struct fb_var_screeninfo *vinfo, int bpp, 
+      int r, int g, int b)
+  {
+  return vinfo->bits_per_pixel == bpp 
+    && vinfo->red.offset == r && vinfo->green.offset == g 
+    && vinfo->blue.offset == b;
+  }
+
+
+/*==========================================================================
+
+  blit_choose
+
+==========================================================================*/
+void blit_choose (const struct fb_var_screeninfo *vinfo, Blitter *blitter)
+  {
+  LOG_IN
+  blitter->bytes_per_pixel = vinfo->bits_per_pixel / 8;
+  blitter->format = BLIT_FORMAT_OTHER;
+  blitter->blit_row_dither = NULL;
+  if (blit_is (vinfo, 32, 16, 8, 0))
+    {
+    blitter->name = "XRGB8888";
+    blitter->blit_row = blit_xrgb8888;
+    blitter->format = BLIT_FORMAT_XRGB8888;
+    }
+  else if (blit_is (vinfo, 32, 0, 8, 16))
+    {
+    blitter->name = "XBGR8888";
+    blitter->blit_row = blit_xbgr8888;
+    blitter->format = BLIT_FORMAT_XBGR8888;
+    }
+  else if (blit_is (vinfo, 24, 16, 8, 0))
+    {
+    blitter->name = "RGB888";
+    blitter->blit_row = blit_rgb888;
+    }
+  else if (blit_is (vinfo, 24, 0, 8, 16))
+    {
+    blitter->name = "BGR888";
+    blitter->blit_row = blit_bgr888;
+    }
+  else if (blit_is (vinfo, 16, 11, 5, 0) && vinfo->green.length == 6)
+    {
+    blitter->name = "RGB565";
+    blitter->blit_row = blit_rgb565;
+    blitter->format = BLIT_FORMAT_RGB565;
+    blitter->blit_row_dither = blit_rgb565_dither;
+    }
+  else if (blit_is (vinfo, 16, 0, 5, 11) && vinfo->green.length == 6)
+    {
+    blitter->name = "BGR565";
+    blitter->blit_row = blit_bgr565;
+    blitter->blit_row_dither = blit_bgr565_dither;
+    }
+  else
+    {
+    blitter->name = "generic";
+    blitter->blit_row = blit_generic;
+    }
+  log_debug ("blit: %d bpp, r=%d/%d g=%d/%d b=%d/%d: using %s", 
+    vinfo->bits_per_pixel, vinfo->red.offset, vinfo->red.length, 
+    vinfo->green.offset, vinfo->green.length, vinfo->blue.offset, 
+    vinfo->blue.length, blitter->name);
+  LOG_OUT
+  }
+
@@ -0,0 +1,48 @@
+/*============================================================================
+
+  jpegtofb
+  blit.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <linux/fb.h>
+#include "defs.h"
+
+// Convert n pixels of packed RGB888 into framebuffer pixels at dest. 
+//   The vinfo argument is only used by the generic (slow) converter
+typedef void (*BlitRowFn) (BYTE *dest, const BYTE *rgb, int n, 
+          const struct fb_var_screeninfo *vinfo);
+
+// As BlitRowFn, but with an ordered dither. x and y are the screen 
+//   position of the first pixel, which fix the dither pattern
+typedef void (*BlitDitherRowFn) (BYTE *dest, const BYTE *rgb, int n, 
+          int x, int y);
+
+// The framebuffer layouts that the JPEG decoder can produce directly
+typedef enum _BlitFormat
+  {
+  BLIT_FORMAT_OTHER = 0,
+  BLIT_FORMAT_XRGB8888,
+  BLIT_FORMAT_XBGR8888,
+  BLIT_FORMAT_RGB565
+  } BlitFormat;
+
+typedef struct _Blitter
+  {
+  const char *name;
+  int bytes_per_pixel;
+  BlitFormat format;
+  BlitRowFn blit_row;
+  // NULL if dithering would make no difference to this format
+  BlitDitherRowFn blit_row_dither;
+  } Blitter;
+
+BEGIN_DECLS
+
+void blit_choose (const struct fb_var_screeninfo *vinfo, Blitter *blitter);
+
+END_DECLS
+
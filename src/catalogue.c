@@ -0,0 +1,350 @@
+/*==========================================================================
+
+  jpegtofb
+  catalogue.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  The pathnames of the pictures in the slideshow, in the order they
+  are to be shown. The order is an array of pointers, so getting the
+  Nth picture, or the number of pictures, takes no time at all, and
+  shuffling is a single pass over the array.
+
+  Each pathname is stored once, in large blocks of memory that are
+  never moved or freed until the catalogue is destroyed, and found
+  again through a hash table. So a pathname returned by
+  catalogue_get() stays valid even if the picture is removed, and
+  checking whether a picture is already in the catalogue doesn't
+  involve looking through all of them. A picture that is removed
+  and then added again -- because it's been replaced, for example --
+  uses the same copy of its name.
+
+  There is no locking here; the slideshow does that.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "catalogue.h"
+
+// Size of the blocks the pathnames are stored in. A name longer than
+//   this gets a block to itself
+#define CATALOGUE_BLOCK 65536
+
+typedef struct _CatalogueBlock
+  {
+  struct _CatalogueBlock *next;
+  size_t size;
+  size_t used;
+  char data[];
+  } CatalogueBlock;
+
+// An entry in the hash table of every pathname ever added
+typedef struct _CatalogueName
+  {
+  const char *path;
+  uint32_t hash;
+  // Whether the picture is in the catalogue now
+  BOOL present;
+  } CatalogueName;
+
+struct _Catalogue
+  {
+  // The pictures, in order
+  const char **paths;
+  int n_paths;
+  int max_paths;
+  // Open-addressed, and never more than half full. Entries are never
+  //   removed, so there's no need for tombstones
+  CatalogueName *names;
+  uint32_t n_names;
+  uint32_t max_names;
+  CatalogueBlock *blocks;
+  };
+
+
+/*==========================================================================
+
+  catalogue_create
+
+==========================================================================*/
+Catalogue *catalogue_create (void)
+  {
+  LOG_IN
+  Catalogue *self = malloc (sizeof (Catalogue));
+  memset (self, 0, sizeof (Catalogue));
+  self->max_names = 1024;
+  self->names = calloc (self->max_names, sizeof (CatalogueName));
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  catalogue_destroy
+
+==========================================================================*/
+void catalogue_destroy (Catalogue *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    CatalogueBlock *b = self->blocks;
+    while (b)
+      {
+      CatalogueBlock *next = b->next;
+      free (b);
+      b = next;
+      }
+    free (self->names);
+    free (self->paths);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  catalogue_hash
+
+  FNV-1a
+
+==========================================================================*/
+static uint32_t catalogue_hash (const char *path)
+  {
+  uint32_t h = 2166136261u;
+  for (const BYTE *p = (const BYTE *)path; *p; p++)
+    h = (h ^ *p) * 16777619u;
+  return h;
+  }
+
+
+/*==========================================================================
+
+  catalogue_find
+
+  The hash table entry for path, or the empty entry where it would go
+
+==========================================================================*/
+static CatalogueName *catalogue_find (const Catalogue *self,
+      const char *path, uint32_t hash)
+  {
+  uint32_t mask = self->max_names - 1;
+  uint32_t i = hash & mask;
+  while (self->names[i].path && (self->names[i].hash != hash
+       || strcmp (self->names[i].path, path) != 0))
+    i = (i + 1) & mask;
+  return &self->names[i];
+  }
+
+
+/*==========================================================================
+
+  catalogue_store
+
+  Copy a pathname into the blocks
+
+==========================================================================*/
+static const char *catalogue_store (Catalogue *self, const char *path)
+  {
+  size_t l = strlen (path) + 1;
+  CatalogueBlock *b = self->blocks;
+  if (!b || b->size - b->used < l)
+    {
+    size_t size = l > CATALOGUE_BLOCK ? l : CATALOGUE_BLOCK;
+    b = malloc (sizeof (CatalogueBlock) + size);
+    b->size = size;
+    b->used = 0;
+    b->next = self->blocks;
+    self->blocks = b;
+    }
+  char *s = b->data + b->used;
+  memcpy (s, path, l);
+  b->used += l;
+  return s;
+  }
+
+
+/*==========================================================================
+
+  catalogue_intern
+
+  The hash table entry for path, adding it if it isn't there
+
+==========================================================================*/
+static CatalogueName *catalogue_intern (Catalogue *self, const char *path)
+  {
+  uint32_t hash = catalogue_hash (path);
+  CatalogueName *n = catalogue_find (self, path, hash);
+  if (n->path) return n;
+
+  if (2 * (self->n_names + 1) > self->max_names)
+    {
+    CatalogueName *old = self->names;
+    uint32_t old_max = self->max_names;
+    self->max_names *= 2;
+    self->names = calloc (self->max_names, sizeof (CatalogueName));
+    for (uint32_t i = 0; i < old_max; i++)
+      if (old[i].path)
+        *catalogue_find (self, old[i].path, old[i].hash) = old[i];
+    free (old);
+    n = catalogue_find (self, path, hash);
+    }
+
+  n->path = catalogue_store (self, path);
+  n->hash = hash;
+  n->present = FALSE;
+  self->n_names++;
+  return n;
+  }
+
+
+/*==========================================================================
+
+  catalogue_add
+
+  Add a picture at the end. Returns FALSE if it was already there
+
+==========================================================================*/
+BOOL catalogue_add (Catalogue *self, const char *path)
+  {
+  CatalogueName *n = catalogue_intern (self, path);
+  if (n->present) return FALSE;
+  if (self->n_paths == self->max_paths)
+    {
+    self->max_paths = self->max_paths ? 2 * self->max_paths : 256;
+    self->paths = realloc (self->paths,
+      self->max_paths * sizeof (const char *));
+    }
+  self->paths[self->n_paths++] = n->path;
+  n->present = TRUE;
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  catalogue_add_random
+
+  Add a picture at a random place between first and the end, moving 
+  the picture that was there to the end. Returns FALSE if it was 
+  already there
+
+==========================================================================*/
+BOOL catalogue_add_random (Catalogue *self, const char *path, int first)
+  {
+  if (!catalogue_add (self, path)) return FALSE;
+  int n = self->n_paths;
+  if (first < n - 1)
+    {
+    int j = first + rand () % (n - first);
+    const char *t = self->paths[j];
+    self->paths[j] = self->paths[n - 1];
+    self->paths[n - 1] = t;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  catalogue_remove
+
+  Remove a picture, or every picture in a directory, keeping the rest
+  in the same order. If cursor is not NULL, it is an index into the
+  catalogue, which is moved back by the number of pictures removed
+  before it, so that it stays on the same picture
+
+==========================================================================*/
+void catalogue_remove (Catalogue *self, const char *path, int *cursor)
+  {
+  LOG_IN
+  size_t l = strlen (path);
+  int j = 0, before = 0;
+  for (int i = 0; i < self->n_paths; i++)
+    {
+    const char *p = self->paths[i];
+    if (strncmp (p, path, l) == 0 && (p[l] == 0 || p[l] == '/'))
+      {
+      catalogue_find (self, p, catalogue_hash (p))->present = FALSE;
+      if (cursor && i < *cursor) before++;
+      }
+    else
+      self->paths[j++] = p;
+    }
+  log_debug ("catalogue: removed %d for %s", self->n_paths - j, path);
+  self->n_paths = j;
+  if (cursor) *cursor -= before;
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  catalogue_contains
+
+==========================================================================*/
+BOOL catalogue_contains (const Catalogue *self, const char *path)
+  {
+  CatalogueName *n = catalogue_find (self, path, catalogue_hash (path));
+  return n->path && n->present;
+  }
+
+
+/*==========================================================================
+
+  catalogue_length
+
+==========================================================================*/
+int catalogue_length (const Catalogue *self)
+  {
+  return self->n_paths;
+  }
+
+
+/*==========================================================================
+
+  catalogue_get
+
+==========================================================================*/
+const char *catalogue_get (const Catalogue *self, int index)
+  {
+  return self->paths[index];
+  }
+
+
+/*==========================================================================
+
+  catalogue_shuffle
+
+  Fisher-Yates, in place. If not_first is not NULL, and ends up first,
+  it is swapped with some other picture, so that a picture isn't shown
+  twice running when a random show starts again
+
+==========================================================================*/
+void catalogue_shuffle (Catalogue *self, const char *not_first)
+  {
+  LOG_IN
+  int n = self->n_paths;
+  for (int i = n - 1; i > 0; i--)
+    {
+    int j = rand () % (i + 1);
+    const char *t = self->paths[i];
+    self->paths[i] = self->paths[j];
+    self->paths[j] = t;
+    }
+  if (n > 1 && not_first && strcmp (self->paths[0], not_first) == 0)
+    {
+    int j = 1 + rand () % (n - 1);
+    self->paths[0] = self->paths[j];
+    self->paths[j] = not_first;
+    }
+  LOG_OUT
+  }
+
+
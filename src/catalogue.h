@@ -0,0 +1,32 @@
+/*============================================================================
+
+  jpegtofb
+  catalogue.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+struct _Catalogue;
+typedef struct _Catalogue Catalogue;
+
+BEGIN_DECLS
+
+Catalogue  *catalogue_create (void);
+void        catalogue_destroy (Catalogue *self);
+BOOL        catalogue_add (Catalogue *self, const char *path);
+BOOL        catalogue_add_random (Catalogue *self, const char *path,
+              int first);
+void        catalogue_remove (Catalogue *self, const char *path,
+              int *cursor);
+BOOL        catalogue_contains (const Catalogue *self, const char *path);
+int         catalogue_length (const Catalogue *self);
+const char *catalogue_get (const Catalogue *self, int index);
+void        catalogue_shuffle (Catalogue *self, const char *not_first);
+
+END_DECLS
+
+
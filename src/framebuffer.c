@@ -0,0 +1,317 @@
+/*==========================================================================
+
+  jpegtofb
+  framebuffer.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A FrameBuffer is a long-lived session on a framebuffer device. The
+  device is opened and mapped the first time it is needed, and then
+  stays mapped until the object is destroyed. Before each use, 
+  framebuffer_refresh() asks the driver for the current mode; the
+  device is only closed and remapped if the geometry has changed 
+  since last time.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fb.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <string.h>
+#include "log.h" 
+#include "framebuffer.h" 
+
+struct _FrameBuffer
+  {
+  char *fbdev;
+  int fd;
+  struct fb_fix_screeninfo finfo;
+  struct fb_var_screeninfo vinfo;
+  BYTE *data;
+  int data_size;
+  // Row converter for the current pixel format
+  Blitter blitter;
+  }; 
+
+
+/*==========================================================================
+
+  framebuffer_create
+
+  Note that this does not open the device -- that happens on the
+  first call to framebuffer_refresh()
+
+==========================================================================*/
+FrameBuffer *framebuffer_create (const char *fbdev)
+  {
+  LOG_IN
+  FrameBuffer *self = malloc (sizeof (FrameBuffer));
+  memset (self, 0, sizeof (FrameBuffer));
+  self->fbdev = strdup (fbdev);
+  self->fd = -1;
+  self->data = NULL;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_close
+
+==========================================================================*/
+static void framebuffer_close (FrameBuffer *self)
+  {
+  LOG_IN
+  if (self->data)
+    {
+    munmap (self->data, self->data_size);
+    self->data = NULL;
+    }
+  if (self->fd >= 0)
+    {
+    close (self->fd);
+    self->fd = -1;
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  framebuffer_destroy
+
+==========================================================================*/
+void framebuffer_destroy (FrameBuffer *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    framebuffer_close (self);
+    if (self->fbdev) 
+      {
+      free (self->fbdev);
+      self->fbdev = NULL;
+      }
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  framebuffer_open
+
+==========================================================================*/
+static BOOL framebuffer_open (FrameBuffer *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  self->fd = open (self->fbdev, O_RDWR);
+  if (self->fd >= 0)
+    {
+    ioctl (self->fd, FBIOGET_FSCREENINFO, &self->finfo);
+    ioctl (self->fd, FBIOGET_VSCREENINFO, &self->vinfo);
+
+    log_debug ("framebuffer: smem_len %d", self->finfo.smem_len);
+    log_debug ("framebuffer: line_len %d", self->finfo.line_length);
+    log_debug ("framebuffer: xres %d", self->vinfo.xres); 
+    log_debug ("framebuffer: yres %d", self->vinfo.yres); 
+    log_debug ("framebuffer: bpp %d", self->vinfo.bits_per_pixel); 
+
+    blit_choose (&self->vinfo, &self->blitter);
+
+    /* only ~`data_size' is writable, even if `smem_len' is bigger */
+    self->data_size = self->finfo.line_length * self->vinfo.yres;
+    self->data = mmap (0, self->data_size, 
+	     PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, (off_t)0);
+    if (self->data != MAP_FAILED)
+      {
+      ret = TRUE;
+      }
+    else
+      {
+      self->data = NULL;
+      asprintf (error, "Can't map framebuffer '%s': %s", self->fbdev, 
+        strerror (errno));
+      framebuffer_close (self);
+      }
+    }
+  else
+    {
+    asprintf (error, "Can't open framebuffer '%s': %s", self->fbdev, 
+      strerror (errno));
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_refresh
+
+  Make sure the framebuffer is open and mapped with its current
+  geometry. This must be called before the data and geometry 
+  accessors are used. On an open session it costs one ioctl() 
+
+==========================================================================*/
+BOOL framebuffer_refresh (FrameBuffer *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (self->fd >= 0)
+    {
+    struct fb_var_screeninfo vinfo;
+    if (ioctl (self->fd, FBIOGET_VSCREENINFO, &vinfo) == 0
+        && vinfo.xres == self->vinfo.xres
+        && vinfo.yres == self->vinfo.yres
+        && vinfo.bits_per_pixel == self->vinfo.bits_per_pixel
+        && vinfo.red.offset == self->vinfo.red.offset
+        && vinfo.green.offset == self->vinfo.green.offset
+        && vinfo.blue.offset == self->vinfo.blue.offset
+        && vinfo.red.length == self->vinfo.red.length
+        && vinfo.green.length == self->vinfo.green.length
+        && vinfo.blue.length == self->vinfo.blue.length)
+      {
+      ret = TRUE;
+      }
+    else
+      {
+      log_info ("Framebuffer mode has changed: reopening '%s'", 
+        self->fbdev);
+      framebuffer_close (self);
+      }
+    }
+
+  if (!ret)
+    ret = framebuffer_open (self, error);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_data
+
+==========================================================================*/
+BYTE *framebuffer_get_data (const FrameBuffer *self)
+  {
+  return self->data;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_width
+
+==========================================================================*/
+int framebuffer_get_width (const FrameBuffer *self)
+  {
+  return self->vinfo.xres;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_height
+
+==========================================================================*/
+int framebuffer_get_height (const FrameBuffer *self)
+  {
+  return self->vinfo.yres;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_stride
+
+  Returns the length of a line in bytes, which need not be the
+  same as width * bytes_per_pixel
+
+==========================================================================*/
+int framebuffer_get_stride (const FrameBuffer *self)
+  {
+  return self->finfo.line_length;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_bytes_per_pixel
+
+==========================================================================*/
+int framebuffer_get_bytes_per_pixel (const FrameBuffer *self)
+  {
+  return self->vinfo.bits_per_pixel / 8;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_vinfo
+
+==========================================================================*/
+const struct fb_var_screeninfo *framebuffer_get_vinfo 
+       (const FrameBuffer *self)
+  {
+  return &self->vinfo;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_blitter
+
+  Returns the row converter that suits the current pixel format
+
+==========================================================================*/
+const Blitter *framebuffer_get_blitter (const FrameBuffer *self)
+  {
+  return &self->blitter;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_get_surface
+
+  Describe the mapped framebuffer as a surface that can be drawn on
+
+==========================================================================*/
+void framebuffer_get_surface (const FrameBuffer *self, FbSurface *surface)
+  {
+  surface->data = self->data;
+  surface->width = framebuffer_get_width (self);
+  surface->height = framebuffer_get_height (self);
+  surface->stride = framebuffer_get_stride (self);
+  surface->bytes_per_pixel = framebuffer_get_bytes_per_pixel (self);
+  surface->vinfo = self->vinfo;
+  surface->blitter = self->blitter;
+  }
+
+
+/*==========================================================================
+
+  framebuffer_surfaces_match
+
+  Returns TRUE if two surfaces have the same size and pixel layout, 
+  so that the contents of one can be copied straight into the other
+
+==========================================================================*/
+BOOL framebuffer_surfaces_match (const FbSurface *s1, const FbSurface *s2)
+  {
+  return s1->width == s2->width && s1->height == s2->height
+    && s1->stride == s2->stride 
+    && s1->bytes_per_pixel == s2->bytes_per_pixel
+    && s1->blitter.blit_row == s2->blitter.blit_row;
+  }
+
@@ -0,0 +1,52 @@
+/*============================================================================
+
+  jpegtofb
+  framebuffer.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <linux/fb.h>
+#include "defs.h"
+#include "blit.h"
+
+struct _FrameBuffer;
+typedef struct _FrameBuffer FrameBuffer;
+
+// An FbSurface describes a block of memory laid out exactly like the 
+//   framebuffer -- either the mapped framebuffer itself, or an off-screen
+//   copy of it. The screen info and blitter are copies, so a surface
+//   stays valid even if the framebuffer is reopened in a different mode
+typedef struct _FbSurface
+  {
+  BYTE *data;
+  int width;
+  int height;
+  int stride;
+  int bytes_per_pixel;
+  struct fb_var_screeninfo vinfo;
+  Blitter blitter;
+  } FbSurface;
+
+BEGIN_DECLS
+
+FrameBuffer *framebuffer_create (const char *fbdev);
+void         framebuffer_destroy (FrameBuffer *self);
+BOOL         framebuffer_refresh (FrameBuffer *self, char **error);
+BYTE        *framebuffer_get_data (const FrameBuffer *self);
+int          framebuffer_get_width (const FrameBuffer *self);
+int          framebuffer_get_height (const FrameBuffer *self);
+int          framebuffer_get_stride (const FrameBuffer *self);
+int          framebuffer_get_bytes_per_pixel (const FrameBuffer *self);
+const struct fb_var_screeninfo *framebuffer_get_vinfo 
+               (const FrameBuffer *self);
+const Blitter *framebuffer_get_blitter (const FrameBuffer *self);
+void         framebuffer_get_surface (const FrameBuffer *self, 
+               FbSurface *surface);
+BOOL         framebuffer_surfaces_match (const FbSurface *s1, 
+               const FbSurface *s2);
+
+END_DECLS
+
@@ -0,0 +1,598 @@
+/*==========================================================================
+
+  jpegtofb
+  imageindex.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A file that remembers what was learned about each picture the last
+  time the program ran -- its size, orientation, EXIF date, and whether
+  it could be read at all -- so that, on the next start, only files
+  that are new or have changed need to be probed. A file is taken to
+  be unchanged if its size and modification time are the same as
+  before. On a large collection on an SD card, this turns a start-up
+  that reads the headers of thousands of files into one that just
+  stat()s them.
+
+  The index is a header, an array of fixed-size records sorted by
+  pathname, and then the pathnames themselves, with no terminators.
+  It is mapped into memory read-only, and searched in place, so
+  loading it costs nothing, however large it is. Lookups can be made
+  from many threads at once. The records for the files looked at in
+  this run are collected in memory, one for each pathname, and
+  imageindex_save() writes them out as a new index, replacing the old
+  one in a single rename(); files that were not looked at this time,
+  or that have been removed since, are dropped. The index can be saved
+  as often as necessary -- after new pictures turn up in a watched
+  directory, for example -- but if nothing has changed since the last
+  save, the file is not rewritten.
+
+  The index is only a cache: if it is missing, or damaged, or from
+  a different version of the program, it is ignored and rebuilt.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "imageindex.h"
+
+#define INDEX_MAGIC "JTFBIDX"
+#define INDEX_VERSION 2
+
+// Record flags
+#define INDEX_VALID        0x01
+#define INDEX_PROGRESSIVE  0x02
+
+typedef struct _IndexHeader
+  {
+  char magic[8];
+  uint32_t version;
+  // Checks that the index was written by a program with the same
+  //   record layout, and the same byte order
+  uint32_t record_size;
+  uint32_t count;
+  uint32_t names_size;
+  } IndexHeader;
+
+typedef struct _IndexRecord
+  {
+  // Offset and length of the pathname, in the names that follow the
+  //   records
+  uint32_t name;
+  uint32_t name_len;
+  // The key, along with the pathname: if either of these has changed,
+  //   the file has to be probed again. mtime is in nanoseconds
+  int64_t size;
+  int64_t mtime;
+  uint16_t width;
+  uint16_t height;
+  uint16_t restart_interval;
+  uint8_t flags;
+  uint8_t orientation;
+  uint8_t components;
+  // Horizontal sampling factor in the top four bits, vertical in the
+  //   bottom four, as in the JPEG frame header
+  uint8_t sampling;
+  uint8_t reserved[2];
+  char datetime[20];
+  } IndexRecord;
+
+// A file probed (or looked up) in this run
+typedef struct _IndexEntry
+  {
+  char *path;
+  IndexRecord record;
+  // The file has gone, so it won't be saved. The entry is kept, in
+  //   case the file comes back
+  BOOL removed;
+  } IndexEntry;
+
+struct _ImageIndex
+  {
+  char *index_file;
+  // The directory that relative pathnames are relative to, so that the
+  //   index doesn't depend on where the program is run from
+  char *cwd;
+  // The index as it was last saved, mapped read-only. count is zero
+  //   if there wasn't one, or it couldn't be used
+  void *map;
+  size_t map_size;
+  const IndexRecord *records;
+  const char *names;
+  uint32_t count;
+  // Protects everything below
+  pthread_mutex_t mutex;
+  IndexEntry *entries;
+  int n_entries;
+  int max_entries;
+  // Finds the entry for a pathname: an open-addressed hash table of 
+  //   entry numbers plus one, so that zero is empty. Never more than
+  //   half full
+  int *slots;
+  int max_slots;
+  // Files that had to be probed, rather than found in the index
+  int n_probed;
+  // Whether any entry has been added, changed, or removed since the 
+  //   last save
+  BOOL changed;
+  // Files in the index as last saved
+  int n_saved;
+  };
+
+
+/*==========================================================================
+
+  imageindex_compare
+
+  Pathnames are compared as bytes, shorter first if one is the start
+  of the other. This is the order of the records in the file
+
+==========================================================================*/
+static int imageindex_compare (const char *p1, size_t l1, const char *p2,
+      size_t l2)
+  {
+  int c = memcmp (p1, p2, l1 < l2 ? l1 : l2);
+  if (c) return c;
+  return l1 < l2 ? -1 : l1 > l2 ? 1 : 0;
+  }
+
+
+/*==========================================================================
+
+  imageindex_entry_compare
+
+  For qsort()
+
+==========================================================================*/
+static int imageindex_entry_compare (const void *e1, const void *e2)
+  {
+  const char *p1 = (*(IndexEntry * const *)e1)->path;
+  const char *p2 = (*(IndexEntry * const *)e2)->path;
+  return imageindex_compare (p1, strlen (p1), p2, strlen (p2));
+  }
+
+
+/*==========================================================================
+
+  imageindex_load
+
+  Map the existing index file, if there is one, and check that it
+  makes sense. Every record is checked up front, so that lookups can
+  trust the offsets
+
+==========================================================================*/
+static void imageindex_load (ImageIndex *self)
+  {
+  LOG_IN
+  int fd = open (self->index_file, O_RDONLY);
+  if (fd >= 0)
+    {
+    struct stat sb;
+    if (fstat (fd, &sb) == 0 && sb.st_size >= sizeof (IndexHeader))
+      {
+      void *map = mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (map != MAP_FAILED)
+        {
+        const IndexHeader *h = map;
+        const IndexRecord *records = (const IndexRecord *)(h + 1);
+        BOOL ok = memcmp (h->magic, INDEX_MAGIC, sizeof (INDEX_MAGIC)) == 0
+          && h->version == INDEX_VERSION
+          && h->record_size == sizeof (IndexRecord)
+          && (uint64_t)sizeof (IndexHeader) + (uint64_t)h->count
+             * sizeof (IndexRecord) + h->names_size == sb.st_size;
+        for (uint32_t i = 0; ok && i < h->count; i++)
+          ok = (uint64_t)records[i].name + records[i].name_len
+             <= h->names_size;
+        if (ok)
+          {
+          self->map = map;
+          self->map_size = sb.st_size;
+          self->records = records;
+          self->names = (const char *)(records + h->count);
+          self->count = h->count;
+          self->n_saved = h->count;
+          log_debug ("Index %s has %d files", self->index_file,
+            (int)self->count);
+          }
+        else
+          {
+          log_warning ("Ignoring damaged or outdated index %s",
+            self->index_file);
+          munmap (map, sb.st_size);
+          }
+        }
+      }
+    close (fd);
+    }
+  else
+    log_debug ("No index %s: %s", self->index_file, strerror (errno));
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  imageindex_open
+
+  Load the index from index_file, if it exists. The file need not
+  exist -- it will be created by imageindex_save()
+
+==========================================================================*/
+ImageIndex *imageindex_open (const char *index_file)
+  {
+  LOG_IN
+  ImageIndex *self = malloc (sizeof (ImageIndex));
+  memset (self, 0, sizeof (ImageIndex));
+  self->index_file = strdup (index_file);
+  self->cwd = get_current_dir_name ();
+  pthread_mutex_init (&self->mutex, NULL);
+  imageindex_load (self);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  imageindex_destroy
+
+==========================================================================*/
+void imageindex_destroy (ImageIndex *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    if (self->map) munmap (self->map, self->map_size);
+    for (int i = 0; i < self->n_entries; i++)
+      free (self->entries[i].path);
+    free (self->entries);
+    free (self->slots);
+    pthread_mutex_destroy (&self->mutex);
+    free (self->cwd);
+    free (self->index_file);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  imageindex_find
+
+  Binary search of the mapped index. Returns NULL if the file isn't
+  there
+
+==========================================================================*/
+static const IndexRecord *imageindex_find (const ImageIndex *self,
+      const char *path)
+  {
+  size_t len = strlen (path);
+  int lo = 0, hi = (int)self->count - 1;
+  while (lo <= hi)
+    {
+    int mid = (lo + hi) / 2;
+    const IndexRecord *r = &self->records[mid];
+    int c = imageindex_compare (self->names + r->name, r->name_len,
+      path, len);
+    if (c == 0) return r;
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  imageindex_slot
+
+  The hash table slot for path: the one that holds its entry, or the
+  empty one where it would go. FNV-1a
+
+==========================================================================*/
+static int *imageindex_slot (const ImageIndex *self, const char *path)
+  {
+  uint32_t h = 2166136261u;
+  for (const BYTE *p = (const BYTE *)path; *p; p++)
+    h = (h ^ *p) * 16777619u;
+  int mask = self->max_slots - 1;
+  int i = h & mask;
+  while (self->slots[i] 
+       && strcmp (self->entries[self->slots[i] - 1].path, path) != 0)
+    i = (i + 1) & mask;
+  return &self->slots[i];
+  }
+
+
+/*==========================================================================
+
+  imageindex_add
+
+  Remember a file for the next save, replacing anything remembered
+  about it before. Takes ownership of path
+
+==========================================================================*/
+static void imageindex_add (ImageIndex *self, char *path,
+      const IndexRecord *record, BOOL probed)
+  {
+  pthread_mutex_lock (&self->mutex);
+  if (2 * (self->n_entries + 1) > self->max_slots)
+    {
+    self->max_slots = self->max_slots ? 2 * self->max_slots : 512;
+    free (self->slots);
+    self->slots = calloc (self->max_slots, sizeof (int));
+    for (int i = 0; i < self->n_entries; i++)
+      *imageindex_slot (self, self->entries[i].path) = i + 1;
+    }
+
+  // Where the name is in the file is only known when it's saved
+  IndexRecord r = *record;
+  r.name = r.name_len = 0;
+
+  int *slot = imageindex_slot (self, path);
+  if (*slot)
+    {
+    IndexEntry *e = &self->entries[*slot - 1];
+    if (e->removed || memcmp (&e->record, &r, sizeof (IndexRecord)))
+      self->changed = TRUE;
+    e->record = r;
+    e->removed = FALSE;
+    free (path);
+    }
+  else
+    {
+    if (self->n_entries == self->max_entries)
+      {
+      self->max_entries = self->max_entries ? 2 * self->max_entries : 256;
+      self->entries = realloc (self->entries,
+        self->max_entries * sizeof (IndexEntry));
+      }
+    IndexEntry *e = &self->entries[self->n_entries++];
+    e->path = path;
+    e->record = r;
+    e->removed = FALSE;
+    *slot = self->n_entries;
+    }
+  if (probed) 
+    {
+    self->n_probed++;
+    self->changed = TRUE;
+    }
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  imageindex_full_path
+
+  The pathname the index knows a file by. The result must be freed
+
+==========================================================================*/
+static char *imageindex_full_path (const ImageIndex *self, 
+      const char *filename)
+  {
+  char *path;
+  if (filename[0] == '/' || !self->cwd)
+    path = strdup (filename);
+  else
+    asprintf (&path, "%s/%s", self->cwd, filename);
+  return path;
+  }
+
+
+/*==========================================================================
+
+  imageindex_remove
+
+  Forget a file, or every file in a directory, because it has gone. 
+  Thread-safe
+
+==========================================================================*/
+void imageindex_remove (ImageIndex *self, const char *filename)
+  {
+  LOG_IN
+  char *path = imageindex_full_path (self, filename);
+  int l = strlen (path);
+  pthread_mutex_lock (&self->mutex);
+  for (int i = 0; i < self->n_entries; i++)
+    {
+    IndexEntry *e = &self->entries[i];
+    if (!e->removed && strncmp (e->path, path, l) == 0 
+        && (e->path[l] == 0 || e->path[l] == '/'))
+      {
+      e->removed = TRUE;
+      self->changed = TRUE;
+      }
+    }
+  pthread_mutex_unlock (&self->mutex);
+  free (path);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  imageindex_probe
+
+  Get the same information as jpegprobe_file() would, from the index
+  if the file hasn't changed since it was last probed, or from the
+  file if it has. A file that was found not to be a usable JPEG last
+  time is rejected again without being read. Files that can't be
+  opened are not remembered, as that might be a temporary problem.
+  Thread-safe
+
+==========================================================================*/
+BOOL imageindex_probe (ImageIndex *self, const char *filename,
+       JpegProbeInfo *info, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  char *path = imageindex_full_path (self, filename);
+
+  struct stat sb;
+  const IndexRecord *r = NULL;
+  if (stat (filename, &sb) == 0)
+    r = imageindex_find (self, path);
+
+  if (r && r->size == sb.st_size && r->mtime ==
+        (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec)
+    {
+    log_debug ("index: %s unchanged", filename);
+    memset (info, 0, sizeof (*info));
+    ret = (r->flags & INDEX_VALID) != 0;
+    if (ret)
+      {
+      info->width = r->width;
+      info->height = r->height;
+      info->components = r->components;
+      info->progressive = (r->flags & INDEX_PROGRESSIVE) != 0;
+      info->restart_interval = r->restart_interval;
+      info->h_samp = r->sampling >> 4;
+      info->v_samp = r->sampling & 0x0F;
+      info->orientation = r->orientation;
+      memcpy (info->datetime, r->datetime, sizeof (info->datetime));
+      info->datetime[sizeof (info->datetime) - 1] = 0;
+      }
+    else
+      asprintf (error, "Can't read '%s': not a usable JPEG when "
+        "last checked", filename);
+    imageindex_add (self, path, r, FALSE);
+    }
+  else
+    {
+    int fd = open (filename, O_RDONLY);
+    if (fd >= 0 && fstat (fd, &sb) == 0)
+      {
+      ret = jpegprobe_fd (fd, filename, info, error);
+
+      // Key the record on the file as it was when it was read
+      IndexRecord record;
+      memset (&record, 0, sizeof (record));
+      record.size = sb.st_size;
+      record.mtime = (int64_t)sb.st_mtim.tv_sec * 1000000000
+        + sb.st_mtim.tv_nsec;
+      if (ret && info->width <= 0xFFFF && info->height <= 0xFFFF)
+        {
+        record.flags = INDEX_VALID
+          | (info->progressive ? INDEX_PROGRESSIVE : 0);
+        record.width = info->width;
+        record.height = info->height;
+        record.restart_interval = info->restart_interval;
+        record.orientation = info->orientation;
+        record.components = info->components;
+        record.sampling = info->h_samp << 4 | info->v_samp;
+        memcpy (record.datetime, info->datetime, sizeof (info->datetime));
+        }
+      imageindex_add (self, path, &record, TRUE);
+      }
+    else
+      {
+      asprintf (error, "Can't read '%s': %s", filename, strerror (errno));
+      free (path);
+      }
+    if (fd >= 0) close (fd);
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  imageindex_save
+
+  Write the files looked up in this run, and not removed since, as the
+  new index, if anything has changed since the last save. The new
+  index is written alongside the old one and renamed over it, so a
+  crash or power cut in the middle leaves one or the other intact
+
+==========================================================================*/
+BOOL imageindex_save (ImageIndex *self)
+  {
+  LOG_IN
+  BOOL ret = TRUE;
+  pthread_mutex_lock (&self->mutex);
+
+  // The entries are sorted by way of pointers, so that the hash table
+  //   stays valid
+  IndexEntry **sorted = malloc ((self->n_entries + 1) 
+    * sizeof (IndexEntry *));
+  int n = 0;
+  for (int i = 0; i < self->n_entries; i++)
+    if (!self->entries[i].removed)
+      sorted[n++] = &self->entries[i];
+
+  log_debug ("Index: %d files, %d probed", n, self->n_probed);
+  if (self->changed || n != self->n_saved)
+    {
+    qsort (sorted, n, sizeof (IndexEntry *), imageindex_entry_compare);
+    char *temp;
+    asprintf (&temp, "%s.new", self->index_file);
+    FILE *f = fopen (temp, "w");
+    if (f)
+      {
+      IndexHeader header;
+      memset (&header, 0, sizeof (header));
+      memcpy (header.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC));
+      header.version = INDEX_VERSION;
+      header.record_size = sizeof (IndexRecord);
+      header.count = n;
+      for (int i = 0; i < n; i++)
+        header.names_size += strlen (sorted[i]->path);
+
+      fwrite (&header, sizeof (header), 1, f);
+      uint32_t name = 0;
+      for (int i = 0; i < n; i++)
+        {
+        IndexRecord r = sorted[i]->record;
+        r.name = name;
+        r.name_len = strlen (sorted[i]->path);
+        name += r.name_len;
+        fwrite (&r, sizeof (IndexRecord), 1, f);
+        }
+      for (int i = 0; i < n; i++)
+        fwrite (sorted[i]->path, strlen (sorted[i]->path), 1, f);
+      ret = !ferror (f);
+      if (fclose (f) != 0) ret = FALSE;
+      if (ret && rename (temp, self->index_file) != 0) ret = FALSE;
+      if (ret)
+        {
+        self->n_probed = 0;
+        self->changed = FALSE;
+        self->n_saved = n;
+        }
+      else
+        {
+        log_warning ("Can't write index %s: %s", self->index_file,
+          strerror (errno));
+        unlink (temp);
+        }
+      }
+    else
+      {
+      log_warning ("Can't write index %s: %s", temp, strerror (errno));
+      ret = FALSE;
+      }
+    free (temp);
+    }
+  free (sorted);
+
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  return ret;
+  }
+
+
@@ -0,0 +1,28 @@
+/*============================================================================
+
+  jpegtofb
+  imageindex.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "jpegprobe.h"
+
+struct _ImageIndex;
+typedef struct _ImageIndex ImageIndex;
+
+BEGIN_DECLS
+
+ImageIndex *imageindex_open (const char *index_file);
+void        imageindex_destroy (ImageIndex *self);
+BOOL        imageindex_probe (ImageIndex *self, const char *filename,
+              JpegProbeInfo *info, char **error);
+void        imageindex_remove (ImageIndex *self, const char *filename);
+BOOL        imageindex_save (ImageIndex *self);
+
+END_DECLS
+
+
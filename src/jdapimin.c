@@ -83,6 +83,24 @@ jpeg_CreateDecompress (j_decompress_ptr cinfo, int version, size_t structsize)
 }
 
 
+/*
+ * Wait for the pipelined decoder's input thread, if there is one,
+ * telling it to give up first if abort is TRUE.  Must be called before
+ * anything else touches the input side of the decompressor.
+ */
+
+LOCAL(void)
+finish_input_thread (j_decompress_ptr cinfo, boolean abort)
+{
+#ifdef D_PIPELINE_SUPPORTED
+  if (cinfo->global_state >= DSTATE_PRELOAD &&
+      cinfo->global_state <= DSTATE_STOPPING &&
+      cinfo->coef != NULL && cinfo->coef->finish_input_thread != NULL)
+    (*cinfo->coef->finish_input_thread) (cinfo, abort);
+#endif
+}
+
+
 /*
  * Destruction of a JPEG decompression object
  */
@@ -90,6 +108,7 @@ jpeg_CreateDecompress (j_decompress_ptr cinfo, int version, size_t structsize)
 GLOBAL(void)
 jpeg_destroy_decompress (j_decompress_ptr cinfo)
 {
+  finish_input_thread(cinfo, TRUE);
   jpeg_destroy((j_common_ptr) cinfo); /* use common routine */
 }
 
@@ -102,6 +121,7 @@ jpeg_destroy_decompress (j_decompress_ptr cinfo)
 GLOBAL(void)
 jpeg_abort_decompress (j_decompress_ptr cinfo)
 {
+  finish_input_thread(cinfo, TRUE);
   jpeg_abort((j_common_ptr) cinfo); /* use common routine */
 }
 
@@ -193,6 +213,12 @@ default_decompress_parms (j_decompress_ptr cinfo)
   cinfo->dct_method = JDCT_DEFAULT;
   cinfo->do_fancy_upsampling = TRUE;
   cinfo->do_block_smoothing = TRUE;
+  cinfo->do_pipeline = FALSE;
+  cinfo->band_source = NULL;
+  cinfo->band_first_iMCU_row = 0;
+  cinfo->band_first_iMCU_col = 0;
+  cinfo->band_num_iMCU_cols = 0;
+  cinfo->dither_origin_row = 0;
   cinfo->quantize_colors = FALSE;
   /* We set these in case application only sets quantize_colors. */
   cinfo->dither_mode = JDITHER_FS;
@@ -382,6 +408,8 @@ jpeg_finish_decompress (j_decompress_ptr cinfo)
     /* STOPPING = repeat call after a suspension, anything else is error */
     ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
   }
+  /* The input thread, if any, reads up to EOI itself */
+  finish_input_thread(cinfo, FALSE);
   /* Read until EOI */
   while (! cinfo->inputctl->eoi_reached) {
     if ((*cinfo->inputctl->consume_input) (cinfo) == JPEG_SUSPENDED)
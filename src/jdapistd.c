@@ -79,7 +79,14 @@ jpeg_start_decompress (j_decompress_ptr cinfo)
   } else if (cinfo->global_state != DSTATE_PRESCAN)
     ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
   /* Perform any dummy output passes, and set up for the final pass */
-  return output_pass_setup(cinfo);
+  if (! output_pass_setup(cinfo))
+    return FALSE;
+#ifdef D_PIPELINE_SUPPORTED
+  /* In pipelined mode, entropy decoding now carries on in the background */
+  if (cinfo->coef->start_input_thread != NULL)
+    (*cinfo->coef->start_input_thread) (cinfo);
+#endif
+  return TRUE;
 }
 
 
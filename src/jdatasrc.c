@@ -32,7 +32,7 @@ typedef struct {
 
 typedef my_source_mgr * my_src_ptr;
 
-#define INPUT_BUF_SIZE  4096	/* choose an efficiently fread'able size */
+#define INPUT_BUF_SIZE  65536	/* big enough for the Huffman fast path */
 
 
 /*
@@ -129,10 +129,17 @@ skip_input_data (j_decompress_ptr cinfo, long num_bytes)
 {
   my_src_ptr src = (my_src_ptr) cinfo->src;
 
-  /* Just a dumb implementation for now.  Could use fseek() except
-   * it doesn't work on pipes.  Not clear that being smart is worth
-   * any trouble anyway --- large skips are infrequent.
+  /* Large skips are not so infrequent: camera files have EXIF segments
+   * of tens of kilobytes.  So seek past whatever is not in the buffer,
+   * and only read through it if the stream can't seek (a pipe, say).
    */
+  if (num_bytes > (long) src->pub.bytes_in_buffer) {
+    if (fseek(src->infile, num_bytes - (long) src->pub.bytes_in_buffer,
+	      SEEK_CUR) == 0) {
+      src->pub.bytes_in_buffer = 0; /* forces fill_input_buffer next */
+      return;
+    }
+  }
   if (num_bytes > 0) {
     while (num_bytes > (long) src->pub.bytes_in_buffer) {
       num_bytes -= (long) src->pub.bytes_in_buffer;
@@ -210,3 +217,73 @@ jpeg_stdio_src (j_decompress_ptr cinfo, FILE * infile)
   src->pub.bytes_in_buffer = 0; /* forces fill_input_buffer on first read */
   src->pub.next_input_byte = NULL; /* until buffer loaded */
 }
+
+
+/*
+ * Memory source: the whole of the JPEG datastream is already in a buffer
+ * supplied by the caller, which must stay valid until decompression is
+ * finished.  The buffer is handed to the decompressor in one piece, so
+ * there is never anything to read; running off the end is treated like
+ * end of file, and gets a fake EOI marker.
+ */
+
+METHODDEF(void)
+init_mem_source (j_decompress_ptr cinfo)
+{
+  /* no work necessary here */
+}
+
+METHODDEF(boolean)
+fill_mem_input_buffer (j_decompress_ptr cinfo)
+{
+  static const JOCTET fake_eoi[2] = { (JOCTET) 0xFF, (JOCTET) JPEG_EOI };
+
+  WARNMS(cinfo, JWRN_JPEG_EOF);
+  cinfo->src->next_input_byte = fake_eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+METHODDEF(void)
+skip_mem_input_data (j_decompress_ptr cinfo, long num_bytes)
+{
+  struct jpeg_source_mgr * src = cinfo->src;
+
+  if (num_bytes > 0) {
+    if (num_bytes > (long) src->bytes_in_buffer) {
+      (void) fill_mem_input_buffer(cinfo);
+    } else {
+      src->next_input_byte += (size_t) num_bytes;
+      src->bytes_in_buffer -= (size_t) num_bytes;
+    }
+  }
+}
+
+
+/*
+ * Prepare for input from a memory buffer.
+ */
+
+GLOBAL(void)
+jpeg_mem_src (j_decompress_ptr cinfo, const JOCTET * buffer, size_t size)
+{
+  struct jpeg_source_mgr * src;
+
+  if (buffer == NULL || size == 0)
+    ERREXIT(cinfo, JERR_INPUT_EMPTY);
+
+  if (cinfo->src == NULL) {	/* first time for this JPEG object? */
+    cinfo->src = (struct jpeg_source_mgr *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+				  SIZEOF(struct jpeg_source_mgr));
+  }
+
+  src = cinfo->src;
+  src->init_source = init_mem_source;
+  src->fill_input_buffer = fill_mem_input_buffer;
+  src->skip_input_data = skip_mem_input_data;
+  src->resync_to_restart = jpeg_resync_to_restart; /* use default method */
+  src->term_source = term_source;
+  src->bytes_in_buffer = size;
+  src->next_input_byte = buffer;
+}
@@ -0,0 +1,157 @@
+/*
+ * jdband.c
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains jpeg_setup_band(), which lets the output pass of a
+ * multi-scan (typically progressive) image be split across threads, or
+ * a single-scan image be decoded only in part; and jpeg_setup_columns(),
+ * which narrows the output of any decompressor to some iMCU columns.
+ *
+ * Once a decompressor has absorbed the whole of such a file, every iMCU
+ * row of coefficients is complete, and the IDCT, upsampling and color
+ * conversion of one row no longer depend on anything still to come.  A
+ * second decompressor, which has read the same file's headers, can then
+ * be told to produce just a horizontal band of the image: it takes its
+ * coefficients from the first decompressor's buffer, behaves in every
+ * other respect as if the band were the whole image, and never reads any
+ * compressed data.  Several such band decompressors, each on its own
+ * thread, may share one source, which must not be used for anything else,
+ * nor destroyed, until they have finished.
+ *
+ * Interblock smoothing reads neighbouring rows from the source's buffer,
+ * so it matches the whole-image decode exactly.  Fancy upsampling does not
+ * look outside the band, so a caller that wants identical output needs to
+ * decode an extra iMCU row above and below the band, and drop the result.
+ *
+ * A single-scan image has no such buffer, but a band of it can still be
+ * decoded straight from the file.  The iMCU rows above the band have to be
+ * entropy-decoded, to find where the band starts, but they get no IDCT and
+ * no postprocessing; the rows below the band are never read at all.
+ *
+ * In the same way, the entropy decoder has to read every column of the
+ * image, but the IDCT, upsampling and color conversion can be confined to
+ * the columns that are wanted.  This works for any decompressor, band or
+ * not.  Fancy upsampling does not look outside those columns either, so
+ * the same remarks apply as for bands.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+
+
+/*
+ * Set up cinfo, whose header has just been read, to decode num_iMCU_rows
+ * iMCU rows, starting at first_iMCU_row, from source's coefficient buffer.
+ * source must be a decompressor of the same file with a full-image
+ * coefficient buffer (a multi-scan file, after jpeg_start_decompress; or any
+ * file, in buffered-image mode), which has reached EOI or, in buffered-image
+ * mode, the end of a scan.  The band shows the image as of that scan.
+ * The output of cinfo is the band alone: output_height, output_scanline and
+ * so on all count from the top of the band.
+ *
+ * If source is NULL, the band is read from cinfo's own file instead, which
+ * must be a single-scan file, not in buffered-image mode.  Unless the band
+ * reaches the bottom of the image, the rest of the file is left unread, and
+ * the application must not call jpeg_finish_decompress; it should abort or
+ * destroy the decompressor once it has read the scanlines.
+ */
+
+GLOBAL(void)
+jpeg_setup_band (j_decompress_ptr cinfo, j_decompress_ptr source,
+		 JDIMENSION first_iMCU_row, JDIMENSION num_iMCU_rows)
+{
+  int ci, iMCU_height;
+  long top, bottom;
+  jpeg_component_info *compptr;
+
+  if (cinfo->global_state != DSTATE_READY)
+    ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+  if (source == NULL) {
+    /* A band of our own file */
+    if (cinfo->inputctl->has_multiple_scans ||
+	num_iMCU_rows == 0 ||
+	first_iMCU_row + num_iMCU_rows > cinfo->total_iMCU_rows)
+      ERREXIT(cinfo, JERR_NOTIMPL);
+    source = cinfo;
+  } else {
+    if (source->coef == NULL || source->coef->coef_arrays == NULL ||
+	(! source->inputctl->eoi_reached &&
+	 source->input_iMCU_row < source->total_iMCU_rows))
+      ERREXIT1(cinfo, JERR_BAD_STATE, source->global_state);
+    if (num_iMCU_rows == 0 ||
+	first_iMCU_row + num_iMCU_rows > source->total_iMCU_rows ||
+	cinfo->num_components != source->num_components ||
+	cinfo->max_v_samp_factor != source->max_v_samp_factor ||
+	cinfo->image_height != source->image_height)
+      ERREXIT(cinfo, JERR_NOTIMPL);
+  }
+
+  cinfo->band_source = source;
+  cinfo->band_first_iMCU_row = first_iMCU_row;
+
+  /* Make the band look like a whole image, as initial_setup would */
+  iMCU_height = cinfo->max_v_samp_factor * DCTSIZE;
+  top = (long) first_iMCU_row * iMCU_height;
+  bottom = (long) (first_iMCU_row + num_iMCU_rows) * iMCU_height;
+  if (bottom > (long) source->image_height)
+    bottom = (long) source->image_height;
+  cinfo->image_height = (JDIMENSION) (bottom - top);
+  cinfo->total_iMCU_rows = num_iMCU_rows;
+  for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
+       ci++, compptr++) {
+    compptr->height_in_blocks = (JDIMENSION)
+      jdiv_round_up((long) cinfo->image_height *
+		    (long) compptr->v_samp_factor,
+		    (long) iMCU_height);
+    compptr->downsampled_height = (JDIMENSION)
+      jdiv_round_up((long) cinfo->image_height *
+		    (long) compptr->v_samp_factor,
+		    (long) cinfo->max_v_samp_factor);
+  }
+
+  /* The input side of a band of our own file believes the image to be the
+   * band too, once the coefficient controller has skipped the rows above.
+   */
+  if (source == cinfo)
+    return;
+
+  /* Dequantize with the tables the source latched for its scans */
+  for (ci = 0; ci < cinfo->num_components; ci++)
+    cinfo->comp_info[ci].quant_table = source->comp_info[ci].quant_table;
+  /* Smoothing decisions are based on what the source has decoded */
+  cinfo->coef_bits = source->coef_bits;
+
+  /* There is no input to be read */
+  cinfo->inputctl->has_multiple_scans = FALSE;
+  cinfo->inputctl->eoi_reached = TRUE;
+}
+
+
+/*
+ * Set up cinfo, whose header has just been read, to output only
+ * num_iMCU_cols iMCU columns, starting at first_iMCU_col.  This may be
+ * combined with jpeg_setup_band, and the columns are always those of the
+ * whole image.  The output of cinfo is those columns alone: output_width
+ * counts from the left edge of the first of them.
+ */
+
+GLOBAL(void)
+jpeg_setup_columns (j_decompress_ptr cinfo, JDIMENSION first_iMCU_col,
+		    JDIMENSION num_iMCU_cols)
+{
+  JDIMENSION total_iMCU_cols;
+
+  if (cinfo->global_state != DSTATE_READY)
+    ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+  total_iMCU_cols = (JDIMENSION)
+    jdiv_round_up((long) cinfo->image_width,
+		  (long) (cinfo->max_h_samp_factor * DCTSIZE));
+  if (num_iMCU_cols == 0 || first_iMCU_col + num_iMCU_cols > total_iMCU_cols)
+    ERREXIT(cinfo, JERR_NOTIMPL);
+
+  cinfo->band_first_iMCU_col = first_iMCU_col;
+  cinfo->band_num_iMCU_cols = num_iMCU_cols;
+}
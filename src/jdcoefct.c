@@ -17,12 +17,21 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#ifdef D_PIPELINE_SUPPORTED
+#include <signal.h>
+#include "jpipe.h"
+#endif
 
 /* Block smoothing is only applicable for progressive JPEG, so: */
 #ifndef D_PROGRESSIVE_SUPPORTED
 #undef BLOCK_SMOOTHING_SUPPORTED
 #endif
 
+#ifdef D_PIPELINE_SUPPORTED
+/* Number of iMCU rows buffered between the pipeline's input and output */
+#define PIPE_ROWS  4
+#endif
+
 /* Private buffer controller object */
 
 typedef struct {
@@ -36,6 +45,19 @@ typedef struct {
 
   /* The output side's location is represented by cinfo->output_iMCU_row. */
 
+  /* A band of our own file (see jdband.c) lies below this many iMCU rows,
+   * which the input side must entropy-decode, and throw away, first.
+   */
+  JDIMENSION rows_to_skip;
+
+  /* Only some columns may be wanted (see jdband.c): MCU columns
+   * [first_MCU_col, end_MCU_col) of the current scan, in single-pass modes,
+   * and block columns [first_block, end_block) of each component.  The
+   * rest are entropy-decoded, but get no IDCT.
+   */
+  JDIMENSION first_MCU_col, end_MCU_col;
+  JDIMENSION first_block[MAX_COMPONENTS], end_block[MAX_COMPONENTS];
+
   /* In single-pass modes, it's sufficient to buffer just one MCU.
    * We allocate a workspace of D_MAX_BLOCKS_IN_MCU coefficient blocks,
    * and let the entropy decoder write into that workspace each time.
@@ -46,10 +68,22 @@ typedef struct {
    * within the virtual arrays; it is used only by the input side.
    */
   JBLOCKROW MCU_buffer[D_MAX_BLOCKS_IN_MCU];
+  /* Which of those blocks the entropy decoder expects to be zeroed; in a
+   * sequential scan, it stores only the DC coefficient of a block whose
+   * component is being output at 1/8 scale (see jdhuff.c).
+   */
+  boolean MCU_zero[D_MAX_BLOCKS_IN_MCU];
+  boolean MCU_zero_all;		/* TRUE if all of them are */
 
 #ifdef D_MULTISCAN_FILES_SUPPORTED
   /* In multi-pass modes, we need a virtual block array for each component. */
   jvirt_barray_ptr whole_image[MAX_COMPONENTS];
+  /* A band decompressor (see jdband.c) borrows another's arrays, and
+   * outputs only some of their rows.  Otherwise these describe our own.
+   */
+  j_common_ptr array_owner;	/* whose memory manager owns whole_image */
+  JDIMENSION row_offset;	/* iMCU row of whole_image that is our row 0 */
+  JDIMENSION array_iMCU_rows;	/* iMCU rows in whole_image */
 #endif
 
 #ifdef BLOCK_SMOOTHING_SUPPORTED
@@ -57,6 +91,24 @@ typedef struct {
   int * coef_bits_latch;
 #define SAVED_COEFS  6		/* we save coef_bits[0..5] */
 #endif
+
+#ifdef D_PIPELINE_SUPPORTED
+  /* In pipelined mode, entropy decoding runs on a thread of its own, and
+   * hands whole iMCU rows of coefficients to the output side through a
+   * ring of PIPE_ROWS iMCU rows for each component.
+   */
+  JBLOCKARRAY pipe_rows[MAX_COMPONENTS];
+  /* The entropy decoder's last_coef for each block in pipe_rows, in rows
+   * of pipe_width[ci] entries, so that the IDCT can use it later.
+   */
+  UINT8 * pipe_last[MAX_COMPONENTS];
+  JDIMENSION pipe_width[MAX_COMPONENTS];
+  jpipe_ring pipe;
+  int pipe_slot;		/* slot the input side is filling, or -1 */
+  boolean pipe_live;		/* pipe has been initialized */
+  boolean input_running;	/* input thread has been started */
+  pthread_t input_thread;
+#endif
 } my_coef_controller;
 
 typedef my_coef_controller * my_coef_ptr;
@@ -68,6 +120,10 @@ METHODDEF(int) decompress_onepass
 METHODDEF(int) decompress_data
 	JPP((j_decompress_ptr cinfo, JSAMPIMAGE output_buf));
 #endif
+#ifdef D_PIPELINE_SUPPORTED
+METHODDEF(int) decompress_data_pipe
+	JPP((j_decompress_ptr cinfo, JSAMPIMAGE output_buf));
+#endif
 #ifdef BLOCK_SMOOTHING_SUPPORTED
 LOCAL(boolean) smoothing_ok JPP((j_decompress_ptr cinfo));
 METHODDEF(int) decompress_smooth_data
@@ -99,6 +155,55 @@ start_iMCU_row (j_decompress_ptr cinfo)
 }
 
 
+LOCAL(boolean)
+needs_zeroing (jpeg_component_info * compptr)
+/* Must this component's blocks be zeroed before a sequential scan
+ * decodes into them?  Not if only their DC coefficient will be used
+ * (and stored), nor if they won't be used at all.
+ */
+{
+  return compptr->component_needed && compptr->DCT_scaled_size > 1;
+}
+
+
+LOCAL(boolean)
+skip_rows_above (j_decompress_ptr cinfo)
+/* Entropy-decode the iMCU rows above a band of our own file, throwing the
+ * coefficients away.  None of these rows can be the last of the image, so
+ * all are full height.  The single-MCU workspace is used for the
+ * coefficients; that is free even in pipelined mode, as nothing else has
+ * been decoded yet.  Returns FALSE if suspended.
+ */
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+  JDIMENSION MCU_col_num;	/* index of current MCU within row */
+  int yoffset, MCU_rows;
+
+  if (cinfo->comps_in_scan > 1)
+    MCU_rows = 1;
+  else
+    MCU_rows = cinfo->cur_comp_info[0]->v_samp_factor;
+
+  while (coef->rows_to_skip > 0) {
+    for (yoffset = coef->MCU_vert_offset; yoffset < MCU_rows; yoffset++) {
+      for (MCU_col_num = coef->MCU_ctr; MCU_col_num < cinfo->MCUs_per_row;
+	   MCU_col_num++) {
+	if (! (*cinfo->entropy->decode_mcu) (cinfo, coef->MCU_buffer)) {
+	  /* Suspension forced; update state counters and exit */
+	  coef->MCU_vert_offset = yoffset;
+	  coef->MCU_ctr = MCU_col_num;
+	  return FALSE;
+	}
+      }
+      coef->MCU_ctr = 0;
+    }
+    coef->MCU_vert_offset = 0;
+    coef->rows_to_skip--;
+  }
+  return TRUE;
+}
+
+
 /*
  * Initialize for an input processing pass.
  */
@@ -106,6 +211,38 @@ start_iMCU_row (j_decompress_ptr cinfo)
 METHODDEF(void)
 start_input_pass (j_decompress_ptr cinfo)
 {
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+  int ci, blkn;
+
+  /* Work out which blocks of the MCU need zeroing (single-pass modes) */
+  coef->MCU_zero_all = TRUE;
+  blkn = 0;
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+    jpeg_component_info *compptr = cinfo->cur_comp_info[ci];
+    boolean zero = needs_zeroing(compptr);
+    int i;
+
+    for (i = 0; i < compptr->MCU_blocks; i++)
+      coef->MCU_zero[blkn++] = zero;
+    if (! zero)
+      coef->MCU_zero_all = FALSE;
+  }
+
+  /* Work out which MCU columns get the IDCT (single-pass modes).  In a
+   * noninterleaved scan, an MCU is a single block.
+   */
+  if (cinfo->comps_in_scan > 1) {
+    coef->first_MCU_col = cinfo->band_first_iMCU_col;
+    coef->end_MCU_col = cinfo->MCUs_per_row;
+    if (cinfo->band_num_iMCU_cols > 0 &&
+	coef->first_MCU_col + cinfo->band_num_iMCU_cols < coef->end_MCU_col)
+      coef->end_MCU_col = coef->first_MCU_col + cinfo->band_num_iMCU_cols;
+  } else {
+    ci = cinfo->cur_comp_info[0]->component_index;
+    coef->first_MCU_col = coef->first_block[ci];
+    coef->end_MCU_col = coef->end_block[ci];
+  }
+
   cinfo->input_iMCU_row = 0;
   start_iMCU_row(cinfo);
 }
@@ -150,26 +287,43 @@ decompress_onepass (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
   JDIMENSION MCU_col_num;	/* index of current MCU within row */
   JDIMENSION last_MCU_col = cinfo->MCUs_per_row - 1;
   JDIMENSION last_iMCU_row = cinfo->total_iMCU_rows - 1;
+  JDIMENSION first_MCU_col = coef->first_MCU_col;
+  JDIMENSION end_MCU_col = coef->end_MCU_col;
   int blkn, ci, xindex, yindex, yoffset, useful_width;
   JSAMPARRAY output_ptr;
   JDIMENSION start_col, output_col;
   jpeg_component_info *compptr;
-  inverse_DCT_method_ptr inverse_DCT;
+  struct jpeg_inverse_dct * idct = cinfo->idct;
+  int * last_coef = cinfo->entropy->last_coef;
+
+  if (coef->rows_to_skip > 0 && ! skip_rows_above(cinfo))
+    return JPEG_SUSPENDED;
 
   /* Loop to process as much as one whole iMCU row */
   for (yoffset = coef->MCU_vert_offset; yoffset < coef->MCU_rows_per_iMCU_row;
        yoffset++) {
     for (MCU_col_num = coef->MCU_ctr; MCU_col_num <= last_MCU_col;
 	 MCU_col_num++) {
-      /* Try to fetch an MCU.  Entropy decoder expects buffer to be zeroed. */
-      jzero_far((void FAR *) coef->MCU_buffer[0],
-		(size_t) (cinfo->blocks_in_MCU * SIZEOF(JBLOCK)));
+      /* Try to fetch an MCU.  Entropy decoder expects buffer to be zeroed,
+       * apart from blocks that get only a DC value.
+       */
+      if (coef->MCU_zero_all)
+	jzero_far((void FAR *) coef->MCU_buffer[0],
+		  (size_t) (cinfo->blocks_in_MCU * SIZEOF(JBLOCK)));
+      else {
+	for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++)
+	  if (coef->MCU_zero[blkn])
+	    jzero_far((void FAR *) coef->MCU_buffer[blkn], SIZEOF(JBLOCK));
+      }
       if (! (*cinfo->entropy->decode_mcu) (cinfo, coef->MCU_buffer)) {
 	/* Suspension forced; update state counters and exit */
 	coef->MCU_vert_offset = yoffset;
 	coef->MCU_ctr = MCU_col_num;
 	return JPEG_SUSPENDED;
       }
+      /* Columns that are not wanted get no further */
+      if (MCU_col_num < first_MCU_col || MCU_col_num >= end_MCU_col)
+	continue;
       /* Determine where data should go in output_buf and do the IDCT thing.
        * We skip dummy blocks at the right and bottom edges (but blkn gets
        * incremented past them!).  Note the inner loop relies on having
@@ -183,20 +337,21 @@ decompress_onepass (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
 	  blkn += compptr->MCU_blocks;
 	  continue;
 	}
-	inverse_DCT = cinfo->idct->inverse_DCT[compptr->component_index];
 	useful_width = (MCU_col_num < last_MCU_col) ? compptr->MCU_width
 						    : compptr->last_col_width;
 	output_ptr = output_buf[compptr->component_index] +
 	  yoffset * compptr->DCT_scaled_size;
-	start_col = MCU_col_num * compptr->MCU_sample_width;
+	start_col = (MCU_col_num - first_MCU_col) * compptr->MCU_sample_width;
 	for (yindex = 0; yindex < compptr->MCU_height; yindex++) {
 	  if (cinfo->input_iMCU_row < last_iMCU_row ||
 	      yoffset+yindex < compptr->last_row_height) {
 	    output_col = start_col;
 	    for (xindex = 0; xindex < useful_width; xindex++) {
-	      (*inverse_DCT) (cinfo, compptr,
-			      (JCOEFPTR) coef->MCU_buffer[blkn+xindex],
-			      output_ptr, output_col);
+	      /* Blocks with few coefficients get a cheaper IDCT */
+	      (*IDCT_SPARSE(idct, compptr->component_index,
+			    last_coef[blkn+xindex]))
+		(cinfo, compptr, (JCOEFPTR) coef->MCU_buffer[blkn+xindex],
+		 output_ptr, output_col);
 	      output_col += compptr->DCT_scaled_size;
 	    }
 	  }
@@ -326,9 +481,10 @@ decompress_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
   inverse_DCT_method_ptr inverse_DCT;
 
   /* Force some input to be done if we are getting ahead of the input. */
-  while (cinfo->input_scan_number < cinfo->output_scan_number ||
-	 (cinfo->input_scan_number == cinfo->output_scan_number &&
-	  cinfo->input_iMCU_row <= cinfo->output_iMCU_row)) {
+  while ((cinfo->input_scan_number < cinfo->output_scan_number ||
+	  (cinfo->input_scan_number == cinfo->output_scan_number &&
+	   cinfo->input_iMCU_row <= cinfo->output_iMCU_row)) &&
+	 ! cinfo->inputctl->eoi_reached) {
     if ((*cinfo->inputctl->consume_input)(cinfo) == JPEG_SUSPENDED)
       return JPEG_SUSPENDED;
   }
@@ -340,9 +496,9 @@ decompress_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
     if (! compptr->component_needed)
       continue;
     /* Align the virtual buffer for this component. */
-    buffer = (*cinfo->mem->access_virt_barray)
-      ((j_common_ptr) cinfo, coef->whole_image[ci],
-       cinfo->output_iMCU_row * compptr->v_samp_factor,
+    buffer = (*coef->array_owner->mem->access_virt_barray)
+      (coef->array_owner, coef->whole_image[ci],
+       (cinfo->output_iMCU_row + coef->row_offset) * compptr->v_samp_factor,
        (JDIMENSION) compptr->v_samp_factor, FALSE);
     /* Count non-dummy DCT block rows in this iMCU row. */
     if (cinfo->output_iMCU_row < last_iMCU_row)
@@ -356,9 +512,10 @@ decompress_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
     output_ptr = output_buf[ci];
     /* Loop over all DCT blocks to be processed. */
     for (block_row = 0; block_row < block_rows; block_row++) {
-      buffer_ptr = buffer[block_row];
+      buffer_ptr = buffer[block_row] + coef->first_block[ci];
       output_col = 0;
-      for (block_num = 0; block_num < compptr->width_in_blocks; block_num++) {
+      for (block_num = coef->first_block[ci]; block_num < coef->end_block[ci];
+	   block_num++) {
 	(*inverse_DCT) (cinfo, compptr, (JCOEFPTR) buffer_ptr,
 			output_ptr, output_col);
 	buffer_ptr++;
@@ -376,6 +533,264 @@ decompress_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
 #endif /* D_MULTISCAN_FILES_SUPPORTED */
 
 
+#ifdef D_PIPELINE_SUPPORTED
+
+/*
+ * Consume input data and store it in the pipeline ring.
+ * This is called on the input thread, and reads one fully interleaved
+ * MCU row ("iMCU" row) per call, like consume_data.  If the ring is full
+ * it waits for the output side to free a slot.
+ * Return value is JPEG_ROW_COMPLETED, JPEG_SCAN_COMPLETED, or JPEG_SUSPENDED;
+ * the last is also returned if the pipeline has been shut down.
+ */
+
+METHODDEF(int)
+consume_data_pipe (j_decompress_ptr cinfo)
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+  JDIMENSION MCU_col_num;	/* index of current MCU within row */
+  int blkn, ci, xindex, yindex, yoffset;
+  JDIMENSION start_col;
+  JBLOCKARRAY buffer[MAX_COMPS_IN_SCAN];
+  JBLOCKROW buffer_ptr;
+  UINT8 * last_ptr;
+  int * last_coef = cinfo->entropy->last_coef;
+  jpeg_component_info *compptr;
+
+  if (coef->rows_to_skip > 0 && ! skip_rows_above(cinfo))
+    return JPEG_SUSPENDED;
+
+  /* Claim a free slot, unless we are resuming after a suspension. */
+  if (coef->pipe_slot < 0) {
+    coef->pipe_slot = jpipe_acquire_write(&coef->pipe);
+    if (coef->pipe_slot < 0)
+      return JPEG_SUSPENDED;	/* pipeline has been shut down */
+    /* Entropy decoder expects the blocks to be zeroed, apart from
+     * those that get only a DC value
+     */
+    for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+      compptr = cinfo->cur_comp_info[ci];
+      if (! needs_zeroing(compptr))
+	continue;
+      buffer[ci] = coef->pipe_rows[compptr->component_index] +
+	coef->pipe_slot * compptr->v_samp_factor;
+      for (yindex = 0; yindex < compptr->v_samp_factor; yindex++)
+	jzero_far((void FAR *) buffer[ci][yindex],
+		  (size_t) jround_up((long) compptr->width_in_blocks,
+				     (long) compptr->h_samp_factor)
+		  * SIZEOF(JBLOCK));
+    }
+  }
+
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+    compptr = cinfo->cur_comp_info[ci];
+    buffer[ci] = coef->pipe_rows[compptr->component_index] +
+      coef->pipe_slot * compptr->v_samp_factor;
+  }
+
+  /* Loop to process one whole iMCU row */
+  for (yoffset = coef->MCU_vert_offset; yoffset < coef->MCU_rows_per_iMCU_row;
+       yoffset++) {
+    for (MCU_col_num = coef->MCU_ctr; MCU_col_num < cinfo->MCUs_per_row;
+	 MCU_col_num++) {
+      /* Construct list of pointers to DCT blocks belonging to this MCU */
+      blkn = 0;			/* index of current DCT block within MCU */
+      for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+	compptr = cinfo->cur_comp_info[ci];
+	start_col = MCU_col_num * compptr->MCU_width;
+	for (yindex = 0; yindex < compptr->MCU_height; yindex++) {
+	  buffer_ptr = buffer[ci][yindex+yoffset] + start_col;
+	  for (xindex = 0; xindex < compptr->MCU_width; xindex++) {
+	    coef->MCU_buffer[blkn++] = buffer_ptr++;
+	  }
+	}
+      }
+      /* Try to fetch the MCU. */
+      if (! (*cinfo->entropy->decode_mcu) (cinfo, coef->MCU_buffer)) {
+	/* Suspension forced; update state counters and exit */
+	coef->MCU_vert_offset = yoffset;
+	coef->MCU_ctr = MCU_col_num;
+	return JPEG_SUSPENDED;
+      }
+      /* Save each block's last_coef alongside it */
+      blkn = 0;
+      for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+	compptr = cinfo->cur_comp_info[ci];
+	last_ptr = coef->pipe_last[compptr->component_index] +
+	  (coef->pipe_slot * compptr->v_samp_factor + yoffset) *
+	  coef->pipe_width[compptr->component_index] +
+	  MCU_col_num * compptr->MCU_width;
+	for (yindex = 0; yindex < compptr->MCU_height; yindex++) {
+	  for (xindex = 0; xindex < compptr->MCU_width; xindex++)
+	    last_ptr[xindex] = (UINT8) last_coef[blkn++];
+	  last_ptr += coef->pipe_width[compptr->component_index];
+	}
+      }
+    }
+    /* Completed an MCU row, but perhaps not an iMCU row */
+    coef->MCU_ctr = 0;
+  }
+  /* Completed the iMCU row: pass it on, and advance counters */
+  coef->pipe_slot = -1;
+  jpipe_commit_write(&coef->pipe);
+  if (++(cinfo->input_iMCU_row) < cinfo->total_iMCU_rows) {
+    start_iMCU_row(cinfo);
+    return JPEG_ROW_COMPLETED;
+  }
+  /* Completed the scan */
+  (*cinfo->inputctl->finish_input_pass) (cinfo);
+  return JPEG_SCAN_COMPLETED;
+}
+
+
+/*
+ * Decompress and return one iMCU row in pipelined mode, waiting for the
+ * input thread to supply it if necessary.  If the input thread has not
+ * been started, the input is consumed here instead, one row ahead.
+ * Return value is JPEG_ROW_COMPLETED, JPEG_SCAN_COMPLETED, or JPEG_SUSPENDED.
+ */
+
+METHODDEF(int)
+decompress_data_pipe (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+  JDIMENSION last_iMCU_row = cinfo->total_iMCU_rows - 1;
+  JDIMENSION block_num;
+  int ci, slot, block_row, block_rows;
+  JBLOCKARRAY buffer;
+  JBLOCKROW buffer_ptr;
+  UINT8 * last_ptr;
+  JSAMPARRAY output_ptr;
+  JDIMENSION output_col;
+  jpeg_component_info *compptr;
+  struct jpeg_inverse_dct * idct = cinfo->idct;
+
+  if (! coef->input_running) {
+    while (cinfo->input_iMCU_row <= cinfo->output_iMCU_row &&
+	   ! cinfo->inputctl->eoi_reached) {
+      if ((*cinfo->inputctl->consume_input)(cinfo) == JPEG_SUSPENDED)
+	return JPEG_SUSPENDED;
+    }
+  }
+  slot = jpipe_acquire_read(&coef->pipe);
+  if (slot < 0)
+    return JPEG_SUSPENDED;	/* input side stopped early */
+
+  for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
+       ci++, compptr++) {
+    /* Don't bother to IDCT an uninteresting component. */
+    if (! compptr->component_needed)
+      continue;
+    buffer = coef->pipe_rows[ci] + slot * compptr->v_samp_factor;
+    /* Count non-dummy DCT block rows in this iMCU row. */
+    if (cinfo->output_iMCU_row < last_iMCU_row)
+      block_rows = compptr->v_samp_factor;
+    else {
+      block_rows = (int) (compptr->height_in_blocks % compptr->v_samp_factor);
+      if (block_rows == 0) block_rows = compptr->v_samp_factor;
+    }
+    output_ptr = output_buf[ci];
+    /* Loop over all DCT blocks to be processed. */
+    for (block_row = 0; block_row < block_rows; block_row++) {
+      buffer_ptr = buffer[block_row] + coef->first_block[ci];
+      last_ptr = coef->pipe_last[ci] +
+	(slot * compptr->v_samp_factor + block_row) * coef->pipe_width[ci];
+      output_col = 0;
+      for (block_num = coef->first_block[ci]; block_num < coef->end_block[ci];
+	   block_num++) {
+	(*IDCT_SPARSE(idct, ci, last_ptr[block_num]))
+	  (cinfo, compptr, (JCOEFPTR) buffer_ptr, output_ptr, output_col);
+	buffer_ptr++;
+	output_col += compptr->DCT_scaled_size;
+      }
+      output_ptr += compptr->DCT_scaled_size;
+    }
+  }
+  jpipe_commit_read(&coef->pipe);
+
+  if (++(cinfo->output_iMCU_row) < cinfo->total_iMCU_rows)
+    return JPEG_ROW_COMPLETED;
+  return JPEG_SCAN_COMPLETED;
+}
+
+
+/*
+ * Body of the input thread: consume input to the end of the scan.  The
+ * markers after it are left for jpeg_finish_decompress, which is not called
+ * at all for a band that ends short of the bottom of the image.
+ * The error manager's error_exit must not return to (or longjmp into)
+ * this thread; the standard one exits the program.
+ */
+
+LOCAL(void *)
+input_thread_main (void * arg)
+{
+  j_decompress_ptr cinfo = (j_decompress_ptr) arg;
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+  int retcode;
+
+  do {
+    retcode = (*cinfo->inputctl->consume_input) (cinfo);
+  } while (retcode == JPEG_ROW_COMPLETED);
+  /* Let the output side drain what is left, and then stop */
+  jpipe_close(&coef->pipe);
+  return NULL;
+}
+
+
+/*
+ * Start the input thread.  Called once the output pass has been set up;
+ * from then on, the input side of cinfo belongs to the input thread until
+ * finish_input_thread() is called.
+ */
+
+METHODDEF(void)
+start_input_thread (j_decompress_ptr cinfo)
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+  sigset_t all, old;
+
+  if (coef->input_running || cinfo->inputctl->eoi_reached)
+    return;
+  /* Signals are meant for the application's own threads -- apart from
+   * SIGBUS, which is raised by reading a mapped file that has been cut
+   * short, on whichever thread does the reading.
+   */
+  sigfillset(&all);
+  sigdelset(&all, SIGBUS);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  /* If there is no thread, decompress_data_pipe does the input itself */
+  coef->input_running = (pthread_create(&coef->input_thread, NULL,
+					input_thread_main, cinfo) == 0);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+
+/*
+ * Wait for the input thread to finish, first telling it to give up if
+ * abort is TRUE, and release the pipeline.
+ */
+
+METHODDEF(void)
+finish_input_thread (j_decompress_ptr cinfo, boolean abort)
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+
+  if (coef->input_running) {
+    if (abort)
+      jpipe_close(&coef->pipe);
+    pthread_join(coef->input_thread, NULL);
+    coef->input_running = FALSE;
+  }
+  if (coef->pipe_live) {
+    jpipe_term(&coef->pipe);
+    coef->pipe_live = FALSE;
+  }
+}
+
+#endif /* D_PIPELINE_SUPPORTED */
+
+
 #ifdef BLOCK_SMOOTHING_SUPPORTED
 
 /*
@@ -461,7 +876,11 @@ METHODDEF(int)
 decompress_smooth_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
 {
   my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
-  JDIMENSION last_iMCU_row = cinfo->total_iMCU_rows - 1;
+  /* Rows are numbered within whole_image, so that a band decompressor
+   * smooths against the true neighbours of its first and last rows.
+   */
+  JDIMENSION iMCU_row = cinfo->output_iMCU_row + coef->row_offset;
+  JDIMENSION last_iMCU_row = coef->array_iMCU_rows - 1;
   JDIMENSION block_num, last_block_column;
   int ci, block_row, block_rows, access_rows;
   JBLOCKARRAY buffer;
@@ -502,7 +921,7 @@ decompress_smooth_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
     if (! compptr->component_needed)
       continue;
     /* Count non-dummy DCT block rows in this iMCU row. */
-    if (cinfo->output_iMCU_row < last_iMCU_row) {
+    if (iMCU_row < last_iMCU_row) {
       block_rows = compptr->v_samp_factor;
       access_rows = block_rows * 2; /* this and next iMCU row */
       last_row = FALSE;
@@ -514,17 +933,17 @@ decompress_smooth_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
       last_row = TRUE;
     }
     /* Align the virtual buffer for this component. */
-    if (cinfo->output_iMCU_row > 0) {
+    if (iMCU_row > 0) {
       access_rows += compptr->v_samp_factor; /* prior iMCU row too */
-      buffer = (*cinfo->mem->access_virt_barray)
-	((j_common_ptr) cinfo, coef->whole_image[ci],
-	 (cinfo->output_iMCU_row - 1) * compptr->v_samp_factor,
+      buffer = (*coef->array_owner->mem->access_virt_barray)
+	(coef->array_owner, coef->whole_image[ci],
+	 (iMCU_row - 1) * compptr->v_samp_factor,
 	 (JDIMENSION) access_rows, FALSE);
       buffer += compptr->v_samp_factor;	/* point to current iMCU row */
       first_row = FALSE;
     } else {
-      buffer = (*cinfo->mem->access_virt_barray)
-	((j_common_ptr) cinfo, coef->whole_image[ci],
+      buffer = (*coef->array_owner->mem->access_virt_barray)
+	(coef->array_owner, coef->whole_image[ci],
 	 (JDIMENSION) 0, (JDIMENSION) access_rows, FALSE);
       first_row = TRUE;
     }
@@ -550,15 +969,26 @@ decompress_smooth_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
 	next_block_row = buffer_ptr;
       else
 	next_block_row = buffer[block_row+1];
+      block_num = coef->first_block[ci];
+      buffer_ptr += block_num;
+      prev_block_row += block_num;
+      next_block_row += block_num;
       /* We fetch the surrounding DC values using a sliding-register approach.
        * Initialize all nine here so as to do the right thing on narrow pics.
+       * If the wanted columns do not start at the left edge, the blocks to
+       * their left are still real neighbours.
        */
       DC1 = DC2 = DC3 = (int) prev_block_row[0][0];
       DC4 = DC5 = DC6 = (int) buffer_ptr[0][0];
       DC7 = DC8 = DC9 = (int) next_block_row[0][0];
+      if (block_num > 0) {
+	DC1 = (int) prev_block_row[-1][0];
+	DC4 = (int) buffer_ptr[-1][0];
+	DC7 = (int) next_block_row[-1][0];
+      }
       output_col = 0;
       last_block_column = compptr->width_in_blocks - 1;
-      for (block_num = 0; block_num <= last_block_column; block_num++) {
+      for (; block_num < coef->end_block[ci]; block_num++) {
 	/* Fetch current DCT block into workspace so we can modify it. */
 	jcopy_block_row(buffer_ptr, (JBLOCKROW) workspace, (JDIMENSION) 1);
 	/* Update DC values */
@@ -668,6 +1098,33 @@ decompress_smooth_data (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
 #endif /* BLOCK_SMOOTHING_SUPPORTED */
 
 
+/*
+ * Work out which block columns of each component get the IDCT.
+ */
+
+LOCAL(void)
+select_blocks (j_decompress_ptr cinfo)
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+  int ci;
+  JDIMENSION end;
+  jpeg_component_info *compptr;
+
+  for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
+       ci++, compptr++) {
+    coef->first_block[ci] = cinfo->band_first_iMCU_col *
+      compptr->h_samp_factor;
+    coef->end_block[ci] = compptr->width_in_blocks;
+    if (cinfo->band_num_iMCU_cols > 0) {
+      end = (cinfo->band_first_iMCU_col + cinfo->band_num_iMCU_cols) *
+	compptr->h_samp_factor;
+      if (end < coef->end_block[ci])
+	coef->end_block[ci] = end;
+    }
+  }
+}
+
+
 /*
  * Initialize coefficient buffer controller.
  */
@@ -683,10 +1140,21 @@ jinit_d_coef_controller (j_decompress_ptr cinfo, boolean need_full_buffer)
   cinfo->coef = (struct jpeg_d_coef_controller *) coef;
   coef->pub.start_input_pass = start_input_pass;
   coef->pub.start_output_pass = start_output_pass;
+  coef->pub.start_input_thread = NULL;
+  coef->pub.finish_input_thread = NULL;
 #ifdef BLOCK_SMOOTHING_SUPPORTED
   coef->coef_bits_latch = NULL;
 #endif
 
+  /* Band set up by jdband.c, if any */
+  coef->rows_to_skip = 0;
+  if (cinfo->band_source == cinfo) {
+    if (need_full_buffer)
+      ERREXIT(cinfo, JERR_NOTIMPL);
+    coef->rows_to_skip = cinfo->band_first_iMCU_row;
+  }
+  select_blocks(cinfo);
+
   /* Create the coefficient buffer. */
   if (need_full_buffer) {
 #ifdef D_MULTISCAN_FILES_SUPPORTED
@@ -696,8 +1164,16 @@ jinit_d_coef_controller (j_decompress_ptr cinfo, boolean need_full_buffer)
     int ci, access_rows;
     jpeg_component_info *compptr;
 
+    coef->array_owner = (j_common_ptr) cinfo;
+    coef->row_offset = 0;
+    coef->array_iMCU_rows = cinfo->total_iMCU_rows;
     for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
 	 ci++, compptr++) {
+      if (BAND_BORROWS_COEFS(cinfo)) {
+	/* Borrow the source's arrays; see jdband.c */
+	coef->whole_image[ci] = cinfo->band_source->coef->coef_arrays[ci];
+	continue;
+      }
       access_rows = compptr->v_samp_factor;
 #ifdef BLOCK_SMOOTHING_SUPPORTED
       /* If block smoothing could be used, need a bigger window */
@@ -712,6 +1188,11 @@ jinit_d_coef_controller (j_decompress_ptr cinfo, boolean need_full_buffer)
 				(long) compptr->v_samp_factor),
 	 (JDIMENSION) access_rows);
     }
+    if (BAND_BORROWS_COEFS(cinfo)) {
+      coef->array_owner = (j_common_ptr) cinfo->band_source;
+      coef->row_offset = cinfo->band_first_iMCU_row;
+      coef->array_iMCU_rows = cinfo->band_source->total_iMCU_rows;
+    }
     coef->pub.consume_data = consume_data;
     coef->pub.decompress_data = decompress_data;
     coef->pub.coef_arrays = coef->whole_image; /* link to virtual arrays */
@@ -732,5 +1213,35 @@ jinit_d_coef_controller (j_decompress_ptr cinfo, boolean need_full_buffer)
     coef->pub.consume_data = dummy_consume_data;
     coef->pub.decompress_data = decompress_onepass;
     coef->pub.coef_arrays = NULL; /* flag for no virtual arrays */
+
+#ifdef D_PIPELINE_SUPPORTED
+    if (cinfo->do_pipeline) {
+      /* Replace the single-MCU scheme with a ring of iMCU rows */
+      int ci;
+      jpeg_component_info *compptr;
+
+      for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
+	   ci++, compptr++) {
+	coef->pipe_width[ci] = (JDIMENSION)
+	  jround_up((long) compptr->width_in_blocks,
+		    (long) compptr->h_samp_factor);
+	coef->pipe_rows[ci] = (*cinfo->mem->alloc_barray)
+	  ((j_common_ptr) cinfo, JPOOL_IMAGE, coef->pipe_width[ci],
+	   (JDIMENSION) (PIPE_ROWS * compptr->v_samp_factor));
+	coef->pipe_last[ci] = (UINT8 *)
+	  (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				      (size_t) coef->pipe_width[ci] *
+				      PIPE_ROWS * compptr->v_samp_factor);
+      }
+      jpipe_init(&coef->pipe, PIPE_ROWS);
+      coef->pipe_slot = -1;
+      coef->pipe_live = TRUE;
+      coef->input_running = FALSE;
+      coef->pub.consume_data = consume_data_pipe;
+      coef->pub.decompress_data = decompress_data_pipe;
+      coef->pub.start_input_thread = start_input_thread;
+      coef->pub.finish_input_thread = finish_input_thread;
+    }
+#endif
   }
 }
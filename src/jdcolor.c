@@ -11,6 +11,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"
 
 
 /* Private subobject */
@@ -23,6 +24,12 @@ typedef struct {
   int * Cb_b_tab;		/* => table for Cb to B conversion */
   INT32 * Cr_g_tab;		/* => table for Cr to G conversion */
   INT32 * Cb_g_tab;		/* => table for Cb to G conversion */
+
+  /* Private state for packed-pixel output */
+  int red_shift, blue_shift;	/* positions of red and blue, 32-bit pixels */
+  boolean dither;		/* TRUE to dither RGB565 */
+  JDIMENSION output_row;	/* image row of the next row converted */
+  JDIMENSION col_origin;	/* image column of output column 0 */
 } my_color_deconverter;
 
 typedef my_color_deconverter * my_cconvert_ptr;
@@ -157,6 +164,100 @@ ycc_rgb_convert (j_decompress_ptr cinfo,
 }
 
 
+/**************** YCbCr -> packed framebuffer pixels **************/
+
+/*
+ * These are the same as ycc_rgb_convert, except that each pixel is stored
+ * as one native 32- or 16-bit integer (see jpegint.h).  The RGB565 dither
+ * depends on where the pixel is in the whole image, so a band decoded on
+ * its own comes out the same as those rows of a full decode.
+ */
+
+METHODDEF(void)
+ycc_rgb32_convert (j_decompress_ptr cinfo,
+		   JSAMPIMAGE input_buf, JDIMENSION input_row,
+		   JSAMPARRAY output_buf, int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  register int y, cb, cr;
+  register JSAMPROW outptr;
+  register JSAMPROW inptr0, inptr1, inptr2;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+  int rshift = cconvert->red_shift;
+  int bshift = cconvert->blue_shift;
+  /* copy these pointers into registers if possible */
+  register JSAMPLE * range_limit = cinfo->sample_range_limit;
+  register int * Crrtab = cconvert->Cr_r_tab;
+  register int * Cbbtab = cconvert->Cb_b_tab;
+  register INT32 * Crgtab = cconvert->Cr_g_tab;
+  register INT32 * Cbgtab = cconvert->Cb_g_tab;
+  SHIFT_TEMPS
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    for (col = 0; col < num_cols; col++) {
+      y  = GETJSAMPLE(inptr0[col]);
+      cb = GETJSAMPLE(inptr1[col]);
+      cr = GETJSAMPLE(inptr2[col]);
+      PUT_PIXEL32(outptr, range_limit[y + Crrtab[cr]],
+		  range_limit[y + ((int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr],
+						      SCALEBITS))],
+		  range_limit[y + Cbbtab[cb]], rshift, bshift);
+      outptr += 4;
+    }
+  }
+}
+
+
+METHODDEF(void)
+ycc_rgb565_convert (j_decompress_ptr cinfo,
+		    JSAMPIMAGE input_buf, JDIMENSION input_row,
+		    JSAMPARRAY output_buf, int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  register int y, cb, cr, d;
+  register JSAMPROW outptr;
+  register JSAMPROW inptr0, inptr1, inptr2;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+  JDIMENSION col_origin = cconvert->col_origin;
+  unsigned int drow;
+  /* copy these pointers into registers if possible */
+  register JSAMPLE * range_limit = cinfo->sample_range_limit;
+  register int * Crrtab = cconvert->Cr_r_tab;
+  register int * Cbbtab = cconvert->Cb_b_tab;
+  register INT32 * Crgtab = cconvert->Cr_g_tab;
+  register INT32 * Cbgtab = cconvert->Cb_g_tab;
+  SHIFT_TEMPS
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    drow = cconvert->dither ? DITHER_565_ROW(cconvert->output_row) : 0;
+    cconvert->output_row++;
+    for (col = 0; col < num_cols; col++) {
+      y  = GETJSAMPLE(inptr0[col]);
+      cb = GETJSAMPLE(inptr1[col]);
+      cr = GETJSAMPLE(inptr2[col]);
+      d = DITHER_565(drow, col + col_origin);
+      PUT_PIXEL565(outptr, range_limit[y + Crrtab[cr] + d],
+		   range_limit[y + ((int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr],
+						       SCALEBITS)) + (d >> 1)],
+		   range_limit[y + Cbbtab[cb] + d]);
+      outptr += 2;
+    }
+  }
+}
+
+
 /**************** Cases other than YCbCr -> RGB **************/
 
 
@@ -234,6 +335,48 @@ gray_rgb_convert (j_decompress_ptr cinfo,
 }
 
 
+/*
+ * Convert RGB to packed pixels.  Files stored as RGB are rare enough that
+ * one routine does for all the packed formats.
+ */
+
+METHODDEF(void)
+rgb_packed_convert (j_decompress_ptr cinfo,
+		    JSAMPIMAGE input_buf, JDIMENSION input_row,
+		    JSAMPARRAY output_buf, int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  register JSAMPROW inptr0, inptr1, inptr2, outptr;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+  JSAMPLE * range_limit = cinfo->sample_range_limit;
+  unsigned int drow;
+  int d;
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    if (cinfo->out_color_space != JCS_RGB565) {
+      for (col = 0; col < num_cols; col++, outptr += 4)
+	PUT_PIXEL32(outptr, inptr0[col], inptr1[col], inptr2[col],
+		    cconvert->red_shift, cconvert->blue_shift);
+    } else {
+      drow = cconvert->dither ? DITHER_565_ROW(cconvert->output_row) : 0;
+      for (col = 0; col < num_cols; col++, outptr += 2) {
+	d = DITHER_565(drow, col + cconvert->col_origin);
+	PUT_PIXEL565(outptr, range_limit[GETJSAMPLE(inptr0[col]) + d],
+		     range_limit[GETJSAMPLE(inptr1[col]) + (d >> 1)],
+		     range_limit[GETJSAMPLE(inptr2[col]) + d]);
+      }
+    }
+    cconvert->output_row++;
+  }
+}
+
+
 /*
  * Adobe-style YCCK->CMYK conversion.
  * We convert YCbCr to R=1-C, G=1-M, and B=1-Y using the same
@@ -286,13 +429,18 @@ ycck_cmyk_convert (j_decompress_ptr cinfo,
 
 
 /*
- * Empty method for start_pass.
+ * Initialize for an output pass.  Only the packed-pixel converters keep
+ * any state, which is where they are in the image.
  */
 
 METHODDEF(void)
 start_pass_dcolor (j_decompress_ptr cinfo)
 {
-  /* no work needed */
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+
+  cconvert->output_row = cinfo->dither_origin_row +
+    cinfo->band_first_iMCU_row * (JDIMENSION)
+      (cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size);
 }
 
 
@@ -358,8 +506,12 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
   case JCS_RGB:
     cinfo->out_color_components = RGB_PIXELSIZE;
     if (cinfo->jpeg_color_space == JCS_YCbCr) {
-      cconvert->pub.color_convert = ycc_rgb_convert;
-      build_ycc_rgb_table(cinfo);
+      if (jsimd_can_ycc_rgb(cinfo))
+	cconvert->pub.color_convert = jsimd_ycc_rgb_convert;
+      else {
+	cconvert->pub.color_convert = ycc_rgb_convert;
+	build_ycc_rgb_table(cinfo);
+      }
     } else if (cinfo->jpeg_color_space == JCS_GRAYSCALE) {
       cconvert->pub.color_convert = gray_rgb_convert;
     } else if (cinfo->jpeg_color_space == JCS_RGB && RGB_PIXELSIZE == 3) {
@@ -379,6 +531,28 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
       ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
     break;
 
+  case JCS_XRGB8888:
+  case JCS_XBGR8888:
+  case JCS_RGB565:
+    cinfo->out_color_components =
+      (cinfo->out_color_space == JCS_RGB565) ? 2 : 4;
+    cconvert->red_shift = (cinfo->out_color_space == JCS_XBGR8888) ? 0 : 16;
+    cconvert->blue_shift = 16 - cconvert->red_shift;
+    cconvert->dither = (cinfo->dither_mode != JDITHER_NONE);
+    cconvert->col_origin = cinfo->band_first_iMCU_col * (JDIMENSION)
+      (cinfo->max_h_samp_factor * cinfo->min_DCT_scaled_size);
+    if (cinfo->jpeg_color_space == JCS_YCbCr) {
+      if (cinfo->out_color_space == JCS_RGB565)
+	cconvert->pub.color_convert = ycc_rgb565_convert;
+      else
+	cconvert->pub.color_convert = ycc_rgb32_convert;
+      build_ycc_rgb_table(cinfo);
+    } else if (cinfo->jpeg_color_space == JCS_RGB) {
+      cconvert->pub.color_convert = rgb_packed_convert;
+    } else
+      ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
+    break;
+
   default:
     /* Permit null conversion to same output space */
     if (cinfo->out_color_space == cinfo->jpeg_color_space) {
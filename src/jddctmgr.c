@@ -19,6 +19,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
 
 
 /*
@@ -93,11 +94,15 @@ start_pass (j_decompress_ptr cinfo)
   jpeg_component_info *compptr;
   int method = 0;
   inverse_DCT_method_ptr method_ptr = NULL;
+  boolean sparse;
+  const inverse_DCT_method_ptr * scaled_ptrs;
   JQUANT_TBL * qtbl;
 
   for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
        ci++, compptr++) {
     /* Select the proper IDCT routine for this component's scaling */
+    sparse = FALSE;
+    scaled_ptrs = NULL;
     switch (compptr->DCT_scaled_size) {
 #ifdef IDCT_SCALING_SUPPORTED
     case 1:
@@ -117,8 +122,12 @@ start_pass (j_decompress_ptr cinfo)
       switch (cinfo->dct_method) {
 #ifdef DCT_ISLOW_SUPPORTED
       case JDCT_ISLOW:
-	method_ptr = jpeg_idct_islow;
+	if (jsimd_can_idct_islow())
+	  method_ptr = jsimd_idct_islow;
+	else
+	  method_ptr = jpeg_idct_islow;
 	method = JDCT_ISLOW;
+	sparse = TRUE;
 	break;
 #endif
 #ifdef DCT_IFAST_SUPPORTED
@@ -139,10 +148,32 @@ start_pass (j_decompress_ptr cinfo)
       }
       break;
     default:
+#ifdef IDCT_SCALING_SUPPORTED
+      scaled_ptrs = jpeg_idct_scaled(compptr->DCT_scaled_size);
+      if (scaled_ptrs != NULL) {
+	method_ptr = scaled_ptrs[3];
+	method = JDCT_ISLOW;	/* jidctscl uses islow-style table */
+	break;
+      }
+#endif
       ERREXIT1(cinfo, JERR_BAD_DCTSIZE, compptr->DCT_scaled_size);
       break;
     }
     idct->pub.inverse_DCT[ci] = method_ptr;
+#ifdef DCT_ISLOW_SUPPORTED
+    if (sparse) {
+      idct->pub.inverse_DCT_sparse[ci][0] = jpeg_idct_islow_dc;
+      idct->pub.inverse_DCT_sparse[ci][1] = jpeg_idct_islow_2c;
+      /* The vector IDCT, if we have one, beats the 4x4-corner routine */
+      idct->pub.inverse_DCT_sparse[ci][2] =
+	jsimd_can_idct_islow() ? method_ptr : jpeg_idct_islow_4c;
+    } else
+#endif
+    {
+      for (i = 0; i < 3; i++)
+	idct->pub.inverse_DCT_sparse[ci][i] =
+	  (scaled_ptrs != NULL) ? scaled_ptrs[i] : method_ptr;
+    }
     /* Create multiplier table from quant table.
      * However, we can skip this if the component is uninteresting
      * or if we already built the table.  Also, if no quant table
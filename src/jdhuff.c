@@ -138,6 +138,10 @@ start_pass_huff_decoder (j_decompress_ptr cinfo)
 }
 
 
+/* Offset making the coefficient values in look_ac[] entries positive */
+#define LOOK_AC_BIAS	(1 << (HUFF_LOOKAHEAD-1))
+
+
 /*
  * Compute the derived values for a Huffman table.
  * This routine also performs some validation checks on the table.
@@ -152,7 +156,7 @@ jpeg_make_d_derived_tbl (j_decompress_ptr cinfo, boolean isDC, int tblno,
   JHUFF_TBL *htbl;
   d_derived_tbl *dtbl;
   int p, i, l, si, numsymbols;
-  int lookbits, ctr;
+  int lookbits, ctr, sym, r, nbits, val;
   char huffsize[257];
   unsigned int huffcode[257];
   unsigned int code;
@@ -250,6 +254,34 @@ jpeg_make_d_derived_tbl (j_decompress_ptr cinfo, boolean isDC, int tblno,
     }
   }
 
+  /* Compute the combined AC lookahead table.  An entry is made wherever
+   * the code for a nonzero coefficient, plus the magnitude bits following
+   * it, fit within HUFF_LOOKAHEAD bits.  The entry packs
+   *   (value + LOOK_AC_BIAS) << 12  |  run << 4  |  total # bits
+   * which is never 0, and never negative for the coefficient values that
+   * can occur here.  EOB and ZRL codes are left to the ordinary tables.
+   */
+
+  MEMZERO(dtbl->look_ac, SIZEOF(dtbl->look_ac));
+
+  if (! isDC) {
+    for (lookbits = 0; lookbits < (1 << HUFF_LOOKAHEAD); lookbits++) {
+      l = dtbl->look_nbits[lookbits];
+      sym = dtbl->look_sym[lookbits];
+      r = sym >> 4;
+      si = sym & 15;
+      nbits = l + si;
+      if (l == 0 || si == 0 || nbits > HUFF_LOOKAHEAD)
+	continue;
+      /* Figure F.12: extend sign bit */
+      val = (lookbits >> (HUFF_LOOKAHEAD - nbits)) & ((1 << si) - 1);
+      if (val < (1 << (si - 1)))
+	val -= (1 << si) - 1;
+      dtbl->look_ac[lookbits] =
+	((val + LOOK_AC_BIAS) << 12) | (r << 4) | nbits;
+    }
+  }
+
   /* Validate symbols as being reasonable.
    * For AC tables, we make no check, but accept all byte values 0..255.
    * For DC tables, we require the symbols to be in range 0..15.
@@ -498,13 +530,324 @@ process_restart (j_decompress_ptr cinfo)
 }
 
 
+/*
+ * Decode one MCU the general way, a bit or a byte at a time, coping with
+ * suspension, markers, and the end of the source buffer.
+ * The i'th block of the MCU is stored into the block pointed to by
+ * MCU_data[i], as described for decode_mcu() below.
+ * Returns FALSE if data source requested suspension.
+ */
+
+LOCAL(boolean)
+decode_mcu_slow (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  huff_entropy_ptr entropy = (huff_entropy_ptr) cinfo->entropy;
+  int blkn;
+  BITREAD_STATE_VARS;
+  savable_state state;
+
+  /* Load up working state */
+  BITREAD_LOAD_STATE(cinfo,entropy->bitstate);
+  ASSIGN_STATE(state, entropy->saved);
+
+  /* Outer loop handles each block in the MCU */
+
+  for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
+    JBLOCKROW block = MCU_data[blkn];
+    d_derived_tbl * dctbl = entropy->dc_cur_tbls[blkn];
+    d_derived_tbl * actbl = entropy->ac_cur_tbls[blkn];
+    register int s, k, r;
+
+    /* Decode a single block's worth of coefficients */
+
+    /* Section F.2.2.1: decode the DC coefficient difference */
+    HUFF_DECODE(s, br_state, dctbl, return FALSE, label1);
+    if (s) {
+      CHECK_BIT_BUFFER(br_state, s, return FALSE);
+      r = GET_BITS(s);
+      s = HUFF_EXTEND(r, s);
+    }
+
+    if (entropy->dc_needed[blkn]) {
+      /* Convert DC difference to actual value, update last_dc_val */
+      int ci = cinfo->MCU_membership[blkn];
+      s += state.last_dc_val[ci];
+      state.last_dc_val[ci] = s;
+      /* Output the DC coefficient (assumes jpeg_natural_order[0] = 0) */
+      (*block)[0] = (JCOEF) s;
+    }
+
+    if (entropy->ac_needed[blkn]) {
+
+      /* Section F.2.2.2: decode the AC coefficients */
+      /* Since zeroes are skipped, output area must be cleared beforehand */
+      for (k = 1; k < DCTSIZE2; k++) {
+	HUFF_DECODE(s, br_state, actbl, return FALSE, label2);
+
+	r = s >> 4;
+	s &= 15;
+
+	if (s) {
+	  k += r;
+	  CHECK_BIT_BUFFER(br_state, s, return FALSE);
+	  r = GET_BITS(s);
+	  s = HUFF_EXTEND(r, s);
+	  /* Output coefficient in natural (dezigzagged) order.
+	   * Note: the extra entries in jpeg_natural_order[] will save us
+	   * if k >= DCTSIZE2, which could happen if the data is corrupted.
+	   */
+	  (*block)[jpeg_natural_order[k]] = (JCOEF) s;
+	} else {
+	  if (r != 15)
+	    break;
+	  k += 15;
+	}
+      }
+      entropy->pub.last_coef[blkn] = k - 1;
+
+    } else {
+
+      /* Section F.2.2.2: decode the AC coefficients */
+      /* In this path we just discard the values */
+      for (k = 1; k < DCTSIZE2; k++) {
+	HUFF_DECODE(s, br_state, actbl, return FALSE, label3);
+
+	r = s >> 4;
+	s &= 15;
+
+	if (s) {
+	  k += r;
+	  CHECK_BIT_BUFFER(br_state, s, return FALSE);
+	  DROP_BITS(s);
+	} else {
+	  if (r != 15)
+	    break;
+	  k += 15;
+	}
+      }
+      entropy->pub.last_coef[blkn] = 0;
+
+    }
+  }
+
+  /* Completed MCU, so update state */
+  BITREAD_SAVE_STATE(cinfo,entropy->bitstate);
+  ASSIGN_STATE(entropy->saved, state);
+
+  return TRUE;
+}
+
+
+/*
+ * Fast path for decoding one MCU, used when the source buffer is known to
+ * hold enough bytes for the largest possible MCU.  The bit buffer is then
+ * refilled six bytes at a time, inline, without checking for the end of
+ * the buffer, and most AC coefficients are decoded with a single lookup in
+ * the combined look_ac[] table.
+ *
+ * A marker (usually a restart marker, or EOI) ends the entropy-coded data.
+ * If we run into one, we stop short of it and feed in zero bits, as
+ * jpeg_fill_bit_buffer() does.  That is only allowed if the MCU does not
+ * actually use any of those zero bits; if it does, the data is truncated
+ * or corrupt, and so is any MCU containing a code longer than 16 bits.
+ * In those cases we return FALSE without having changed any permanent
+ * state, and decode_mcu() clears the MCU and hands it to decode_mcu_slow(),
+ * which issues the appropriate warnings.  (The two can read corrupt data
+ * differently: we take FF/FF/00 as a marker, but jpeg_fill_bit_buffer()
+ * takes it as an FF data byte.)
+ */
+
+/* Source bytes needed for the fast path, per block in the MCU.  A block
+ * has at most 64 codes of up to 16 bits, each followed by up to 16
+ * magnitude bits, and byte stuffing can double the number of bytes.
+ */
+#define FAST_BLOCK_BYTES  (DCTSIZE2 * 8)
+
+/* Read one byte into the bit buffer.  On a marker (any 0xFF not followed
+ * by a stuffed zero), supply a zero byte instead and stay put.
+ */
+#define FILL_BYTE_FAST \
+	{ register int c = GETJOCTET(*next_input_byte++);  \
+	  if (c == 0xFF) {  \
+	    if (GETJOCTET(*next_input_byte) == 0)  \
+	      next_input_byte++;  \
+	    else {  \
+	      next_input_byte--;  \
+	      c = 0;  \
+	      zero_bits += 8;  \
+	    }  \
+	  }  \
+	  get_buffer = (get_buffer << 8) | c;  \
+	  bits_left += 8; }
+
+/* Ensure there are at least 17 bits in the bit buffer: enough for any
+ * Huffman code, or for any magnitude field.
+ */
+#define FILL_BIT_BUFFER_FAST \
+	{ if (bits_left <= 16) {  \
+	    FILL_BYTE_FAST FILL_BYTE_FAST FILL_BYTE_FAST  \
+	    FILL_BYTE_FAST FILL_BYTE_FAST FILL_BYTE_FAST } }
+
+/* Decode a Huffman code, whose first HUFF_LOOKAHEAD bits are in 'look'.
+ * The caller must have filled the bit buffer.
+ */
+#define HUFF_DECODE_FAST(result,look,htbl) \
+{ register int nb; \
+  if ((nb = htbl->look_nbits[look]) != 0) { \
+    DROP_BITS(nb); \
+    result = htbl->look_sym[look]; \
+  } else { \
+    register INT32 code; \
+    nb = HUFF_LOOKAHEAD+1; \
+    code = GET_BITS(nb); \
+    while (code > htbl->maxcode[nb]) { \
+      code = (code << 1) | GET_BITS(1); \
+      nb++; \
+    } \
+    if (nb > 16) \
+      return FALSE; \
+    result = htbl->pub->huffval[ (int) (code + htbl->valoffset[nb]) ]; \
+  } \
+}
+
+LOCAL(boolean)
+decode_mcu_fast (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  huff_entropy_ptr entropy = (huff_entropy_ptr) cinfo->entropy;
+  register bit_buf_type get_buffer = entropy->bitstate.get_buffer;
+  register int bits_left = entropy->bitstate.bits_left;
+  register const JOCTET * next_input_byte = cinfo->src->next_input_byte;
+  int zero_bits = 0;		/* # of zero bits supplied for a marker */
+  savable_state state;
+  int blkn;
+
+  ASSIGN_STATE(state, entropy->saved);
+
+  for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
+    JBLOCKROW block = MCU_data[blkn];
+    d_derived_tbl * dctbl = entropy->dc_cur_tbls[blkn];
+    d_derived_tbl * actbl = entropy->ac_cur_tbls[blkn];
+    register int s, k, r, look, entry;
+
+    /* Section F.2.2.1: decode the DC coefficient difference */
+    FILL_BIT_BUFFER_FAST;
+    look = PEEK_BITS(HUFF_LOOKAHEAD);
+    HUFF_DECODE_FAST(s, look, dctbl);
+    if (s) {
+      FILL_BIT_BUFFER_FAST;
+      r = GET_BITS(s);
+      s = HUFF_EXTEND(r, s);
+    }
+
+    if (entropy->dc_needed[blkn]) {
+      int ci = cinfo->MCU_membership[blkn];
+      s += state.last_dc_val[ci];
+      state.last_dc_val[ci] = s;
+      (*block)[0] = (JCOEF) s;
+    }
+
+    if (entropy->ac_needed[blkn]) {
+
+      /* Section F.2.2.2: decode the AC coefficients.  As in
+       * decode_mcu_slow(), the extra entries in jpeg_natural_order[] cope
+       * with k >= DCTSIZE2.
+       */
+      for (k = 1; k < DCTSIZE2; k++) {
+	FILL_BIT_BUFFER_FAST;
+	look = PEEK_BITS(HUFF_LOOKAHEAD);
+	if ((entry = actbl->look_ac[look]) != 0) {
+	  /* Code and magnitude bits together */
+	  DROP_BITS(entry & 15);
+	  k += (entry >> 4) & 15;
+	  (*block)[jpeg_natural_order[k]] =
+	    (JCOEF) ((entry >> 12) - LOOK_AC_BIAS);
+	  continue;
+	}
+
+	HUFF_DECODE_FAST(s, look, actbl);
+	r = s >> 4;
+	s &= 15;
+
+	if (s) {
+	  k += r;
+	  FILL_BIT_BUFFER_FAST;
+	  r = GET_BITS(s);
+	  s = HUFF_EXTEND(r, s);
+	  (*block)[jpeg_natural_order[k]] = (JCOEF) s;
+	} else {
+	  if (r != 15)
+	    break;
+	  k += 15;
+	}
+      }
+      entropy->pub.last_coef[blkn] = k - 1;
+
+    } else {
+
+      /* Section F.2.2.2: skip over the AC coefficients.  Only the run
+       * lengths and code sizes matter; the magnitude bits are dropped
+       * without being read.
+       */
+      for (k = 1; k < DCTSIZE2; k++) {
+	FILL_BIT_BUFFER_FAST;
+	look = PEEK_BITS(HUFF_LOOKAHEAD);
+	if ((entry = actbl->look_ac[look]) != 0) {
+	  DROP_BITS(entry & 15);
+	  k += (entry >> 4) & 15;
+	  continue;
+	}
+
+	HUFF_DECODE_FAST(s, look, actbl);
+	r = s >> 4;
+	s &= 15;
+
+	if (s) {
+	  k += r;
+	  FILL_BIT_BUFFER_FAST;
+	  DROP_BITS(s);
+	} else {
+	  if (r != 15)
+	    break;
+	  k += 15;
+	}
+      }
+      entropy->pub.last_coef[blkn] = 0;
+
+    }
+  }
+
+  /* Discard the zero bits, if we had to supply any, so that the buffer
+   * holds only real data; the marker is then found by the usual means.
+   */
+  if (zero_bits > 0) {
+    if (zero_bits > bits_left)
+      return FALSE;
+    bits_left -= zero_bits;
+    if (bits_left > 0)		/* else zero_bits may be BIT_BUF_SIZE */
+      get_buffer >>= zero_bits;
+  }
+
+  /* Completed MCU, so update state */
+  cinfo->src->bytes_in_buffer -= next_input_byte - cinfo->src->next_input_byte;
+  cinfo->src->next_input_byte = next_input_byte;
+  entropy->bitstate.get_buffer = get_buffer;
+  entropy->bitstate.bits_left = bits_left;
+  ASSIGN_STATE(entropy->saved, state);
+
+  return TRUE;
+}
+
+
 /*
  * Decode and return one MCU's worth of Huffman-compressed coefficients.
  * The coefficients are reordered from zigzag order into natural array order,
  * but are not dequantized.
  *
  * The i'th block of the MCU is stored into the block pointed to by
- * MCU_data[i].  WE ASSUME THIS AREA HAS BEEN ZEROED BY THE CALLER.
+ * MCU_data[i].  WE ASSUME THIS AREA HAS BEEN ZEROED BY THE CALLER,
+ * except for blocks whose AC coefficients are not needed (a component
+ * being output at 1/8 scale): only the DC coefficient of those is stored,
+ * and nothing at all is stored for a component that is not needed.
  * (Wholesale zeroing is usually a little faster than retail...)
  *
  * Returns FALSE if data source requested suspension.  In that case no
@@ -518,8 +861,6 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 {
   huff_entropy_ptr entropy = (huff_entropy_ptr) cinfo->entropy;
   int blkn;
-  BITREAD_STATE_VARS;
-  savable_state state;
 
   /* Process restart marker if needed; may have to suspend */
   if (cinfo->restart_interval) {
@@ -530,94 +871,29 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 
   /* If we've run out of data, just leave the MCU set to zeroes.
    * This way, we return uniform gray for the remainder of the segment.
+   * Blocks that get only a DC value were not zeroed by the caller.
    */
-  if (! entropy->pub.insufficient_data) {
-
-    /* Load up working state */
-    BITREAD_LOAD_STATE(cinfo,entropy->bitstate);
-    ASSIGN_STATE(state, entropy->saved);
-
-    /* Outer loop handles each block in the MCU */
-
+  if (entropy->pub.insufficient_data) {
     for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
-      JBLOCKROW block = MCU_data[blkn];
-      d_derived_tbl * dctbl = entropy->dc_cur_tbls[blkn];
-      d_derived_tbl * actbl = entropy->ac_cur_tbls[blkn];
-      register int s, k, r;
-
-      /* Decode a single block's worth of coefficients */
-
-      /* Section F.2.2.1: decode the DC coefficient difference */
-      HUFF_DECODE(s, br_state, dctbl, return FALSE, label1);
-      if (s) {
-	CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	r = GET_BITS(s);
-	s = HUFF_EXTEND(r, s);
-      }
-
-      if (entropy->dc_needed[blkn]) {
-	/* Convert DC difference to actual value, update last_dc_val */
-	int ci = cinfo->MCU_membership[blkn];
-	s += state.last_dc_val[ci];
-	state.last_dc_val[ci] = s;
-	/* Output the DC coefficient (assumes jpeg_natural_order[0] = 0) */
-	(*block)[0] = (JCOEF) s;
-      }
-
-      if (entropy->ac_needed[blkn]) {
-
-	/* Section F.2.2.2: decode the AC coefficients */
-	/* Since zeroes are skipped, output area must be cleared beforehand */
-	for (k = 1; k < DCTSIZE2; k++) {
-	  HUFF_DECODE(s, br_state, actbl, return FALSE, label2);
-      
-	  r = s >> 4;
-	  s &= 15;
-      
-	  if (s) {
-	    k += r;
-	    CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	    r = GET_BITS(s);
-	    s = HUFF_EXTEND(r, s);
-	    /* Output coefficient in natural (dezigzagged) order.
-	     * Note: the extra entries in jpeg_natural_order[] will save us
-	     * if k >= DCTSIZE2, which could happen if the data is corrupted.
-	     */
-	    (*block)[jpeg_natural_order[k]] = (JCOEF) s;
-	  } else {
-	    if (r != 15)
-	      break;
-	    k += 15;
-	  }
-	}
-
-      } else {
-
-	/* Section F.2.2.2: decode the AC coefficients */
-	/* In this path we just discard the values */
-	for (k = 1; k < DCTSIZE2; k++) {
-	  HUFF_DECODE(s, br_state, actbl, return FALSE, label3);
-      
-	  r = s >> 4;
-	  s &= 15;
-      
-	  if (s) {
-	    k += r;
-	    CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	    DROP_BITS(s);
-	  } else {
-	    if (r != 15)
-	      break;
-	    k += 15;
-	  }
-	}
-
+      if (entropy->dc_needed[blkn] && ! entropy->ac_needed[blkn])
+	(*MCU_data[blkn])[0] = 0;
+      entropy->pub.last_coef[blkn] = 0;
+    }
+  } else {
+    boolean done = FALSE;
+
+    if (cinfo->unread_marker == 0 &&
+	cinfo->src->bytes_in_buffer >=
+	  (size_t) FAST_BLOCK_BYTES * cinfo->blocks_in_MCU) {
+      done = decode_mcu_fast(cinfo, MCU_data);
+      if (! done) {
+	/* Undo anything the fast path stored before it gave up */
+	for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++)
+	  MEMZERO(MCU_data[blkn], SIZEOF(JBLOCK));
       }
     }
-
-    /* Completed MCU, so update state */
-    BITREAD_SAVE_STATE(cinfo,entropy->bitstate);
-    ASSIGN_STATE(entropy->saved, state);
+    if (! done && ! decode_mcu_slow(cinfo, MCU_data))
+      return FALSE;
   }
 
   /* Account for restart interval (no-op if not using restarts) */
@@ -21,7 +21,7 @@
 
 /* Derived data constructed for each Huffman table */
 
-#define HUFF_LOOKAHEAD	8	/* # of bits of lookahead */
+#define HUFF_LOOKAHEAD	10	/* # of bits of lookahead */
 
 typedef struct {
   /* Basic tables: (element [0] of each array is unused) */
@@ -41,8 +41,16 @@ typedef struct {
    * than HUFF_LOOKAHEAD bits long, we can obtain its length and
    * the corresponding symbol directly from these tables.
    */
-  int look_nbits[1<<HUFF_LOOKAHEAD]; /* # bits, or 0 if too long */
+  UINT8 look_nbits[1<<HUFF_LOOKAHEAD]; /* # bits, or 0 if too long */
   UINT8 look_sym[1<<HUFF_LOOKAHEAD]; /* symbol, or unused */
+
+  /* Combined lookahead table for AC coefficients (sequential mode only).
+   * If the next HUFF_LOOKAHEAD bits hold both a complete code for a
+   * nonzero coefficient and all of that coefficient's magnitude bits,
+   * the entry gives the lot at once; see jdhuff.c for the packing.
+   * Otherwise (and always for DC tables) the entry is 0.
+   */
+  int look_ac[1<<HUFF_LOOKAHEAD];
 } d_derived_tbl;
 
 /* Expand a Huffman table definition into the derived format */
@@ -69,14 +77,13 @@ EXTERN(void) jpeg_make_d_derived_tbl
  * necessary.
  */
 
-typedef INT32 bit_buf_type;	/* type of bit-extraction buffer */
-#define BIT_BUF_SIZE  32	/* size of buffer in bits */
+typedef unsigned long long bit_buf_type; /* type of bit-extraction buffer */
+#define BIT_BUF_SIZE  64	/* size of buffer in bits */
 
-/* If long is > 32 bits on your machine, and shifting/masking longs is
- * reasonably fast, making bit_buf_type be long and setting BIT_BUF_SIZE
- * appropriately should be a win.  Unfortunately we can't define the size
- * with something like  #define BIT_BUF_SIZE (sizeof(bit_buf_type)*8)
- * because not all machines measure sizeof in 8-bit bytes.
+/* A 64-bit buffer needs refilling less than half as often as a 32-bit one,
+ * and lets the fast path in jdhuff.c fetch a code and its magnitude bits
+ * between refills.  Every machine we build for shifts 64-bit quantities
+ * cheaply (32-bit ARM needs a couple of instructions per shift).
  */
 
 typedef struct {		/* Bitreading state saved across MCUs */
@@ -47,10 +47,12 @@ use_merged_upsample (j_decompress_ptr cinfo)
   /* Merging is the equivalent of plain box-filter upsampling */
   if (cinfo->do_fancy_upsampling || cinfo->CCIR601_sampling)
     return FALSE;
-  /* jdmerge.c only supports YCC=>RGB color conversion */
-  if (cinfo->jpeg_color_space != JCS_YCbCr || cinfo->num_components != 3 ||
-      cinfo->out_color_space != JCS_RGB ||
-      cinfo->out_color_components != RGB_PIXELSIZE)
+  /* jdmerge.c only supports YCC=>RGB color conversion, or packed pixels */
+  if (cinfo->jpeg_color_space != JCS_YCbCr || cinfo->num_components != 3)
+    return FALSE;
+  if ((cinfo->out_color_space != JCS_RGB ||
+       cinfo->out_color_components != RGB_PIXELSIZE) &&
+      ! PACKED_COLOR_SPACE(cinfo->out_color_space))
     return FALSE;
   /* and it only handles 2h1v or 2h2v sampling ratios */
   if (cinfo->comp_info[0].h_samp_factor != 2 ||
@@ -84,9 +86,10 @@ GLOBAL(void)
 jpeg_calc_output_dimensions (j_decompress_ptr cinfo)
 /* Do computations that are needed before master selection phase */
 {
-#ifdef IDCT_SCALING_SUPPORTED
   int ci;
   jpeg_component_info *compptr;
+#ifdef IDCT_SCALING_SUPPORTED
+  int ssize;
 #endif
 
   /* Prevent application from calling me at wrong times */
@@ -95,47 +98,34 @@ jpeg_calc_output_dimensions (j_decompress_ptr cinfo)
 
 #ifdef IDCT_SCALING_SUPPORTED
 
-  /* Compute actual output image dimensions and DCT scaling choices. */
-  if (cinfo->scale_num * 8 <= cinfo->scale_denom) {
-    /* Provide 1/8 scaling */
-    cinfo->output_width = (JDIMENSION)
-      jdiv_round_up((long) cinfo->image_width, 8L);
-    cinfo->output_height = (JDIMENSION)
-      jdiv_round_up((long) cinfo->image_height, 8L);
-    cinfo->min_DCT_scaled_size = 1;
-  } else if (cinfo->scale_num * 4 <= cinfo->scale_denom) {
-    /* Provide 1/4 scaling */
-    cinfo->output_width = (JDIMENSION)
-      jdiv_round_up((long) cinfo->image_width, 4L);
-    cinfo->output_height = (JDIMENSION)
-      jdiv_round_up((long) cinfo->image_height, 4L);
-    cinfo->min_DCT_scaled_size = 2;
-  } else if (cinfo->scale_num * 2 <= cinfo->scale_denom) {
-    /* Provide 1/2 scaling */
-    cinfo->output_width = (JDIMENSION)
-      jdiv_round_up((long) cinfo->image_width, 2L);
-    cinfo->output_height = (JDIMENSION)
-      jdiv_round_up((long) cinfo->image_height, 2L);
-    cinfo->min_DCT_scaled_size = 4;
-  } else {
-    /* Provide 1/1 scaling */
-    cinfo->output_width = cinfo->image_width;
-    cinfo->output_height = cinfo->image_height;
-    cinfo->min_DCT_scaled_size = DCTSIZE;
+  /* Compute actual output image dimensions and DCT scaling choices.
+   * We provide N/8 scaling for N = 1..16, using the smallest N that
+   * gives at least the requested scale (or 16, if none does).
+   */
+  for (ssize = 1; ssize < 2*DCTSIZE; ssize++) {
+    if (cinfo->scale_num * DCTSIZE <= cinfo->scale_denom * ssize)
+      break;
   }
+  cinfo->output_width = (JDIMENSION)
+    jdiv_round_up((long) cinfo->image_width * (long) ssize, (long) DCTSIZE);
+  cinfo->output_height = (JDIMENSION)
+    jdiv_round_up((long) cinfo->image_height * (long) ssize, (long) DCTSIZE);
+  cinfo->min_DCT_scaled_size = ssize;
+
   /* In selecting the actual DCT scaling for each component, we try to
    * scale up the chroma components via IDCT scaling rather than upsampling.
-   * This saves time if the upsampler gets to use 1:1 scaling.
-   * Note this code assumes that the supported DCT scalings are powers of 2.
+   * This saves time if the upsampler gets to use 1:1 scaling.  We don't
+   * go beyond 8x8, though, as the larger IDCTs cost more than upsampling.
+   * The upsampler needs the remaining ratio to be an integer.
    */
   for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
        ci++, compptr++) {
-    int ssize = cinfo->min_DCT_scaled_size;
-    while (ssize < DCTSIZE &&
-	   (compptr->h_samp_factor * ssize * 2 <=
-	    cinfo->max_h_samp_factor * cinfo->min_DCT_scaled_size) &&
-	   (compptr->v_samp_factor * ssize * 2 <=
-	    cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size)) {
+    ssize = cinfo->min_DCT_scaled_size;
+    while (ssize * 2 <= DCTSIZE &&
+	   (cinfo->max_h_samp_factor * cinfo->min_DCT_scaled_size) %
+	   (compptr->h_samp_factor * ssize * 2) == 0 &&
+	   (cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size) %
+	   (compptr->v_samp_factor * ssize * 2) == 0) {
       ssize = ssize * 2;
     }
     compptr->DCT_scaled_size = ssize;
@@ -168,6 +158,29 @@ jpeg_calc_output_dimensions (j_decompress_ptr cinfo)
 
 #endif /* IDCT_SCALING_SUPPORTED */
 
+  /* If only some iMCU columns are wanted (see jdband.c), the output is
+   * just as wide as they are.  They start on an iMCU boundary, so the
+   * widths work out as if those columns were the whole image.
+   */
+  if (cinfo->band_num_iMCU_cols > 0) {
+    long iMCU_width = (long) cinfo->max_h_samp_factor * DCTSIZE;
+    long left = (long) cinfo->band_first_iMCU_col * iMCU_width;
+    long right = left + (long) cinfo->band_num_iMCU_cols * iMCU_width;
+
+    if (right > (long) cinfo->image_width)
+      right = (long) cinfo->image_width;
+    cinfo->output_width = (JDIMENSION)
+      jdiv_round_up((right - left) * (long) cinfo->min_DCT_scaled_size,
+		    (long) DCTSIZE);
+    for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
+	 ci++, compptr++) {
+      compptr->downsampled_width = (JDIMENSION)
+	jdiv_round_up((right - left) *
+		      (long) (compptr->h_samp_factor * compptr->DCT_scaled_size),
+		      (long) (cinfo->max_h_samp_factor * DCTSIZE));
+    }
+  }
+
   /* Report number of components in selected colorspace. */
   /* Probably this should be in the color conversion module... */
   switch (cinfo->out_color_space) {
@@ -186,6 +199,14 @@ jpeg_calc_output_dimensions (j_decompress_ptr cinfo)
   case JCS_YCCK:
     cinfo->out_color_components = 4;
     break;
+  /* For packed pixels, the "components" are bytes */
+  case JCS_XRGB8888:
+  case JCS_XBGR8888:
+    cinfo->out_color_components = 4;
+    break;
+  case JCS_RGB565:
+    cinfo->out_color_components = 2;
+    break;
   default:			/* else must be same colorspace as in file */
     cinfo->out_color_components = cinfo->num_components;
     break;
@@ -316,7 +337,7 @@ master_selection (j_decompress_ptr cinfo)
     cinfo->enable_2pass_quant = FALSE;
   }
   if (cinfo->quantize_colors) {
-    if (cinfo->raw_data_out)
+    if (cinfo->raw_data_out || PACKED_COLOR_SPACE(cinfo->out_color_space))
       ERREXIT(cinfo, JERR_NOTIMPL);
     /* 2-pass quantizer only works in 3-component color space. */
     if (cinfo->out_color_components != 3) {
@@ -371,8 +392,13 @@ master_selection (j_decompress_ptr cinfo)
   }
   /* Inverse DCT */
   jinit_inverse_dct(cinfo);
-  /* Entropy decoding: either Huffman or arithmetic coding. */
-  if (cinfo->arith_code) {
+  /* Entropy decoding: either Huffman or arithmetic coding.
+   * A band decompressor that borrows another's coefficients has nothing
+   * to decode; see jdband.c.
+   */
+  if (BAND_BORROWS_COEFS(cinfo)) {
+    /* no entropy decoder */
+  } else if (cinfo->arith_code) {
     ERREXIT(cinfo, JERR_ARITH_NOTIMPL);
   } else {
     if (cinfo->progressive_mode) {
@@ -386,7 +412,8 @@ master_selection (j_decompress_ptr cinfo)
   }
 
   /* Initialize principal buffer controllers. */
-  use_c_buffer = cinfo->inputctl->has_multiple_scans || cinfo->buffered_image;
+  use_c_buffer = cinfo->inputctl->has_multiple_scans || cinfo->buffered_image ||
+		 BAND_BORROWS_COEFS(cinfo);
   jinit_d_coef_controller(cinfo, use_c_buffer);
 
   if (! cinfo->raw_data_out)
@@ -396,7 +423,8 @@ master_selection (j_decompress_ptr cinfo)
   (*cinfo->mem->realize_virt_arrays) ((j_common_ptr) cinfo);
 
   /* Initialize input side of decompressor to consume first scan. */
-  (*cinfo->inputctl->start_input_pass) (cinfo);
+  if (! BAND_BORROWS_COEFS(cinfo))
+    (*cinfo->inputctl->start_input_pass) (cinfo);
 
 #ifdef D_MULTISCAN_FILES_SUPPORTED
   /* If jpeg_start_decompress will read the whole file, initialize
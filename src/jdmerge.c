@@ -65,6 +65,12 @@ typedef struct {
 
   JDIMENSION out_row_width;	/* samples per output row */
   JDIMENSION rows_to_go;	/* counts rows remaining in image */
+
+  /* Private state for packed-pixel output; see jdcolor.c */
+  int red_shift, blue_shift;	/* positions of red and blue, 32-bit pixels */
+  boolean dither;		/* TRUE to dither RGB565 */
+  JDIMENSION output_row;	/* image row of the next row produced */
+  JDIMENSION col_origin;	/* image column of output column 0 */
 } my_upsampler;
 
 typedef my_upsampler * my_upsample_ptr;
@@ -131,6 +137,10 @@ start_pass_merged_upsample (j_decompress_ptr cinfo)
   upsample->spare_full = FALSE;
   /* Initialize total-height counter for detecting bottom of image */
   upsample->rows_to_go = cinfo->output_height;
+  /* Where the first output row is in the whole image, for dithering */
+  upsample->output_row = cinfo->dither_origin_row +
+    cinfo->band_first_iMCU_row * (JDIMENSION)
+      (cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size);
 }
 
 
@@ -358,6 +368,151 @@ h2v2_merged_upsample (j_decompress_ptr cinfo,
 }
 
 
+/*
+ * Packed-pixel versions of the two routines above.  Both 32-bit formats and
+ * RGB565 are handled here; the test on the format is the same for every
+ * pixel of the row, so it costs very little.  PUT_PACKED stores one pixel,
+ * from luma y and the chroma terms already worked out, and steps past it.
+ */
+
+#define PUT_PACKED(outptr,y,d) \
+  if (packed32) { \
+    PUT_PIXEL32(outptr, range_limit[(y) + cred], \
+		range_limit[(y) + cgreen], range_limit[(y) + cblue], \
+		rshift, bshift); \
+    outptr += 4; \
+  } else { \
+    PUT_PIXEL565(outptr, range_limit[(y) + cred + (d)], \
+		 range_limit[(y) + cgreen + ((d) >> 1)], \
+		 range_limit[(y) + cblue + (d)]); \
+    outptr += 2; \
+  }
+
+METHODDEF(void)
+h2v1_merged_upsample_packed (j_decompress_ptr cinfo,
+			     JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			     JSAMPARRAY output_buf)
+{
+  my_upsample_ptr upsample = (my_upsample_ptr) cinfo->upsample;
+  register int y, cred, cgreen, cblue;
+  int cb, cr;
+  register JSAMPROW outptr;
+  JSAMPROW inptr0, inptr1, inptr2;
+  JDIMENSION col, x;
+  boolean packed32 = (cinfo->out_color_space != JCS_RGB565);
+  int rshift = upsample->red_shift;
+  int bshift = upsample->blue_shift;
+  unsigned int drow;
+  /* copy these pointers into registers if possible */
+  register JSAMPLE * range_limit = cinfo->sample_range_limit;
+  int * Crrtab = upsample->Cr_r_tab;
+  int * Cbbtab = upsample->Cb_b_tab;
+  INT32 * Crgtab = upsample->Cr_g_tab;
+  INT32 * Cbgtab = upsample->Cb_g_tab;
+  SHIFT_TEMPS
+
+  inptr0 = input_buf[0][in_row_group_ctr];
+  inptr1 = input_buf[1][in_row_group_ctr];
+  inptr2 = input_buf[2][in_row_group_ctr];
+  outptr = output_buf[0];
+  drow = upsample->dither ? DITHER_565_ROW(upsample->output_row) : 0;
+  upsample->output_row++;
+  x = upsample->col_origin;
+  /* Loop for each pair of output pixels */
+  for (col = cinfo->output_width >> 1; col > 0; col--) {
+    /* Do the chroma part of the calculation */
+    cb = GETJSAMPLE(*inptr1++);
+    cr = GETJSAMPLE(*inptr2++);
+    cred = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue = Cbbtab[cb];
+    /* Fetch 2 Y values and emit 2 pixels */
+    y  = GETJSAMPLE(*inptr0++);
+    PUT_PACKED(outptr, y, DITHER_565(drow, x));
+    y  = GETJSAMPLE(*inptr0++);
+    PUT_PACKED(outptr, y, DITHER_565(drow, x + 1));
+    x += 2;
+  }
+  /* If image width is odd, do the last output column separately */
+  if (cinfo->output_width & 1) {
+    cb = GETJSAMPLE(*inptr1);
+    cr = GETJSAMPLE(*inptr2);
+    cred = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue = Cbbtab[cb];
+    y  = GETJSAMPLE(*inptr0);
+    PUT_PACKED(outptr, y, DITHER_565(drow, x));
+  }
+}
+
+
+METHODDEF(void)
+h2v2_merged_upsample_packed (j_decompress_ptr cinfo,
+			     JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			     JSAMPARRAY output_buf)
+{
+  my_upsample_ptr upsample = (my_upsample_ptr) cinfo->upsample;
+  register int y, cred, cgreen, cblue;
+  int cb, cr;
+  register JSAMPROW outptr0, outptr1;
+  JSAMPROW inptr00, inptr01, inptr1, inptr2;
+  JDIMENSION col, x;
+  boolean packed32 = (cinfo->out_color_space != JCS_RGB565);
+  int rshift = upsample->red_shift;
+  int bshift = upsample->blue_shift;
+  unsigned int drow0, drow1;
+  /* copy these pointers into registers if possible */
+  register JSAMPLE * range_limit = cinfo->sample_range_limit;
+  int * Crrtab = upsample->Cr_r_tab;
+  int * Cbbtab = upsample->Cb_b_tab;
+  INT32 * Crgtab = upsample->Cr_g_tab;
+  INT32 * Cbgtab = upsample->Cb_g_tab;
+  SHIFT_TEMPS
+
+  inptr00 = input_buf[0][in_row_group_ctr*2];
+  inptr01 = input_buf[0][in_row_group_ctr*2 + 1];
+  inptr1 = input_buf[1][in_row_group_ctr];
+  inptr2 = input_buf[2][in_row_group_ctr];
+  outptr0 = output_buf[0];
+  outptr1 = output_buf[1];
+  drow0 = upsample->dither ? DITHER_565_ROW(upsample->output_row) : 0;
+  drow1 = upsample->dither ? DITHER_565_ROW(upsample->output_row + 1) : 0;
+  upsample->output_row += 2;
+  x = upsample->col_origin;
+  /* Loop for each group of output pixels */
+  for (col = cinfo->output_width >> 1; col > 0; col--) {
+    /* Do the chroma part of the calculation */
+    cb = GETJSAMPLE(*inptr1++);
+    cr = GETJSAMPLE(*inptr2++);
+    cred = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue = Cbbtab[cb];
+    /* Fetch 4 Y values and emit 4 pixels */
+    y  = GETJSAMPLE(*inptr00++);
+    PUT_PACKED(outptr0, y, DITHER_565(drow0, x));
+    y  = GETJSAMPLE(*inptr00++);
+    PUT_PACKED(outptr0, y, DITHER_565(drow0, x + 1));
+    y  = GETJSAMPLE(*inptr01++);
+    PUT_PACKED(outptr1, y, DITHER_565(drow1, x));
+    y  = GETJSAMPLE(*inptr01++);
+    PUT_PACKED(outptr1, y, DITHER_565(drow1, x + 1));
+    x += 2;
+  }
+  /* If image width is odd, do the last output column separately */
+  if (cinfo->output_width & 1) {
+    cb = GETJSAMPLE(*inptr1);
+    cr = GETJSAMPLE(*inptr2);
+    cred = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue = Cbbtab[cb];
+    y  = GETJSAMPLE(*inptr00);
+    PUT_PACKED(outptr0, y, DITHER_565(drow0, x));
+    y  = GETJSAMPLE(*inptr01);
+    PUT_PACKED(outptr1, y, DITHER_565(drow1, x));
+  }
+}
+
+
 /*
  * Module initialization routine for merged upsampling/color conversion.
  *
@@ -379,17 +534,28 @@ jinit_merged_upsampler (j_decompress_ptr cinfo)
   upsample->pub.need_context_rows = FALSE;
 
   upsample->out_row_width = cinfo->output_width * cinfo->out_color_components;
+  upsample->red_shift = (cinfo->out_color_space == JCS_XBGR8888) ? 0 : 16;
+  upsample->blue_shift = 16 - upsample->red_shift;
+  upsample->dither = (cinfo->dither_mode != JDITHER_NONE);
+  upsample->col_origin = cinfo->band_first_iMCU_col * (JDIMENSION)
+    (cinfo->max_h_samp_factor * cinfo->min_DCT_scaled_size);
 
   if (cinfo->max_v_samp_factor == 2) {
     upsample->pub.upsample = merged_2v_upsample;
-    upsample->upmethod = h2v2_merged_upsample;
+    if (PACKED_COLOR_SPACE(cinfo->out_color_space))
+      upsample->upmethod = h2v2_merged_upsample_packed;
+    else
+      upsample->upmethod = h2v2_merged_upsample;
     /* Allocate a spare row buffer */
     upsample->spare_row = (JSAMPROW)
       (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
 		(size_t) (upsample->out_row_width * SIZEOF(JSAMPLE)));
   } else {
     upsample->pub.upsample = merged_1v_upsample;
-    upsample->upmethod = h2v1_merged_upsample;
+    if (PACKED_COLOR_SPACE(cinfo->out_color_space))
+      upsample->upmethod = h2v1_merged_upsample_packed;
+    else
+      upsample->upmethod = h2v1_merged_upsample;
     /* No spare row needed */
     upsample->spare_row = NULL;
   }
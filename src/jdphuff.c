@@ -649,6 +649,9 @@ jinit_phuff_decoder (j_decompress_ptr cinfo)
 				SIZEOF(phuff_entropy_decoder));
   cinfo->entropy = (struct jpeg_entropy_decoder *) entropy;
   entropy->pub.start_pass = start_pass_phuff_decoder;
+  /* We don't track where the last coefficient is */
+  for (i = 0; i < D_MAX_BLOCKS_IN_MCU; i++)
+    entropy->pub.last_coef[i] = DCTSIZE2-1;
 
   /* Mark derived tables unallocated */
   for (i = 0; i < NUM_HUFF_TBLS; i++) {
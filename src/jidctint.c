@@ -386,4 +386,288 @@ jpeg_idct_islow (j_decompress_ptr cinfo, jpeg_component_info * compptr,
   }
 }
 
+/*
+ * Cheaper versions of jpeg_idct_islow for sparse blocks.
+ *
+ * Most blocks in a photograph have only a few nonzero coefficients, and
+ * the entropy decoder can tell where the last of them is.  If they all lie
+ * in the top-left 4x4 or 2x2 corner of the block, or there is just the DC
+ * term, the following routines do the same calculation as jpeg_idct_islow
+ * with the known-zero inputs left out.  Since the arithmetic is integer,
+ * dropping terms that are zero changes nothing, and the output is
+ * identical to jpeg_idct_islow's.  (jpeg_idct_islow's all-zero-AC
+ * shortcuts also give exactly what its full calculation would.)
+ */
+
+GLOBAL(void)
+jpeg_idct_islow_dc (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		    JCOEFPTR coef_block,
+		    JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  JSAMPROW outptr;
+  int dcval, ctr;
+  JSAMPLE outval;
+  SHIFT_TEMPS
+
+  /* Only the DC term is nonzero, so every column and then every row
+   * takes jpeg_idct_islow's "AC terms all zero" path.
+   */
+  dcval = DEQUANTIZE(coef_block[0], quantptr[0]) << PASS1_BITS;
+  outval = range_limit[(int) DESCALE((INT32) dcval, PASS1_BITS+3)
+		       & RANGE_MASK];
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+    outptr[0] = outval;
+    outptr[1] = outval;
+    outptr[2] = outval;
+    outptr[3] = outval;
+    outptr[4] = outval;
+    outptr[5] = outval;
+    outptr[6] = outval;
+    outptr[7] = outval;
+  }
+}
+
+
+GLOBAL(void)
+jpeg_idct_islow_2c (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		    JCOEFPTR coef_block,
+		    JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  INT32 tmp0, tmp1, tmp2, tmp3;
+  INT32 z1, z3, z4, z5;
+  JCOEFPTR inptr;
+  ISLOW_MULT_TYPE * quantptr;
+  int * wsptr;
+  JSAMPROW outptr;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  int ctr;
+  int workspace[DCTSIZE*2];	/* only columns 0..1 can be nonzero */
+  SHIFT_TEMPS
+
+  /* Pass 1: process columns 0..1 from input, store into work array.
+   * Inputs 2..7 of each column are zero.
+   */
+
+  inptr = coef_block;
+  quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  wsptr = workspace;
+  for (ctr = 0; ctr < 2; ctr++) {
+    /* Even part: only y0 is present, so tmp10 = .. = tmp13 = z3 */
+    z3 = ((INT32) DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]))
+	 << CONST_BITS;
+
+    /* Odd part: only y1 is present */
+    tmp3 = DEQUANTIZE(inptr[DCTSIZE*1], quantptr[DCTSIZE*1]);
+    z5 = MULTIPLY(tmp3, FIX_1_175875602);
+    z1 = MULTIPLY(tmp3, - FIX_0_899976223);
+    z4 = MULTIPLY(tmp3, - FIX_0_390180644) + z5;
+    tmp3 = MULTIPLY(tmp3, FIX_1_501321110) + z1 + z4;
+    tmp2 = z5;
+    tmp1 = z4;
+    tmp0 = z1 + z5;
+
+    /* Final output stage */
+    wsptr[2*0] = (int) DESCALE(z3 + tmp3, CONST_BITS-PASS1_BITS);
+    wsptr[2*7] = (int) DESCALE(z3 - tmp3, CONST_BITS-PASS1_BITS);
+    wsptr[2*1] = (int) DESCALE(z3 + tmp2, CONST_BITS-PASS1_BITS);
+    wsptr[2*6] = (int) DESCALE(z3 - tmp2, CONST_BITS-PASS1_BITS);
+    wsptr[2*2] = (int) DESCALE(z3 + tmp1, CONST_BITS-PASS1_BITS);
+    wsptr[2*5] = (int) DESCALE(z3 - tmp1, CONST_BITS-PASS1_BITS);
+    wsptr[2*3] = (int) DESCALE(z3 + tmp0, CONST_BITS-PASS1_BITS);
+    wsptr[2*4] = (int) DESCALE(z3 - tmp0, CONST_BITS-PASS1_BITS);
+
+    inptr++;			/* advance pointers to next column */
+    quantptr++;
+    wsptr++;
+  }
+
+  /* Pass 2: process rows from work array, store into output array.
+   * Inputs 2..7 of each row are zero.
+   */
+
+  wsptr = workspace;
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+
+    z3 = ((INT32) wsptr[0]) << CONST_BITS;
+
+    tmp3 = (INT32) wsptr[1];
+    z5 = MULTIPLY(tmp3, FIX_1_175875602);
+    z1 = MULTIPLY(tmp3, - FIX_0_899976223);
+    z4 = MULTIPLY(tmp3, - FIX_0_390180644) + z5;
+    tmp3 = MULTIPLY(tmp3, FIX_1_501321110) + z1 + z4;
+    tmp2 = z5;
+    tmp1 = z4;
+    tmp0 = z1 + z5;
+
+    outptr[0] = range_limit[(int) DESCALE(z3 + tmp3,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[7] = range_limit[(int) DESCALE(z3 - tmp3,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[1] = range_limit[(int) DESCALE(z3 + tmp2,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[6] = range_limit[(int) DESCALE(z3 - tmp2,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[2] = range_limit[(int) DESCALE(z3 + tmp1,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[5] = range_limit[(int) DESCALE(z3 - tmp1,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[3] = range_limit[(int) DESCALE(z3 + tmp0,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[4] = range_limit[(int) DESCALE(z3 - tmp0,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+
+    wsptr += 2;			/* advance pointer to next row */
+  }
+}
+
+
+GLOBAL(void)
+jpeg_idct_islow_4c (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		    JCOEFPTR coef_block,
+		    JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  INT32 tmp0, tmp1, tmp2, tmp3;
+  INT32 tmp10, tmp11, tmp12, tmp13;
+  INT32 z1, z2, z3, z4, z5;
+  JCOEFPTR inptr;
+  ISLOW_MULT_TYPE * quantptr;
+  int * wsptr;
+  JSAMPROW outptr;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  int ctr;
+  int workspace[DCTSIZE*4];	/* only columns 0..3 can be nonzero */
+  SHIFT_TEMPS
+
+  /* Pass 1: process columns 0..3 from input, store into work array.
+   * Inputs 4..7 of each column are zero.
+   */
+
+  inptr = coef_block;
+  quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  wsptr = workspace;
+  for (ctr = 0; ctr < 4; ctr++) {
+    /* Even part: y4 and y6 are zero */
+    z2 = DEQUANTIZE(inptr[DCTSIZE*2], quantptr[DCTSIZE*2]);
+
+    z1 = MULTIPLY(z2, FIX_0_541196100);
+    tmp2 = z1;
+    tmp3 = z1 + MULTIPLY(z2, FIX_0_765366865);
+
+    tmp0 = ((INT32) DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]))
+	   << CONST_BITS;
+
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp0 + tmp2;
+    tmp12 = tmp0 - tmp2;
+
+    /* Odd part: y5 and y7 are zero */
+    tmp2 = DEQUANTIZE(inptr[DCTSIZE*3], quantptr[DCTSIZE*3]);
+    tmp3 = DEQUANTIZE(inptr[DCTSIZE*1], quantptr[DCTSIZE*1]);
+
+    z5 = MULTIPLY(tmp2 + tmp3, FIX_1_175875602);
+    z1 = MULTIPLY(tmp3, - FIX_0_899976223);
+    z2 = MULTIPLY(tmp2, - FIX_2_562915447);
+    z3 = MULTIPLY(tmp2, - FIX_1_961570560) + z5;
+    z4 = MULTIPLY(tmp3, - FIX_0_390180644) + z5;
+
+    tmp0 = z1 + z3;
+    tmp1 = z2 + z4;
+    tmp2 = MULTIPLY(tmp2, FIX_3_072711026) + z2 + z3;
+    tmp3 = MULTIPLY(tmp3, FIX_1_501321110) + z1 + z4;
+
+    wsptr[4*0] = (int) DESCALE(tmp10 + tmp3, CONST_BITS-PASS1_BITS);
+    wsptr[4*7] = (int) DESCALE(tmp10 - tmp3, CONST_BITS-PASS1_BITS);
+    wsptr[4*1] = (int) DESCALE(tmp11 + tmp2, CONST_BITS-PASS1_BITS);
+    wsptr[4*6] = (int) DESCALE(tmp11 - tmp2, CONST_BITS-PASS1_BITS);
+    wsptr[4*2] = (int) DESCALE(tmp12 + tmp1, CONST_BITS-PASS1_BITS);
+    wsptr[4*5] = (int) DESCALE(tmp12 - tmp1, CONST_BITS-PASS1_BITS);
+    wsptr[4*3] = (int) DESCALE(tmp13 + tmp0, CONST_BITS-PASS1_BITS);
+    wsptr[4*4] = (int) DESCALE(tmp13 - tmp0, CONST_BITS-PASS1_BITS);
+
+    inptr++;			/* advance pointers to next column */
+    quantptr++;
+    wsptr++;
+  }
+
+  /* Pass 2: process rows from work array, store into output array.
+   * Inputs 4..7 of each row are zero.
+   */
+
+  wsptr = workspace;
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+
+    /* Even part */
+    z2 = (INT32) wsptr[2];
+
+    z1 = MULTIPLY(z2, FIX_0_541196100);
+    tmp2 = z1;
+    tmp3 = z1 + MULTIPLY(z2, FIX_0_765366865);
+
+    tmp0 = ((INT32) wsptr[0]) << CONST_BITS;
+
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp0 + tmp2;
+    tmp12 = tmp0 - tmp2;
+
+    /* Odd part */
+    tmp2 = (INT32) wsptr[3];
+    tmp3 = (INT32) wsptr[1];
+
+    z5 = MULTIPLY(tmp2 + tmp3, FIX_1_175875602);
+    z1 = MULTIPLY(tmp3, - FIX_0_899976223);
+    z2 = MULTIPLY(tmp2, - FIX_2_562915447);
+    z3 = MULTIPLY(tmp2, - FIX_1_961570560) + z5;
+    z4 = MULTIPLY(tmp3, - FIX_0_390180644) + z5;
+
+    tmp0 = z1 + z3;
+    tmp1 = z2 + z4;
+    tmp2 = MULTIPLY(tmp2, FIX_3_072711026) + z2 + z3;
+    tmp3 = MULTIPLY(tmp3, FIX_1_501321110) + z1 + z4;
+
+    outptr[0] = range_limit[(int) DESCALE(tmp10 + tmp3,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[7] = range_limit[(int) DESCALE(tmp10 - tmp3,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[1] = range_limit[(int) DESCALE(tmp11 + tmp2,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[6] = range_limit[(int) DESCALE(tmp11 - tmp2,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[2] = range_limit[(int) DESCALE(tmp12 + tmp1,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[5] = range_limit[(int) DESCALE(tmp12 - tmp1,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[3] = range_limit[(int) DESCALE(tmp13 + tmp0,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[4] = range_limit[(int) DESCALE(tmp13 - tmp0,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+
+    wsptr += 4;			/* advance pointer to next row */
+  }
+}
+
+
 #endif /* DCT_ISLOW_SUPPORTED */
@@ -0,0 +1,392 @@
+/*
+ * jidctscl.c
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains inverse-DCT routines that produce NxN output from an
+ * 8x8 DCT block, for the sizes that jidctint.c and jidctred.c do not cover:
+ * N = 3, 5, 6, 7 (output scaled by N/8) and N = 9..16 (output enlarged).
+ *
+ * As in later IJG releases, an NxN output block for N < 8 is the N-point
+ * IDCT of the top-left NxN coefficients; the higher frequencies cannot be
+ * represented at the smaller size, and are dropped.  For N > 8, it is the
+ * N-point IDCT of all 64 coefficients, with the missing higher frequencies
+ * taken as zero.  Either way, output sample x of a row is
+ *
+ *	sum over u of 1/2 * C(u) * F(u) * cos((2x+1)*u*pi/2N)
+ *
+ * with C(0) = 1/sqrt(2) and C(u) = 1 otherwise, which keeps the DC level
+ * and the amplitude of each frequency the same as at 8x8.
+ *
+ * The sums are done directly, as jidctint.c does its multiplies, in
+ * fixed point with the same CONST_BITS and PASS1_BITS; only the symmetry
+ * cos((2(N-1-x)+1)*u*pi/2N) = (-1)^u * cos((2x+1)*u*pi/2N) is used, to
+ * produce two outputs from each pair of even and odd sums.  That is slower
+ * than a hand-factored IDCT, so each size also has variants, in the manner
+ * of jpeg_idct_islow_dc() and friends in jidctint.c, for blocks whose
+ * nonzero coefficients all lie in the top-left 1x1, 2x2 or 4x4 corner;
+ * the coefficient controller picks one from the entropy decoder's
+ * last_coef[].  Most blocks of a photo fall in one of those classes.
+ *
+ * jdmaster.c never asks for a chroma IDCT larger than 8x8 to save
+ * upsampling, so the 9..16 sizes only do the work of an enlarged image.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+
+#ifdef IDCT_SCALING_SUPPORTED
+
+
+/*
+ * This module is specialized to the case DCTSIZE = 8.
+ */
+
+#if DCTSIZE != 8
+  Sorry, this code only copes with 8x8 DCTs. /* deliberate syntax err */
+#endif
+
+
+/* Scaling is the same as in jidctint.c. */
+
+#if BITS_IN_JSAMPLE == 8
+#define CONST_BITS  13
+#define PASS1_BITS  2
+#else
+#define CONST_BITS  13
+#define PASS1_BITS  1		/* lose a little precision to avoid overflow */
+#endif
+
+#if CONST_BITS != 13
+  Sorry, the tables below are for CONST_BITS = 13. /* deliberate syntax err */
+#endif
+
+
+/* Multiply an INT32 variable by an INT32 constant to yield an INT32 result;
+ * see jidctint.c.
+ */
+
+#if BITS_IN_JSAMPLE == 8
+#define MULTIPLY(var,const)  MULTIPLY16C16(var,const)
+#else
+#define MULTIPLY(var,const)  ((var) * (const))
+#endif
+
+
+/* Dequantize a coefficient by multiplying it by the multiplier-table
+ * entry; produce an int result.
+ */
+
+#define DEQUANTIZE(coef,quantval)  (((ISLOW_MULT_TYPE) (coef)) * (quantval))
+
+
+/*
+ * Cosine tables.  For output size N, entry [x][u] is
+ * FIX(1/2 * C(u) * cos((2x+1)*u*pi/2N)), for the first (N+1)/2 outputs x
+ * and the min(N,8) inputs u that are used.
+ */
+
+static const INT32 idct_cos_3[2*3] = {
+  2896, 3547, 2048,
+  2896, 0, -4096
+};
+
+static const INT32 idct_cos_5[3*5] = {
+  2896, 3896, 3314, 2408, 1266,
+  2896, 2408, -1266, -3896, -3314,
+  2896, 0, -4096, 0, 4096
+};
+
+static const INT32 idct_cos_6[3*6] = {
+  2896, 3956, 3547, 2896, 2048, 1060,
+  2896, 2896, 0, -2896, -4096, -2896,
+  2896, 1060, -3547, -2896, 2048, 3956
+};
+
+static const INT32 idct_cos_7[4*7] = {
+  2896, 3993, 3690, 3202, 2554, 1777, 911,
+  2896, 3202, 911, -1777, -3690, -3993, -2554,
+  2896, 1777, -2554, -3993, -911, 3202, 3690,
+  2896, 0, -4096, 0, 4096, 0, -4096
+};
+
+static const INT32 idct_cos_9[5*8] = {
+  2896, 4034, 3849, 3547, 3138, 2633, 2048, 1401,
+  2896, 3547, 2048, 0, -2048, -3547, -4096, -3547,
+  2896, 2633, -711, -3547, -3849, -1401, 2048, 4034,
+  2896, 1401, -3138, -3547, 711, 4034, 2048, -2633,
+  2896, 0, -4096, 0, 4096, 0, -4096, 0
+};
+
+static const INT32 idct_cos_10[5*8] = {
+  2896, 4046, 3896, 3650, 3314, 2896, 2408, 1860,
+  2896, 3650, 2408, 641, -1266, -2896, -3896, -4046,
+  2896, 2896, 0, -2896, -4096, -2896, 0, 2896,
+  2896, 1860, -2408, -4046, -1266, 2896, 3896, 641,
+  2896, 641, -3896, -1860, 3314, 2896, -2408, -3650
+};
+
+static const INT32 idct_cos_11[6*8] = {
+  2896, 4054, 3930, 3726, 3446, 3096, 2682, 2214,
+  2896, 3726, 2682, 1154, -583, -2214, -3446, -4054,
+  2896, 3096, 583, -2214, -3930, -3726, -1702, 1154,
+  2896, 2214, -1702, -4054, -2682, 1154, 3930, 3096,
+  2896, 1154, -3446, -3096, 1702, 4054, 583, -3726,
+  2896, 0, -4096, 0, 4096, 0, -4096, 0
+};
+
+static const INT32 idct_cos_12[6*8] = {
+  2896, 4061, 3956, 3784, 3547, 3250, 2896, 2493,
+  2896, 3784, 2896, 1567, 0, -1567, -2896, -3784,
+  2896, 3250, 1060, -1567, -3547, -4061, -2896, -535,
+  2896, 2493, -1060, -3784, -3547, -535, 2896, 4061,
+  2896, 1567, -2896, -3784, 0, 3784, 2896, -1567,
+  2896, 535, -3956, -1567, 3547, 2493, -2896, -3250
+};
+
+static const INT32 idct_cos_13[7*8] = {
+  2896, 4066, 3977, 3830, 3627, 3371, 3066, 2716,
+  2896, 3830, 3066, 1904, 494, -980, -2327, -3371,
+  2896, 3371, 1452, -980, -3066, -4066, -3627, -1904,
+  2896, 2716, -494, -3371, -3977, -1904, 1452, 3830,
+  2896, 1904, -2327, -4066, -1452, 2716, 3977, 980,
+  2896, 980, -3627, -2716, 2327, 3830, -494, -4066,
+  2896, 0, -4096, 0, 4096, 0, -4096, 0
+};
+
+static const INT32 idct_cos_14[7*8] = {
+  2896, 4070, 3993, 3866, 3690, 3468, 3202, 2896,
+  2896, 3866, 3202, 2179, 911, -459, -1777, -2896,
+  2896, 3468, 1777, -459, -2554, -3866, -3993, -2896,
+  2896, 2896, 0, -2896, -4096, -2896, 0, 2896,
+  2896, 2179, -1777, -4070, -2554, 1353, 3993, 2896,
+  2896, 1353, -3202, -3468, 911, 4070, 1777, -2896,
+  2896, 459, -3993, -1353, 3690, 2179, -3202, -2896
+};
+
+static const INT32 idct_cos_15[8*8] = {
+  2896, 4074, 4006, 3896, 3742, 3547, 3314, 3044,
+  2896, 3896, 3314, 2408, 1266, 0, -1266, -2408,
+  2896, 3547, 2048, 0, -2048, -3547, -4096, -3547,
+  2896, 3044, 428, -2408, -4006, -3547, -1266, 1666,
+  2896, 2408, -1266, -3896, -3314, 0, 3314, 3896,
+  2896, 1666, -2741, -3896, -428, 3547, 3314, -852,
+  2896, 852, -3742, -2408, 2741, 3547, -1266, -4074,
+  2896, 0, -4096, 0, 4096, 0, -4096, 0
+};
+
+static const INT32 idct_cos_16[8*8] = {
+  2896, 4076, 4017, 3920, 3784, 3612, 3406, 3166,
+  2896, 3920, 3406, 2598, 1567, 401, -799, -1931,
+  2896, 3612, 2276, 401, -1567, -3166, -4017, -3920,
+  2896, 3166, 799, -1931, -3784, -3920, -2276, 401,
+  2896, 2598, -799, -3612, -3784, -1189, 2276, 4076,
+  2896, 1931, -2276, -4076, -1567, 2598, 4017, 1189,
+  2896, 1189, -3406, -3166, 1567, 4076, 799, -3612,
+  2896, 401, -4017, -1189, 3784, 1931, -3406, -2598
+};
+
+
+/*
+ * Perform dequantization and an NxN inverse DCT on one block of
+ * coefficients, using the cosine table for N.  Only the top-left KxK
+ * coefficients are used: the caller knows that the others are zero or,
+ * for N < 8, not wanted.
+ */
+
+INLINE
+LOCAL(void)
+idct_scaled (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	     JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col,
+	     int N, int K, const INT32 * cos_table)
+{
+  int T = (N < DCTSIZE) ? N : DCTSIZE; /* length of a cos_table row */
+  int H = (N + 1) / 2;		/* # of even/odd sum pairs */
+  INT32 in[DCTSIZE];
+  INT32 even, odd;
+  const INT32 * cosptr;
+  JCOEFPTR inptr;
+  ISLOW_MULT_TYPE * quantptr;
+  int * wsptr;
+  JSAMPROW outptr;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  int ctr, x, u;
+  int workspace[DCTSIZE*16];	/* buffers data between passes */
+  SHIFT_TEMPS
+
+  /* Pass 1: process K columns from input, store into work array.
+   * The work array has N rows of K entries.
+   */
+
+  inptr = coef_block;
+  quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  wsptr = workspace;
+  for (ctr = 0; ctr < K; ctr++) {
+    for (u = 0; u < K; u++)
+      in[u] = DEQUANTIZE(inptr[DCTSIZE*u], quantptr[DCTSIZE*u]);
+
+    cosptr = cos_table;
+    for (x = 0; x < H; x++) {
+      even = MULTIPLY(in[0], cosptr[0]);
+      odd = 0;
+      for (u = 1; u < K; u += 2) {
+	odd += MULTIPLY(in[u], cosptr[u]);
+	if (u + 1 < K)
+	  even += MULTIPLY(in[u+1], cosptr[u+1]);
+      }
+      wsptr[K*x] = (int) DESCALE(even + odd, CONST_BITS-PASS1_BITS);
+      wsptr[K*(N-1-x)] = (int) DESCALE(even - odd, CONST_BITS-PASS1_BITS);
+      cosptr += T;
+    }
+
+    inptr++;			/* advance pointers to next column */
+    quantptr++;
+    wsptr++;
+  }
+
+  /* Pass 2: process N rows from work array, store into output array. */
+
+  wsptr = workspace;
+  for (ctr = 0; ctr < N; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+
+    cosptr = cos_table;
+    for (x = 0; x < H; x++) {
+      even = MULTIPLY((INT32) wsptr[0], cosptr[0]);
+      odd = 0;
+      for (u = 1; u < K; u += 2) {
+	odd += MULTIPLY((INT32) wsptr[u], cosptr[u]);
+	if (u + 1 < K)
+	  even += MULTIPLY((INT32) wsptr[u+1], cosptr[u+1]);
+      }
+      outptr[x] = range_limit[(int) DESCALE(even + odd,
+					    CONST_BITS+PASS1_BITS)
+			      & RANGE_MASK];
+      outptr[N-1-x] = range_limit[(int) DESCALE(even - odd,
+						CONST_BITS+PASS1_BITS)
+				  & RANGE_MASK];
+      cosptr += T;
+    }
+
+    wsptr += K;			/* advance pointer to next row */
+  }
+}
+
+
+/*
+ * The routines for each size N: one for any block, and cheaper ones for
+ * blocks whose nonzero coefficients all lie in the DC term, the top-left
+ * 2x2 corner or the top-left 4x4 corner (see IDCT_SPARSE in jpegint.h).
+ * Leaving out terms that are known to be zero does not change the result.
+ * Each routine gets its own copy of idct_scaled(), with N and K known at
+ * compile time.
+ */
+
+#define SCALED_IDCT(name,N,K) \
+METHODDEF(void) \
+name (j_decompress_ptr cinfo, jpeg_component_info * compptr, \
+      JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col) \
+{ \
+  idct_scaled(cinfo, compptr, coef_block, output_buf, output_col, \
+	      N, K, idct_cos_##N); \
+}
+
+SCALED_IDCT(idct_3x3_dc, 3, 1)
+SCALED_IDCT(idct_3x3_2c, 3, 2)
+SCALED_IDCT(idct_3x3_4c, 3, 3)
+SCALED_IDCT(idct_3x3, 3, 3)
+SCALED_IDCT(idct_5x5_dc, 5, 1)
+SCALED_IDCT(idct_5x5_2c, 5, 2)
+SCALED_IDCT(idct_5x5_4c, 5, 4)
+SCALED_IDCT(idct_5x5, 5, 5)
+SCALED_IDCT(idct_6x6_dc, 6, 1)
+SCALED_IDCT(idct_6x6_2c, 6, 2)
+SCALED_IDCT(idct_6x6_4c, 6, 4)
+SCALED_IDCT(idct_6x6, 6, 6)
+SCALED_IDCT(idct_7x7_dc, 7, 1)
+SCALED_IDCT(idct_7x7_2c, 7, 2)
+SCALED_IDCT(idct_7x7_4c, 7, 4)
+SCALED_IDCT(idct_7x7, 7, 7)
+SCALED_IDCT(idct_9x9_dc, 9, 1)
+SCALED_IDCT(idct_9x9_2c, 9, 2)
+SCALED_IDCT(idct_9x9_4c, 9, 4)
+SCALED_IDCT(idct_9x9, 9, 8)
+SCALED_IDCT(idct_10x10_dc, 10, 1)
+SCALED_IDCT(idct_10x10_2c, 10, 2)
+SCALED_IDCT(idct_10x10_4c, 10, 4)
+SCALED_IDCT(idct_10x10, 10, 8)
+SCALED_IDCT(idct_11x11_dc, 11, 1)
+SCALED_IDCT(idct_11x11_2c, 11, 2)
+SCALED_IDCT(idct_11x11_4c, 11, 4)
+SCALED_IDCT(idct_11x11, 11, 8)
+SCALED_IDCT(idct_12x12_dc, 12, 1)
+SCALED_IDCT(idct_12x12_2c, 12, 2)
+SCALED_IDCT(idct_12x12_4c, 12, 4)
+SCALED_IDCT(idct_12x12, 12, 8)
+SCALED_IDCT(idct_13x13_dc, 13, 1)
+SCALED_IDCT(idct_13x13_2c, 13, 2)
+SCALED_IDCT(idct_13x13_4c, 13, 4)
+SCALED_IDCT(idct_13x13, 13, 8)
+SCALED_IDCT(idct_14x14_dc, 14, 1)
+SCALED_IDCT(idct_14x14_2c, 14, 2)
+SCALED_IDCT(idct_14x14_4c, 14, 4)
+SCALED_IDCT(idct_14x14, 14, 8)
+SCALED_IDCT(idct_15x15_dc, 15, 1)
+SCALED_IDCT(idct_15x15_2c, 15, 2)
+SCALED_IDCT(idct_15x15_4c, 15, 4)
+SCALED_IDCT(idct_15x15, 15, 8)
+SCALED_IDCT(idct_16x16_dc, 16, 1)
+SCALED_IDCT(idct_16x16_2c, 16, 2)
+SCALED_IDCT(idct_16x16_4c, 16, 4)
+SCALED_IDCT(idct_16x16, 16, 8)
+
+#define SCALED_METHODS(N) \
+  { idct_##N##x##N##_dc, idct_##N##x##N##_2c, idct_##N##x##N##_4c, \
+    idct_##N##x##N }
+
+static const inverse_DCT_method_ptr scaled_methods[][4] = {
+  SCALED_METHODS(3),
+  SCALED_METHODS(5),
+  SCALED_METHODS(6),
+  SCALED_METHODS(7),
+  SCALED_METHODS(9),
+  SCALED_METHODS(10),
+  SCALED_METHODS(11),
+  SCALED_METHODS(12),
+  SCALED_METHODS(13),
+  SCALED_METHODS(14),
+  SCALED_METHODS(15),
+  SCALED_METHODS(16)
+};
+
+
+/*
+ * Return the IDCT routines for NxN output, or NULL if this module does not
+ * provide that size.  Entries 0..2 are for the same kinds of sparse block
+ * as inverse_DCT_sparse[][0..2], and entry 3 is for any block.
+ */
+
+GLOBAL(const inverse_DCT_method_ptr *)
+jpeg_idct_scaled (int size)
+{
+  switch (size) {
+  case 3: return scaled_methods[0];
+  case 5: return scaled_methods[1];
+  case 6: return scaled_methods[2];
+  case 7: return scaled_methods[3];
+  case 9: return scaled_methods[4];
+  case 10: return scaled_methods[5];
+  case 11: return scaled_methods[6];
+  case 12: return scaled_methods[7];
+  case 13: return scaled_methods[8];
+  case 14: return scaled_methods[9];
+  case 15: return scaled_methods[10];
+  case 16: return scaled_methods[11];
+  default: return NULL;
+  }
+}
+
+#endif /* IDCT_SCALING_SUPPORTED */
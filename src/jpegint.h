@@ -171,6 +171,10 @@ struct jpeg_d_coef_controller {
 				 JSAMPIMAGE output_buf));
   /* Pointer to array of coefficient virtual arrays, or NULL if none */
   jvirt_barray_ptr *coef_arrays;
+  /* Pipelined mode only, else NULL: start and stop the input-side thread */
+  JMETHOD(void, start_input_thread, (j_decompress_ptr cinfo));
+  JMETHOD(void, finish_input_thread, (j_decompress_ptr cinfo,
+				      boolean abort));
 };
 
 /* Decompression postprocessing (color quantization buffer control) */
@@ -214,6 +218,12 @@ struct jpeg_entropy_decoder {
   /* This is here to share code between baseline and progressive decoders; */
   /* other modules probably should not use it */
   boolean insufficient_data;	/* set TRUE after emitting warning */
+
+  /* For each block of the last MCU decoded, an upper bound on the zigzag
+   * index of its last nonzero coefficient (0 means only DC can be nonzero).
+   * Sequential mode only; the progressive decoder leaves this at 63.
+   */
+  int last_coef[D_MAX_BLOCKS_IN_MCU];
 };
 
 /* Inverse DCT (also performs dequantization) */
@@ -226,8 +236,23 @@ struct jpeg_inverse_dct {
   JMETHOD(void, start_pass, (j_decompress_ptr cinfo));
   /* It is useful to allow each component to have a separate IDCT method. */
   inverse_DCT_method_ptr inverse_DCT[MAX_COMPONENTS];
+  /* Cheaper methods for blocks whose nonzero coefficients are known to
+   * lie in the DC term, the top-left 2x2 corner, or the top-left 4x4
+   * corner; they must give the same output as inverse_DCT.
+   * Use IDCT_SPARSE to pick one, given the entropy decoder's last_coef.
+   */
+  inverse_DCT_method_ptr inverse_DCT_sparse[MAX_COMPONENTS][3];
 };
 
+/* Zigzag positions 0..2 lie within the top-left 2x2 corner of a block,
+ * and 0..9 within the top-left 4x4 corner.
+ */
+#define IDCT_SPARSE(idct,ci,last) \
+  ((last) == 0 ? (idct)->inverse_DCT_sparse[ci][0] : \
+   (last) <= 2 ? (idct)->inverse_DCT_sparse[ci][1] : \
+   (last) <= 9 ? (idct)->inverse_DCT_sparse[ci][2] : \
+   (idct)->inverse_DCT[ci])
+
 /* Upsampling (note that upsampler must also call color converter) */
 struct jpeg_upsampler {
   JMETHOD(void, start_pass, (j_decompress_ptr cinfo));
@@ -268,6 +293,39 @@ struct jpeg_color_quantizer {
 #undef MIN
 #define MIN(a,b)	((a) < (b) ? (a) : (b))
 
+/* Is cinfo a band decompressor (see jdband.c) that takes its coefficients
+ * from another decompressor, rather than from its own file?
+ */
+#define BAND_BORROWS_COEFS(cinfo) \
+  ((cinfo)->band_source != NULL && (cinfo)->band_source != (cinfo))
+
+/* Packed-pixel output (JCS_XRGB8888 etc), for jdcolor.c and jdmerge.c.
+ * Pixels are stored in native byte order, so a row can be copied straight
+ * into a framebuffer of the same layout.  XRGB8888 and XBGR8888 differ only
+ * in the shifts given for red and blue.
+ */
+#define PACKED_COLOR_SPACE(space) \
+  ((space) == JCS_XRGB8888 || (space) == JCS_XBGR8888 || \
+   (space) == JCS_RGB565)
+#define PUT_PIXEL32(ptr,r,g,b,rshift,bshift) \
+  { unsigned int pix32 = 0xFF000000U | ((unsigned int) (r) << (rshift)) | \
+      ((unsigned int) (g) << 8) | ((unsigned int) (b) << (bshift)); \
+    MEMCOPY(ptr, &pix32, 4); }
+#define PUT_PIXEL565(ptr,r,g,b) \
+  { unsigned short pix16 = (unsigned short) \
+      ((((r) & 0xF8) << 8) | (((g) & 0xFC) << 3) | ((b) >> 3)); \
+    MEMCOPY(ptr, &pix16, 2); }
+
+/* Ordered dither for RGB565: a 4x4 Bayer matrix of biases 0..7, four bits
+ * to an entry and sixteen to a row.  The bias is added to red and blue
+ * before their low three bits are dropped, and half of it to green, which
+ * loses two; range_limit[] takes care of any overflow.  Without dithering
+ * the row is zero, so the cost is the same either way.
+ */
+#define DITHER_565_ROW(row) \
+  ((unsigned int) (0x2637405137265140ULL >> (((row) & 3) * 16)) & 0xFFFF)
+#define DITHER_565(drow,col)	((int) (((drow) >> (((col) & 3) * 4)) & 7))
+
 
 /* We assume that right shift corresponds to signed division by 2 with
  * rounding towards minus infinity.  This is correct for typical "arithmetic
@@ -209,7 +209,15 @@ typedef enum {
 	JCS_RGB,		/* red/green/blue */
 	JCS_YCbCr,		/* Y/Cb/Cr (also known as YUV) */
 	JCS_CMYK,		/* C/M/Y/K */
-	JCS_YCCK		/* Y/Cb/Cr/K */
+	JCS_YCCK,		/* Y/Cb/Cr/K */
+	/* Packed framebuffer pixels, for output only.  Each pixel is one
+	 * 32- or 16-bit integer in native byte order, and the names follow
+	 * the DRM convention: XRGB8888 has red in bits 16-23, RGB565 has red
+	 * in bits 11-15, and so on.
+	 */
+	JCS_XRGB8888,
+	JCS_XBGR8888,
+	JCS_RGB565
 } J_COLOR_SPACE;
 
 /* DCT/IDCT algorithm options. */
@@ -439,9 +447,27 @@ struct jpeg_decompress_struct {
   J_DCT_METHOD dct_method;	/* IDCT algorithm selector */
   boolean do_fancy_upsampling;	/* TRUE=apply fancy upsampling */
   boolean do_block_smoothing;	/* TRUE=apply interblock smoothing */
+  boolean do_pipeline;		/* TRUE=entropy decode on its own thread */
+
+  /* Set by jpeg_setup_band() and jpeg_setup_columns(), which see;
+   * not to be set directly
+   */
+  struct jpeg_decompress_struct * band_source; /* owner of coefficients */
+  JDIMENSION band_first_iMCU_row; /* band's position in band_source */
+  JDIMENSION band_first_iMCU_col; /* first iMCU column to output */
+  JDIMENSION band_num_iMCU_cols; /* iMCU columns to output, 0 = all */
+
+  /* Row of the whole image that output row 0 is, if the application has
+   * made a separate JPEG of part of it.  Only the pattern of JCS_RGB565
+   * dithering depends on this; bands set up by jpeg_setup_band() and
+   * jpeg_setup_columns() are allowed for already.
+   */
+  JDIMENSION dither_origin_row;
 
   boolean quantize_colors;	/* TRUE=colormapped output wanted */
-  /* the following are ignored if not quantize_colors: */
+  /* the following are ignored if not quantize_colors, except that any
+   * dither_mode but JDITHER_NONE selects ordered dither for JCS_RGB565:
+   */
   J_DITHER_MODE dither_mode;	/* type of color dithering to use */
   boolean two_pass_quantize;	/* TRUE=use two-pass color quantization */
   int desired_number_of_colors;	/* max # colors to use in created colormap */
@@ -836,6 +862,9 @@ typedef JMETHOD(boolean, jpeg_marker_parser_method, (j_decompress_ptr cinfo));
 #define jpeg_destroy_decompress	jDestDecompress
 #define jpeg_stdio_dest		jStdDest
 #define jpeg_stdio_src		jStdSrc
+#define jpeg_mem_src		jMemSrc
+#define jpeg_setup_band		jSetupBand
+#define jpeg_setup_columns	jSetupCols
 #define jpeg_set_defaults	jSetDefaults
 #define jpeg_set_colorspace	jSetColorspace
 #define jpeg_default_colorspace	jDefColorspace
@@ -909,6 +938,9 @@ EXTERN(void) jpeg_destroy_decompress JPP((j_decompress_ptr cinfo));
 /* Caller is responsible for opening the file before and closing after. */
 EXTERN(void) jpeg_stdio_dest JPP((j_compress_ptr cinfo, FILE * outfile));
 EXTERN(void) jpeg_stdio_src JPP((j_decompress_ptr cinfo, FILE * infile));
+/* Data source manager: a buffer already in memory. */
+EXTERN(void) jpeg_mem_src JPP((j_decompress_ptr cinfo,
+			       const JOCTET * buffer, size_t size));
 
 /* Default parameter setup for compression */
 EXTERN(void) jpeg_set_defaults JPP((j_compress_ptr cinfo));
@@ -978,6 +1010,18 @@ EXTERN(JDIMENSION) jpeg_read_scanlines JPP((j_decompress_ptr cinfo,
 					    JDIMENSION max_lines));
 EXTERN(boolean) jpeg_finish_decompress JPP((j_decompress_ptr cinfo));
 
+/* Decode only a band of iMCU rows, from another decompressor's
+ * coefficients or from the file itself; and only some iMCU columns.
+ * Call after jpeg_read_header, before jpeg_start_decompress.
+ */
+EXTERN(void) jpeg_setup_band JPP((j_decompress_ptr cinfo,
+				  j_decompress_ptr source,
+				  JDIMENSION first_iMCU_row,
+				  JDIMENSION num_iMCU_rows));
+EXTERN(void) jpeg_setup_columns JPP((j_decompress_ptr cinfo,
+				     JDIMENSION first_iMCU_col,
+				     JDIMENSION num_iMCU_cols));
+
 /* Replaces jpeg_read_scanlines when reading raw downsampled data. */
 EXTERN(JDIMENSION) jpeg_read_raw_data JPP((j_decompress_ptr cinfo,
 					   JSAMPIMAGE data,
@@ -0,0 +1,355 @@
+/*==========================================================================
+
+  jpegtofb
+  jpegprobe.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A quick look at the headers of a JPEG file, to find its size and
+  a few other things, without starting (or even creating) a libjpeg
+  decompressor. The markers are read in order from the start of the
+  file, as far as the start of the first scan; segments that are of
+  no interest are skipped with lseek(), so on a typical camera file
+  only the first few kilobytes are read. This is what makes checking
+  a large collection of pictures at startup fast -- the time goes on
+  I/O, not on building Huffman tables and sample buffers that are
+  never used.
+
+  The EXIF data in an APP1 segment, if there is one, is examined for
+  the orientation and the date the picture was taken.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "log.h"
+#include "jpegprobe.h"
+
+// Bytes of the file read at a time
+#define PROBE_BUF_SIZE 4096
+
+// A file being read forwards, a buffer at a time
+typedef struct _ProbeStream
+  {
+  int fd;
+  int pos;
+  int len;
+  BYTE buf[PROBE_BUF_SIZE];
+  } ProbeStream;
+
+
+/*==========================================================================
+
+  jpegprobe_byte
+
+  The next byte of the file, or -1 at the end
+
+==========================================================================*/
+static int jpegprobe_byte (ProbeStream *s)
+  {
+  if (s->pos == s->len)
+    {
+    s->pos = 0;
+    s->len = read (s->fd, s->buf, PROBE_BUF_SIZE);
+    if (s->len <= 0)
+      {
+      s->len = 0;
+      return -1;
+      }
+    }
+  return s->buf[s->pos++];
+  }
+
+
+/*==========================================================================
+
+  jpegprobe_read
+
+  Read the next n bytes of the file. Returns FALSE at the end of the
+  file
+
+==========================================================================*/
+static BOOL jpegprobe_read (ProbeStream *s, BYTE *dest, int n)
+  {
+  for (int i = 0; i < n; i++)
+    {
+    int c = jpegprobe_byte (s);
+    if (c < 0) return FALSE;
+    dest[i] = c;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  jpegprobe_skip
+
+  Skip n bytes. What is in the buffer is skipped over; the rest is
+  seeked past, unless the file can't seek
+
+==========================================================================*/
+static void jpegprobe_skip (ProbeStream *s, long n)
+  {
+  if (n <= s->len - s->pos)
+    {
+    s->pos += n;
+    return;
+    }
+  n -= s->len - s->pos;
+  s->pos = s->len = 0;
+  if (lseek (s->fd, n, SEEK_CUR) < 0)
+    while (n-- > 0 && jpegprobe_byte (s) >= 0);
+  }
+
+
+/*==========================================================================
+
+  jpegprobe_get16, jpegprobe_get32
+
+  EXIF data can be either byte order
+
+==========================================================================*/
+static unsigned jpegprobe_get16 (const BYTE *p, BOOL big_endian)
+  {
+  return big_endian ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+  }
+
+static unsigned long jpegprobe_get32 (const BYTE *p, BOOL big_endian)
+  {
+  return big_endian
+    ? ((unsigned long)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3])
+    : ((unsigned long)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0]);
+  }
+
+
+/*==========================================================================
+
+  jpegprobe_ifd
+
+  Look for the tags we want in one EXIF image file directory, which
+  starts at offset off in the TIFF data. If exif_ifd is not NULL, it
+  gets the offset of the EXIF sub-directory, if there is one. Every
+  offset is checked, because there's a lot of broken EXIF about. The
+  checks are all subtractions from size, which can't wrap round on a
+  32-bit system whatever the offsets are
+
+==========================================================================*/
+static void jpegprobe_ifd (const BYTE *tiff, size_t size, BOOL big_endian,
+      size_t off, JpegProbeInfo *info, size_t *exif_ifd)
+  {
+  if (size < 2 || off > size - 2) return;
+  size_t count = jpegprobe_get16 (tiff + off, big_endian);
+  // Don't go past the end of the data, even if count says so
+  size_t max_count = (size - off - 2) / 12;
+  if (count > max_count) count = max_count;
+  for (size_t i = 0; i < count; i++)
+    {
+    const BYTE *e = tiff + off + 2 + 12 * i;
+    unsigned tag = jpegprobe_get16 (e, big_endian);
+    unsigned type = jpegprobe_get16 (e + 2, big_endian);
+    size_t value = jpegprobe_get32 (e + 8, big_endian);
+    switch (tag)
+      {
+      case 0x0112: // Orientation, a SHORT held in the entry itself
+        {
+        unsigned o = jpegprobe_get16 (e + 8, big_endian);
+        if (type == 3 && o >= 1 && o <= 8) info->orientation = o;
+        }
+        break;
+      case 0x0132: // DateTime: when the file was last changed
+      case 0x9003: // DateTimeOriginal: when the picture was taken
+        // Prefer DateTimeOriginal, which is in the EXIF sub-directory,
+        //   and so is seen after DateTime
+        if (type == 2 && size >= 19 && value <= size - 19
+            && (tag == 0x9003 || info->datetime[0] == 0))
+          {
+          memcpy (info->datetime, tiff + value, 19);
+          info->datetime[19] = 0;
+          }
+        break;
+      case 0x8769: // Pointer to the EXIF sub-directory
+        if (exif_ifd) *exif_ifd = value;
+        break;
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  jpegprobe_exif
+
+  Examine an APP1 segment, which may or may not be EXIF. Returns TRUE
+  if it is
+
+==========================================================================*/
+static BOOL jpegprobe_exif (const BYTE *seg, size_t len,
+      JpegProbeInfo *info)
+  {
+  if (len < 14 || memcmp (seg, "Exif\0\0", 6) != 0) return FALSE;
+  const BYTE *tiff = seg + 6;
+  size_t size = len - 6;
+  BOOL big_endian;
+  if (tiff[0] == 'M' && tiff[1] == 'M')
+    big_endian = TRUE;
+  else if (tiff[0] == 'I' && tiff[1] == 'I')
+    big_endian = FALSE;
+  else
+    return TRUE;
+  if (jpegprobe_get16 (tiff + 2, big_endian) != 42) return TRUE;
+
+  size_t exif_ifd = 0;
+  jpegprobe_ifd (tiff, size, big_endian, jpegprobe_get32 (tiff + 4,
+    big_endian), info, &exif_ifd);
+  if (exif_ifd)
+    jpegprobe_ifd (tiff, size, big_endian, exif_ifd, info, NULL);
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  jpegprobe_fd
+
+  Read the headers of a JPEG file that is already open, reading from 
+  the current position. The filename is only for messages. Returns 
+  FALSE, and sets *error, if the file doesn't look like a JPEG that 
+  libjpeg can decode -- no SOI, no frame header before the first scan,
+  or a lossless or arithmetic-coded frame
+
+==========================================================================*/
+BOOL jpegprobe_fd (int fd, const char *filename, JpegProbeInfo *info,
+       char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  log_debug ("probe: file=%s", filename);
+  memset (info, 0, sizeof (*info));
+
+  ProbeStream stream;
+  ProbeStream *s = &stream;
+  s->pos = s->len = 0;
+  s->fd = fd;
+  BOOL have_sof = FALSE, have_exif = FALSE;
+  const char *problem = NULL;
+  int c0 = jpegprobe_byte (s);
+  int c1 = jpegprobe_byte (s);
+  if (c1 < 0)
+    problem = "file too short";
+  else if (c0 != 0xFF || c1 != 0xD8)
+    problem = "no JPEG header";
+
+  while (!problem)
+    {
+    // Skip any garbage before the marker, as libjpeg does, and any 
+    //   number of fill bytes
+    int m;
+    while ((m = jpegprobe_byte (s)) >= 0 && m != 0xFF);
+    while ((m = jpegprobe_byte (s)) == 0xFF);
+    if (m < 0) { problem = "file too short"; break; }
+    if (m == 0xD9 || m == 0xDA) // EOI or SOS: no more headers
+      break;
+    if (m == 0x00 || m == 0x01 || (m >= 0xD0 && m <= 0xD7)) 
+      continue; // Stuffed zero, or a marker with no length
+
+    BYTE b[2];
+    if (!jpegprobe_read (s, b, 2)) { problem = "file too short"; break; }
+    int len = (b[0] << 8 | b[1]) - 2;
+    if (len < 0) { problem = "bad marker"; break; }
+
+    if (m >= 0xC3 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC)
+      {
+      // Lossless, hierarchical, or arithmetic-coded: libjpeg 6b
+      //   can't decode any of these
+      problem = "unsupported JPEG type";
+      break;
+      }
+    else if (m >= 0xC0 && m <= 0xC2)
+      {
+      // SOF0-2, baseline, extended, or progressive Huffman: precision,
+      //   height, width, components, and then three bytes for each
+      //   component
+      BYTE sof[9];
+      if (have_sof || len < 9 || !jpegprobe_read (s, sof, 9))
+        { problem = "bad frame header"; break; }
+      info->height = sof[1] << 8 | sof[2];
+      info->width = sof[3] << 8 | sof[4];
+      info->components = sof[5];
+      info->h_samp = sof[7] >> 4;
+      info->v_samp = sof[7] & 0x0F;
+      info->progressive = m == 0xC2;
+      have_sof = TRUE;
+      jpegprobe_skip (s, len - 9);
+      }
+    else if (m == 0xDD && len >= 2)
+      {
+      // DRI
+      if (!jpegprobe_read (s, b, 2)) { problem = "file too short"; break; }
+      info->restart_interval = b[0] << 8 | b[1];
+      jpegprobe_skip (s, len - 2);
+      }
+    else if (m == 0xE1 && !have_exif)
+      {
+      BYTE *seg = malloc (len);
+      if (!jpegprobe_read (s, seg, len))
+        problem = "file too short";
+      else
+        have_exif = jpegprobe_exif (seg, len, info);
+      free (seg);
+      }
+    else
+      jpegprobe_skip (s, len);
+    }
+
+  if (!problem && (!have_sof || info->width == 0 || info->height == 0))
+    problem = "no frame header";
+  if (problem)
+    asprintf (error, "Can't read '%s': %s", filename, problem);
+  else
+    ret = TRUE;
+
+  if (ret)
+    log_debug ("probe: %d by %d, %d components, %s, %dx%d sampling, "
+      "restart interval %d, orientation %d, date '%s'", info->width,
+      info->height, info->components, info->progressive ? "progressive"
+      : "sequential", info->h_samp, info->v_samp, info->restart_interval,
+      info->orientation, info->datetime);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  jpegprobe_file
+
+  Read the headers of a JPEG file, as jpegprobe_fd(). Returns FALSE, and
+  sets *error, if the file can't be opened, as well
+
+==========================================================================*/
+BOOL jpegprobe_file (const char *filename, JpegProbeInfo *info,
+       char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  int fd = open (filename, O_RDONLY);
+  if (fd >= 0)
+    {
+    ret = jpegprobe_fd (fd, filename, info, error);
+    close (fd);
+    }
+  else
+    {
+    memset (info, 0, sizeof (*info));
+    asprintf (error, "Can't read '%s': %s", filename, strerror (errno));
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
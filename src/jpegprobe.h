@@ -0,0 +1,43 @@
+/*============================================================================
+
+  jpegtofb
+  jpegprobe.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+// What can be learned about a JPEG from its headers, without decoding
+//   anything
+typedef struct _JpegProbeInfo
+  {
+  int width;
+  int height;
+  // Number of components in the file: 1 for greyscale, 3 for colour
+  int components;
+  BOOL progressive;
+  // In MCUs; 0 if the file has no restart markers
+  int restart_interval;
+  // Sampling factors of the first (luma) component: 2 by 2 for 4:2:0,
+  //   2 by 1 for 4:2:2, 1 by 1 for 4:4:4
+  int h_samp;
+  int v_samp;
+  // EXIF orientation, 1-8, or 0 if the file doesn't say
+  int orientation;
+  // EXIF date the picture was taken, "YYYY:MM:DD HH:MM:SS", or empty
+  char datetime[20];
+  } JpegProbeInfo;
+
+BEGIN_DECLS
+
+BOOL jpegprobe_fd (int fd, const char *filename, JpegProbeInfo *info,
+       char **error);
+BOOL jpegprobe_file (const char *filename, JpegProbeInfo *info,
+       char **error);
+
+END_DECLS
+
+
@@ -12,180 +12,796 @@
 ==========================================================================*/
 #define _GNU_SOURCE
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include "jpeglib.h"
 #include <sys/ioctl.h>
 #include <linux/fb.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
 #include "log.h" 
 #include "jpegreader.h" 
+#include "restart.h" 
+#include "progressive.h"
+#include "bands.h"
+#include "jpipe.h" 
 
+// Read no more than this many scans of a progressive file; 0 means all
+static int jpegreader_max_scans = 0;
 
 /*==========================================================================
 
-  jpegreader_get_image_size
+  jpegreader_set_max_scans
 
 ==========================================================================*/
-BOOL jpegreader_get_image_size (const char *filename, int *height, 
-       int *width, int *components)
+void jpegreader_set_max_scans (int max_scans)
+  {
+  jpegreader_max_scans = max_scans;
+  }
+
+
+/*==========================================================================
+
+  jpegreader_choose_scale
+
+  Pick the smallest IDCT scale, N/8 for N from 1 to 16, at which the 
+  decoded image is still at least min_width wide and min_height high.
+  Decoding at a reduced scale is much cheaper than decoding at full
+  size and then throwing most of the pixels away, and lands close
+  enough to the target that the scaler has little left to do. A small
+  image is enlarged by the IDCT, up to twice its size, which is smoother
+  than enlarging it afterwards. Either minimum can be zero, meaning 
+  "don't care". The header must already have been read.
+
+  The output size is rounded up, so for a very small image several
+  scales give the same size; the largest of them is used, because it
+  throws away the least detail -- a 7 by 5 image is decoded at 8/8, 
+  not 7/8.
+
+==========================================================================*/
+static void jpegreader_choose_scale (struct jpeg_decompress_struct *cinfo,
+      int min_width, int min_height)
   {
   LOG_IN
-  BOOL ret = FALSE;
-  log_debug ("get_image_size: file=%s", filename);
-  if (jpegreader_check (filename, NULL)) 
+  cinfo->scale_denom = DCTSIZE;
+  int num;
+  for (num = 1; num < 2 * DCTSIZE; num++)
+    {
+    cinfo->scale_num = num;
+    jpeg_calc_output_dimensions (cinfo);
+    if ((int)cinfo->output_width >= min_width 
+         && (int)cinfo->output_height >= min_height)
+      break;
+    }
+  cinfo->scale_num = num;
+  jpeg_calc_output_dimensions (cinfo);
+  JDIMENSION width = cinfo->output_width;
+  JDIMENSION height = cinfo->output_height;
+  for (; num < 2 * DCTSIZE; num++)
     {
-    FILE *fin = fopen (filename, "r");
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
+    cinfo->scale_num = num + 1;
+    jpeg_calc_output_dimensions (cinfo);
+    if (cinfo->output_width != width || cinfo->output_height != height)
+      break;
+    }
+  cinfo->scale_num = num;
+  log_debug ("choose_scale: image %d by %d, target %d by %d, scale %d/%d",
+    cinfo->image_width, cinfo->image_height, min_width, min_height, 
+    cinfo->scale_num, cinfo->scale_denom);
+  LOG_OUT
+  }
 
-    cinfo.err = jpeg_std_error (&jerr);
-    jpeg_create_decompress(&cinfo);
 
-    jpeg_stdio_src (&cinfo, fin);
+// In pipelined mode, decoded rows are passed from the decoding thread
+//   to the caller's thread in batches of this many rows...
+#define PIPE_BATCH_ROWS 8
+// ... through a ring of this many batches
+#define PIPE_BATCHES 4
+
+// A decode in progress, in pipelined mode
+typedef struct _JpegReaderPipe
+  {
+  struct jpeg_decompress_struct *cinfo;
+  jpipe_ring ring;
+  int row_stride;
+  BYTE *rows;
+  int batch_rows[PIPE_BATCHES];
+  } JpegReaderPipe;
+
+
+// Where decoded rows go. The decompressor's output begins at row top,
+//   column left, of the image, and only the rows and columns of region
+//   are wanted
+typedef struct _JpegReaderSink
+  {
+  JpegReaderRegion region;
+  int top;
+  int left;
+  int pixel_size;
+  JpegReaderRowFn row_fn;
+  void *user_data;
+  } JpegReaderSink;
+
+
+/*==========================================================================
+
+  jpegreader_deliver
+
+  Pass row y of the decompressor's output to the row function, if it
+  is in the region. Returns FALSE once the last row of the region has
+  been passed
+
+==========================================================================*/
+static BOOL jpegreader_deliver (const JpegReaderSink *sink, const BYTE *row,
+      int y)
+  {
+  const JpegReaderRegion *r = &sink->region;
+  y += sink->top;
+  if (y >= r->y && y < r->y + r->height)
+    sink->row_fn (row + (r->x - sink->left) * sink->pixel_size, y, 
+      sink->user_data);
+  return y + 1 < r->y + r->height;
+  }
 
-    int rc = jpeg_read_header(&cinfo, TRUE);
-    if (rc == 1) 
+
+/*==========================================================================
+
+  jpegreader_read_rows
+
+  Hand each row of a started decompressor to the sink, in order, 
+  stopping after the last row that is wanted
+
+==========================================================================*/
+static void jpegreader_read_rows (struct jpeg_decompress_struct *cinfo,
+      const JpegReaderSink *sink)
+  {
+  int row_stride = cinfo->output_width * cinfo->output_components;
+  int batch = cinfo->rec_outbuf_height;
+  BYTE *rows = malloc (batch * row_stride);
+  JSAMPROW row_pointers[batch];
+  for (int i = 0; i < batch; i++)
+    row_pointers[i] = rows + i * row_stride;
+
+  BOOL more = TRUE;
+  while (more && cinfo->output_scanline < cinfo->output_height) 
+    {
+    int y = cinfo->output_scanline;
+    int n = jpeg_read_scanlines (cinfo, row_pointers, batch);
+    for (int i = 0; i < n && more; i++)
+      more = jpegreader_deliver (sink, row_pointers[i], y + i);
+    }
+  free (rows);
+  }
+
+
+/*==========================================================================
+
+  jpegreader_pipe_thread
+
+  The middle stage of the pipeline: IDCT, upsampling and colour 
+  conversion all happen inside jpeg_read_scanlines. Fill batches of 
+  rows for the caller's thread until the image is finished
+
+==========================================================================*/
+static void *jpegreader_pipe_thread (void *arg)
+  {
+  JpegReaderPipe *pipe = arg;
+  struct jpeg_decompress_struct *cinfo = pipe->cinfo;
+  int slot;
+  while (cinfo->output_scanline < cinfo->output_height 
+       && (slot = jpipe_acquire_write (&pipe->ring)) >= 0)
+    {
+    BYTE *batch = pipe->rows + slot * PIPE_BATCH_ROWS * pipe->row_stride;
+    int n = 0;
+    while (n < PIPE_BATCH_ROWS 
+         && cinfo->output_scanline < cinfo->output_height)
       {
-      jpeg_start_decompress (&cinfo);
-      *width = cinfo.output_width;
-      *height = cinfo.output_height;
-      *components = cinfo.output_components;
-      //jpeg_finish_decompress(&cinfo);
-      jpeg_destroy_decompress(&cinfo);
-      ret = TRUE;
+      JSAMPROW row_pointers[PIPE_BATCH_ROWS];
+      for (int i = n; i < PIPE_BATCH_ROWS; i++)
+        row_pointers[i - n] = batch + i * pipe->row_stride;
+      int got = jpeg_read_scanlines (cinfo, row_pointers, 
+        PIPE_BATCH_ROWS - n);
+      if (got == 0) break; 
+      n += got;
       }
-    fclose (fin);
+    if (n == 0) break;
+    pipe->batch_rows[slot] = n;
+    jpipe_commit_write (&pipe->ring);
     }
-  LOG_OUT
-  return ret;
+  jpipe_close (&pipe->ring);
+  return NULL;
   }
 
 
 /*==========================================================================
 
-  jpegreader_file_to_mem
+  jpegreader_read_pipelined
+
+  Like jpegreader_read_rows, but for a decompressor started in 
+  pipelined mode. There are three stages, each on its own thread:
+  entropy decoding (a thread inside libjpeg), IDCT and colour 
+  conversion (jpegreader_pipe_thread), and whatever row_fn does -- 
+  scaling and blitting, for us -- on the calling thread. The stages 
+  are linked by bounded rings, so each can get ahead of the next by 
+  only a few rows. Once the last row of the region has been delivered,
+  the other two stages are stopped, and the decompression abandoned,
+  so that the rest of the image isn't decoded for nothing
 
 ==========================================================================*/
-void jpegreader_file_to_mem (const char *filename, int *jpeg_height, 
-      int *jpeg_width, int *bytespp, char **buffer, char **error)
+static void jpegreader_read_pipelined (struct jpeg_decompress_struct *cinfo,
+      const JpegReaderSink *sink)
   {
-  LOG_IN
-  log_debug ("read_jpeg: file=%s", filename);
-  if (jpegreader_check (filename, error)) 
+  JpegReaderPipe pipe;
+  pipe.cinfo = cinfo;
+  pipe.row_stride = cinfo->output_width * cinfo->output_components;
+  pipe.rows = malloc ((size_t)PIPE_BATCHES * PIPE_BATCH_ROWS 
+    * pipe.row_stride);
+  jpipe_init (&pipe.ring, PIPE_BATCHES);
+
+  pthread_t thread;
+  sigset_t all, old;
+  sigfillset (&all);
+  // SIGBUS can only be handled on the thread that reads the file
+  sigdelset (&all, SIGBUS);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  BOOL threaded = pthread_create (&thread, NULL, 
+    jpegreader_pipe_thread, &pipe) == 0;
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+  if (threaded)
+    {
+    int y = 0, slot;
+    BOOL more = TRUE;
+    while (more && (slot = jpipe_acquire_read (&pipe.ring)) >= 0)
+      {
+      const BYTE *row = pipe.rows + slot * PIPE_BATCH_ROWS * pipe.row_stride;
+      for (int i = 0; i < pipe.batch_rows[slot] && more; 
+           i++, row += pipe.row_stride)
+        more = jpegreader_deliver (sink, row, y++);
+      jpipe_commit_read (&pipe.ring);
+      }
+    // The pipe thread stops at the end of the batch it is working on
+    if (!more) jpipe_close (&pipe.ring);
+    pthread_join (thread, NULL);
+    // ... and the entropy decoder when the decompression is abandoned
+    if (!more && cinfo->output_scanline < cinfo->output_height)
+      {
+      log_debug ("decode: region finished at row %d of %d, abandoning", 
+        y, cinfo->output_height);
+      jpeg_abort_decompress (cinfo);
+      }
+    }
+  else
     {
-    FILE *fin = fopen (filename, "r");
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
+    jpegreader_read_rows (cinfo, sink);
+    }
+
+  jpipe_term (&pipe.ring);
+  free (pipe.rows);
+  }
+
 
-    cinfo.err = jpeg_std_error (&jerr);
-    jpeg_create_decompress(&cinfo);
+// A file's contents, in memory. Usually the file is mapped, which saves
+//   copying it; but if it can't be (it's a pipe, say), it is read
+typedef struct _JpegReaderFile
+  {
+  BYTE *data;
+  size_t size;
+  BOOL mapped;
+  // The entry in jpegreader_maps, if mapped
+  int map;
+  } JpegReaderFile;
+
+// The files that are mapped, so that the SIGBUS handler can tell 
+//   whether a fault is in one of them. An entry is free when data is 
+//   NULL. There are rarely more than two files open at once -- the one
+//   being shown, and the next
+typedef struct _JpegReaderMap
+  {
+  BYTE *data;
+  size_t size;
+  // Set by the SIGBUS handler: the file has got shorter since it was
+  //   mapped, and some of what was read was not from the file
+  volatile sig_atomic_t changed;
+  } JpegReaderMap;
+
+#define JPEGREADER_MAX_MAPS 8
+static JpegReaderMap jpegreader_maps[JPEGREADER_MAX_MAPS];
+static pthread_once_t jpegreader_sigbus_once = PTHREAD_ONCE_INIT;
+static struct sigaction jpegreader_old_sigbus;
+static long jpegreader_page_size;
+
+
+// An image file, opened by jpegreader_open
+typedef struct _JpegReaderImage
+  {
+  char *filename;
+  JpegReaderFile file;
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  } JpegReaderImage;
 
-    jpeg_stdio_src (&cinfo, fin);
 
-    int rc = jpeg_read_header(&cinfo, TRUE);
-    if (rc == 1) 
+/*==========================================================================
+
+  jpegreader_sigbus
+
+  A mapped file has been truncated, or rewritten, while it was being
+  read -- which is quite likely in a directory that is being synced --
+  and a page that is no longer in the file has been touched. The page
+  is replaced with zeros, which the decoder will make what it can of,
+  and the file is marked as changed, so that the decode can be failed
+  afterwards. This works whichever thread the fault is on, which a
+  longjmp() would not. A fault anywhere else is not ours: the old
+  handler is put back, and the fault happens again when this returns
+
+==========================================================================*/
+static void jpegreader_sigbus (int sig, siginfo_t *info, void *context)
+  {
+  BYTE *addr = info->si_addr;
+  for (int i = 0; i < JPEGREADER_MAX_MAPS; i++)
+    {
+    JpegReaderMap *map = &jpegreader_maps[i];
+    BYTE *data = __atomic_load_n (&map->data, __ATOMIC_ACQUIRE);
+    if (data && addr >= data && addr < data + map->size)
       {
-      jpeg_start_decompress(&cinfo);
-	    
-      int width = cinfo.output_width;
-      int height = cinfo.output_height;
-      int pixel_size = cinfo.output_components;
-      if (pixel_size == 3)
+      void *page = (void *)((uintptr_t)addr & ~(jpegreader_page_size - 1));
+      if (mmap (page, jpegreader_page_size, PROT_READ, 
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
         {
-	*jpeg_width = width;
-	*jpeg_height = height;
-	*bytespp = pixel_size;
-
-        log_debug ("read_jpeg: image is %d by %d with %d components", 
-	    width, height, pixel_size);
-	unsigned long bmp_size;
-	char *bmp_buffer;
-
-	bmp_size = width * height * pixel_size;
-	bmp_buffer = (char*) malloc(bmp_size);
-
-	int row_stride = width * pixel_size;
-
-	while (cinfo.output_scanline < cinfo.output_height) 
-	  {
-	  char *buffer_array[1];
-	  buffer_array[0] = bmp_buffer + cinfo.output_scanline * row_stride;
-	  jpeg_read_scanlines (&cinfo, (unsigned char **)buffer_array, 1);
-	  }
-        *buffer = bmp_buffer;
-        } 
-      else
+        map->changed = TRUE;
+        return;
+        }
+      }
+    }
+  sigaction (SIGBUS, &jpegreader_old_sigbus, NULL);
+  }
+
+
+/*==========================================================================
+
+  jpegreader_install_sigbus
+
+==========================================================================*/
+static void jpegreader_install_sigbus (void)
+  {
+  jpegreader_page_size = sysconf (_SC_PAGESIZE);
+  struct sigaction sa;
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_sigaction = jpegreader_sigbus;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset (&sa.sa_mask);
+  sigaction (SIGBUS, &sa, &jpegreader_old_sigbus);
+  }
+
+
+/*==========================================================================
+
+  jpegreader_add_map
+
+  Record a mapped file in jpegreader_maps, and return its entry, or -1
+  if they are all in use
+
+==========================================================================*/
+static int jpegreader_add_map (BYTE *data, size_t size)
+  {
+  pthread_once (&jpegreader_sigbus_once, jpegreader_install_sigbus);
+  for (int i = 0; i < JPEGREADER_MAX_MAPS; i++)
+    {
+    JpegReaderMap *map = &jpegreader_maps[i];
+    BYTE *expected = NULL;
+    if (__atomic_compare_exchange_n (&map->data, &expected, data, FALSE,
+         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      {
+      // Nothing can fault in the mapping until this returns, so it 
+      //   doesn't matter that the size is set after the address
+      map->size = size;
+      map->changed = FALSE;
+      __atomic_thread_fence (__ATOMIC_RELEASE);
+      return i;
+      }
+    }
+  return -1;
+  }
+
+
+/*==========================================================================
+
+  jpegreader_file_changed
+
+  Whether the file has got shorter since it was mapped, so that some
+  of the data was not really from the file
+
+==========================================================================*/
+static BOOL jpegreader_file_changed (const JpegReaderFile *file)
+  {
+  return file->mapped && jpegreader_maps[file->map].changed;
+  }
+
+
+/*==========================================================================
+
+  jpegreader_map
+
+  Get the whole of a file into memory, preferably by mapping it, so
+  that only the parts that are looked at are ever read from disk. 
+  If the file is cut short while it's mapped, reading past the new 
+  end gives zeros, and jpegreader_file_changed() reports it. 
+  Returns FALSE, and sets *error, if the file can't be read, or is 
+  empty. Call jpegreader_unmap when finished with the data
+
+==========================================================================*/
+static BOOL jpegreader_map (const char *filename, JpegReaderFile *file,
+      char **error)
+  {
+  LOG_IN
+  memset (file, 0, sizeof (*file));
+  int fd = open (filename, O_RDONLY);
+  if (fd >= 0)
+    {
+    struct stat sb;
+    if (fstat (fd, &sb) == 0 && S_ISREG (sb.st_mode) && sb.st_size > 0)
+      {
+      void *p = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED)
         {
-        asprintf (error, "JPEG file '%s' is not RGB", filename); 
+        file->map = jpegreader_add_map (p, sb.st_size);
+        if (file->map >= 0)
+          {
+          file->data = p;
+          file->size = sb.st_size;
+          file->mapped = TRUE;
+          }
+        else
+          munmap (p, sb.st_size);
         }
-      jpeg_finish_decompress(&cinfo);
-      jpeg_destroy_decompress(&cinfo);
       }
-    else
+    if (!file->mapped)
       {
-      asprintf (error, "Invalid JPEG file '%s'", filename); 
+      // Read it the slow way, into a buffer that grows as needed
+      size_t alloc = 0;
+      ssize_t n;
+      do
+        {
+        if (file->size == alloc)
+          {
+          alloc = alloc ? 2 * alloc : 65536;
+          file->data = realloc (file->data, alloc);
+          }
+        n = read (fd, file->data + file->size, alloc - file->size);
+        if (n > 0) file->size += n;
+        } while (n > 0);
+      if (n < 0 || file->size == 0)
+        {
+        free (file->data);
+        file->data = NULL;
+        asprintf (error, "Can't read '%s': %s", filename, 
+          n < 0 ? strerror (errno) : "file too short"); 
+        }
       }
-    fclose (fin);
+    close (fd);
+    }
+  else
+    {
+    asprintf (error, "Can't read '%s': %s", filename, strerror (errno));
     }
   LOG_OUT
+  return file->data != NULL;
   }
 
 
 /*==========================================================================
 
-  jpegreader_check
+  jpegreader_unmap
+
+==========================================================================*/
+static void jpegreader_unmap (JpegReaderFile *file)
+  {
+  if (file->mapped)
+    {
+    munmap (file->data, file->size);
+    __atomic_store_n (&jpegreader_maps[file->map].data, NULL, 
+      __ATOMIC_RELEASE);
+    }
+  else
+    free (file->data);
+  file->data = NULL;
+  }
+
+
+/*==========================================================================
 
-  This is a quick check that the file exists, and looks like a JPEG.
-  We don't want to rely on libjpeg functions to do this check, because
-  their error handling really stinks. Better to make sure the file
-  is basically sane, before letting libjpeg get stuck in.
+  jpegreader_clip_region
+
+  Make sure that the region the caller asked for is inside the image, 
+  and not empty
+
+==========================================================================*/
+static void jpegreader_clip_region (JpegReaderRegion *region, int width, 
+      int height)
+  {
+  if (region->x < 0) region->x = 0;
+  if (region->x > width - 1) region->x = width - 1;
+  if (region->width > width - region->x) region->width = width - region->x;
+  if (region->width < 1) region->width = 1;
+  if (region->y < 0) region->y = 0;
+  if (region->y > height - 1) region->y = height - 1;
+  if (region->height > height - region->y) 
+    region->height = height - region->y;
+  if (region->height < 1) region->height = 1;
+  }
+
+
+/*==========================================================================
+
+  jpegreader_set_format
+
+  Have the decompressor produce pixels in the specified format. The 
+  framebuffer formats come straight out of libjpeg's colour converter,
+  which saves a copy and, for 16-bit pixels, a lot of memory traffic
+
+==========================================================================*/
+static void jpegreader_set_format (struct jpeg_decompress_struct *cinfo,
+      JpegReaderFormat format)
+  {
+  cinfo->dither_mode = JDITHER_NONE;
+  switch (format)
+    {
+    case JPEGREADER_XRGB8888:
+      cinfo->out_color_space = JCS_XRGB8888;
+      break;
+    case JPEGREADER_XBGR8888:
+      cinfo->out_color_space = JCS_XBGR8888;
+      break;
+    case JPEGREADER_RGB565_DITHER:
+      cinfo->dither_mode = JDITHER_ORDERED;
+      // Fall through
+    case JPEGREADER_RGB565:
+      cinfo->out_color_space = JCS_RGB565;
+      break;
+    default:
+      cinfo->out_color_space = JCS_RGB;
+    }
+  jpeg_calc_output_dimensions (cinfo);
+  }
+
+
+/*==========================================================================
+
+  jpegreader_close
 
 ==========================================================================*/
-BOOL jpegreader_check (const char *filename, char **error)
+static void jpegreader_close (JpegReaderImage *self)
   {
   LOG_IN
-  BOOL ret = FALSE;
+  if (self)
+    {
+    jpeg_destroy_decompress (&self->cinfo);
+    jpegreader_unmap (&self->file);
+    free (self->filename);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  jpegreader_open
 
-  int f = open (filename, O_RDONLY);
-  if (f >= 0)
+  Open a JPEG file, and read its header. The file is opened and mapped
+  just once, and the same mapping and decompressor are used to decode
+  it. 
+
+  The first thing checked is that the file starts with an SOI marker.
+  We don't want to rely on libjpeg to do this, because its error 
+  handling really stinks. Better to make sure the file is basically 
+  sane, before letting libjpeg get stuck in.
+
+  Returns NULL, and sets *error, if the file can't be read, or is not
+  a JPEG. Otherwise the caller must call jpegreader_close on the result
+
+==========================================================================*/
+static JpegReaderImage *jpegreader_open (const char *filename, 
+      char **error)
+  {
+  LOG_IN
+  log_debug ("open: file=%s", filename);
+  JpegReaderImage *self = NULL;
+  JpegReaderFile file;
+  if (jpegreader_map (filename, &file, error))
     {
-    unsigned char buff[2];
-    int n = read (f, buff, 2);
-    if (n == 2)
+    if (file.size < 2)
       {
-      if (buff[0] == 0xff && buff[1] == 0xd8)
-        { 
-        ret = TRUE;
-        }
-      else
-        { 
-        if (error)
-           asprintf (error, "Can't read '%s': %s", 
-            filename, "no JPEG header");
-        }
+      asprintf (error, "Can't read '%s': %s", filename, "file too short");
+      }
+    else if (file.data[0] != 0xff || file.data[1] != 0xd8)
+      {
+      asprintf (error, "Can't read '%s': %s", filename, "no JPEG header");
       }
     else
       {
-      if (error)
-         asprintf (error, "Can't read '%s': %s", 
-          filename, "file too short");
+      self = malloc (sizeof (JpegReaderImage));
+      self->filename = strdup (filename);
+      self->file = file;
+      self->cinfo.err = jpeg_std_error (&self->jerr);
+      jpeg_create_decompress (&self->cinfo);
+      jpeg_mem_src (&self->cinfo, file.data, file.size);
+      if (jpeg_read_header (&self->cinfo, TRUE) == JPEG_HEADER_OK
+           && !jpegreader_file_changed (&file))
+        {
+        jpeg_calc_output_dimensions (&self->cinfo);
+        }
+      else
+        {
+        asprintf (error, "Invalid JPEG file '%s'", filename); 
+        jpeg_destroy_decompress (&self->cinfo);
+        free (self->filename);
+        free (self);
+        self = NULL;
+        }
       }
-    close (f);
+    if (!self)
+      jpegreader_unmap (&file);
     }
-  else
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  jpegreader_decode_image
+
+  Decode the image a batch of scanlines at a time, handing each 
+  row to row_fn as soon as it is available. The whole
+  image is never held in memory -- only as many rows as libjpeg 
+  produces in one call to jpeg_read_scanlines. An image can only be 
+  decoded once.
+
+  The image is decoded at the smallest reduced scale that is still at 
+  least min_width by min_height, and start_fn is told the actual 
+  decoded size before the first row is delivered. start_fn can ask for
+  only part of the image, in which case the iMCU rows and columns that
+  lie outside that part get no IDCT, upsampling or colour conversion.
+  The rows above it still have to be Huffman decoded, unless the file
+  has restart markers, but those below it are not read at all.
+  start_fn can also choose the layout of the pixels; the default is
+  RGB888.
+
+  Files with a restart interval are split up and decoded on several
+  threads (see restart.c), as is the output pass of progressive files
+  (see progressive.c). Other single-scan files are decoded in a
+  pipeline of three threads (see jpegreader_read_pipelined). Whichever
+  way, the rows are still delivered in order, on the calling thread.
+
+==========================================================================*/
+static void jpegreader_decode_image (JpegReaderImage *self, 
+      int min_width, int min_height, JpegReaderStartFn start_fn, 
+      JpegReaderRowFn row_fn, void *user_data, char **error)
+  {
+  LOG_IN
+  log_debug ("decode: file=%s", self->filename);
+  const BYTE *data = self->file.data;
+  size_t size = self->file.size;
+  struct jpeg_decompress_struct *cinfo = &self->cinfo;
+
+  // From here on, the file will be read from start to finish, so the 
+  //   kernel can read ahead aggressively
+  if (self->file.mapped)
+    madvise (self->file.data, size, MADV_SEQUENTIAL);
+
+  jpegreader_choose_scale (cinfo, min_width, min_height);
+  jpeg_calc_output_dimensions (cinfo);
+	    
+  int width = cinfo->output_width;
+  int height = cinfo->output_height;
+  int pixel_size = cinfo->output_components;
+  if (pixel_size != 3)
     {
-    if (error)
-       asprintf (error, "Can't read '%s': %s", 
-          filename, strerror (errno));
+    asprintf (error, "JPEG file '%s' is not RGB", self->filename); 
+    }
+  else 
+    {
+    JpegReaderSink sink;
+    memset (&sink, 0, sizeof (sink));
+    sink.region.width = width;
+    sink.region.height = height;
+    sink.row_fn = row_fn;
+    sink.user_data = user_data;
+    JpegReaderFormat format = JPEGREADER_RGB888;
+    start_fn (width, height, &sink.region, &format, user_data);
+    jpegreader_clip_region (&sink.region, width, height);
+    jpegreader_set_format (cinfo, format);
+    sink.pixel_size = cinfo->output_components;
+    log_debug ("decode: region %d by %d at %d,%d", sink.region.width,
+      sink.region.height, sink.region.x, sink.region.y);
+
+    if (!restart_decode (data, size, cinfo, &sink.region, row_fn, 
+        user_data)
+      && !progressive_decode (data, size, cinfo, 
+        jpegreader_max_scans, &sink.region, row_fn, user_data))
+      {
+      // Pipelining needs a spare CPU, and progressive files must be
+      //   buffered in full anyway, so there's nothing to overlap
+      cinfo->do_pipeline = sysconf (_SC_NPROCESSORS_ONLN) > 1
+        && !jpeg_has_multiple_scans (cinfo);
+      log_debug ("decode: image is %d by %d with %d components%s", 
+          width, height, pixel_size, 
+          cinfo->do_pipeline ? ", pipelined" : "");
+
+      // Decode only the iMCU rows and columns that the region needs.
+      //   A multi-scan file has to be read in full before any rows
+      //   come out, but it need not all be output
+      Band window;
+      bands_window (cinfo, &sink.region, &window);
+      // jpeg_setup_band() makes the band look like the whole image, 
+      //   so whether it reaches the bottom has to be decided first
+      int mcu_rows = cinfo->total_iMCU_rows;
+      BOOL to_bottom = window.dec_last >= mcu_rows;
+      if (!jpeg_has_multiple_scans (cinfo) && (window.dec_first > 0 
+           || window.dec_last < mcu_rows))
+        {
+        jpeg_setup_band (cinfo, NULL, window.dec_first, 
+          window.dec_last - window.dec_first);
+        sink.top = window.dec_first * cinfo->max_v_samp_factor 
+          * cinfo->min_DCT_scaled_size;
+        }
+      else
+        to_bottom = TRUE;
+      if (window.n_cols > 0)
+        {
+        jpeg_setup_columns (cinfo, window.first_col, window.n_cols);
+        sink.left = window.first_col * cinfo->max_h_samp_factor 
+          * cinfo->min_DCT_scaled_size;
+        }
+
+      BOOL partial = progressive_start (cinfo, jpegreader_max_scans);
+
+      if (cinfo->do_pipeline)
+        jpegreader_read_pipelined (cinfo, &sink);
+      else
+        jpegreader_read_rows (cinfo, &sink);
+      // If only some of the scans, or only the top of the image, 
+      //   were read, the rest of the file is of no interest
+      if (!partial && to_bottom 
+           && cinfo->output_scanline == cinfo->output_height) 
+        jpeg_finish_decompress (cinfo);
+      } 
     }
+  if (!*error && jpegreader_file_changed (&self->file))
+    asprintf (error, "'%s' changed while it was being read", 
+      self->filename);
   LOG_OUT
-  return ret;
   }
 
 
+/*==========================================================================
+
+  jpegreader_decode
+
+  Open a file and decode it, as jpegreader_decode_image
+
+==========================================================================*/
+void jpegreader_decode (const char *filename, int min_width, 
+      int min_height, JpegReaderStartFn start_fn, JpegReaderRowFn row_fn, 
+      void *user_data, char **error)
+  {
+  LOG_IN
+  JpegReaderImage *image = jpegreader_open (filename, error);
+  if (image)
+    {
+    jpegreader_decode_image (image, min_width, min_height, start_fn, 
+      row_fn, user_data, error);
+    jpegreader_close (image);
+    }
+  LOG_OUT
+  }
 
 
@@ -11,13 +11,48 @@
 #include "defs.h"
 
 
+// A rectangle of the decoded image, in pixels
+typedef struct _JpegReaderRegion
+  {
+  int x;
+  int y;
+  int width;
+  int height;
+  } JpegReaderRegion;
+
+// The pixel layouts that decoded rows can be delivered in. Apart from
+//   RGB888, which is three bytes in R, G, B order, these are framebuffer
+//   formats, and each pixel is a native 32- or 16-bit integer, named in
+//   the DRM way. RGB565_DITHER is RGB565 with an ordered dither, aligned
+//   to the whole image
+typedef enum _JpegReaderFormat
+  {
+  JPEGREADER_RGB888 = 0,
+  JPEGREADER_XRGB8888,
+  JPEGREADER_XBGR8888,
+  JPEGREADER_RGB565,
+  JPEGREADER_RGB565_DITHER
+  } JpegReaderFormat;
+
+// Called once, when the size of the decoded image is known. The region
+//   is initially the whole image; the caller can shrink it to the part
+//   it actually wants, and the rest will not be decoded, or not fully.
+//   The format is initially RGB888, and the caller can change it
+typedef void (*JpegReaderStartFn) (int width, int height, 
+  JpegReaderRegion *region, JpegReaderFormat *format, void *user_data);
+
+// Called for each decoded scanline in the region, in order. y is the row
+//   number in the whole image. The row is in the format that the start
+//   function chose, starts at the left edge of the region, and is only 
+//   valid for the duration of the call
+typedef void (*JpegReaderRowFn) (const BYTE *row, int y, void *user_data);
+
 BEGIN_DECLS
 
-void     jpegreader_file_to_mem (const char *filename, int *jpeg_height, 
-            int *jpeg_width, int *bytespp, char **buffer, char **error);
-BOOL     jpegreader_check (const char *filename, char **error);
-BOOL     jpegreader_get_image_size (const char *filename, int *height, 
-            int *width, int *components);
+void     jpegreader_decode (const char *filename, int min_width,
+            int min_height, JpegReaderStartFn start_fn, 
+            JpegReaderRowFn row_fn, void *user_data, char **error);
+void     jpegreader_set_max_scans (int max_scans);
 
 END_DECLS
 
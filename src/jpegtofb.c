@@ -9,194 +9,335 @@
 
 ==========================================================================*/
 #define _GNU_SOURCE
-#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include "jpeglib.h"
-#include <sys/ioctl.h>
 #include <linux/fb.h>
-#include <sys/mman.h>
 #include <errno.h>
 #include <string.h>
 #include "log.h" 
+#include "framebuffer.h" 
 #include "jpegreader.h" 
+#include "scaler.h" 
 #include "jpegtofb.h" 
 
+// Dither the picture on 16-bit framebuffers
+static BOOL jpegtofb_dither = FALSE;
+
+// Scale with a smoothing filter, rather than by sampling
+static BOOL jpegtofb_smooth = FALSE;
+
+// State shared between the decoder callbacks while an image is
+//   streamed onto the framebuffer. Nothing in here is proportional
+//   to the image height -- the only buffers are one row wide
+
+typedef struct _JpegToFbStream
+  {
+  char *fbdata;
+  int fb_width;
+  int fb_height;
+  int fb_bytes;
+  int stride;
+  const struct fb_var_screeninfo *vinfo;
+  const Blitter *blitter;
+  BOOL fit_to_width;
+  int in_width;
+  int in_height;
+  int fit_width;
+  int fit_height;
+  int x_off;
+  int y_off;
+  // The span of screen columns that the picture covers, after 
+  //  clipping
+  int first_col;
+  int n_cols;
+  // Scales decoded rows to the fitted size, producing only the 
+  //  visible part. NULL if the decoder produces the fitted size itself
+  Scaler *scaler;
+  // Whether the decoder produces the framebuffer's own pixels
+  BOOL native;
+  } JpegToFbStream;
+
+
+/*==========================================================================
+
+  jpegtofb_set_dither
+
+==========================================================================*/
+void jpegtofb_set_dither (BOOL dither)
+  {
+  jpegtofb_dither = dither;
+  }
+
+
+/*==========================================================================
+
+  jpegtofb_set_smooth
+
+==========================================================================*/
+void jpegtofb_set_smooth (BOOL smooth)
+  {
+  jpegtofb_smooth = smooth;
+  }
+
+
+/*==========================================================================
+
+  jpegtofb_clear_rows
+
+  Blank framebuffer rows [from, to), clipped to the screen 
+
+==========================================================================*/
+static void jpegtofb_clear_rows (JpegToFbStream *s, int from, int to)
+  {
+  if (from < 0) from = 0;
+  if (to > s->fb_height) to = s->fb_height;
+  for (int y = from; y < to; y++)
+    memset (s->fbdata + y * s->stride, 0, s->fb_width * s->fb_bytes);
+  }
+
+
+/*==========================================================================
+
+  jpegtofb_put_row
+
+  Called by the scaler with each visible output row, already scaled to 
+  the visible width. Convert it straight into the framebuffer, 
+  blanking the margins either side of the picture
+
+==========================================================================*/
+static void jpegtofb_put_row (const BYTE *row, int y, void *user_data)
+  {
+  JpegToFbStream *s = user_data;
+  char *fbrow = s->fbdata + (y + s->y_off) * s->stride;
+  int last_col = s->first_col + s->n_cols;
+
+  memset (fbrow, 0, s->first_col * s->fb_bytes);
+  memset (fbrow + last_col * s->fb_bytes, 0, 
+      (s->fb_width - last_col) * s->fb_bytes);
+
+  if (jpegtofb_dither && s->blitter->blit_row_dither)
+    s->blitter->blit_row_dither ((BYTE *)fbrow + s->first_col * s->fb_bytes,
+      row, s->n_cols, s->first_col, y + s->y_off);
+  else
+    s->blitter->blit_row ((BYTE *)fbrow + s->first_col * s->fb_bytes, 
+      row, s->n_cols, s->vinfo);
+  }
+
+
+/*==========================================================================
+
+  jpegtofb_native_format
+
+  The format in which the decoder can produce pixels for this 
+  framebuffer directly, if there is one; otherwise RGB888
+
+==========================================================================*/
+static JpegReaderFormat jpegtofb_native_format (const Blitter *blitter)
+  {
+  switch (blitter->format)
+    {
+    case BLIT_FORMAT_XRGB8888:
+      return JPEGREADER_XRGB8888;
+    case BLIT_FORMAT_XBGR8888:
+      return JPEGREADER_XBGR8888;
+    case BLIT_FORMAT_RGB565:
+      return jpegtofb_dither ? JPEGREADER_RGB565_DITHER : JPEGREADER_RGB565;
+    default:
+      return JPEGREADER_RGB888;
+    }
+  }
+
 
 /*==========================================================================
 
-  transform
+  jpegtofb_start
 
-  The buffers pointed to on entry are both 3-bytes per pixel although,
-  of course, the output buffer is empty, and will get filled up.
-  After the transformation, the 3-byte per pixel output buffer will
-  get transformed to match the framebuffer pixel size.
+  Called by the reader when the decoded image size is known. Works
+  out how the image will be fitted to the screen, and blanks the
+  parts of the screen above the image. If the image is cropped to fit
+  the screen -- the top and bottom, usually, with --fit-width -- the
+  reader is asked to decode only the part that will be seen. 
 
-  This function will behave very badly if the input and output
-  images are different aspect ratios
+  If the decoder has already produced the fitted size -- as it often 
+  does with --fit-width, because it can scale by N/8 -- no scaler is
+  needed. If it can write the framebuffer's pixel format, too, the
+  rows are copied straight onto the screen; if not, they are just
+  converted
 
 ==========================================================================*/
-static void transform (char *in, int in_height, int in_width, char *out, 
-    int out_height, int out_width)
+static void jpegtofb_start (int width, int height, 
+      JpegReaderRegion *region, JpegReaderFormat *format, void *user_data)
   {
   LOG_IN
-  if (in_height == out_height && in_width == out_width)
+  JpegToFbStream *s = user_data;
+  s->in_width = width;
+  s->in_height = height;
+
+  double aspect = (double)width / (double) height;
+  
+  if (s->fit_to_width)
     {
-    // No need to scale -- just copy the input to the 
-    //   output
-    int size = in_width * in_height * 3;
-    memcpy (out, in, size);
+    s->fit_width = s->fb_width;
+    s->fit_height = s->fit_width / aspect;
     }
   else
     {
-    double scale = (double)in_width / (double)out_width;
-    log_debug ("transform: scale=%f", scale);
-    for (int i = 0; i < out_height; i++)
-      {
-      int new_y = i * scale;
-      for (int j = 0; j < out_width; j++)
-        {
-        int new_x = j * scale; 
-        int index24in = (new_y * in_width + new_x) * 3;
-        int index24out = (i * out_width + j) * 3;
-        char r = in[index24in + 0];
-        char g = in[index24in + 1];
-        char b = in[index24in + 2];
-        out[index24out + 0] = r;
-        out[index24out + 1] = g;
-        out[index24out + 2] = b;
-        }
-      }
+    s->fit_height = s->fb_height;
+    s->fit_width = (int) s->fit_height * aspect;
+    }
+
+  BOOL exact = s->fit_to_width ? width == s->fb_width 
+    : height == s->fb_height;
+  if (exact)
+    {
+    // Don't let rounding in the aspect ratio spoil an exact fit
+    s->fit_width = width;
+    s->fit_height = height;
+    }
+
+  // xoff is the number of pixels between the left edge of the photo,
+  //   and the left edge of the screen. 
+  // If the picture is wider than the screen, then x_off will be negative,
+  //  and some parts of the picture will not be displayed
+  // If the picture is narrower than the screen, the x_off will be positive,
+  //  and some parts of the screen will be black
+ 
+  s->x_off = (s->fb_width - s->fit_width) / 2;
+  s->y_off = (s->fb_height - s->fit_height) / 2;
+
+  if (s->fit_width < 1) s->fit_width = 1;
+  if (s->fit_height < 1) s->fit_height = 1;
+
+  s->first_col = s->x_off > 0 ? s->x_off : 0; 
+  int last_col = s->x_off + s->fit_width; 
+  if (last_col > s->fb_width) last_col = s->fb_width;
+  s->n_cols = last_col - s->first_col;
+
+  int first_row = s->y_off > 0 ? s->y_off : 0; 
+  int last_row = s->y_off + s->fit_height; 
+  if (last_row > s->fb_height) last_row = s->fb_height;
+
+  if (exact) 
+    {
+    *format = jpegtofb_native_format (s->blitter);
+    s->native = *format != JPEGREADER_RGB888;
+    log_debug ("start: no scaling, %s %s", s->native ? "decoding direct to" 
+      : "converting to", s->blitter->name);
+    region->x = s->first_col - s->x_off;
+    region->width = s->n_cols;
+    region->y = first_row - s->y_off;
+    region->height = last_row - first_row;
     }
+  else
+    {
+    s->scaler = scaler_create (width, height, s->fit_width, s->fit_height,
+      s->first_col - s->x_off, s->n_cols, first_row - s->y_off, 
+      last_row - first_row, jpegtofb_smooth, jpegtofb_put_row, s);
+    scaler_crop_input (s->scaler, &region->x, &region->y, &region->width,
+      &region->height);
+    }
+
+  jpegtofb_clear_rows (s, 0, s->y_off);
   LOG_OUT
   }
 
 
+/*==========================================================================
+
+  jpegtofb_row
+
+  Called by the reader for each decoded row of the region, which just 
+  gets passed on to the scaler -- unless it is already the right size,
+  in which case it is converted straight into place, or, if it is in 
+  the framebuffer's format, copied
+
+==========================================================================*/
+static void jpegtofb_row (const BYTE *row, int y, void *user_data)
+  {
+  JpegToFbStream *s = user_data;
+  if (s->scaler)
+    {
+    scaler_push_row (s->scaler, row);
+    }
+  else if (!s->native)
+    {
+    jpegtofb_put_row (row, y, s);
+    }
+  else
+    {
+    char *fbrow = s->fbdata + (y + s->y_off) * s->stride;
+    int last_col = s->first_col + s->n_cols;
+    memset (fbrow, 0, s->first_col * s->fb_bytes);
+    memset (fbrow + last_col * s->fb_bytes, 0, 
+      (s->fb_width - last_col) * s->fb_bytes);
+    memcpy (fbrow + s->first_col * s->fb_bytes, row, 
+      s->n_cols * s->fb_bytes);
+    }
+  }
+
 
 /*==========================================================================
 
-  jpegtofb_putonfb
+  jpegtofb_render
+
+  Decode the file onto a surface that is laid out like the framebuffer.
+  The whole surface is drawn, including the black margins, so it does
+  not need to be cleared first
 
 ==========================================================================*/
-void jpegtofb_putonfb (const char *fbdev, const char *filename, 
+void jpegtofb_render (const FbSurface *surface, const char *filename, 
      BOOL fit_to_width, char **error)
   {
   LOG_IN
   *error = NULL;  
 
-  // Read the JPEG file into a buffer. The buffer _should_ be 
-  //  3 bytes per pixel. I'm not sure what to do if it isn't
+  JpegToFbStream s;
+  memset (&s, 0, sizeof (s));
+  s.fbdata = (char *)surface->data;
+  s.fb_width = surface->width;
+  s.fb_height = surface->height;
+  s.fb_bytes = surface->bytes_per_pixel;
+  s.stride = surface->stride;
+  s.vinfo = &surface->vinfo;
+  s.blitter = &surface->blitter;
+  s.fit_to_width = fit_to_width;
 
-  int jpeg_width = 0, jpeg_height = 0, jpeg_bytes = 0;
-  char *bmp_buffer = 0;
+  // Rows go straight from the decoder, through the scaler, and onto
+  //  the surface. We know the surface size at this point, so the 
+  //  reader can decode at a reduced scale, so long as the result is 
+  //  still big enough to fill the dimension we're fitting to
+
+  jpegreader_decode (filename, fit_to_width ? s.fb_width : 0, 
+    fit_to_width ? 0 : s.fb_height, jpegtofb_start, jpegtofb_row, 
+    &s, error);
 
-  jpegreader_file_to_mem (filename, &jpeg_height, &jpeg_width, 
-    &jpeg_bytes, &bmp_buffer, error);
   if (*error == NULL)
+    jpegtofb_clear_rows (&s, s.y_off + s.fit_height, s.fb_height);
+
+  scaler_destroy (s.scaler);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  jpegtofb_putonfb
+
+  Decode the file onto the framebuffer session fb, which will be 
+  opened, or reopened if its mode has changed, as necessary
+
+==========================================================================*/
+void jpegtofb_putonfb (FrameBuffer *fb, const char *filename, 
+     BOOL fit_to_width, char **error)
+  {
+  LOG_IN
+  *error = NULL;  
+
+  if (framebuffer_refresh (fb, error))
     {
-    int fbfd = open (fbdev, O_RDWR);
-    if (fbfd >= 0)
-      {
-      struct fb_fix_screeninfo finfo;
-      struct fb_var_screeninfo vinfo;
-
-      ioctl (fbfd, FBIOGET_FSCREENINFO, &finfo);
-      ioctl (fbfd, FBIOGET_VSCREENINFO, &vinfo);
-
-      log_debug ("putonfb: smem_len %d", finfo.smem_len);
-      log_debug ("putonfb: line_len %d", finfo.line_length);
-      log_debug ("putonfb: xres %d", vinfo.xres); 
-      log_debug ("putonfb: yres %d", vinfo.yres); 
-      log_debug ("putonfb: bpp %d", vinfo.bits_per_pixel); 
-
-      int fb_width = vinfo.xres;
-      int fb_height = vinfo.yres;
-      int fb_bpp = vinfo.bits_per_pixel;
-      int fb_bytes = fb_bpp / 8;
-
-      double aspect = (double)jpeg_width / (double) jpeg_height;
-  
-      int fit_width, fit_height;
-      if (fit_to_width)
-        {
-        fit_width = fb_width;
-        fit_height = fit_width / aspect;
-        }
-      else
-        {
-        fit_height = fb_height;
-        fit_width = (int) fit_height * aspect;
-        }
-
-      char *out_24bpp = malloc (fit_height * fit_width * 3);
-      transform (bmp_buffer, jpeg_height, jpeg_width, 
-        out_24bpp, fit_height, fit_width);
-
-      int fb_data_size = fb_width * fb_height * fb_bytes;
-      log_debug ("putonfb: data_size %d", fb_data_size);
-
-      char *fbdata = mmap (0, fb_data_size, 
-	     PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, (off_t)0);
-
-      memset (fbdata, 0, fb_data_size); 
-
-      // xoff is the number of pixels between the left edge of the photo,
-      //   and the left edge of the screen. 
-      // If the picture is wider than the screen, then x_off will be negative,
-      //  and some parts of the picture will not be displayed
-      // If the picture is narrower than the screen, the x_off will be positive,
-      //  and some parts of the screen will be black
- 
-      int x_off = (fb_width - fit_width) / 2;
-
-      int y_off = (fb_height - fit_height) / 2;
-
-      int stride = finfo.line_length;	/* stride may be in bytes, not pixels */
-      int transp_len = vinfo.transp.length; 
-
-      int y24 = -y_off;
-      for (int i = 0; i < fb_height; i++)
-	{
-        int y32 = i;
-        if (y32 >= 0 && y32 < fb_height)
-          {
-          int x24 = -x_off;
-	  for (int j = 0; j < fb_width; j++)
-	    {
-            int x32 = j;
-            if (x32 > 0 && x32 < fb_width && x24 > 0 && x24 < fit_width)
-              {
-	      int index24 = (y24 * fit_width + x24) * 3;
-	      int index32 = (y32 * stride) + (x32 * fb_bytes);
-              /* only ~`fb_data_size' is writable, 
-                   even if `smem_len' is bigger */
-              if (index32 >= fb_data_size)
-                 break;
-	      char r = out_24bpp [index24++];
-	      char g = out_24bpp [index24++];
-	      char b = out_24bpp [index24];
-	      fbdata [index32++] = b;
-	      fbdata [index32++] = g;
-	      fbdata [index32++] = r;
-              if (transp_len == 8)
-	        fbdata [index32] = 0xFF;
-              }
-            x24++;
-            }
-	  }
-        y24++;
-        }
-      munmap (fbdata, fb_data_size);
-      free (out_24bpp);
-      }
-    else
-      {
-      asprintf (error, "Can't open framebuffer '%s': %s", fbdev, 
-        strerror (errno));
-      }
-    free(bmp_buffer);
-    close (fbfd);
+    FbSurface surface;
+    framebuffer_get_surface (fb, &surface);
+    jpegtofb_render (&surface, filename, fit_to_width, error);
     }
   LOG_OUT
   }
@@ -9,10 +9,15 @@
 #pragma once
 
 #include "defs.h"
+#include "framebuffer.h"
 
 BEGIN_DECLS
 
-void jpegtofb_putonfb (const char *fbdev, const char *filename, 
+void jpegtofb_set_dither (BOOL dither);
+void jpegtofb_set_smooth (BOOL smooth);
+void jpegtofb_putonfb (FrameBuffer *fb, const char *filename, 
+        BOOL fit_to_width, char **error);
+void jpegtofb_render (const FbSurface *surface, const char *filename, 
         BOOL fit_to_width, char **error);
 
 END_DECLS
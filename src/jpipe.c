@@ -0,0 +1,138 @@
+/*
+ * jpipe.c
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains the single-producer, single-consumer ring that links
+ * the stages of a pipelined decode.  See jpipe.h for the interface.
+ *
+ * The counts run freely and wrap; head - tail is the number of full slots.
+ * A waiting thread registers itself in 'sleepers' and then re-checks the
+ * ring before sleeping; a committing thread stores its count and then
+ * checks 'sleepers'.  Both use sequentially consistent atomics, so either
+ * the waiter sees the new count or the committer sees the waiter, and a
+ * wakeup cannot be lost.
+ */
+
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jpipe.h"
+
+#define LOAD(p)		__atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+
+
+GLOBAL(void)
+jpipe_init (jpipe_ring * ring, unsigned int slots)
+{
+  ring->slots = slots;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->sleepers = 0;
+  ring->closed = FALSE;
+  pthread_mutex_init(&ring->mutex, NULL);
+  pthread_cond_init(&ring->cond, NULL);
+}
+
+
+GLOBAL(void)
+jpipe_term (jpipe_ring * ring)
+{
+  pthread_cond_destroy(&ring->cond);
+  pthread_mutex_destroy(&ring->mutex);
+}
+
+
+/*
+ * Wake any thread that is waiting for the ring to change.
+ */
+
+LOCAL(void)
+wake_sleepers (jpipe_ring * ring)
+{
+  if (LOAD(&ring->sleepers) != 0) {
+    pthread_mutex_lock(&ring->mutex);
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->mutex);
+  }
+}
+
+
+/*
+ * Return TRUE if a slot is free (for the producer) or full (for the
+ * consumer), or the ring has been closed.
+ */
+
+LOCAL(boolean)
+can_write (jpipe_ring * ring)
+{
+  return LOAD(&ring->closed) ||
+	 ring->head - LOAD(&ring->tail) < ring->slots;
+}
+
+LOCAL(boolean)
+can_read (jpipe_ring * ring)
+{
+  return LOAD(&ring->closed) || LOAD(&ring->head) != ring->tail;
+}
+
+
+GLOBAL(int)
+jpipe_acquire_write (jpipe_ring * ring)
+{
+  if (! can_write(ring)) {
+    pthread_mutex_lock(&ring->mutex);
+    STORE(&ring->sleepers, ring->sleepers + 1);
+    while (! can_write(ring))
+      pthread_cond_wait(&ring->cond, &ring->mutex);
+    STORE(&ring->sleepers, ring->sleepers - 1);
+    pthread_mutex_unlock(&ring->mutex);
+  }
+  if (LOAD(&ring->closed))
+    return -1;
+  return (int) (ring->head % ring->slots);
+}
+
+
+GLOBAL(void)
+jpipe_commit_write (jpipe_ring * ring)
+{
+  STORE(&ring->head, ring->head + 1);
+  wake_sleepers(ring);
+}
+
+
+GLOBAL(int)
+jpipe_acquire_read (jpipe_ring * ring)
+{
+  if (! can_read(ring)) {
+    pthread_mutex_lock(&ring->mutex);
+    STORE(&ring->sleepers, ring->sleepers + 1);
+    while (! can_read(ring))
+      pthread_cond_wait(&ring->cond, &ring->mutex);
+    STORE(&ring->sleepers, ring->sleepers - 1);
+    pthread_mutex_unlock(&ring->mutex);
+  }
+  if (LOAD(&ring->head) == ring->tail)
+    return -1;			/* closed, and nothing left */
+  return (int) (ring->tail % ring->slots);
+}
+
+
+GLOBAL(void)
+jpipe_commit_read (jpipe_ring * ring)
+{
+  STORE(&ring->tail, ring->tail + 1);
+  wake_sleepers(ring);
+}
+
+
+GLOBAL(void)
+jpipe_close (jpipe_ring * ring)
+{
+  pthread_mutex_lock(&ring->mutex);
+  STORE(&ring->closed, TRUE);
+  pthread_cond_broadcast(&ring->cond);
+  pthread_mutex_unlock(&ring->mutex);
+}
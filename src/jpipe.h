@@ -0,0 +1,53 @@
+/*
+ * jpipe.h
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file declares a bounded single-producer, single-consumer ring,
+ * used to pass work between two threads of a decoding pipeline.  The
+ * ring only keeps count of its slots; the caller owns the storage, and
+ * indexes it with the slot numbers handed out here.
+ *
+ * The producer calls jpipe_acquire_write() to get a free slot, fills it,
+ * and publishes it with jpipe_commit_write(); the consumer does the same
+ * with jpipe_acquire_read() and jpipe_commit_read().  So long as the ring
+ * is neither full nor empty, these are lock-free: each side publishes its
+ * count with an atomic store, and reads the other side's with an atomic
+ * load.  A side that has to wait sleeps on a condition variable, which
+ * the other side signals only if someone is asleep.
+ *
+ * jpipe_close() may be called by either side.  After that, the producer
+ * gets no more free slots, and the consumer gets only the slots that were
+ * already committed; both then get -1.
+ */
+
+#include <pthread.h>
+
+#ifdef NEED_SHORT_EXTERNAL_NAMES
+#define jpipe_init		jPinit
+#define jpipe_term		jPterm
+#define jpipe_acquire_write	jPacqwrite
+#define jpipe_commit_write	jPcomwrite
+#define jpipe_acquire_read	jPacqread
+#define jpipe_commit_read	jPcomread
+#define jpipe_close		jPclose
+#endif /* NEED_SHORT_EXTERNAL_NAMES */
+
+typedef struct {
+  unsigned int slots;		/* number of slots in the ring */
+  unsigned int head;		/* slots committed by the producer */
+  unsigned int tail;		/* slots committed by the consumer */
+  int sleepers;			/* threads waiting on cond */
+  int closed;			/* set by jpipe_close() */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} jpipe_ring;
+
+EXTERN(void) jpipe_init JPP((jpipe_ring * ring, unsigned int slots));
+EXTERN(void) jpipe_term JPP((jpipe_ring * ring));
+EXTERN(int) jpipe_acquire_write JPP((jpipe_ring * ring));
+EXTERN(void) jpipe_commit_write JPP((jpipe_ring * ring));
+EXTERN(int) jpipe_acquire_read JPP((jpipe_ring * ring));
+EXTERN(void) jpipe_commit_read JPP((jpipe_ring * ring));
+EXTERN(void) jpipe_close JPP((jpipe_ring * ring));
@@ -0,0 +1,290 @@
+/*
+ * jsimd.c
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains the SIMD dispatch layer: it probes the CPU once and
+ * routes each accelerated routine to the best kernel available.
+ * See jsimd.h for the interface.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+#include <stdlib.h>
+#include <pthread.h>
+#ifdef JSIMD_ARM
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON  (1 << 12)	/* from the 32-bit ARM <asm/hwcap.h> */
+#endif
+#endif
+
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+/* The kernels chosen for this CPU, or NULL to use the C code */
+static inverse_DCT_method_ptr idct_islow_kernel = NULL;
+static jsimd_ycc_rgb_run_ptr ycc_rgb_run = NULL;
+static jsimd_h2v1_fancy_run_ptr h2v1_fancy_run = NULL;
+static jsimd_h2v2_fancy_run_ptr h2v2_fancy_run = NULL;
+
+
+/*
+ * Return TRUE if the environment variable 'name' is set to "1".
+ */
+
+LOCAL(boolean)
+env_flag (const char * name)
+{
+  const char * value = getenv(name);
+
+  return (value != NULL && value[0] == '1' && value[1] == '\0');
+}
+
+
+/*
+ * Probe the CPU and choose the kernels.  Called exactly once, via
+ * pthread_once(), because images may be decoded on more than one thread.
+ */
+
+LOCAL(void)
+init_simd (void)
+{
+  if (env_flag("JSIMD_FORCENONE"))
+    return;
+  /* The kernels assume the standard 8-bit configuration */
+  if (SIZEOF(JCOEF) != 2 || SIZEOF(ISLOW_MULT_TYPE) != 4)
+    return;
+
+#ifdef JSIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    idct_islow_kernel = jsimd_idct_islow_sse2;
+    ycc_rgb_run = jsimd_ycc_rgb_run_sse2;
+    h2v1_fancy_run = jsimd_h2v1_fancy_run_sse2;
+    h2v2_fancy_run = jsimd_h2v2_fancy_run_sse2;
+  }
+  if (__builtin_cpu_supports("avx2") && ! env_flag("JSIMD_FORCESSE2"))
+    idct_islow_kernel = jsimd_idct_islow_avx2;
+#endif
+#ifdef JSIMD_ARM
+#ifndef __aarch64__
+  if ((getauxval(AT_HWCAP) & HWCAP_NEON) == 0)
+    return;
+#endif
+  idct_islow_kernel = jsimd_idct_islow_neon;
+  ycc_rgb_run = jsimd_ycc_rgb_run_neon;
+  h2v1_fancy_run = jsimd_h2v1_fancy_run_neon;
+  h2v2_fancy_run = jsimd_h2v2_fancy_run_neon;
+#endif
+}
+
+
+LOCAL(void)
+probe_simd (void)
+{
+  pthread_once(&simd_once, init_simd);
+}
+
+
+/*
+ * Inverse DCT.
+ */
+
+GLOBAL(int)
+jsimd_can_idct_islow (void)
+{
+  probe_simd();
+  return idct_islow_kernel != NULL;
+}
+
+
+GLOBAL(void)
+jsimd_idct_islow (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		  JCOEFPTR coef_block,
+		  JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  (*idct_islow_kernel) (cinfo, compptr, coef_block, output_buf, output_col);
+}
+
+
+/*
+ * YCbCr->RGB colour conversion.  The kernel does as much of each row as
+ * it can; the rest is done here, with the same arithmetic that
+ * build_ycc_rgb_table() (jdcolor.c) uses to fill its tables.
+ */
+
+#undef FIX			/* jdct.h's version is for the IDCT */
+#define SCALEBITS	16
+#define ONE_HALF	((INT32) 1 << (SCALEBITS-1))
+#define FIX(x)		((INT32) ((x) * (1L<<SCALEBITS) + 0.5))
+
+GLOBAL(int)
+jsimd_can_ycc_rgb (j_decompress_ptr cinfo)
+{
+  probe_simd();
+  /* The kernels write packed R,G,B triples */
+  if (RGB_PIXELSIZE != 3 || RGB_RED != 0 || RGB_GREEN != 1 || RGB_BLUE != 2)
+    return 0;
+  return ycc_rgb_run != NULL;
+}
+
+
+GLOBAL(void)
+jsimd_ycc_rgb_convert (j_decompress_ptr cinfo,
+		       JSAMPIMAGE input_buf, JDIMENSION input_row,
+		       JSAMPARRAY output_buf, int num_rows)
+{
+  JSAMPLE * range_limit = cinfo->sample_range_limit;
+  JDIMENSION num_cols = cinfo->output_width;
+  JSAMPROW inptr0, inptr1, inptr2, outptr;
+  JDIMENSION col;
+  int y, cb, cr;
+  SHIFT_TEMPS
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    col = (*ycc_rgb_run) (inptr0, inptr1, inptr2, outptr, num_cols);
+    for (outptr += col * RGB_PIXELSIZE; col < num_cols; col++) {
+      y  = GETJSAMPLE(inptr0[col]);
+      cb = GETJSAMPLE(inptr1[col]) - CENTERJSAMPLE;
+      cr = GETJSAMPLE(inptr2[col]) - CENTERJSAMPLE;
+      outptr[RGB_RED] = range_limit[y + (int)
+	RIGHT_SHIFT(FIX(1.40200) * cr + ONE_HALF, SCALEBITS)];
+      outptr[RGB_GREEN] = range_limit[y + (int)
+	RIGHT_SHIFT((- FIX(0.34414)) * cb + ONE_HALF +
+		    (- FIX(0.71414)) * cr, SCALEBITS)];
+      outptr[RGB_BLUE] = range_limit[y + (int)
+	RIGHT_SHIFT(FIX(1.77200) * cb + ONE_HALF, SCALEBITS)];
+      outptr += RGB_PIXELSIZE;
+    }
+  }
+}
+
+
+/*
+ * Fancy upsampling.  The first and last columns, and whatever the kernel
+ * leaves over, are done here exactly as in jdsample.c.
+ */
+
+GLOBAL(int)
+jsimd_can_h2v1_fancy_upsample (void)
+{
+  probe_simd();
+  return h2v1_fancy_run != NULL;
+}
+
+
+GLOBAL(void)
+jsimd_h2v1_fancy_upsample (j_decompress_ptr cinfo,
+			   jpeg_component_info * compptr,
+			   JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+  JSAMPARRAY output_data = *output_data_ptr;
+  JSAMPROW inptr, outptr;
+  int invalue;
+  JDIMENSION colctr, done;
+  int inrow;
+
+  for (inrow = 0; inrow < cinfo->max_v_samp_factor; inrow++) {
+    inptr = input_data[inrow];
+    outptr = output_data[inrow];
+    /* Special case for first column */
+    invalue = GETJSAMPLE(*inptr++);
+    *outptr++ = (JSAMPLE) invalue;
+    *outptr++ = (JSAMPLE) ((invalue * 3 + GETJSAMPLE(*inptr) + 2) >> 2);
+
+    done = (*h2v1_fancy_run) (inptr, outptr,
+			      compptr->downsampled_width - 2);
+    inptr += done;
+    outptr += done * 2;
+    for (colctr = compptr->downsampled_width - 2 - done; colctr > 0;
+	 colctr--) {
+      /* General case: 3/4 * nearer pixel + 1/4 * further pixel */
+      invalue = GETJSAMPLE(*inptr++) * 3;
+      *outptr++ = (JSAMPLE) ((invalue + GETJSAMPLE(inptr[-2]) + 1) >> 2);
+      *outptr++ = (JSAMPLE) ((invalue + GETJSAMPLE(*inptr) + 2) >> 2);
+    }
+
+    /* Special case for last column */
+    invalue = GETJSAMPLE(*inptr);
+    *outptr++ = (JSAMPLE) ((invalue * 3 + GETJSAMPLE(inptr[-1]) + 1) >> 2);
+    *outptr++ = (JSAMPLE) invalue;
+  }
+}
+
+
+GLOBAL(int)
+jsimd_can_h2v2_fancy_upsample (void)
+{
+  probe_simd();
+  return h2v2_fancy_run != NULL;
+}
+
+
+GLOBAL(void)
+jsimd_h2v2_fancy_upsample (j_decompress_ptr cinfo,
+			   jpeg_component_info * compptr,
+			   JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+  JSAMPARRAY output_data = *output_data_ptr;
+  JSAMPROW inptr0, inptr1, outptr;
+  int thiscolsum, lastcolsum, nextcolsum;
+  JDIMENSION colctr, done;
+  int inrow, outrow, v;
+
+  inrow = outrow = 0;
+  while (outrow < cinfo->max_v_samp_factor) {
+    for (v = 0; v < 2; v++) {
+      /* inptr0 points to nearest input row, inptr1 points to next nearest */
+      inptr0 = input_data[inrow];
+      if (v == 0)		/* next nearest is row above */
+	inptr1 = input_data[inrow-1];
+      else			/* next nearest is row below */
+	inptr1 = input_data[inrow+1];
+      outptr = output_data[outrow++];
+
+      /* Special case for first column */
+      thiscolsum = GETJSAMPLE(*inptr0++) * 3 + GETJSAMPLE(*inptr1++);
+      nextcolsum = GETJSAMPLE(*inptr0++) * 3 + GETJSAMPLE(*inptr1++);
+      *outptr++ = (JSAMPLE) ((thiscolsum * 4 + 8) >> 4);
+      *outptr++ = (JSAMPLE) ((thiscolsum * 3 + nextcolsum + 7) >> 4);
+      lastcolsum = thiscolsum; thiscolsum = nextcolsum;
+
+      /* The kernel starts from the second column, which the loop below
+       * has in hand as thiscolsum.
+       */
+      done = (*h2v2_fancy_run) (inptr0 - 1, inptr1 - 1, outptr,
+				compptr->downsampled_width - 2);
+      if (done > 0) {
+	inptr0 += done;
+	inptr1 += done;
+	outptr += done * 2;
+	lastcolsum = GETJSAMPLE(inptr0[-2]) * 3 + GETJSAMPLE(inptr1[-2]);
+	thiscolsum = GETJSAMPLE(inptr0[-1]) * 3 + GETJSAMPLE(inptr1[-1]);
+      }
+
+      for (colctr = compptr->downsampled_width - 2 - done; colctr > 0;
+	   colctr--) {
+	/* General case: 3/4 * nearer pixel + 1/4 * further pixel in each */
+	/* dimension, thus 9/16, 3/16, 3/16, 1/16 overall */
+	nextcolsum = GETJSAMPLE(*inptr0++) * 3 + GETJSAMPLE(*inptr1++);
+	*outptr++ = (JSAMPLE) ((thiscolsum * 3 + lastcolsum + 8) >> 4);
+	*outptr++ = (JSAMPLE) ((thiscolsum * 3 + nextcolsum + 7) >> 4);
+	lastcolsum = thiscolsum; thiscolsum = nextcolsum;
+      }
+
+      /* Special case for last column */
+      *outptr++ = (JSAMPLE) ((thiscolsum * 3 + lastcolsum + 8) >> 4);
+      *outptr++ = (JSAMPLE) ((thiscolsum * 4 + 7) >> 4);
+    }
+    inrow++;
+  }
+}
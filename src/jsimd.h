@@ -0,0 +1,154 @@
+/*
+ * jsimd.h
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file declares the SIMD dispatch layer.  At the first call into any
+ * jsimd_can_XXX() routine the host CPU is probed once, and the fastest
+ * implementation it supports is chosen for each accelerated routine:
+ * the islow IDCT, YCbCr->RGB conversion, and h2v1/h2v2 fancy upsampling.
+ * The library modules ask jsimd_can_XXX() whether an accelerated version
+ * is usable and, if so, install jsimd_XXX() as their method; otherwise
+ * they keep the portable C code.  Every accelerated routine produces
+ * exactly the same output as the C routine it replaces.
+ *
+ * Setting the environment variable JSIMD_FORCENONE=1 disables all SIMD
+ * code, and JSIMD_FORCESSE2=1 restricts x86 hosts to the SSE2 kernels;
+ * both are useful for checking that the kernels agree with the C code.
+ */
+
+/*
+ * The kernels are written with GCC vector extensions (or, for SSE2, with
+ * intrinsics), and built once per instruction set using function-level
+ * target attributes, so that one binary can run on any CPU of the family.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 9 && \
+    defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && \
+    BITS_IN_JSAMPLE == 8 && DCTSIZE == 8
+#if defined(__x86_64__) || defined(__i386__)
+#define JSIMD_X86
+#elif defined(__aarch64__) || \
+      (defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+#define JSIMD_ARM
+#endif
+#endif
+
+
+#ifdef NEED_SHORT_EXTERNAL_NAMES
+#define jsimd_can_idct_islow		jSCidctislow
+#define jsimd_idct_islow		jSidctislow
+#define jsimd_idct_islow_sse2		jSidctislowsse2
+#define jsimd_idct_islow_avx2		jSidctislowavx2
+#define jsimd_idct_islow_neon		jSidctislowneon
+#define jsimd_can_ycc_rgb		jSCyccrgb
+#define jsimd_ycc_rgb_convert		jSyccrgb
+#define jsimd_ycc_rgb_run_sse2		jSyccrgbsse2
+#define jsimd_ycc_rgb_run_neon		jSyccrgbneon
+#define jsimd_can_h2v1_fancy_upsample	jSCh2v1fancy
+#define jsimd_h2v1_fancy_upsample	jSh2v1fancy
+#define jsimd_h2v1_fancy_run_sse2	jSh2v1fancysse2
+#define jsimd_h2v1_fancy_run_neon	jSh2v1fancyneon
+#define jsimd_can_h2v2_fancy_upsample	jSCh2v2fancy
+#define jsimd_h2v2_fancy_upsample	jSh2v2fancy
+#define jsimd_h2v2_fancy_run_sse2	jSh2v2fancysse2
+#define jsimd_h2v2_fancy_run_neon	jSh2v2fancyneon
+#endif /* NEED_SHORT_EXTERNAL_NAMES */
+
+/*
+ * Output of the IDCT for a block whose AC terms are all zero: a flat square
+ * of one sample value, computed exactly as jpeg_idct_islow()'s shortcuts
+ * compute it.  The kernels use this rather than doing two full passes for
+ * what is the commonest kind of block in smooth areas.  Only the IDCT
+ * modules, which include jdct.h, need it.
+ */
+
+#ifdef IDCT_range_limit
+
+static inline void
+jsimd_idct_islow_flat (j_decompress_ptr cinfo, ISLOW_MULT_TYPE * quantptr,
+		       JCOEFPTR coef_block,
+		       JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  int wsval = (((ISLOW_MULT_TYPE) coef_block[0]) * quantptr[0]) << 2;
+  JSAMPLE dcval;
+  JSAMPROW outptr;
+  int row, col;
+  SHIFT_TEMPS
+
+  dcval = range_limit[(int) DESCALE((INT32) wsval, 2+3) & RANGE_MASK];
+  for (row = 0; row < DCTSIZE; row++) {
+    outptr = output_buf[row] + output_col;
+    for (col = 0; col < DCTSIZE; col++)
+      outptr[col] = dcval;
+  }
+}
+
+#endif /* IDCT_range_limit */
+
+
+/* Dispatch entry points (jsimd.c).  These have the same signatures as
+ * the library methods they replace.
+ */
+EXTERN(int) jsimd_can_idct_islow JPP((void));
+EXTERN(void) jsimd_idct_islow
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+EXTERN(int) jsimd_can_ycc_rgb JPP((j_decompress_ptr cinfo));
+EXTERN(void) jsimd_ycc_rgb_convert
+    JPP((j_decompress_ptr cinfo, JSAMPIMAGE input_buf, JDIMENSION input_row,
+	 JSAMPARRAY output_buf, int num_rows));
+EXTERN(int) jsimd_can_h2v1_fancy_upsample JPP((void));
+EXTERN(void) jsimd_h2v1_fancy_upsample
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr));
+EXTERN(int) jsimd_can_h2v2_fancy_upsample JPP((void));
+EXTERN(void) jsimd_h2v2_fancy_upsample
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr));
+
+/* Kernels for runs of pixels, which return the number of pixels (input
+ * columns, for the upsamplers) they have processed.  The upsamplers read
+ * one column either side of the run.
+ */
+typedef JDIMENSION (*jsimd_ycc_rgb_run_ptr)
+    JPP((JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+	 JSAMPROW outptr, JDIMENSION count));
+typedef JDIMENSION (*jsimd_h2v1_fancy_run_ptr)
+    JPP((JSAMPROW inptr, JSAMPROW outptr, JDIMENSION count));
+typedef JDIMENSION (*jsimd_h2v2_fancy_run_ptr)
+    JPP((JSAMPROW inptr0, JSAMPROW inptr1,
+	 JSAMPROW outptr, JDIMENSION count));
+
+/* Per-instruction-set kernels (jsimd_sse2.c, jsimd_avx2.c, jsimd_neon.c) */
+#ifdef JSIMD_X86
+EXTERN(void) jsimd_idct_islow_sse2
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+EXTERN(void) jsimd_idct_islow_avx2
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+EXTERN(JDIMENSION) jsimd_ycc_rgb_run_sse2
+    JPP((JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+	 JSAMPROW outptr, JDIMENSION count));
+EXTERN(JDIMENSION) jsimd_h2v1_fancy_run_sse2
+    JPP((JSAMPROW inptr, JSAMPROW outptr, JDIMENSION count));
+EXTERN(JDIMENSION) jsimd_h2v2_fancy_run_sse2
+    JPP((JSAMPROW inptr0, JSAMPROW inptr1,
+	 JSAMPROW outptr, JDIMENSION count));
+#endif
+#ifdef JSIMD_ARM
+EXTERN(void) jsimd_idct_islow_neon
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+EXTERN(JDIMENSION) jsimd_ycc_rgb_run_neon
+    JPP((JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+	 JSAMPROW outptr, JDIMENSION count));
+EXTERN(JDIMENSION) jsimd_h2v1_fancy_run_neon
+    JPP((JSAMPROW inptr, JSAMPROW outptr, JDIMENSION count));
+EXTERN(JDIMENSION) jsimd_h2v2_fancy_run_neon
+    JPP((JSAMPROW inptr0, JSAMPROW inptr1,
+	 JSAMPROW outptr, JDIMENSION count));
+#endif
@@ -0,0 +1,26 @@
+/*
+ * jsimd_avx2.c
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file builds the x86 AVX2 kernels from the vector templates.
+ * Only the functions themselves are compiled for AVX2, so the rest of
+ * the program still runs on CPUs without it; jsimd.c checks for AVX2
+ * support before calling anything here.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+
+#ifdef JSIMD_X86
+
+#define JSIMD_LANES  8
+#define JSIMD_TARGET  __attribute__((__target__("avx2")))
+#define JSIMD_IDCT_ISLOW  jsimd_idct_islow_avx2
+#include "jsimdidct.h"
+
+#endif /* JSIMD_X86 */
@@ -0,0 +1,37 @@
+/*
+ * jsimd_neon.c
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file builds the ARM NEON kernels from the vector templates
+ * (jsimdidct.h and jsimdpix.h).
+ * NEON is always present on 64-bit ARM.  On 32-bit ARM (ARMv7 and later)
+ * only the functions themselves are compiled for NEON, so the program
+ * still runs on cores without it; jsimd.c checks the kernel's hardware
+ * capability flags before calling anything here.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+
+#ifdef JSIMD_ARM
+
+#define JSIMD_LANES  4
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define JSIMD_TARGET
+#else
+#define JSIMD_TARGET  __attribute__((__target__("fpu=neon")))
+#endif
+#define JSIMD_IDCT_ISLOW  jsimd_idct_islow_neon
+#include "jsimdidct.h"
+
+#define JSIMD_YCC_RGB_RUN  jsimd_ycc_rgb_run_neon
+#define JSIMD_H2V1_FANCY_RUN  jsimd_h2v1_fancy_run_neon
+#define JSIMD_H2V2_FANCY_RUN  jsimd_h2v2_fancy_run_neon
+#include "jsimdpix.h"
+
+#endif /* JSIMD_ARM */
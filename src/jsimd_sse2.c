@@ -0,0 +1,465 @@
+/*
+ * jsimd_sse2.c
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains the x86 SSE2 kernels.  Only the functions themselves
+ * are compiled for SSE2, so the rest of the program still runs on CPUs
+ * without it; jsimd.c checks for SSE2 support before calling anything here.
+ *
+ * SSE2 has no 32-bit multiply, so rather than use the 32-bit vector
+ * template (jsimdidct.h) the IDCT keeps its data in 16-bit lanes, eight to
+ * a register, and does all of its multiplications with PMADDWD, which
+ * forms a*c1 + b*c2 from pairs of 16-bit values.  The rotations of
+ * jidctint.c are regrouped so that every product has 16-bit operands;
+ * because integer multiplication distributes exactly, the sums are the
+ * same as jpeg_idct_islow()'s.  That needs the inputs of each pass to fit
+ * in 16 bits, with some headroom for the odd-part sums, so the kernel
+ * checks each block and hands any that do not to jpeg_idct_islow().  As
+ * with the template, only corrupt data ever gets that far.
+ *
+ * The colour converter and upsamplers work on runs of 16 pixels, and
+ * leave the ends of each row to the C code in jsimd.c.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+
+#ifdef JSIMD_X86
+
+#include <emmintrin.h>
+
+#define JSIMD_TARGET  __attribute__((__target__("sse2")))
+#define JSIMD_INLINE  static inline __attribute__((__always_inline__, \
+						    __target__("sse2")))
+
+#define CONST_BITS  13
+#define PASS1_BITS  2
+
+/* Largest dequantized coefficient for which pass 1 cannot overflow 32 bits
+ * (see jsimdidct.h), and largest pass-1 output that leaves room for the
+ * odd-part sums of pass 2 in 16 bits.
+ */
+#define PASS1_LIMIT  12000
+#define PASS2_LIMIT  16383
+
+/* A register holding the pair (c1, c2) four times, for PMADDWD */
+#define PAIR(c1, c2)  _mm_set_epi16(c2, c1, c2, c1, c2, c1, c2, c1)
+
+
+/*
+ * Transpose the 8x8 array of 16-bit values in v[0..7], in place.
+ */
+
+JSIMD_INLINE void
+transpose_8x8 (__m128i v[8])
+{
+  __m128i a0, a1, a2, a3, a4, a5, a6, a7, b0, b1, b2, b3, b4, b5, b6, b7;
+
+  a0 = _mm_unpacklo_epi16(v[0], v[1]);
+  a1 = _mm_unpackhi_epi16(v[0], v[1]);
+  a2 = _mm_unpacklo_epi16(v[2], v[3]);
+  a3 = _mm_unpackhi_epi16(v[2], v[3]);
+  a4 = _mm_unpacklo_epi16(v[4], v[5]);
+  a5 = _mm_unpackhi_epi16(v[4], v[5]);
+  a6 = _mm_unpacklo_epi16(v[6], v[7]);
+  a7 = _mm_unpackhi_epi16(v[6], v[7]);
+  b0 = _mm_unpacklo_epi32(a0, a2);
+  b1 = _mm_unpackhi_epi32(a0, a2);
+  b2 = _mm_unpacklo_epi32(a1, a3);
+  b3 = _mm_unpackhi_epi32(a1, a3);
+  b4 = _mm_unpacklo_epi32(a4, a6);
+  b5 = _mm_unpackhi_epi32(a4, a6);
+  b6 = _mm_unpacklo_epi32(a5, a7);
+  b7 = _mm_unpackhi_epi32(a5, a7);
+  v[0] = _mm_unpacklo_epi64(b0, b4);
+  v[1] = _mm_unpackhi_epi64(b0, b4);
+  v[2] = _mm_unpacklo_epi64(b1, b5);
+  v[3] = _mm_unpackhi_epi64(b1, b5);
+  v[4] = _mm_unpacklo_epi64(b2, b6);
+  v[5] = _mm_unpackhi_epi64(b2, b6);
+  v[6] = _mm_unpacklo_epi64(b3, b7);
+  v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+
+/*
+ * One 1-D IDCT over the eight 16-bit vectors x[0..7], with 'rounder' added
+ * ahead of the final descaling.  The undescaled 32-bit outputs for lanes
+ * 0..3 go to lo[0..7] and those for lanes 4..7 to hi[0..7].
+ */
+
+JSIMD_INLINE void
+idct_1d (const __m128i x[8], __m128i rounder, __m128i lo[8], __m128i hi[8])
+{
+  __m128i tmp0[2], tmp1[2], tmp2[2], tmp3[2];
+  __m128i tmp10[2], tmp11[2], tmp12[2], tmp13[2];
+  __m128i z3p[2], z4p[2], p[2], q[2];
+  __m128i z3, z4;
+  int h;
+
+  /* Even part: z1 = (z2 + z3) * c6 is folded into the other products */
+  p[0] = _mm_unpacklo_epi16(x[2], x[6]);
+  p[1] = _mm_unpackhi_epi16(x[2], x[6]);
+  q[0] = _mm_unpacklo_epi16(x[0], x[4]);
+  q[1] = _mm_unpackhi_epi16(x[0], x[4]);
+  for (h = 0; h < 2; h++) {
+    tmp2[h] = _mm_madd_epi16(p[h], PAIR(4433, 4433 - 15137));
+    tmp3[h] = _mm_madd_epi16(p[h], PAIR(4433 + 6270, 4433));
+    tmp0[h] = _mm_add_epi32(_mm_madd_epi16(q[h], PAIR(8192, 8192)),
+			    rounder);
+    tmp1[h] = _mm_add_epi32(_mm_madd_epi16(q[h], PAIR(8192, -8192)),
+			    rounder);
+    tmp10[h] = _mm_add_epi32(tmp0[h], tmp3[h]);
+    tmp13[h] = _mm_sub_epi32(tmp0[h], tmp3[h]);
+    tmp11[h] = _mm_add_epi32(tmp1[h], tmp2[h]);
+    tmp12[h] = _mm_sub_epi32(tmp1[h], tmp2[h]);
+  }
+
+  /* Odd part: z5 = (z3 + z4) * c3 is folded into z3' and z4', and
+   * z1' and z2' into the products of the individual inputs.
+   */
+  z3 = _mm_add_epi16(x[7], x[3]);
+  z4 = _mm_add_epi16(x[5], x[1]);
+  p[0] = _mm_unpacklo_epi16(z3, z4);
+  p[1] = _mm_unpackhi_epi16(z3, z4);
+  for (h = 0; h < 2; h++) {
+    z3p[h] = _mm_madd_epi16(p[h], PAIR(9633 - 16069, 9633));
+    z4p[h] = _mm_madd_epi16(p[h], PAIR(9633, 9633 - 3196));
+  }
+  p[0] = _mm_unpacklo_epi16(x[7], x[1]);
+  p[1] = _mm_unpackhi_epi16(x[7], x[1]);
+  q[0] = _mm_unpacklo_epi16(x[5], x[3]);
+  q[1] = _mm_unpackhi_epi16(x[5], x[3]);
+  for (h = 0; h < 2; h++) {
+    tmp0[h] = _mm_add_epi32(_mm_madd_epi16(p[h], PAIR(2446 - 7373, -7373)),
+			    z3p[h]);
+    tmp3[h] = _mm_add_epi32(_mm_madd_epi16(p[h], PAIR(-7373, 12299 - 7373)),
+			    z4p[h]);
+    tmp1[h] = _mm_add_epi32(_mm_madd_epi16(q[h],
+					   PAIR(16819 - 20995, -20995)),
+			    z4p[h]);
+    tmp2[h] = _mm_add_epi32(_mm_madd_epi16(q[h],
+					   PAIR(-20995, 25172 - 20995)),
+			    z3p[h]);
+  }
+
+  /* Final output stage */
+  for (h = 0; h < 2; h++) {
+    __m128i * out = h ? hi : lo;
+    out[0] = _mm_add_epi32(tmp10[h], tmp3[h]);
+    out[7] = _mm_sub_epi32(tmp10[h], tmp3[h]);
+    out[1] = _mm_add_epi32(tmp11[h], tmp2[h]);
+    out[6] = _mm_sub_epi32(tmp11[h], tmp2[h]);
+    out[2] = _mm_add_epi32(tmp12[h], tmp1[h]);
+    out[5] = _mm_sub_epi32(tmp12[h], tmp1[h]);
+    out[3] = _mm_add_epi32(tmp13[h], tmp0[h]);
+    out[4] = _mm_sub_epi32(tmp13[h], tmp0[h]);
+  }
+}
+
+
+JSIMD_TARGET GLOBAL(void)
+jsimd_idct_islow_sse2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		       JCOEFPTR coef_block,
+		       JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  __m128i x[DCTSIZE], lo[DCTSIZE], hi[DCTSIZE];
+  __m128i coefs, quant, prodlo, prodhi, bytes;
+  __m128i bad = _mm_setzero_si128();
+  __m128i ac = _mm_setzero_si128();
+  int i;
+
+  /* Dequantize.  A product fits in 16 bits if its high half is just the
+   * sign of its low half.  Saturating the multipliers to 16 bits is safe,
+   * since any coefficient they change is far out of range anyway.
+   */
+  for (i = 0; i < DCTSIZE; i++) {
+    coefs = _mm_loadu_si128((const __m128i *) (coef_block + i * DCTSIZE));
+    quant = _mm_packs_epi32(
+      _mm_loadu_si128((const __m128i *) (quantptr + i * DCTSIZE)),
+      _mm_loadu_si128((const __m128i *) (quantptr + i * DCTSIZE + 4)));
+    prodlo = _mm_mullo_epi16(coefs, quant);
+    prodhi = _mm_mulhi_epi16(coefs, quant);
+    bad = _mm_or_si128(bad, _mm_xor_si128(prodhi,
+					 _mm_srai_epi16(prodlo, 15)));
+    bad = _mm_or_si128(bad, _mm_cmpgt_epi16(prodlo,
+					    _mm_set1_epi16(PASS1_LIMIT)));
+    bad = _mm_or_si128(bad, _mm_cmplt_epi16(prodlo,
+					    _mm_set1_epi16(-PASS1_LIMIT)));
+    x[i] = prodlo;
+    ac = _mm_or_si128(ac, i ? coefs : _mm_srli_si128(coefs, 2));
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(ac, _mm_setzero_si128())) == 0xFFFF) {
+    jsimd_idct_islow_flat(cinfo, quantptr, coef_block,
+			  output_buf, output_col);
+    return;
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xFFFF)
+    goto use_c;
+
+  /* Pass 1: process columns, scaling the results by 2**PASS1_BITS. */
+  idct_1d(x, _mm_set1_epi32(1 << (CONST_BITS-PASS1_BITS-1)), lo, hi);
+  for (i = 0; i < DCTSIZE; i++) {
+    x[i] = _mm_packs_epi32(_mm_srai_epi32(lo[i], CONST_BITS-PASS1_BITS),
+			   _mm_srai_epi32(hi[i], CONST_BITS-PASS1_BITS));
+    bad = _mm_or_si128(bad, _mm_cmpgt_epi16(x[i],
+					    _mm_set1_epi16(PASS2_LIMIT)));
+    bad = _mm_or_si128(bad, _mm_cmplt_epi16(x[i],
+					    _mm_set1_epi16(-PASS2_LIMIT)));
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xFFFF)
+    goto use_c;
+
+  /* Pass 2: process rows.  After the transpose the lanes are rows. */
+  transpose_8x8(x);
+  idct_1d(x, _mm_set1_epi32(1 << (CONST_BITS+PASS1_BITS+3-1)), lo, hi);
+  for (i = 0; i < DCTSIZE; i++) {
+    /* Equivalent to range_limit[x & RANGE_MASK]: wrap to 10 bits as a
+     * signed value and add CENTERJSAMPLE; the saturating packs below then
+     * clamp to 0..MAXJSAMPLE.
+     */
+    lo[i] = _mm_srai_epi32(lo[i], CONST_BITS+PASS1_BITS+3);
+    hi[i] = _mm_srai_epi32(hi[i], CONST_BITS+PASS1_BITS+3);
+    lo[i] = _mm_and_si128(_mm_add_epi32(lo[i], _mm_set1_epi32(512)),
+			  _mm_set1_epi32(RANGE_MASK));
+    hi[i] = _mm_and_si128(_mm_add_epi32(hi[i], _mm_set1_epi32(512)),
+			  _mm_set1_epi32(RANGE_MASK));
+    x[i] = _mm_add_epi16(_mm_packs_epi32(lo[i], hi[i]),
+			 _mm_set1_epi16(CENTERJSAMPLE - 512));
+  }
+
+  /* Transpose back so that the lanes are columns, and emit the rows. */
+  transpose_8x8(x);
+  for (i = 0; i < DCTSIZE; i += 2) {
+    bytes = _mm_packus_epi16(x[i], x[i + 1]);
+    _mm_storel_epi64((__m128i *) (output_buf[i] + output_col), bytes);
+    _mm_storel_epi64((__m128i *) (output_buf[i + 1] + output_col),
+		     _mm_unpackhi_epi64(bytes, bytes));
+  }
+  return;
+
+use_c:
+  jpeg_idct_islow(cinfo, compptr, coef_block, output_buf, output_col);
+}
+
+
+
+/*
+ * YCbCr->RGB conversion.  The C code adds table entries to Y; here the
+ * same quantities are computed directly.  With x = Cb or Cr - CENTERJSAMPLE,
+ *   Cr_r_tab = (FIX(1.40200) * x + ONE_HALF) >> 16
+ *            = x + ((FIX(1.40200) - 65536) * x + ONE_HALF) >> 16
+ * and similarly for the other terms, so that each product is a single
+ * PMADDWD with 16-bit operands.  The sums are exact, so the results match
+ * the tables.
+ */
+
+#undef FIX			/* jdct.h's version is for the IDCT */
+#define SCALEBITS	16
+#define ONE_HALF	((INT32) 1 << (SCALEBITS-1))
+#define FIX(x)		((INT32) ((x) * (1L<<SCALEBITS) + 0.5))
+
+/*
+ * Pack four pixels held as 32-bit R,G,B,0 words into 12 bytes of R,G,B.
+ * The top 4 bytes of the result are zero.
+ */
+
+JSIMD_INLINE __m128i
+pack_rgb24 (__m128i p)
+{
+  const __m128i lo = _mm_set_epi32(0, 0, -1, -1);
+
+  /* Within each 64-bit half, move the second pixel down next to the first */
+  p = _mm_or_si128(_mm_and_si128(p, _mm_set_epi32(0, -1, 0, -1)),
+		   _mm_and_si128(_mm_srli_epi64(p, 8),
+				 _mm_set_epi32(0x0000FFFF, (int) 0xFF000000,
+					       0x0000FFFF, (int) 0xFF000000)));
+  /* Then close the two-byte gap between the halves */
+  return _mm_or_si128(_mm_and_si128(p, lo),
+		      _mm_srli_si128(_mm_andnot_si128(lo, p), 2));
+}
+
+
+/*
+ * (a * c1 + b * c2 + ONE_HALF) >> SCALEBITS for 8 pairs of 16-bit values,
+ * with k = PAIR(c1, c2).  The results are packed back to 16 bits.
+ */
+
+JSIMD_INLINE __m128i
+madd_descale (__m128i a, __m128i b, __m128i k)
+{
+  const __m128i half = _mm_set1_epi32(ONE_HALF);
+
+  return _mm_packs_epi32(
+    _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), k),
+				 half), SCALEBITS),
+    _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), k),
+				 half), SCALEBITS));
+}
+
+
+/*
+ * Convert 8 pixels, given as 16-bit Y, Cb and Cr.
+ */
+
+JSIMD_INLINE void
+ycc_rgb_8 (__m128i y, __m128i cb, __m128i cr,
+	   __m128i * r, __m128i * g, __m128i * b)
+{
+  const __m128i zero = _mm_setzero_si128();
+
+  cb = _mm_sub_epi16(cb, _mm_set1_epi16(CENTERJSAMPLE));
+  cr = _mm_sub_epi16(cr, _mm_set1_epi16(CENTERJSAMPLE));
+  /* R = Y + Cr + ((FIX(1.40200) - 65536) * Cr + ONE_HALF) >> 16 */
+  *r = _mm_add_epi16(_mm_add_epi16(y, cr),
+		     madd_descale(cr, zero, PAIR(FIX(1.40200) - 65536, 0)));
+  /* G = Y - Cr + (-FIX(0.34414) * Cb + (65536 - FIX(0.71414)) * Cr
+   *               + ONE_HALF) >> 16
+   */
+  *g = _mm_add_epi16(_mm_sub_epi16(y, cr),
+		     madd_descale(cb, cr, PAIR(- FIX(0.34414),
+					       65536 - FIX(0.71414))));
+  /* B = Y + 2 * Cb + ((FIX(1.77200) - 131072) * Cb + ONE_HALF) >> 16 */
+  *b = _mm_add_epi16(_mm_add_epi16(y, _mm_add_epi16(cb, cb)),
+		     madd_descale(cb, zero, PAIR(FIX(1.77200) - 131072, 0)));
+}
+
+
+JSIMD_TARGET GLOBAL(JDIMENSION)
+jsimd_ycc_rgb_run_sse2 (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+			JSAMPROW outptr, JDIMENSION count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i y, cb, cr, rlo, glo, blo, rhi, ghi, bhi, rgb[4], rg, b0;
+  JDIMENSION col;
+
+  for (col = 0; col + 16 <= count; col += 16) {
+    y = _mm_loadu_si128((const __m128i *) (inptr0 + col));
+    cb = _mm_loadu_si128((const __m128i *) (inptr1 + col));
+    cr = _mm_loadu_si128((const __m128i *) (inptr2 + col));
+    ycc_rgb_8(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi8(cb, zero),
+	      _mm_unpacklo_epi8(cr, zero), &rlo, &glo, &blo);
+    ycc_rgb_8(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi8(cb, zero),
+	      _mm_unpackhi_epi8(cr, zero), &rhi, &ghi, &bhi);
+    /* Saturating to bytes is the range limiting */
+    rlo = _mm_packus_epi16(rlo, rhi);
+    glo = _mm_packus_epi16(glo, ghi);
+    blo = _mm_packus_epi16(blo, bhi);
+
+    /* Interleave to R,G,B,0 words, then squeeze out the padding */
+    rg = _mm_unpacklo_epi8(rlo, glo);
+    b0 = _mm_unpacklo_epi8(blo, zero);
+    rgb[0] = pack_rgb24(_mm_unpacklo_epi16(rg, b0));
+    rgb[1] = pack_rgb24(_mm_unpackhi_epi16(rg, b0));
+    rg = _mm_unpackhi_epi8(rlo, glo);
+    b0 = _mm_unpackhi_epi8(blo, zero);
+    rgb[2] = pack_rgb24(_mm_unpacklo_epi16(rg, b0));
+    rgb[3] = pack_rgb24(_mm_unpackhi_epi16(rg, b0));
+    _mm_storeu_si128((__m128i *) (outptr + col * 3),
+		     _mm_or_si128(rgb[0], _mm_slli_si128(rgb[1], 12)));
+    _mm_storeu_si128((__m128i *) (outptr + col * 3 + 16),
+		     _mm_or_si128(_mm_srli_si128(rgb[1], 4),
+				  _mm_slli_si128(rgb[2], 8)));
+    _mm_storeu_si128((__m128i *) (outptr + col * 3 + 32),
+		     _mm_or_si128(_mm_srli_si128(rgb[2], 8),
+				  _mm_slli_si128(rgb[3], 4)));
+  }
+  return col;
+}
+
+
+/*
+ * Fancy upsampling.  These handle the general case of the C loops only:
+ * 'count' columns starting at inptr, each of which has a neighbour on
+ * both sides.  All the sums fit easily in 16 bits.
+ */
+
+JSIMD_TARGET GLOBAL(JDIMENSION)
+jsimd_h2v1_fancy_run_sse2 (JSAMPROW inptr, JSAMPROW outptr, JDIMENSION count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i here, last, next, even[2], odd[2], three;
+  JDIMENSION col;
+  int h;
+
+  for (col = 0; col + 16 <= count; col += 16) {
+    here = _mm_loadu_si128((const __m128i *) (inptr + col));
+    last = _mm_loadu_si128((const __m128i *) (inptr + col - 1));
+    next = _mm_loadu_si128((const __m128i *) (inptr + col + 1));
+    for (h = 0; h < 2; h++) {
+      /* 3/4 * nearer pixel + 1/4 * further pixel */
+      three = h ? _mm_unpackhi_epi8(here, zero)
+		: _mm_unpacklo_epi8(here, zero);
+      three = _mm_add_epi16(three, _mm_add_epi16(three, three));
+      even[h] = _mm_add_epi16(three, _mm_add_epi16(
+	h ? _mm_unpackhi_epi8(last, zero) : _mm_unpacklo_epi8(last, zero),
+	_mm_set1_epi16(1)));
+      odd[h] = _mm_add_epi16(three, _mm_add_epi16(
+	h ? _mm_unpackhi_epi8(next, zero) : _mm_unpacklo_epi8(next, zero),
+	_mm_set1_epi16(2)));
+      even[h] = _mm_srli_epi16(even[h], 2);
+      odd[h] = _mm_srli_epi16(odd[h], 2);
+    }
+    even[0] = _mm_packus_epi16(even[0], even[1]);
+    odd[0] = _mm_packus_epi16(odd[0], odd[1]);
+    _mm_storeu_si128((__m128i *) (outptr + col * 2),
+		     _mm_unpacklo_epi8(even[0], odd[0]));
+    _mm_storeu_si128((__m128i *) (outptr + col * 2 + 16),
+		     _mm_unpackhi_epi8(even[0], odd[0]));
+  }
+  return col;
+}
+
+
+/* Column sums 3 * nearer row + further row for 8 columns of bytes */
+#define COLSUM(near, far, half) \
+  (_mm_add_epi16(_mm_mullo_epi16((half) ? _mm_unpackhi_epi8(near, zero) : \
+					  _mm_unpacklo_epi8(near, zero), \
+				 _mm_set1_epi16(3)), \
+		 (half) ? _mm_unpackhi_epi8(far, zero) : \
+			  _mm_unpacklo_epi8(far, zero)))
+
+JSIMD_TARGET GLOBAL(JDIMENSION)
+jsimd_h2v2_fancy_run_sse2 (JSAMPROW inptr0, JSAMPROW inptr1,
+			   JSAMPROW outptr, JDIMENSION count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i this0, last0, next0, this1, last1, next1;
+  __m128i thissum, even[2], odd[2];
+  JDIMENSION col;
+  int h;
+
+  for (col = 0; col + 16 <= count; col += 16) {
+    this0 = _mm_loadu_si128((const __m128i *) (inptr0 + col));
+    last0 = _mm_loadu_si128((const __m128i *) (inptr0 + col - 1));
+    next0 = _mm_loadu_si128((const __m128i *) (inptr0 + col + 1));
+    this1 = _mm_loadu_si128((const __m128i *) (inptr1 + col));
+    last1 = _mm_loadu_si128((const __m128i *) (inptr1 + col - 1));
+    next1 = _mm_loadu_si128((const __m128i *) (inptr1 + col + 1));
+    for (h = 0; h < 2; h++) {
+      /* 9/16, 3/16, 3/16, 1/16 of the four nearest pixels */
+      thissum = _mm_mullo_epi16(COLSUM(this0, this1, h), _mm_set1_epi16(3));
+      even[h] = _mm_add_epi16(thissum, _mm_add_epi16(COLSUM(last0, last1, h),
+						     _mm_set1_epi16(8)));
+      odd[h] = _mm_add_epi16(thissum, _mm_add_epi16(COLSUM(next0, next1, h),
+						    _mm_set1_epi16(7)));
+      even[h] = _mm_srli_epi16(even[h], 4);
+      odd[h] = _mm_srli_epi16(odd[h], 4);
+    }
+    even[0] = _mm_packus_epi16(even[0], even[1]);
+    odd[0] = _mm_packus_epi16(odd[0], odd[1]);
+    _mm_storeu_si128((__m128i *) (outptr + col * 2),
+		     _mm_unpacklo_epi8(even[0], odd[0]));
+    _mm_storeu_si128((__m128i *) (outptr + col * 2 + 16),
+		     _mm_unpackhi_epi8(even[0], odd[0]));
+  }
+  return col;
+}
+
+#endif /* JSIMD_X86 */
@@ -0,0 +1,316 @@
+/*
+ * jsimdidct.h
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains a vector implementation of the slow-but-accurate
+ * integer IDCT of jidctint.c.  It is a template: the per-instruction-set
+ * modules include it once for each kernel they build, after defining
+ *   JSIMD_LANES    number of 32-bit lanes per vector (4 or 8)
+ *   JSIMD_TARGET   function attributes selecting the instruction set
+ *   JSIMD_IDCT_ISLOW  name of the routine to define
+ *
+ * The arithmetic is exactly that of jpeg_idct_islow(), including the
+ * rounding and the mask-and-limit treatment of out-of-range results, so
+ * the output is bit-identical.  jpeg_idct_islow() computes in INT32, which
+ * may be 64 bits wide, whereas the vectors hold 32-bit lanes.  For pass 2
+ * this makes no difference, because the output keeps only bits 18..27 of
+ * each sum and those depend only on its low 32 bits.  Pass 1 keeps bits
+ * 11..42, so a block whose pass-1 sums could exceed 32 bits is handed to
+ * jpeg_idct_islow() instead.  The largest pass-1 sum is less than 178220
+ * times the largest dequantized coefficient, so any block whose dequantized
+ * coefficients are all within +/-12000 is safe.  Blocks from 8-bit images
+ * never come close to that (their coefficients are within +/-2048 or so),
+ * so in practice the fallback is only reached by corrupt data.
+ *
+ * The shortcuts that jpeg_idct_islow() takes for all-zero columns and rows
+ * give the same results as the full calculation, so apart from blocks with
+ * no AC terms at all, every block takes the same branch-free path.
+ */
+
+#define JSIMD_IDCT_LIMIT  12000	/* see above */
+
+#define JSIMD_NVEC  (DCTSIZE / JSIMD_LANES)	/* vectors per row */
+
+typedef int jsimd_ivec __attribute__((vector_size(JSIMD_LANES * 4)));
+typedef short jsimd_wvec __attribute__((vector_size(JSIMD_LANES * 4)));
+typedef char jsimd_bvec __attribute__((vector_size(JSIMD_LANES * 4)));
+typedef long long jsimd_qvec __attribute__((vector_size(JSIMD_LANES * 4)));
+typedef short jsimd_svec __attribute__((vector_size(JSIMD_LANES * 2)));
+
+
+/*
+ * Transpose the 8x8 array of 32-bit values held in v[row][half], in place.
+ * With 8 lanes this is the usual three rounds of interleaving; with 4 lanes
+ * each 4x4 quarter is transposed and the off-diagonal quarters swapped.
+ */
+
+#if JSIMD_LANES == 8
+
+#define JSIMD_TRANSPOSE(v) \
+  { jsimd_ivec a0, a1, a2, a3, a4, a5, a6, a7; \
+    jsimd_ivec b0, b1, b2, b3, b4, b5, b6, b7; \
+    const jsimd_ivec lo32 = { 0, 8, 1, 9, 4, 12, 5, 13 }; \
+    const jsimd_ivec hi32 = { 2, 10, 3, 11, 6, 14, 7, 15 }; \
+    const jsimd_ivec lo64 = { 0, 1, 8, 9, 4, 5, 12, 13 }; \
+    const jsimd_ivec hi64 = { 2, 3, 10, 11, 6, 7, 14, 15 }; \
+    const jsimd_ivec lo128 = { 0, 1, 2, 3, 8, 9, 10, 11 }; \
+    const jsimd_ivec hi128 = { 4, 5, 6, 7, 12, 13, 14, 15 }; \
+    a0 = __builtin_shuffle(v[0][0], v[1][0], lo32); \
+    a1 = __builtin_shuffle(v[0][0], v[1][0], hi32); \
+    a2 = __builtin_shuffle(v[2][0], v[3][0], lo32); \
+    a3 = __builtin_shuffle(v[2][0], v[3][0], hi32); \
+    a4 = __builtin_shuffle(v[4][0], v[5][0], lo32); \
+    a5 = __builtin_shuffle(v[4][0], v[5][0], hi32); \
+    a6 = __builtin_shuffle(v[6][0], v[7][0], lo32); \
+    a7 = __builtin_shuffle(v[6][0], v[7][0], hi32); \
+    b0 = __builtin_shuffle(a0, a2, lo64); \
+    b1 = __builtin_shuffle(a0, a2, hi64); \
+    b2 = __builtin_shuffle(a1, a3, lo64); \
+    b3 = __builtin_shuffle(a1, a3, hi64); \
+    b4 = __builtin_shuffle(a4, a6, lo64); \
+    b5 = __builtin_shuffle(a4, a6, hi64); \
+    b6 = __builtin_shuffle(a5, a7, lo64); \
+    b7 = __builtin_shuffle(a5, a7, hi64); \
+    v[0][0] = __builtin_shuffle(b0, b4, lo128); \
+    v[4][0] = __builtin_shuffle(b0, b4, hi128); \
+    v[1][0] = __builtin_shuffle(b1, b5, lo128); \
+    v[5][0] = __builtin_shuffle(b1, b5, hi128); \
+    v[2][0] = __builtin_shuffle(b2, b6, lo128); \
+    v[6][0] = __builtin_shuffle(b2, b6, hi128); \
+    v[3][0] = __builtin_shuffle(b3, b7, lo128); \
+    v[7][0] = __builtin_shuffle(b3, b7, hi128); \
+  }
+
+#else
+
+#define JSIMD_TRANSPOSE4(r0, r1, r2, r3) \
+  { jsimd_ivec a0, a1, a2, a3; \
+    const jsimd_ivec lo32 = { 0, 4, 1, 5 }; \
+    const jsimd_ivec hi32 = { 2, 6, 3, 7 }; \
+    const jsimd_ivec lo64 = { 0, 1, 4, 5 }; \
+    const jsimd_ivec hi64 = { 2, 3, 6, 7 }; \
+    a0 = __builtin_shuffle(r0, r1, lo32); \
+    a1 = __builtin_shuffle(r0, r1, hi32); \
+    a2 = __builtin_shuffle(r2, r3, lo32); \
+    a3 = __builtin_shuffle(r2, r3, hi32); \
+    r0 = __builtin_shuffle(a0, a2, lo64); \
+    r1 = __builtin_shuffle(a0, a2, hi64); \
+    r2 = __builtin_shuffle(a1, a3, lo64); \
+    r3 = __builtin_shuffle(a1, a3, hi64); \
+  }
+
+#define JSIMD_TRANSPOSE(v) \
+  { jsimd_ivec t; \
+    JSIMD_TRANSPOSE4(v[0][0], v[1][0], v[2][0], v[3][0]); \
+    JSIMD_TRANSPOSE4(v[0][1], v[1][1], v[2][1], v[3][1]); \
+    JSIMD_TRANSPOSE4(v[4][0], v[5][0], v[6][0], v[7][0]); \
+    JSIMD_TRANSPOSE4(v[4][1], v[5][1], v[6][1], v[7][1]); \
+    t = v[0][1]; v[0][1] = v[4][0]; v[4][0] = t; \
+    t = v[1][1]; v[1][1] = v[5][0]; v[5][0] = t; \
+    t = v[2][1]; v[2][1] = v[6][0]; v[6][0] = t; \
+    t = v[3][1]; v[3][1] = v[7][0]; v[7][0] = t; \
+  }
+
+#endif
+
+
+/*
+ * Set lane 0 of v to the OR of all its lanes.
+ */
+
+#if JSIMD_LANES == 8
+#define JSIMD_ANY_LANE(v) \
+  { v |= __builtin_shuffle(v, (jsimd_ivec) { 4, 5, 6, 7, 0, 1, 2, 3 }); \
+    v |= __builtin_shuffle(v, (jsimd_ivec) { 2, 3, 0, 1, 6, 7, 4, 5 }); \
+    v |= __builtin_shuffle(v, (jsimd_ivec) { 1, 0, 3, 2, 5, 4, 7, 6 }); }
+#else
+#define JSIMD_ANY_LANE(v) \
+  { v |= __builtin_shuffle(v, (jsimd_ivec) { 2, 3, 0, 1 }); \
+    v |= __builtin_shuffle(v, (jsimd_ivec) { 1, 0, 3, 2 }); }
+#endif
+
+
+/*
+ * Narrow rows of 32-bit samples, starting at v[row], to bytes: each
+ * 64-bit element of q receives one row of 8 samples.  The samples are
+ * known to be in range, so keeping the low half of each lane is exact, and
+ * the compiler can use saturating packs for it.
+ */
+
+#if JSIMD_LANES == 8
+#define JSIMD_NARROW(v, row, w, q) \
+  { const jsimd_wvec even16 = { 0, 2, 4, 6, 8, 10, 12, 14, \
+				16, 18, 20, 22, 24, 26, 28, 30 }; \
+    const jsimd_bvec even8 = { 0, 2, 4, 6, 8, 10, 12, 14, \
+			       16, 18, 20, 22, 24, 26, 28, 30, \
+			       32, 34, 36, 38, 40, 42, 44, 46, \
+			       48, 50, 52, 54, 56, 58, 60, 62 }; \
+    w[0] = __builtin_shuffle((jsimd_wvec) v[row][0], \
+			     (jsimd_wvec) v[row + 1][0], even16); \
+    w[1] = __builtin_shuffle((jsimd_wvec) v[row + 2][0], \
+			     (jsimd_wvec) v[row + 3][0], even16); \
+    q = (jsimd_qvec) __builtin_shuffle((jsimd_bvec) w[0], \
+				       (jsimd_bvec) w[1], even8); }
+#else
+#define JSIMD_NARROW(v, row, w, q) \
+  { const jsimd_wvec even16 = { 0, 2, 4, 6, 8, 10, 12, 14 }; \
+    const jsimd_bvec even8 = { 0, 2, 4, 6, 8, 10, 12, 14, \
+			       16, 18, 20, 22, 24, 26, 28, 30 }; \
+    w[0] = __builtin_shuffle((jsimd_wvec) v[row][0], \
+			     (jsimd_wvec) v[row][1], even16); \
+    w[1] = __builtin_shuffle((jsimd_wvec) v[row + 1][0], \
+			     (jsimd_wvec) v[row + 1][1], even16); \
+    q = (jsimd_qvec) __builtin_shuffle((jsimd_bvec) w[0], \
+				       (jsimd_bvec) w[1], even8); }
+#endif
+
+
+/*
+ * One 1-D IDCT over x[0..7] (a vector of lanes each), in place, exactly as
+ * in jidctint.c.  The outputs are descaled by n bits.
+ */
+
+#define JSIMD_IDCT_1D(x, n) \
+  { jsimd_ivec tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13; \
+    jsimd_ivec z1, z2, z3, z4, z5; \
+    /* Even part */ \
+    z2 = x[2]; \
+    z3 = x[6]; \
+    z1 = (z2 + z3) * 4433;		/* FIX_0_541196100 */ \
+    tmp2 = z1 + z3 * -15137;		/* FIX_1_847759065 */ \
+    tmp3 = z1 + z2 * 6270;		/* FIX_0_765366865 */ \
+    tmp0 = (x[0] + x[4]) << 13;		/* CONST_BITS */ \
+    tmp1 = (x[0] - x[4]) << 13; \
+    /* Fold the descaling rounder into the even part */ \
+    tmp0 += 1 << ((n) - 1); \
+    tmp1 += 1 << ((n) - 1); \
+    tmp10 = tmp0 + tmp3; \
+    tmp13 = tmp0 - tmp3; \
+    tmp11 = tmp1 + tmp2; \
+    tmp12 = tmp1 - tmp2; \
+    /* Odd part */ \
+    tmp0 = x[7]; \
+    tmp1 = x[5]; \
+    tmp2 = x[3]; \
+    tmp3 = x[1]; \
+    z1 = tmp0 + tmp3; \
+    z2 = tmp1 + tmp2; \
+    z3 = tmp0 + tmp2; \
+    z4 = tmp1 + tmp3; \
+    z5 = (z3 + z4) * 9633;		/* FIX_1_175875602 */ \
+    tmp0 = tmp0 * 2446;			/* FIX_0_298631336 */ \
+    tmp1 = tmp1 * 16819;		/* FIX_2_053119869 */ \
+    tmp2 = tmp2 * 25172;		/* FIX_3_072711026 */ \
+    tmp3 = tmp3 * 12299;		/* FIX_1_501321110 */ \
+    z1 = z1 * -7373;			/* FIX_0_899976223 */ \
+    z2 = z2 * -20995;			/* FIX_2_562915447 */ \
+    z3 = z3 * -16069 + z5;		/* FIX_1_961570560 */ \
+    z4 = z4 * -3196 + z5;		/* FIX_0_390180644 */ \
+    tmp0 += z1 + z3; \
+    tmp1 += z2 + z4; \
+    tmp2 += z2 + z3; \
+    tmp3 += z1 + z4; \
+    /* Final output stage */ \
+    x[0] = (tmp10 + tmp3) >> (n); \
+    x[7] = (tmp10 - tmp3) >> (n); \
+    x[1] = (tmp11 + tmp2) >> (n); \
+    x[6] = (tmp11 - tmp2) >> (n); \
+    x[2] = (tmp12 + tmp1) >> (n); \
+    x[5] = (tmp12 - tmp1) >> (n); \
+    x[3] = (tmp13 + tmp0) >> (n); \
+    x[4] = (tmp13 - tmp0) >> (n); \
+  }
+
+
+JSIMD_TARGET GLOBAL(void)
+JSIMD_IDCT_ISLOW (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		  JCOEFPTR coef_block,
+		  JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  jsimd_ivec ws[DCTSIZE][JSIMD_NVEC];	/* [row][half], lanes are columns */
+  jsimd_ivec x[DCTSIZE];
+  jsimd_ivec out_of_range = { 0 };
+  jsimd_svec coefs, ac = { 0 };
+  jsimd_ivec quant;
+  jsimd_wvec words[2];
+  jsimd_qvec bytes;
+  int row, h;
+
+  /* Dequantize the whole block first, so that blocks which might overflow
+   * 32 bits in pass 1 can go to the C code before anything is written.
+   */
+  for (row = 0; row < DCTSIZE; row++) {
+    for (h = 0; h < JSIMD_NVEC; h++) {
+      MEMCOPY(&coefs, coef_block + row * DCTSIZE + h * JSIMD_LANES,
+	      SIZEOF(coefs));
+      MEMCOPY(&quant, quantptr + row * DCTSIZE + h * JSIMD_LANES,
+	      SIZEOF(quant));
+      ws[row][h] = __builtin_convertvector(coefs, jsimd_ivec) * quant;
+      if (row == 0 && h == 0)
+	coefs[0] = 0;			/* the DC term */
+      ac |= coefs;
+      out_of_range |= (ws[row][h] > JSIMD_IDCT_LIMIT) |
+		      (ws[row][h] < -JSIMD_IDCT_LIMIT);
+    }
+  }
+  for (h = 1; h < JSIMD_LANES; h++)
+    ac[0] |= ac[h];
+  if (ac[0] == 0) {
+    jsimd_idct_islow_flat(cinfo, quantptr, coef_block,
+			  output_buf, output_col);
+    return;
+  }
+  JSIMD_ANY_LANE(out_of_range);
+  if (out_of_range[0]) {
+    jpeg_idct_islow(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: process columns, scaling the results by 2**PASS1_BITS. */
+  for (h = 0; h < JSIMD_NVEC; h++) {
+    for (row = 0; row < DCTSIZE; row++)
+      x[row] = ws[row][h];
+    JSIMD_IDCT_1D(x, 13 - 2);		/* CONST_BITS-PASS1_BITS */
+    for (row = 0; row < DCTSIZE; row++)
+      ws[row][h] = x[row];
+  }
+
+  /* Pass 2: process rows.  After the transpose the lanes are rows. */
+  JSIMD_TRANSPOSE(ws);
+  for (h = 0; h < JSIMD_NVEC; h++) {
+    for (row = 0; row < DCTSIZE; row++)
+      x[row] = ws[row][h];
+    JSIMD_IDCT_1D(x, 13 + 2 + 3);	/* CONST_BITS+PASS1_BITS+3 */
+    for (row = 0; row < DCTSIZE; row++) {
+      /* Equivalent to range_limit[x & RANGE_MASK]: wrap to 10 bits as a
+       * signed value, add CENTERJSAMPLE, and clamp to 0..MAXJSAMPLE.
+       */
+      x[row] = ((x[row] + 512) & RANGE_MASK) - 512 + CENTERJSAMPLE;
+      x[row] &= (x[row] > 0);
+      x[row] = (x[row] & ~(x[row] > MAXJSAMPLE)) |
+	       (MAXJSAMPLE & (x[row] > MAXJSAMPLE));
+      ws[row][h] = x[row];
+    }
+  }
+
+  /* Transpose back so that the lanes are columns, then narrow the samples
+   * (already in 0..MAXJSAMPLE) to bytes and emit the rows.
+   */
+  JSIMD_TRANSPOSE(ws);
+  for (row = 0; row < DCTSIZE; row += JSIMD_LANES / 2) {
+    JSIMD_NARROW(ws, row, words, bytes);
+    for (h = 0; h < JSIMD_LANES / 2; h++)
+      MEMCOPY(output_buf[row + h] + output_col, &bytes[h], 8);
+  }
+}
+
+#undef JSIMD_IDCT_LIMIT
+#undef JSIMD_NVEC
+#undef JSIMD_TRANSPOSE
+#undef JSIMD_TRANSPOSE4
+#undef JSIMD_ANY_LANE
+#undef JSIMD_NARROW
+#undef JSIMD_IDCT_1D
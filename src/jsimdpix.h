@@ -0,0 +1,166 @@
+/*
+ * jsimdpix.h
+ *
+ * This file is part of jpegtofb's additions to the IJG JPEG library.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains vector implementations of the per-pixel stages:
+ * YCbCr->RGB conversion (jdcolor.c) and fancy upsampling (jdsample.c).
+ * Like jsimdidct.h it is a template, written with GCC vector extensions;
+ * the including module defines
+ *   JSIMD_TARGET   function attributes selecting the instruction set
+ *   JSIMD_YCC_RGB_RUN, JSIMD_H2V1_FANCY_RUN, JSIMD_H2V2_FANCY_RUN
+ *                  names of the routines to define
+ *
+ * Each routine handles a run of pixels, a vector's worth at a time, and
+ * returns how many it did; jsimd.c does the rest of the row in C.  The
+ * arithmetic is the same as the C code's, so the results are identical.
+ */
+
+typedef unsigned char jsimd_u8x16 __attribute__((vector_size(16)));
+typedef unsigned char jsimd_u8x8 __attribute__((vector_size(8)));
+typedef unsigned char jsimd_u8x4 __attribute__((vector_size(4)));
+typedef unsigned short jsimd_u16x8 __attribute__((vector_size(16)));
+typedef int jsimd_s32x4 __attribute__((vector_size(16)));
+
+#undef FIX			/* jdct.h's version is for the IDCT */
+#define SCALEBITS	16
+#define ONE_HALF	((INT32) 1 << (SCALEBITS-1))
+#define FIX(x)		((INT32) ((x) * (1L<<SCALEBITS) + 0.5))
+
+
+/*
+ * Narrow four vectors of 32-bit values, already in 0..MAXJSAMPLE, to 16
+ * bytes.
+ */
+
+#define JSIMD_NARROW16(v, out) \
+  { const jsimd_u16x8 even16 = { 0, 2, 4, 6, 8, 10, 12, 14 }; \
+    const jsimd_u8x16 even8 = { 0, 2, 4, 6, 8, 10, 12, 14, \
+				16, 18, 20, 22, 24, 26, 28, 30 }; \
+    jsimd_u16x8 w0, w1; \
+    w0 = __builtin_shuffle((jsimd_u16x8) v[0], (jsimd_u16x8) v[1], even16); \
+    w1 = __builtin_shuffle((jsimd_u16x8) v[2], (jsimd_u16x8) v[3], even16); \
+    out = __builtin_shuffle((jsimd_u8x16) w0, (jsimd_u8x16) w1, even8); }
+
+/* Clamp 32-bit values to 0..MAXJSAMPLE, like range_limit[] */
+#define JSIMD_LIMIT(x) \
+  { x &= (x > 0); \
+    x = (x & ~(x > MAXJSAMPLE)) | (MAXJSAMPLE & (x > MAXJSAMPLE)); }
+
+
+JSIMD_TARGET GLOBAL(JDIMENSION)
+JSIMD_YCC_RGB_RUN (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+		   JSAMPROW outptr, JDIMENSION count)
+{
+  /* Masks interleaving R and G, then B, into each 16 bytes of output */
+  static const jsimd_u8x16 rg_mask[3] = {
+    { 0, 16, 0, 1, 17, 0, 2, 18, 0, 3, 19, 0, 4, 20, 0, 5 },
+    { 21, 0, 6, 22, 0, 7, 23, 0, 8, 24, 0, 9, 25, 0, 10, 26 },
+    { 0, 11, 27, 0, 12, 28, 0, 13, 29, 0, 14, 30, 0, 15, 31, 0 } };
+  static const jsimd_u8x16 b_mask[3] = {
+    { 0, 1, 16, 3, 4, 17, 6, 7, 18, 9, 10, 19, 12, 13, 20, 15 },
+    { 0, 21, 2, 3, 22, 5, 6, 23, 8, 9, 24, 11, 12, 25, 14, 15 },
+    { 26, 1, 2, 27, 4, 5, 28, 7, 8, 29, 10, 11, 30, 13, 14, 31 } };
+  /* The constants as int, since vector arithmetic will not narrow INT32 */
+  const int fix_r = (int) FIX(1.40200), fix_b = (int) FIX(1.77200);
+  const int fix_gb = (int) - FIX(0.34414), fix_gr = (int) - FIX(0.71414);
+  const int half = (int) ONE_HALF;
+  jsimd_s32x4 r[4], g[4], b[4], y, cb, cr;
+  jsimd_u8x16 r8, g8, b8, out;
+  jsimd_u8x4 in;
+  JDIMENSION col;
+  int q;
+
+  for (col = 0; col + 16 <= count; col += 16) {
+    for (q = 0; q < 4; q++) {
+      MEMCOPY(&in, inptr0 + col + q * 4, SIZEOF(in));
+      y = __builtin_convertvector(in, jsimd_s32x4);
+      MEMCOPY(&in, inptr1 + col + q * 4, SIZEOF(in));
+      cb = __builtin_convertvector(in, jsimd_s32x4) - CENTERJSAMPLE;
+      MEMCOPY(&in, inptr2 + col + q * 4, SIZEOF(in));
+      cr = __builtin_convertvector(in, jsimd_s32x4) - CENTERJSAMPLE;
+      /* The same sums as the table entries of jdcolor.c */
+      r[q] = y + ((fix_r * cr + half) >> SCALEBITS);
+      g[q] = y + ((fix_gb * cb + half + fix_gr * cr) >> SCALEBITS);
+      b[q] = y + ((fix_b * cb + half) >> SCALEBITS);
+      JSIMD_LIMIT(r[q]);
+      JSIMD_LIMIT(g[q]);
+      JSIMD_LIMIT(b[q]);
+    }
+    JSIMD_NARROW16(r, r8);
+    JSIMD_NARROW16(g, g8);
+    JSIMD_NARROW16(b, b8);
+    for (q = 0; q < 3; q++) {
+      out = __builtin_shuffle(__builtin_shuffle(r8, g8, rg_mask[q]), b8,
+			      b_mask[q]);
+      MEMCOPY(outptr + col * 3 + q * 16, &out, SIZEOF(out));
+    }
+  }
+  return col;
+}
+
+
+/*
+ * Fancy upsampling: the general case of the C loops only, for 'count'
+ * columns starting at inptr, each of which has a neighbour on both sides.
+ * Each pair of output bytes is built as one 16-bit lane, low byte first.
+ */
+
+JSIMD_TARGET GLOBAL(JDIMENSION)
+JSIMD_H2V1_FANCY_RUN (JSAMPROW inptr, JSAMPROW outptr, JDIMENSION count)
+{
+  jsimd_u16x8 here, last, next, out;
+  jsimd_u8x8 in;
+  JDIMENSION col;
+
+  for (col = 0; col + 8 <= count; col += 8) {
+    MEMCOPY(&in, inptr + col, SIZEOF(in));
+    here = __builtin_convertvector(in, jsimd_u16x8) * 3;
+    MEMCOPY(&in, inptr + col - 1, SIZEOF(in));
+    last = __builtin_convertvector(in, jsimd_u16x8);
+    MEMCOPY(&in, inptr + col + 1, SIZEOF(in));
+    next = __builtin_convertvector(in, jsimd_u16x8);
+    /* 3/4 * nearer pixel + 1/4 * further pixel */
+    out = ((here + last + 1) >> 2) | (((here + next + 2) >> 2) << 8);
+    MEMCOPY(outptr + col * 2, &out, SIZEOF(out));
+  }
+  return col;
+}
+
+
+JSIMD_TARGET GLOBAL(JDIMENSION)
+JSIMD_H2V2_FANCY_RUN (JSAMPROW inptr0, JSAMPROW inptr1,
+		      JSAMPROW outptr, JDIMENSION count)
+{
+  jsimd_u16x8 thissum, lastsum, nextsum, out;
+  jsimd_u8x8 in0, in1;
+  JDIMENSION col;
+
+  for (col = 0; col + 8 <= count; col += 8) {
+    /* Column sums: 3 * nearer row + further row */
+    MEMCOPY(&in0, inptr0 + col, SIZEOF(in0));
+    MEMCOPY(&in1, inptr1 + col, SIZEOF(in1));
+    thissum = __builtin_convertvector(in0, jsimd_u16x8) * 3 +
+	      __builtin_convertvector(in1, jsimd_u16x8);
+    MEMCOPY(&in0, inptr0 + col - 1, SIZEOF(in0));
+    MEMCOPY(&in1, inptr1 + col - 1, SIZEOF(in1));
+    lastsum = __builtin_convertvector(in0, jsimd_u16x8) * 3 +
+	      __builtin_convertvector(in1, jsimd_u16x8);
+    MEMCOPY(&in0, inptr0 + col + 1, SIZEOF(in0));
+    MEMCOPY(&in1, inptr1 + col + 1, SIZEOF(in1));
+    nextsum = __builtin_convertvector(in0, jsimd_u16x8) * 3 +
+	      __builtin_convertvector(in1, jsimd_u16x8);
+    /* 9/16, 3/16, 3/16, 1/16 of the four nearest pixels */
+    out = ((thissum * 3 + lastsum + 8) >> 4) |
+	  (((thissum * 3 + nextsum + 7) >> 4) << 8);
+    MEMCOPY(outptr + col * 2, &out, SIZEOF(out));
+  }
+  return col;
+}
+
+#undef SCALEBITS
+#undef ONE_HALF
+#undef FIX
+#undef JSIMD_NARROW16
+#undef JSIMD_LIMIT
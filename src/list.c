@@ -33,6 +33,8 @@ struct _List
   pthread_mutex_t mutex;
   ListItemFreeFn free_fn; 
   ListItem *head;
+  // The last item, so that appending doesn't have to walk the list
+  ListItem *tail;
   };
 
 /*==========================================================================
@@ -109,6 +111,7 @@ void list_prepend (List *self, void *item)
   else
     {
     self->head = i;
+    self->tail = i;
     }
   pthread_mutex_unlock (&self->mutex);
   LOG_OUT
@@ -129,17 +132,11 @@ void list_append (List *self, void *item)
   i->data = item;
   i->next = NULL;
 
-  if (self->head)
-    {
-    ListItem *l = self->head;
-    while (l->next)
-      l = l->next;
-    l->next = i;
-    }
+  if (self->tail)
+    self->tail->next = i;
   else
-    {
     self->head = i;
-    }
+  self->tail = i;
   pthread_mutex_unlock (&self->mutex);
   LOG_OUT
   }
@@ -267,6 +264,7 @@ void list_remove_object (List *self, const void *item)
       l = l->next;
       }
     }
+  self->tail = last_good;
   pthread_mutex_unlock (&self->mutex);
   LOG_OUT
   }
@@ -315,6 +313,7 @@ void list_remove (List *self, const void *item, ListCompareFn fn)
       l = l->next;
       }
     }
+  self->tail = last_good;
   pthread_mutex_unlock (&self->mutex);
   LOG_OUT
   }
@@ -370,7 +369,10 @@ void list_sort (List *self, ListSortFn fn, void *user_data)
   LOG_IN
   pthread_mutex_lock (&self->mutex);
 
-  int length = list_length (self);
+  // Not list_length(), which would try to take the lock again
+  int length = 0;
+  for (ListItem *l = self->head; l != NULL; l = l->next)
+    length++;
   
   void **temp = malloc (length * sizeof (void *));
   ListItem *l = self->head;
@@ -403,3 +405,20 @@ void list_sort (List *self, ListSortFn fn, void *user_data)
   LOG_OUT
   }
 
+
+/*==========================================================================
+  list_foreach
+  Call fn for each item in the list, in order. This is much quicker than
+  calling list_get() for each index in turn, on a long list. The list
+  is locked throughout, so fn must not change it
+*==========================================================================*/
+void list_foreach (List *self, ListForeachFn fn, void *user_data)
+  {
+  LOG_IN
+  pthread_mutex_lock (&self->mutex);
+  for (ListItem *l = self->head; l != NULL; l = l->next)
+    fn (l->data, user_data);
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  }
+
@@ -32,6 +32,8 @@ typedef int (*ListSortFn) (const void *i1, const void *i2,
 
 typedef void* (*ListCopyFn) (const void *orig);
 typedef void (*ListItemFreeFn) (void *);
+// Called by list_foreach with each item in the list
+typedef void (*ListForeachFn) (void *item, void *user_data);
 
 List   *list_create (ListItemFreeFn free_fn);
 void    list_destroy (List *);
@@ -48,4 +50,5 @@ List   *list_clone (List *self, ListCopyFn copyFn);
 List   *list_create_strings (void);
 void    list_remove_object (List *self, const void *item);
 void    list_sort (List *self, ListSortFn fn, void *user_data);
+void    list_foreach (List *self, ListForeachFn fn, void *user_data);
 
@@ -0,0 +1,272 @@
+/*==========================================================================
+
+  jpegtofb
+  prefetch.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A Prefetch object owns a background thread that decodes and scales
+  the next picture into an off-screen buffer, laid out exactly like 
+  the framebuffer, while the current picture is on display. Showing 
+  the picture is then just a copy. 
+
+  There is only one buffer. prefetch_request() hands the worker a new 
+  job, waiting first if the previous job is still being rendered; 
+  prefetch_take() collects the result, waiting if the worker is still
+  busy with the requested file. The worker runs at a lower priority
+  than the main thread, so it soaks up idle time during the slideshow
+  delay without slowing anything else down. 
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "log.h" 
+#include "framebuffer.h" 
+#include "jpegtofb.h" 
+#include "prefetch.h" 
+
+// Nice value for the worker thread
+#define PREFETCH_NICE 10
+
+typedef enum 
+  {
+  PREFETCH_IDLE = 0,
+  PREFETCH_PENDING, // A job has been requested, but not started
+  PREFETCH_BUSY,    // The worker is rendering
+  PREFETCH_READY    // The buffer (or error) holds the result 
+  } PrefetchState;
+
+struct _Prefetch
+  {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  BOOL fit_to_width;
+  BOOL quit;
+  PrefetchState state;
+  char *filename;
+  // Off-screen surface that the worker renders into
+  FbSurface surface;
+  int buffer_size;
+  char *error;
+  }; 
+
+
+/*==========================================================================
+
+  prefetch_thread
+
+==========================================================================*/
+static void *prefetch_thread (void *arg)
+  {
+  Prefetch *self = arg;
+  setpriority (PRIO_PROCESS, syscall (SYS_gettid), PREFETCH_NICE);
+
+  pthread_mutex_lock (&self->mutex);
+  while (!self->quit)
+    {
+    if (self->state != PREFETCH_PENDING)
+      {
+      pthread_cond_wait (&self->cond, &self->mutex);
+      continue;
+      }
+    self->state = PREFETCH_BUSY;
+    pthread_mutex_unlock (&self->mutex);
+
+    // Nothing else touches the job while we are busy, so the render
+    //   can proceed without holding the lock
+    log_debug ("prefetch: rendering %s", self->filename);
+    char *error = NULL;
+    jpegtofb_render (&self->surface, self->filename, 
+      self->fit_to_width, &error);
+
+    pthread_mutex_lock (&self->mutex);
+    self->error = error;
+    self->state = PREFETCH_READY;
+    pthread_cond_broadcast (&self->cond);
+    }
+  pthread_mutex_unlock (&self->mutex);
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  prefetch_create
+
+==========================================================================*/
+Prefetch *prefetch_create (BOOL fit_to_width)
+  {
+  LOG_IN
+  Prefetch *self = malloc (sizeof (Prefetch));
+  memset (self, 0, sizeof (Prefetch));
+  self->fit_to_width = fit_to_width;
+  self->state = PREFETCH_IDLE;
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_cond_init (&self->cond, NULL);
+
+  // Signals must go to the main thread -- SIGUSR1 is supposed to 
+  //   interrupt the slideshow delay, not the worker. SIGBUS, though,
+  //   comes from decoding a file that is cut short, and must be 
+  //   handled on the thread that decodes it
+  sigset_t all, old;
+  sigfillset (&all);
+  sigdelset (&all, SIGBUS);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  pthread_create (&self->thread, NULL, prefetch_thread, self);
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  prefetch_wait_idle
+
+  Wait for any job in progress to finish. Must be called with the
+  mutex held
+
+==========================================================================*/
+static void prefetch_wait_idle (Prefetch *self)
+  {
+  while (self->state == PREFETCH_PENDING || self->state == PREFETCH_BUSY)
+    pthread_cond_wait (&self->cond, &self->mutex);
+  }
+
+
+/*==========================================================================
+
+  prefetch_clear
+
+  Discard the current result. Must be called with the mutex held
+
+==========================================================================*/
+static void prefetch_clear (Prefetch *self)
+  {
+  if (self->filename)
+    {
+    free (self->filename);
+    self->filename = NULL;
+    }
+  if (self->error)
+    {
+    free (self->error);
+    self->error = NULL;
+    }
+  self->state = PREFETCH_IDLE;
+  }
+
+
+/*==========================================================================
+
+  prefetch_destroy
+
+==========================================================================*/
+void prefetch_destroy (Prefetch *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->mutex);
+    self->quit = TRUE;
+    pthread_cond_broadcast (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
+    pthread_join (self->thread, NULL);
+
+    prefetch_clear (self);
+    free (self->surface.data);
+    pthread_cond_destroy (&self->cond);
+    pthread_mutex_destroy (&self->mutex);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  prefetch_request
+
+  Start rendering filename in the background, into a buffer with the
+  same layout as the surface layout (whose data is not used)
+
+==========================================================================*/
+void prefetch_request (Prefetch *self, const char *filename, 
+      const FbSurface *layout)
+  {
+  LOG_IN
+  log_debug ("prefetch: request %s", filename);
+  pthread_mutex_lock (&self->mutex);
+  prefetch_wait_idle (self);
+  prefetch_clear (self);
+
+  int size = layout->stride * layout->height;
+  if (size != self->buffer_size)
+    {
+    free (self->surface.data);
+    self->surface.data = malloc (size);
+    self->buffer_size = size;
+    }
+  BYTE *data = self->surface.data;
+  self->surface = *layout;
+  self->surface.data = data;
+
+  self->filename = strdup (filename);
+  self->state = PREFETCH_PENDING;
+  pthread_cond_broadcast (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  prefetch_take
+
+  If filename has been (or is being) prefetched for a surface with 
+  the same layout as target, copy the result into target and return 
+  TRUE. If the prefetch failed, *error is set, and TRUE is still 
+  returned, because there's no point trying the same file again. If
+  this function returns FALSE, the caller will have to render the
+  picture itself.
+
+==========================================================================*/
+BOOL prefetch_take (Prefetch *self, const char *filename, 
+      const FbSurface *target, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  pthread_mutex_lock (&self->mutex);
+  if (self->filename && strcmp (self->filename, filename) == 0)
+    {
+    prefetch_wait_idle (self);
+    if (self->state == PREFETCH_READY 
+         && framebuffer_surfaces_match (&self->surface, target))
+      {
+      if (self->error)
+        {
+        *error = self->error;
+        self->error = NULL;
+        }
+      else
+        {
+        memcpy (target->data, self->surface.data, self->buffer_size);
+        }
+      ret = TRUE;
+      }
+    prefetch_clear (self);
+    }
+  pthread_mutex_unlock (&self->mutex);
+  log_debug ("prefetch: take %s: %s", filename, ret ? "hit" : "miss");
+  LOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,27 @@
+/*============================================================================
+
+  jpegtofb
+  prefetch.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "framebuffer.h"
+
+struct _Prefetch;
+typedef struct _Prefetch Prefetch;
+
+BEGIN_DECLS
+
+Prefetch   *prefetch_create (BOOL fit_to_width);
+void        prefetch_destroy (Prefetch *self);
+void        prefetch_request (Prefetch *self, const char *filename, 
+              const FbSurface *layout);
+BOOL        prefetch_take (Prefetch *self, const char *filename, 
+              const FbSurface *target, char **error);
+
+END_DECLS
+
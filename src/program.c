@@ -15,6 +15,7 @@
 
 ==========================================================================*/
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -29,12 +30,26 @@
 #include "string.h" 
 #include "list.h" 
 #include "usage.h" 
+#include "framebuffer.h" 
 #include "jpegtofb.h" 
 #include "jpegreader.h" 
+#include "jpegprobe.h" 
 #include "slideshow.h" 
+#include "scan.h" 
+#include "imageindex.h" 
+#include "watch.h" 
+#include "file.h" 
 
+// The filename patterns for pictures in directories, unless --include
+//   says otherwise
+#define DEFAULT_INCLUDE "*.[jJ][pP][gG],*.[jJ][pP][eE][gG]"
 
 Slideshow *slideshow = NULL;
+ImageIndex *imageindex = NULL;
+Watch *watch = NULL;
+// Set when the program is asked to stop, so that the slideshow ends,
+//   and the index is saved
+static volatile sig_atomic_t program_quit = FALSE;
 
 
 /*==========================================================================
@@ -73,12 +88,29 @@ void program_signal_usr1 (int dummy)
   }
 
 
+/*==========================================================================
+
+  program_signal_quit
+
+  SIGINT or SIGTERM. The slideshow loop notices, and ends, when the 
+  signal interrupts its sleep() call. If the program is slow to stop, 
+  the same signal again stops it straight away
+
+==========================================================================*/
+static void program_signal_quit (int sig)
+  {
+  program_quit = TRUE;
+  signal (sig, SIG_DFL);
+  }
+
+
 /*==========================================================================
 
   program_check_for_slideshow
 
   Check whether the file exists, seems to be good JPEG, and meets 
-  whatever inclusion criteria the user has specified
+  whatever inclusion criteria the user has specified. If there is an
+  index, the file is only read if it has changed since it was indexed
 
 ==========================================================================*/
 BOOL program_check_for_slideshow (const ProgramContext *context, 
@@ -89,26 +121,27 @@ BOOL program_check_for_slideshow (const ProgramContext *context,
   log_debug ("check_for_slideshow: %s", filename);
 
   char *error = NULL;
-  jpegreader_check (filename, &error); 
-  if (error == NULL)
+  JpegProbeInfo info;
+  BOOL ok;
+  if (imageindex)
+    ok = imageindex_probe (imageindex, filename, &info, &error);
+  else
+    ok = jpegprobe_file (filename, &info, &error);
+  if (ok)
     {
-    int height = 0, width = 0, components = 0;
-    if (jpegreader_get_image_size (filename, &height, 
-            &width, &components))
+    int width = info.width, height = info.height;
+    BOOL landscape = program_context_get_boolean 
+      (context, "landscape", FALSE);
+    if (landscape) 
       {
-      BOOL landscape = program_context_get_boolean 
-        (context, "landscape", FALSE);
-      if (landscape) 
-        {
-        if (width > height)
-          ret = TRUE;
-        else
-          log_warning ("Excluding from slideshow: %s: portrait format", 
-                filename);
-        }
-      else
+      if (width > height)
         ret = TRUE;
+      else
+        log_warning ("Excluding from slideshow: %s: portrait format", 
+              filename);
       }
+    else
+      ret = TRUE;
     }
   else
     {
@@ -122,6 +155,165 @@ BOOL program_check_for_slideshow (const ProgramContext *context,
   }
 
 
+/*==========================================================================
+
+  program_scan_found
+
+  A picture found in a directory. Called on the scan's list thread
+
+==========================================================================*/
+static void program_scan_found (const char *filename, void *user_data)
+  {
+  scan_add (user_data, filename);
+  }
+
+
+/*==========================================================================
+
+  program_scan_list
+
+  Find the files to check: the ones named on the command line, and 
+  every picture in the directories named on it, all the way down. 
+  Called on one of the scan's threads, so that the first pictures can
+  be checked, and shown, while the directories are still being 
+  searched
+
+==========================================================================*/
+static void program_scan_list (Scan *scan, void *user_data)
+  {
+  const ProgramContext *context = user_data;
+  char ** const argv = program_context_get_nonswitch_argv (context);
+  int argc = program_context_get_nonswitch_argc (context);
+  for (int i = 1; i < argc; i++)
+    {
+    if (watch && file_is_directory (argv[i]))
+      watch_add_tree (watch, argv[i], program_scan_found, scan);
+    else
+      scan_add (scan, argv[i]);
+    }
+  }
+
+
+/*==========================================================================
+
+  program_scan_check
+
+  Called on the scan's worker threads
+
+==========================================================================*/
+static BOOL program_scan_check (const char *filename, void *user_data)
+  {
+  return program_check_for_slideshow (user_data, filename);
+  }
+
+
+/*==========================================================================
+
+  program_scan_add
+
+==========================================================================*/
+static void program_scan_add (const char *filename, void *user_data)
+  {
+  slideshow_add_picture (slideshow, filename);
+  }
+
+
+/*==========================================================================
+
+  program_scan_done
+
+  Every file has been checked, so the index is up to date
+
+==========================================================================*/
+static void program_scan_done (void *user_data)
+  {
+  if (imageindex) imageindex_save (imageindex);
+  if (watch) watch_start (watch);
+  }
+
+
+/*==========================================================================
+
+  program_watch_change
+
+  A picture has been added to, or replaced in, a watched directory. 
+  Called on the watch's thread
+
+==========================================================================*/
+static void program_watch_change (const char *filename, void *user_data)
+  {
+  LOG_IN
+  if (program_check_for_slideshow (user_data, filename))
+    {
+    if (!slideshow_contains (slideshow, filename))
+      {
+      log_info ("New picture %s", filename);
+      BOOL was_empty = slideshow_length (slideshow) == 0;
+      slideshow_add_picture (slideshow, filename);
+      // Don't keep a blank screen waiting for the end of the sleep
+      if (was_empty) kill (getpid (), SIGUSR1);
+      }
+    }
+  else
+    slideshow_remove_pictures (slideshow, filename);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  program_watch_quiet
+
+  The changes to the watched directories have stopped, for now, so 
+  the index can be saved. Called on the watch's thread
+
+==========================================================================*/
+static void program_watch_quiet (void *user_data)
+  {
+  if (imageindex) imageindex_save (imageindex);
+  }
+
+
+/*==========================================================================
+
+  program_watch_remove
+
+  A picture, or a directory of them, has gone from a watched directory.
+  Called on the watch's thread
+
+==========================================================================*/
+static void program_watch_remove (const char *path, void *user_data)
+  {
+  slideshow_remove_pictures (slideshow, path);
+  if (imageindex) imageindex_remove (imageindex, path);
+  }
+
+
+/*==========================================================================
+
+  program_index_file
+
+  The index file, from --index, or in the home directory. Returns
+  NULL if there isn't to be one. The result must be freed
+
+==========================================================================*/
+static char *program_index_file (const ProgramContext *context)
+  {
+  char *ret = NULL;
+  const char *index = program_context_get (context, "index");
+  if (index)
+    {
+    if (index[0]) ret = strdup (index);
+    }
+  else
+    {
+    const char *home = getenv ("HOME");
+    if (home) asprintf (&ret, "%s/.%s.index", home, NAME);
+    }
+  return ret;
+  }
+
+
 /*==========================================================================
 
   program_run
@@ -135,6 +327,13 @@ int program_run (ProgramContext *context)
   char ** const argv = program_context_get_nonswitch_argv (context);
   int argc = program_context_get_nonswitch_argc (context);
 
+  jpegreader_set_max_scans (program_context_get_integer (context, 
+    "scans", 0));
+  jpegtofb_set_dither (program_context_get_boolean (context, 
+    "dither", FALSE));
+  jpegtofb_set_smooth (program_context_get_boolean (context, 
+    "smooth", FALSE));
+
   if (argc >= 2)
     {
     log_debug ("Single image mode");
@@ -145,10 +344,12 @@ int program_run (ProgramContext *context)
     BOOL fit_to_width = program_context_get_boolean (context, 
              "fit-width", FALSE);
 
-    if (argc == 2)
+    if (argc == 2 && !file_is_directory (filename))
       {
       char *error = NULL;
-      jpegtofb_putonfb (fbdev, filename, fit_to_width, &error);
+      FrameBuffer *fb = framebuffer_create (fbdev);
+      jpegtofb_putonfb (fb, filename, fit_to_width, &error);
+      framebuffer_destroy (fb);
       if (error)
         {
         log_error (error);
@@ -163,47 +364,83 @@ int program_run (ProgramContext *context)
       // We are in slideshow mode, with potentially multiple
       //   pictures
       slideshow = slideshow_create (fbdev, fit_to_width);
-
-      for (int i = 1; i < argc; i++)
+      signal (SIGUSR1, program_signal_usr1); 
+      signal (SIGINT, program_signal_quit); 
+      signal (SIGTERM, program_signal_quit); 
+
+      // Directories are searched all the way down, and then watched
+      //   for pictures being added and removed, for as long as the
+      //   show runs
+      for (int i = 1; i < argc && !watch; i++)
         {
-        if (program_check_for_slideshow (context, argv[i]))
+        if (file_is_directory (argv[i]))
           {
-          slideshow_add_picture (slideshow, argv[i]);
+          const char *include = program_context_get (context, 
+            "include");
+          watch = watch_create (include ? include : DEFAULT_INCLUDE,
+            program_watch_change, program_watch_remove, 
+            program_watch_quiet, (void *)context);
           }
-        } 
-  
-      int l = slideshow_length (slideshow);
-      if (l > 0)
-        {
-        BOOL randomize = program_context_get_boolean (context, 
-          "randomize", FALSE);
+        }
 
-        if (randomize)
-          {
-          log_debug ("Slideshow randomize");
-          srand (time (NULL));
-          slideshow_randomize (slideshow);
+      // The files are found and checked in the background, and the 
+      //   show starts as soon as the first good one is found. In a 
+      //   random show, the pictures found after that go into random 
+      //   places in the first round, and the show is reshuffled each
+      //   time round after that
+      BOOL randomize = program_context_get_boolean (context, 
+        "randomize", FALSE);
+      if (randomize)
+        {
+        log_debug ("Slideshow randomize");
+        srand (time (NULL));
+        slideshow_randomize (slideshow);
+        }
 
-          }
- 
-        signal (SIGUSR1, program_signal_usr1); 
+      char *index_file = program_index_file (context);
+      if (index_file)
+        {
+        imageindex = imageindex_open (index_file);
+        free (index_file);
+        }
 
+      Scan *scan = scan_start (program_scan_list, program_scan_check, 
+        program_scan_add, program_scan_done, (void *)context);
+      int found = scan_wait_first (scan);
+      if (found == 0 && watch)
+        log_warning ("No valid JPEG pictures yet: waiting for some");
+      if (found > 0 || watch)
+        {
         int seconds = program_context_get_integer (context, 
           "sleep", 60);
         log_debug ("slideshow sleep is %d seconds", seconds);
-        while (TRUE)
+        while (!program_quit)
           {
-          program_next_picture ();
-          const char *exec = program_context_get (context, "exec");
-          if (exec) system (exec);
-          sleep (seconds); 
+          // The show might be empty, if all the pictures were in 
+          //   watched directories, and have been removed
+          if (slideshow_length (slideshow) > 0)
+            {
+            program_next_picture ();
+            const char *exec = program_context_get (context, "exec");
+            if (exec) system (exec);
+            }
+          if (!program_quit) sleep (seconds); 
           }
+        log_info ("Stopping the slideshow");
         }
       else
         {
         log_error ("No valid JPEG pictures found in list");
         }
 
+      // The scan goes first, because it might still be searching the
+      //   watched directories, or about to start the watch
+      scan_destroy (scan);
+      watch_destroy (watch);
+      watch = NULL;
+      if (imageindex) imageindex_save (imageindex);
+      imageindex_destroy (imageindex);
+      imageindex = NULL;
       slideshow_destroy (slideshow);
       slideshow = NULL;
       }
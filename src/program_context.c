@@ -123,6 +123,11 @@ BOOL program_context_parse_command_line (ProgramContext *self,
       {"exec", required_argument, NULL, 'x'},
       {"landscape", no_argument, NULL, 'l'},
       {"randomize", no_argument, NULL, 'r'},
+      {"scans", required_argument, NULL, 0},
+      {"dither", no_argument, NULL, 0},
+      {"smooth", no_argument, NULL, 0},
+      {"index", required_argument, NULL, 0},
+      {"include", required_argument, NULL, 0},
       {0, 0, 0, 0}
     };
 
@@ -148,6 +153,10 @@ BOOL program_context_parse_command_line (ProgramContext *self,
            program_context_put_boolean (self, "syslog", TRUE);
          else if (strcmp (long_options[option_index].name, "randomize") == 0)
            program_context_put_boolean (self, "randomize", TRUE);
+         else if (strcmp (long_options[option_index].name, "dither") == 0)
+           program_context_put_boolean (self, "dither", TRUE);
+         else if (strcmp (long_options[option_index].name, "smooth") == 0)
+           program_context_put_boolean (self, "smooth", TRUE);
          else if (strcmp (long_options[option_index].name, "version") == 0)
            program_context_put_boolean (self, "show-version", TRUE);
          else if (strcmp (long_options[option_index].name, "log-level") == 0)
@@ -156,10 +165,16 @@ BOOL program_context_parse_command_line (ProgramContext *self,
            program_context_put_integer (self, "width", atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "sleep") == 0)
            program_context_put_integer (self, "sleep", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "scans") == 0)
+           program_context_put_integer (self, "scans", atoi (optarg)); 
          else if (strcmp (long_options[option_index].name, "exec") == 0)
            program_context_put (self, "exec", optarg); 
          else if (strcmp (long_options[option_index].name, "fbdev") == 0)
            program_context_put (self, "fbdev", optarg); 
+         else if (strcmp (long_options[option_index].name, "index") == 0)
+           program_context_put (self, "index", optarg); 
+         else if (strcmp (long_options[option_index].name, "include") == 0)
+           program_context_put (self, "include", optarg); 
          else
            exit (-1);
          break;
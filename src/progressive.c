@@ -0,0 +1,209 @@
+/*==========================================================================
+
+  jpegtofb
+  progressive.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Parallel output for progressive (and other multi-scan) JPEGs. Such
+  a file can't be displayed until all of its scans have been read,
+  so libjpeg reads the whole file into a buffer of DCT coefficients
+  first, and only then does the IDCT, upsampling and colour 
+  conversion, which is most of the work. Reading the scans has to be
+  done in order, but once it is finished every row of coefficients
+  is complete, and the rest can be shared out.
+
+  So the caller's decompressor reads the whole file, and the image is
+  then cut into horizontal bands (see bands.c), each of which is 
+  decoded by its own libjpeg decompressor, on its own thread, using
+  jpeg_setup_band() to take its coefficients from the first 
+  decompressor's buffer rather than from the file.
+
+  The later scans of a progressive file mostly add fine detail, which
+  is lost anyway when a large photo is scaled down to fit the screen.
+  So when the user asks for it (--scans), or when the image is being
+  decoded at 1/8 scale, where each 8x8 block of brightness is reduced
+  to its average (DC) value, only the scans that are needed are read.
+  The rest of the file is ignored, which saves both reading and 
+  Huffman decoding. At 1/8 scale the output is exactly the same as 
+  reading every scan.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "jpeglib.h"
+#include "bands.h"
+#include "progressive.h"
+
+typedef struct _ProgressiveJob
+  {
+  const BYTE *data;
+  size_t size;
+  // The decompressor that owns the coefficients; it must not be
+  //   touched while the bands are being decoded
+  struct jpeg_decompress_struct *source;
+  } ProgressiveJob;
+
+
+/*==========================================================================
+
+  progressive_decode_band
+
+  Decode one band's rows from the source decompressor's coefficients,
+  into band->pixels. Called on a worker thread
+
+==========================================================================*/
+static void progressive_decode_band (Band *band, void *user_data)
+  {
+  const ProgressiveJob *job = user_data;
+  struct jpeg_decompress_struct *source = job->source;
+
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_decompress (&cinfo);
+  // Only the headers are read from here
+  jpeg_mem_src (&cinfo, job->data, job->size);
+  jpeg_read_header (&cinfo, TRUE);
+  cinfo.scale_num = source->scale_num;
+  cinfo.scale_denom = source->scale_denom;
+  cinfo.do_fancy_upsampling = source->do_fancy_upsampling;
+  cinfo.do_block_smoothing = source->do_block_smoothing;
+  cinfo.dct_method = source->dct_method;
+  cinfo.out_color_space = source->out_color_space;
+  cinfo.dither_mode = source->dither_mode;
+  jpeg_setup_band (&cinfo, source, band->dec_first, 
+    band->dec_last - band->dec_first);
+  if (band->n_cols > 0)
+    jpeg_setup_columns (&cinfo, band->first_col, band->n_cols);
+  jpeg_start_decompress (&cinfo);
+  bands_read_scanlines (&cinfo, band);
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+  }
+
+
+/*==========================================================================
+
+  progressive_have_enough
+
+  Called at the end of each scan, to decide whether any more are
+  needed
+
+==========================================================================*/
+static BOOL progressive_have_enough (const struct jpeg_decompress_struct 
+      *cinfo, int max_scans)
+  {
+  if (max_scans > 0 && cinfo->input_scan_number >= max_scans) return TRUE;
+  if (cinfo->min_DCT_scaled_size > 1) return FALSE;
+
+  // A component that is reduced to one pixel per block uses only its
+  //   DC coefficient. But libjpeg may scale subsampled colour 
+  //   components with a larger IDCT, rather than upsample them, and
+  //   then every coefficient counts. We're done when all the
+  //   coefficients that are used are known to full precision
+  for (int ci = 0; ci < cinfo->num_components; ci++)
+    {
+    int used = cinfo->comp_info[ci].DCT_scaled_size == 1 ? 1 : DCTSIZE2;
+    for (int k = 0; k < used; k++)
+      if (cinfo->coef_bits[ci][k] != 0) return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  progressive_start
+
+  Start decompression, in place of jpeg_start_decompress. If the file
+  is progressive, and either max_scans is non-zero or the image is 
+  being decoded at 1/8 scale, the scans are read in buffered-image 
+  mode, stopping as soon as there are enough of them, and an output
+  pass is started. The return value is then TRUE, and the caller must 
+  not call jpeg_finish_decompress, which would read the rest of the 
+  file -- it should just destroy the decompressor when it has read the
+  scanlines.
+
+  Otherwise this function just calls jpeg_start_decompress, and 
+  returns FALSE.
+
+==========================================================================*/
+BOOL progressive_start (struct jpeg_decompress_struct *cinfo, 
+      int max_scans)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (cinfo->progressive_mode 
+       && (max_scans > 0 || cinfo->min_DCT_scaled_size == 1))
+    {
+    cinfo->buffered_image = TRUE;
+    jpeg_start_decompress (cinfo);
+    int rc;
+    do
+      {
+      rc = jpeg_consume_input (cinfo);
+      if (rc == JPEG_SCAN_COMPLETED 
+           && progressive_have_enough (cinfo, max_scans)) 
+        break;
+      } while (rc != JPEG_REACHED_EOI && rc != JPEG_SUSPENDED);
+    log_debug ("progressive: using %d scans%s", cinfo->input_scan_number,
+      rc == JPEG_REACHED_EOI ? " (all)" : "");
+    jpeg_start_output (cinfo, cinfo->input_scan_number);
+    ret = TRUE;
+    }
+  else
+    jpeg_start_decompress (cinfo);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  progressive_decode
+
+  Decode a multi-scan JPEG file, already loaded into memory, with the 
+  output pass split across several threads. cinfo must have had its 
+  header read, and its scale and output dimensions set. max_scans is
+  as for progressive_start.
+
+  If the file is not suitable -- a single-scan file, a small image, a 
+  single CPU -- this function returns FALSE without starting cinfo or 
+  calling row_fn, and the caller must decode the file itself. 
+  Otherwise cinfo is used to read the coefficients, and is left 
+  needing only to be destroyed; the rows of region are passed to 
+  row_fn, in order, on the calling thread.
+
+==========================================================================*/
+BOOL progressive_decode (const BYTE *data, size_t size,
+       struct jpeg_decompress_struct *cinfo, int max_scans, 
+       const JpegReaderRegion *region,
+       JpegReaderRowFn row_fn, void *user_data)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+
+  if (jpeg_has_multiple_scans (cinfo) && cinfo->total_iMCU_rows >= 2
+       && bands_threads () >= 2)
+    {
+    ProgressiveJob job;
+    job.data = data;
+    job.size = size;
+    job.source = cinfo;
+
+    // This reads all the scans that are wanted
+    progressive_start (cinfo, max_scans);
+
+    // Bands can be cut at any iMCU row
+    ret = bands_decode (cinfo, 1, progressive_decode_band, &job,
+      region, row_fn, user_data);
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,278 @@
+/*==========================================================================
+
+  jpegtofb
+  restart.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Parallel decoding of sequential JPEGs that have a restart interval
+  (a DRI marker). At each RST marker the decoder's DC predictors are
+  reset and the bitstream is byte-aligned, so the entropy-coded data
+  between two markers can be decoded without knowing anything about
+  what came before it.
+
+  The RST markers are found once, by scanning the file. The image is
+  then cut into horizontal bands whose edges fall on restart
+  boundaries, and each band is decoded by its own libjpeg
+  decompressor, on its own thread, from a small synthetic JPEG: the
+  original headers, with the frame height patched to the band height,
+  followed by the band's restart intervals (with the RST markers
+  renumbered from zero) and an EOI.
+
+  The bands themselves are scheduled and delivered by bands.c.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "jpeglib.h"
+#include "bands.h"
+#include "restart.h"
+
+typedef struct _RestartJob
+  {
+  const BYTE *data;
+  size_t sof_offset;
+  size_t sos_end;
+  // Start and end of the entropy-coded data for each restart interval,
+  //   not including the RST markers
+  size_t *seg_start;
+  size_t *seg_end;
+  int n_segments;
+  int interval;
+  int mcus_per_row;
+  int mcu_rows;
+  int mcu_height;
+  int image_height;
+  // Decompression parameters, copied from the caller's decompressor
+  unsigned int scale_num;
+  unsigned int scale_denom;
+  boolean do_fancy_upsampling;
+  J_DCT_METHOD dct_method;
+  J_COLOR_SPACE out_color_space;
+  J_DITHER_MODE dither_mode;
+  } RestartJob;
+
+
+/*==========================================================================
+
+  restart_find_segments
+
+  Walk the markers up to the start of the scan, then scan the
+  entropy-coded data for RST markers. Returns FALSE if the file does
+  not have the simple structure we need -- one sequential scan,
+  followed by EOI, with exactly the expected number of RST markers,
+  correctly numbered. Anything odd is left for the ordinary decoder,
+  which knows how to recover from damaged data.
+
+==========================================================================*/
+static BOOL restart_find_segments (RestartJob *job, size_t size)
+  {
+  const BYTE *data = job->data;
+  size_t p = 2;
+  BOOL have_sof = FALSE;
+  job->sos_end = 0;
+
+  while (job->sos_end == 0)
+    {
+    if (p + 4 > size || data[p] != 0xFF) return FALSE;
+    int m = data[p + 1];
+    if (m == 0xFF) { p++; continue; } // Fill byte
+    if (m == JPEG_EOI) return FALSE;
+    int len = data[p + 2] << 8 | data[p + 3];
+    if (len < 2 || p + 2 + len > size) return FALSE;
+    if (m == 0xC0 || m == 0xC1)
+      {
+      job->sof_offset = p;
+      have_sof = TRUE;
+      }
+    else if (m >= 0xC2 && m <= 0xCF && m != 0xC4 && m != 0xC8
+        && m != 0xCC)
+      return FALSE;
+    if (m == 0xDA)
+      job->sos_end = p + 2 + len;
+    p += 2 + len;
+    }
+  if (!have_sof) return FALSE;
+
+  int n = 0;
+  job->seg_start[0] = job->sos_end;
+  for (p = job->sos_end; p + 1 < size; p++)
+    {
+    if (data[p] != 0xFF) continue;
+    int m = data[p + 1];
+    if (m == 0 || m == 0xFF) continue;
+    if (m >= JPEG_RST0 && m <= JPEG_RST0 + 7)
+      {
+      if (n + 1 >= job->n_segments || m != JPEG_RST0 + (n & 7))
+        return FALSE;
+      job->seg_end[n] = p;
+      n++;
+      job->seg_start[n] = p + 2;
+      p++;
+      continue;
+      }
+    if (m != JPEG_EOI || n + 1 != job->n_segments) return FALSE;
+    job->seg_end[n] = p;
+    return TRUE;
+    }
+  return FALSE;
+  }
+
+
+/*==========================================================================
+
+  restart_segment_of_row
+
+  The index of the restart interval that begins at the start of MCU
+  row, which must be on a restart boundary (or the end of the image)
+
+==========================================================================*/
+static int restart_segment_of_row (const RestartJob *job, int row)
+  {
+  if (row >= job->mcu_rows) return job->n_segments;
+  return (int)((long)row * job->mcus_per_row / job->interval);
+  }
+
+
+/*==========================================================================
+
+  restart_decode_band
+
+  Build a stand-alone JPEG for the band, and decode it into
+  band->pixels. Called on a worker thread
+
+==========================================================================*/
+static void restart_decode_band (Band *band, void *user_data)
+  {
+  const RestartJob *job = user_data;
+  int first_seg = restart_segment_of_row (job, band->dec_first);
+  int last_seg = restart_segment_of_row (job, band->dec_last);
+
+  size_t size = job->sos_end + 2;
+  for (int i = first_seg; i < last_seg; i++)
+    size += job->seg_end[i] - job->seg_start[i] + 2;
+
+  BYTE *stream = malloc (size);
+  memcpy (stream, job->data, job->sos_end);
+  int top = band->dec_first * job->mcu_height;
+  int bottom = band->dec_last * job->mcu_height;
+  if (bottom > job->image_height) bottom = job->image_height;
+  stream[job->sof_offset + 5] = (bottom - top) >> 8;
+  stream[job->sof_offset + 6] = (bottom - top) & 0xFF;
+
+  BYTE *q = stream + job->sos_end;
+  for (int i = first_seg; i < last_seg; i++)
+    {
+    if (i > first_seg)
+      {
+      *q++ = 0xFF;
+      *q++ = JPEG_RST0 + ((i - first_seg - 1) & 7);
+      }
+    size_t n = job->seg_end[i] - job->seg_start[i];
+    memcpy (q, job->data + job->seg_start[i], n);
+    q += n;
+    }
+  *q++ = 0xFF;
+  *q++ = JPEG_EOI;
+
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_decompress (&cinfo);
+  jpeg_mem_src (&cinfo, stream, q - stream);
+  jpeg_read_header (&cinfo, TRUE);
+  cinfo.scale_num = job->scale_num;
+  cinfo.scale_denom = job->scale_denom;
+  cinfo.do_fancy_upsampling = job->do_fancy_upsampling;
+  cinfo.dct_method = job->dct_method;
+  cinfo.out_color_space = job->out_color_space;
+  cinfo.dither_mode = job->dither_mode;
+  if (band->n_cols > 0)
+    jpeg_setup_columns (&cinfo, band->first_col, band->n_cols);
+  // The band is a JPEG in its own right, so tell the decoder where it
+  //   sits in the whole picture, to keep any dither pattern aligned
+  jpeg_calc_output_dimensions (&cinfo);
+  cinfo.dither_origin_row = band->dec_first 
+    * cinfo.max_v_samp_factor * cinfo.min_DCT_scaled_size;
+  jpeg_start_decompress (&cinfo);
+  bands_read_scanlines (&cinfo, band);
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+  free (stream);
+  }
+
+
+/*==========================================================================
+
+  restart_decode
+
+  Decode a JPEG file, already loaded into memory, in parallel if it
+  has a restart interval. cinfo must have had its header read, and its
+  scale and output dimensions set; it is used only for parameters, not
+  for decoding.
+
+  If the file is not suitable -- no restart markers, a progressive or
+  multi-scan file, too few restart points, a single CPU -- this
+  function returns FALSE without calling row_fn, and the caller must
+  decode the file itself. Otherwise the rows of region are passed to
+  row_fn, in order, on the calling thread. Bands outside the region 
+  are not decoded at all.
+
+==========================================================================*/
+BOOL restart_decode (const BYTE *data, size_t size,
+       struct jpeg_decompress_struct *cinfo, 
+       const JpegReaderRegion *region, JpegReaderRowFn row_fn, 
+       void *user_data)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+
+  if (cinfo->restart_interval == 0 || cinfo->progressive_mode
+       || cinfo->comps_in_scan != cinfo->num_components
+       || cinfo->num_components < 2 || bands_threads () < 2)
+    {
+    LOG_OUT
+    return FALSE;
+    }
+
+  RestartJob job;
+  memset (&job, 0, sizeof (job));
+  job.data = data;
+  job.interval = cinfo->restart_interval;
+  job.mcu_height = cinfo->max_v_samp_factor * DCTSIZE;
+  job.mcus_per_row = (cinfo->image_width
+    + cinfo->max_h_samp_factor * DCTSIZE - 1)
+    / (cinfo->max_h_samp_factor * DCTSIZE);
+  job.mcu_rows = cinfo->total_iMCU_rows;
+  job.image_height = cinfo->image_height;
+  job.n_segments = (int)(((long)job.mcus_per_row * job.mcu_rows
+    + job.interval - 1) / job.interval);
+  job.seg_start = malloc (job.n_segments * sizeof (size_t));
+  job.seg_end = malloc (job.n_segments * sizeof (size_t));
+  job.scale_num = cinfo->scale_num;
+  job.scale_denom = cinfo->scale_denom;
+  job.do_fancy_upsampling = cinfo->do_fancy_upsampling;
+  job.dct_method = cinfo->dct_method;
+  job.out_color_space = cinfo->out_color_space;
+  job.dither_mode = cinfo->dither_mode;
+
+  if (restart_find_segments (&job, size))
+    {
+    // Restart boundaries fall at the start of every step'th MCU row
+    int a = job.interval, b = job.mcus_per_row;
+    while (b) { int t = a % b; a = b; b = t; }
+    log_debug ("restart: interval %d, %d segments",
+      job.interval, job.n_segments);
+    ret = bands_decode (cinfo, job.interval / a, restart_decode_band, 
+      &job, region, row_fn, user_data);
+    }
+
+  free (job.seg_start);
+  free (job.seg_end);
+  LOG_OUT
+  return ret;
+  }
+
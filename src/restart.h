@@ -0,0 +1,24 @@
+/*============================================================================
+
+  jpegtofb
+  restart.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdio.h>
+#include "defs.h"
+#include "jpeglib.h"
+#include "jpegreader.h"
+
+BEGIN_DECLS
+
+BOOL restart_decode (const BYTE *data, size_t size,
+       struct jpeg_decompress_struct *cinfo, 
+       const JpegReaderRegion *region, JpegReaderRowFn row_fn, 
+       void *user_data);
+
+END_DECLS
+
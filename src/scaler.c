@@ -0,0 +1,540 @@
+/*==========================================================================
+
+  jpegtofb
+  scaler.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A separable image scaler that works one row at a time, so it can sit
+  between the JPEG decoder and the framebuffer without either image
+  ever being held in memory in full.
+
+  By default, the scaler just samples: each output pixel is a copy of
+  the input pixel under its top-left corner, and each output row of
+  one input row, which is repeated or skipped as necessary. Rows are
+  sampled as they are pushed, and not stored at all. This is as fast
+  as scaling can be, but it makes fine detail shimmer, and edges 
+  jagged, so there is also a smoothing filter, which is described
+  below. The decoder has usually done most of the shrinking by then,
+  so what is left is a factor of less than two, and the filter takes
+  two or three times as long as sampling.
+
+  When shrinking, each output pixel is the area-weighted average of the
+  input pixels it covers (a box filter), which doesn't alias the way
+  that point sampling does. When enlarging, output pixels are
+  interpolated bilinearly from their two nearest neighbours. Either
+  way, every output pixel is a weighted sum of a run of input pixels,
+  and the weights are worked out once per image, as 8-bit fixed-point
+  integers that sum to exactly 1.0. Nothing in the per-pixel loops is
+  floating-point.
+
+  Input rows are kept, as they arrive, in a small ring. As soon as the
+  last input row that an output row depends on has arrived, the rows
+  it needs are combined vertically into one row, which is then scaled
+  horizontally and handed to the caller. The ring needs only as many
+  rows as the largest number of input rows that contribute to one 
+  output row. Scaling vertically first means that each output row is
+  scaled horizontally only once, however many input rows went into
+  it; and the vertical pass works along whole rows of bytes, in 16-bit
+  arithmetic, which the compiler can turn into vector instructions.
+
+  The horizontal pass can't be vectorized like that, because the 
+  inputs to each output pixel are in different places. Instead, the 
+  vertically-scaled row has a 16-bit value for each colour, so that
+  one 64-bit load fetches all three colours of a pixel, each in its 
+  own 16 bits, and one multiplication weights all of them at once:
+  with 8-bit colours, and 8-bit weights that sum to one, no colour 
+  can overflow into the next. This takes about a third of the time 
+  that doing the colours separately does.
+
+  Only the output rows and columns that the caller asked for are
+  computed, and input rows that no wanted output row uses are skipped
+  altogether. If the source of the input can supply just part of the
+  image, the scaler can say which part it needs.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "log.h" 
+#include "scaler.h" 
+
+// Precision of filter weights
+#define SCALER_WEIGHT_BITS 8
+#define SCALER_ONE (1 << SCALER_WEIGHT_BITS)
+
+// Distance between the colours of a pixel of the vertically-scaled 
+//   row, when it is loaded as a 64-bit integer
+#define SCALER_LANE 16
+
+// The contributions to each output pixel (or row) on one axis. Every 
+//   output is the weighted sum of the same number of consecutive inputs,
+//   n_taps, so that the inner loops have a fixed trip count. Output i is
+//   the sum of inputs start[i]..start[i] + n_taps - 1, with weights
+//   weights[i * n_taps].. Outputs that need fewer inputs than n_taps
+//   have some zero weights
+typedef struct _ScalerTaps
+  {
+  int *start;
+  uint16_t *weights;
+  int n_taps;
+  } ScalerTaps;
+
+struct _Scaler
+  {
+  int in_width;
+  int in_height;
+  int first_col;
+  int n_cols;
+  int first_row;
+  int n_rows;
+  ScalerTaps h;
+  ScalerTaps v;
+  // Width of the rows pushed: in_width, unless the input is cropped
+  int row_width;
+  // Ring of input rows, 3 * row_width bytes each
+  BYTE *ring;
+  int ring_rows;
+  // Input rows scaled vertically, 3 * row_width values, and one more
+  //   that is read, but not used, with the last pixel
+  uint16_t *mid;
+  // Output row under construction
+  BYTE *out_row;
+  // Next input row expected, and next output row to produce
+  int in_row;
+  int out_row_num;
+  ScalerRowFn row_fn;
+  void *user_data;
+  };
+
+
+/*==========================================================================
+
+  scaler_make_taps
+
+  Work out the filter taps for outputs first..first+n-1, when in_size
+  inputs are scaled to out_size outputs. Without smoothing, there is
+  one tap, on the input under the output's top-left corner
+
+==========================================================================*/
+static void scaler_make_taps (ScalerTaps *taps, int in_size, int out_size, 
+      int first, int n, BOOL smooth)
+  {
+  double ratio = (double)in_size / (double)out_size;
+  // A box ratio inputs wide can straddle ceil(ratio) + 1 inputs 
+  int n_taps = ratio > 1.0 ? (int)ceil (ratio) + 1 : 2;
+  if (in_size == out_size || !smooth) n_taps = 1;
+  if (n_taps > in_size) n_taps = in_size;
+
+  taps->n_taps = n_taps;
+  taps->start = malloc (n * sizeof (int));
+  taps->weights = malloc (n * n_taps * sizeof (uint16_t));
+
+  if (!smooth)
+    {
+    for (int i = 0; i < n; i++)
+      {
+      int start = (first + i) * ratio;
+      taps->start[i] = start < in_size ? start : in_size - 1;
+      taps->weights[i] = SCALER_ONE;
+      }
+    return;
+    }
+
+  double w[n_taps];
+  for (int i = 0; i < n; i++)
+    {
+    int out = first + i;
+    int start, count = 0;
+    if (ratio >= 1.0)
+      {
+      // Box filter: weight each input by how much of it the output
+      //   pixel covers
+      double a = out * ratio;
+      double b = a + ratio;
+      if (b > in_size) b = in_size;
+      start = (int)a;
+      for (int k = start; k < b && count < n_taps; k++)
+        {
+        double lo = k > a ? k : a;
+        double hi = k + 1 < b ? k + 1 : b;
+        w[count++] = (hi - lo) / ratio;
+        }
+      }
+    else
+      {
+      // Bilinear: interpolate between the two inputs either side of 
+      //   the output pixel's centre
+      double x = (out + 0.5) * ratio - 0.5;
+      if (x < 0) x = 0;
+      start = (int)x;
+      double f = x - start;
+      w[count++] = 1.0 - f;
+      if (start + 1 < in_size && f > 0)
+        w[count++] = f;
+      }
+    if (start >= in_size) start = in_size - 1;
+    if (count == 0) w[count++] = 1.0;
+
+    // Pad out to n_taps, moving the start back if necessary so that
+    //   all the inputs exist
+    int pad = 0;
+    if (start + n_taps > in_size)
+      {
+      pad = start + n_taps - in_size;
+      start -= pad;
+      }
+
+    // Round to fixed point, and make sure the weights sum to exactly
+    //  one, by putting any rounding error into the biggest weight 
+    uint16_t *fw = taps->weights + i * n_taps;
+    memset (fw, 0, n_taps * sizeof (uint16_t));
+    int sum = 0, biggest = pad;
+    for (int k = 0; k < count; k++)
+      {
+      fw[pad + k] = (int)(w[k] * SCALER_ONE + 0.5);
+      sum += fw[pad + k];
+      if (fw[pad + k] > fw[biggest]) biggest = pad + k;
+      }
+    fw[biggest] += SCALER_ONE - sum;
+    taps->start[i] = start;
+    }
+  }
+
+
+/*==========================================================================
+
+  scaler_free_taps
+
+==========================================================================*/
+static void scaler_free_taps (ScalerTaps *taps)
+  {
+  free (taps->start);
+  free (taps->weights);
+  }
+
+
+/*==========================================================================
+
+  scaler_create
+
+  Create a scaler that will take in_width x in_height RGB888 input and 
+  scale it to out_width x out_height. Only output columns 
+  first_col..first_col+n_cols-1 and rows first_row..first_row+n_rows-1 
+  are produced; these must lie within the output image. If smooth is
+  FALSE, the input is just sampled
+
+==========================================================================*/
+Scaler *scaler_create (int in_width, int in_height, int out_width, 
+      int out_height, int first_col, int n_cols, int first_row, 
+      int n_rows, BOOL smooth, ScalerRowFn row_fn, void *user_data)
+  {
+  LOG_IN
+  Scaler *self = malloc (sizeof (Scaler));
+  memset (self, 0, sizeof (Scaler));
+  self->in_width = in_width;
+  self->in_height = in_height;
+  self->first_col = first_col;
+  self->n_cols = n_cols;
+  self->first_row = first_row;
+  self->n_rows = n_rows;
+  self->row_fn = row_fn;
+  self->user_data = user_data;
+
+  scaler_make_taps (&self->h, in_width, out_width, first_col, n_cols,
+    smooth);
+  scaler_make_taps (&self->v, in_height, out_height, first_row, n_rows,
+    smooth);
+
+  self->row_width = in_width;
+  self->ring_rows = self->v.n_taps;
+  self->ring = malloc (self->ring_rows * in_width * 3);
+  self->mid = calloc (in_width * 3 + 1, sizeof (uint16_t));
+  self->out_row = malloc (n_cols * 3);
+  self->in_row = 0;
+  self->out_row_num = 0;
+
+  log_debug ("scaler: %d x %d -> %d x %d, %d h taps, %d v taps", 
+    in_width, in_height, out_width, out_height, self->h.n_taps, 
+    self->v.n_taps);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  scaler_destroy
+
+==========================================================================*/
+void scaler_destroy (Scaler *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    scaler_free_taps (&self->h);
+    scaler_free_taps (&self->v);
+    free (self->ring);
+    free (self->mid);
+    free (self->out_row);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  scaler_crop_input
+
+  Report the rectangle of the input image that the wanted output 
+  actually uses, and set the scaler up to be given only that part: 
+  each row pushed from now on starts at column *x, and the first is
+  row *y. Call this before pushing any rows, or not at all
+
+==========================================================================*/
+void scaler_crop_input (Scaler *self, int *x, int *y, int *width, 
+      int *height)
+  {
+  LOG_IN
+  int left = self->in_width, right = 0;
+  for (int i = 0; i < self->n_cols; i++)
+    {
+    if (self->h.start[i] < left) left = self->h.start[i];
+    if (self->h.start[i] + self->h.n_taps > right) 
+      right = self->h.start[i] + self->h.n_taps;
+    }
+  for (int i = 0; i < self->n_cols; i++)
+    self->h.start[i] -= left;
+
+  int top = self->in_height, bottom = 0;
+  for (int i = 0; i < self->n_rows; i++)
+    {
+    if (self->v.start[i] < top) top = self->v.start[i];
+    if (self->v.start[i] + self->v.n_taps > bottom) 
+      bottom = self->v.start[i] + self->v.n_taps;
+    }
+  self->in_row = top;
+  self->row_width = right - left;
+
+  *x = left;
+  *y = top;
+  *width = right - left;
+  *height = bottom - top;
+  log_debug ("scaler: input cropped to %d x %d at %d,%d", *width, *height,
+    *x, *y);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  scaler_scale_v
+
+  Combine the input rows that output row i (relative to first_row) 
+  depends on, which must all be in the ring, into the mid row. Rows 
+  with no weight are skipped; there is often one, because the taps 
+  are padded. The sums can't overflow 16 bits, because the weights 
+  add up to SCALER_ONE
+
+==========================================================================*/
+static void scaler_scale_v (Scaler *self, int i)
+  {
+  const ScalerTaps *v = &self->v;
+  const uint16_t round = 1 << (SCALER_WEIGHT_BITS - 1);
+  int n = self->row_width * 3;
+  const uint16_t *w = v->weights + i * v->n_taps;
+  uint16_t *mid = self->mid;
+
+  const BYTE *rows[v->n_taps];
+  uint16_t weights[v->n_taps];
+  int n_rows = 0;
+  for (int k = 0; k < v->n_taps; k++)
+    {
+    if (w[k] == 0) continue;
+    rows[n_rows] = self->ring + ((v->start[i] + k) % self->ring_rows) * n;
+    weights[n_rows++] = w[k];
+    }
+
+  const BYTE *p0 = rows[0];
+  uint16_t w0 = weights[0];
+  if (n_rows == 1)
+    {
+    for (int j = 0; j < n; j++)
+      mid[j] = p0[j];
+    }
+  else if (n_rows == 2)
+    {
+    const BYTE *p1 = rows[1];
+    uint16_t w1 = weights[1];
+    for (int j = 0; j < n; j++)
+      mid[j] = (uint16_t)(p0[j] * w0 + p1[j] * w1 + round) 
+        >> SCALER_WEIGHT_BITS;
+    }
+  else
+    {
+    const BYTE *p1 = rows[1], *p2 = rows[2];
+    uint16_t w1 = weights[1], w2 = weights[2];
+    for (int j = 0; j < n; j++)
+      mid[j] = p0[j] * w0 + p1[j] * w1 + p2[j] * w2 + round;
+    for (int k = 3; k < n_rows; k++)
+      {
+      const BYTE *p = rows[k];
+      uint16_t wk = weights[k];
+      for (int j = 0; j < n; j++)
+        mid[j] += p[j] * wk;
+      }
+    for (int j = 0; j < n; j++)
+      mid[j] >>= SCALER_WEIGHT_BITS;
+    }
+  }
+
+
+/*==========================================================================
+
+  scaler_load_pixel
+
+  Pixel x of the mid row, with each colour in its own SCALER_LANE
+  bits. Whatever is in the top 16 bits doesn't matter, because
+  multiplication only carries upwards
+
+==========================================================================*/
+static inline uint64_t scaler_load_pixel (const uint16_t *mid, int x)
+  {
+  uint64_t p;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy (&p, mid + 3 * x, sizeof (p));
+#else
+  mid += 3 * x;
+  p = mid[0] | (uint64_t)mid[1] << SCALER_LANE 
+    | (uint64_t)mid[2] << (2 * SCALER_LANE);
+#endif
+  return p;
+  }
+
+
+/*==========================================================================
+
+  scaler_scale_h_n
+
+  Scale the mid row horizontally into the output row, with a fixed 
+  number of taps. This is always inlined with a constant n_taps, so
+  the compiler can unroll the inner loop
+
+==========================================================================*/
+static inline void scaler_scale_h_n (Scaler *self, const int n_taps)
+  {
+  const uint64_t r = 1 << (SCALER_WEIGHT_BITS - 1);
+  const uint64_t round = r | r << SCALER_LANE | r << (2 * SCALER_LANE);
+  // Locals, because the compiler must assume that writing to out
+  //   might change anything in self
+  const uint16_t *mid = self->mid;
+  const int *start = self->h.start;
+  const uint16_t *w = self->h.weights;
+  int n_cols = self->n_cols;
+  BYTE *out = self->out_row;
+  for (int j = 0; j < n_cols; j++, out += 3, w += n_taps)
+    {
+    uint64_t a = round;
+    for (int k = 0; k < n_taps; k++)
+      a += scaler_load_pixel (mid, start[j] + k) * w[k];
+    out[0] = a >> SCALER_WEIGHT_BITS;
+    out[1] = a >> (SCALER_LANE + SCALER_WEIGHT_BITS);
+    out[2] = a >> (2 * SCALER_LANE + SCALER_WEIGHT_BITS);
+    }
+  }
+
+
+/*==========================================================================
+
+  scaler_scale_h
+
+==========================================================================*/
+static void scaler_scale_h (Scaler *self)
+  {
+  switch (self->h.n_taps)
+    {
+    case 1: scaler_scale_h_n (self, 1); break;
+    case 2: scaler_scale_h_n (self, 2); break;
+    case 3: scaler_scale_h_n (self, 3); break;
+    case 4: scaler_scale_h_n (self, 4); break;
+    default: scaler_scale_h_n (self, self->h.n_taps);
+    }
+  }
+
+
+/*==========================================================================
+
+  scaler_sample_row
+
+  Produce an output row from one input row, when neither axis has more
+  than one tap
+
+==========================================================================*/
+static void scaler_sample_row (Scaler *self, const BYTE *row)
+  {
+  const int *start = self->h.start;
+  int n_cols = self->n_cols;
+  BYTE *out = self->out_row;
+  for (int j = 0; j < n_cols; j++, out += 3)
+    {
+    const BYTE *p = row + start[j] * 3;
+    out[0] = p[0];
+    out[1] = p[1];
+    out[2] = p[2];
+    }
+  }
+
+
+/*==========================================================================
+
+  scaler_push_row
+
+  Supply the next input row, in order from the top. Any output rows
+  that can now be completed are passed to the row callback before this
+  function returns. 
+
+==========================================================================*/
+void scaler_push_row (Scaler *self, const BYTE *row)
+  {
+  const ScalerTaps *v = &self->v;
+  int y = self->in_row++;
+  if (self->out_row_num >= self->n_rows) return;
+
+  // Input rows before the first one the next output row needs can
+  //   be ignored 
+  if (y < v->start[self->out_row_num]) return;
+
+  if (v->n_taps == 1 && self->h.n_taps == 1)
+    {
+    // Each output row that takes this input row is sampled from it
+    //   directly, so it needn't be kept
+    while (self->out_row_num < self->n_rows 
+           && v->start[self->out_row_num] == y)
+      {
+      scaler_sample_row (self, row);
+      self->row_fn (self->out_row, self->first_row + self->out_row_num, 
+        self->user_data);
+      self->out_row_num++;
+      }
+    return;
+    }
+
+  int n = self->row_width * 3;
+  memcpy (self->ring + (y % self->ring_rows) * n, row, n);
+
+  while (self->out_row_num < self->n_rows)
+    {
+    int i = self->out_row_num;
+    int last = v->start[i] + v->n_taps - 1;
+    if (last > y) break;
+    scaler_scale_v (self, i);
+    scaler_scale_h (self);
+    self->row_fn (self->out_row, self->first_row + i, self->user_data);
+    self->out_row_num++;
+    }
+  }
+
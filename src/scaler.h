@@ -0,0 +1,31 @@
+/*============================================================================
+
+  jpegtofb
+  scaler.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+struct _Scaler;
+typedef struct _Scaler Scaler;
+
+// Called with each finished output row, in order. The row is RGB888, 
+//   n_cols pixels wide, and is only valid for the duration of the call
+typedef void (*ScalerRowFn) (const BYTE *row, int y, void *user_data);
+
+BEGIN_DECLS
+
+Scaler *scaler_create (int in_width, int in_height, int out_width, 
+          int out_height, int first_col, int n_cols, int first_row, 
+          int n_rows, BOOL smooth, ScalerRowFn row_fn, void *user_data);
+void    scaler_destroy (Scaler *self);
+void    scaler_crop_input (Scaler *self, int *x, int *y, int *width, 
+          int *height);
+void    scaler_push_row (Scaler *self, const BYTE *row);
+
+END_DECLS
+
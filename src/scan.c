@@ -0,0 +1,291 @@
+/*==========================================================================
+
+  jpegtofb
+  scan.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Finds the files that might belong in the slideshow, and checks them,
+  on a small pool of background threads. Checking a file is mostly 
+  waiting for I/O -- especially on an SD card or over NFS -- so several
+  checks in flight at once go much faster than one after another, even
+  on a single CPU.
+
+  The list of files is made on one of the threads, by the list 
+  function, which passes each file it finds to scan_add(); searching 
+  a large directory tree takes a while, so the files are checked as 
+  they are found, rather than after the search. Files are handed out
+  to the workers in order, and the ones that pass are passed to the 
+  add function in the same order, however the checks happen to 
+  finish. scan_wait_first() returns as soon as the first file has been
+  added, so the slideshow can start while the rest are still being 
+  found and checked; the done function is called when they all have
+  been. The threads run at low priority, so they don't hold up the 
+  decoding of the pictures.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "log.h"
+#include "scan.h"
+
+// Files checked at once. This is about hiding I/O latency, so it
+//   doesn't depend on the number of CPUs
+#define SCAN_THREADS 8
+// Nice value for the threads
+#define SCAN_NICE 10
+
+typedef enum
+  {
+  SCAN_PENDING = 0,
+  SCAN_ACCEPTED,
+  SCAN_REJECTED
+  } ScanResult;
+
+struct _Scan
+  {
+  // The files found so far. Each name is freed once it has been passed
+  //   to add_fn, or rejected
+  char **filenames;
+  BYTE *results;
+  int n;
+  int max;
+  // Whether the list function has finished, and whether the done 
+  //   function has been called
+  BOOL listed;
+  BOOL done;
+  ScanListFn list_fn;
+  ScanCheckFn check_fn;
+  ScanAddFn add_fn;
+  ScanDoneFn done_fn;
+  void *user_data;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  BOOL quit;
+  // The next file to hand to a worker
+  int next_check;
+  // The next file to pass to add_fn, when its check is done
+  int next_add;
+  int n_added;
+  pthread_t list_thread;
+  pthread_t threads[SCAN_THREADS];
+  };
+
+
+/*==========================================================================
+
+  scan_pass_on
+
+  Pass on every file, in order, whose check has finished, and call the
+  done function if that's all of them. Called with the mutex held, 
+  which keeps the calls in order, and one at a time
+
+==========================================================================*/
+static void scan_pass_on (Scan *self)
+  {
+  while (self->next_add < self->n
+       && self->results[self->next_add] != SCAN_PENDING)
+    {
+    char *filename = self->filenames[self->next_add];
+    if (self->results[self->next_add] == SCAN_ACCEPTED)
+      {
+      self->add_fn (filename, self->user_data);
+      self->n_added++;
+      }
+    free (filename);
+    self->filenames[self->next_add] = NULL;
+    self->next_add++;
+    }
+  if (self->listed && self->next_add == self->n && !self->done)
+    {
+    self->done = TRUE;
+    log_debug ("scan: %d files checked, %d added", self->n, 
+      self->n_added);
+    if (self->done_fn) self->done_fn (self->user_data);
+    }
+  }
+
+
+/*==========================================================================
+
+  scan_thread
+
+==========================================================================*/
+static void *scan_thread (void *arg)
+  {
+  Scan *self = arg;
+  setpriority (PRIO_PROCESS, syscall (SYS_gettid), SCAN_NICE);
+
+  pthread_mutex_lock (&self->mutex);
+  while (!self->quit)
+    {
+    if (self->next_check < self->n)
+      {
+      int i = self->next_check++;
+      // The array might be moved by scan_add(), but not the name
+      const char *filename = self->filenames[i];
+      pthread_mutex_unlock (&self->mutex);
+
+      BOOL ok = self->check_fn (filename, self->user_data);
+
+      pthread_mutex_lock (&self->mutex);
+      self->results[i] = ok ? SCAN_ACCEPTED : SCAN_REJECTED;
+      scan_pass_on (self);
+      pthread_cond_broadcast (&self->cond);
+      }
+    else if (self->listed)
+      break;
+    else
+      pthread_cond_wait (&self->cond, &self->mutex);
+    }
+  pthread_mutex_unlock (&self->mutex);
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  scan_list_thread
+
+==========================================================================*/
+static void *scan_list_thread (void *arg)
+  {
+  Scan *self = arg;
+  setpriority (PRIO_PROCESS, syscall (SYS_gettid), SCAN_NICE);
+  self->list_fn (self, self->user_data);
+
+  pthread_mutex_lock (&self->mutex);
+  self->listed = TRUE;
+  // If every file has been checked already, or there are none, the
+  //   workers won't do this
+  scan_pass_on (self);
+  pthread_cond_broadcast (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  scan_start
+
+  Start finding and checking files in the background
+
+==========================================================================*/
+Scan *scan_start (ScanListFn list_fn, ScanCheckFn check_fn,
+       ScanAddFn add_fn, ScanDoneFn done_fn, void *user_data)
+  {
+  LOG_IN
+  Scan *self = malloc (sizeof (Scan));
+  memset (self, 0, sizeof (Scan));
+  self->list_fn = list_fn;
+  self->check_fn = check_fn;
+  self->add_fn = add_fn;
+  self->done_fn = done_fn;
+  self->user_data = user_data;
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_cond_init (&self->cond, NULL);
+
+  // Signals must go to the main thread
+  sigset_t all, old;
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  pthread_create (&self->list_thread, NULL, scan_list_thread, self);
+  for (int i = 0; i < SCAN_THREADS; i++)
+    pthread_create (&self->threads[i], NULL, scan_thread, self);
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  scan_add
+
+  Add a file to the list to be checked. Called by the list function
+
+==========================================================================*/
+void scan_add (Scan *self, const char *filename)
+  {
+  pthread_mutex_lock (&self->mutex);
+  if (!self->quit)
+    {
+    if (self->n == self->max)
+      {
+      self->max = self->max ? 2 * self->max : 256;
+      self->filenames = realloc (self->filenames, 
+        self->max * sizeof (char *));
+      self->results = realloc (self->results, self->max);
+      }
+    self->filenames[self->n] = strdup (filename);
+    self->results[self->n] = SCAN_PENDING;
+    self->n++;
+    pthread_cond_signal (&self->cond);
+    }
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  scan_wait_first
+
+  Wait until the first file has been added, or every file has been
+  found and checked, whichever is sooner. Returns the number of files
+  added so far, which is zero only if none of them passed
+
+==========================================================================*/
+int scan_wait_first (Scan *self)
+  {
+  LOG_IN
+  pthread_mutex_lock (&self->mutex);
+  while (self->n_added == 0 
+       && !(self->listed && self->next_add == self->n))
+    pthread_cond_wait (&self->cond, &self->mutex);
+  int ret = self->n_added;
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  scan_destroy
+
+  Stop the scan, waiting for any checks in progress to finish. If the
+  list function is still searching, that has to finish too, although
+  nothing more it finds is checked
+
+==========================================================================*/
+void scan_destroy (Scan *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->mutex);
+    self->quit = TRUE;
+    pthread_cond_broadcast (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
+    pthread_join (self->list_thread, NULL);
+    for (int i = 0; i < SCAN_THREADS; i++)
+      pthread_join (self->threads[i], NULL);
+    pthread_mutex_destroy (&self->mutex);
+    pthread_cond_destroy (&self->cond);
+    for (int i = self->next_add; i < self->n; i++)
+      free (self->filenames[i]);
+    free (self->filenames);
+    free (self->results);
+    free (self);
+    }
+  LOG_OUT
+  }
+
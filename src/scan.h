@@ -0,0 +1,43 @@
+/*============================================================================
+
+  jpegtofb
+  scan.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+struct _Scan;
+typedef struct _Scan Scan;
+
+// Finds the files to be checked, and passes each one to scan_add(), 
+//   in the order they should be added. Called on one of the scan's
+//   threads; the list is complete when it returns
+typedef void (*ScanListFn) (Scan *scan, void *user_data);
+
+// Decides whether a file should be included. Called on the scan's
+//   worker threads, several at once, so it must be thread-safe
+typedef BOOL (*ScanCheckFn) (const char *filename, void *user_data);
+
+// Called with each file that passed the check, in the original order.
+//   Calls come from the worker threads, but never two at once
+typedef void (*ScanAddFn) (const char *filename, void *user_data);
+
+// Called once, after the list function has finished, and the last 
+//   file has been checked and added. May be NULL
+typedef void (*ScanDoneFn) (void *user_data);
+
+BEGIN_DECLS
+
+Scan       *scan_start (ScanListFn list_fn, ScanCheckFn check_fn,
+              ScanAddFn add_fn, ScanDoneFn done_fn, void *user_data);
+void        scan_add (Scan *self, const char *filename);
+int         scan_wait_first (Scan *self);
+void        scan_destroy (Scan *self);
+
+END_DECLS
+
+
@@ -22,15 +22,26 @@
 #include "string.h" 
 #include "defs.h" 
 #include "log.h" 
-#include "list.h" 
+#include "catalogue.h" 
 #include "slideshow.h" 
+#include "framebuffer.h" 
 #include "jpegtofb.h" 
+#include "prefetch.h" 
 
 struct _Slideshow
   {
-  char *fbdev;
-  List *list;
+  // The framebuffer session lasts as long as the slideshow, so the
+  //   device is not reopened and remapped for every picture
+  FrameBuffer *fb;
+  // Decodes the next picture while the current one is on display
+  Prefetch *prefetch;
+  // Pictures can be added and removed on other threads while the show
+  //   is running. The mutex protects the catalogue and the index
+  pthread_mutex_t mutex;
+  Catalogue *catalogue;
   int index;
+  // Shuffle the pictures every time the show goes back to the start
+  BOOL randomize;
   BOOL fit_to_width;
   }; 
 
@@ -44,9 +55,12 @@ Slideshow *slideshow_create (const char *fbdev, BOOL fit_to_width)
   {
   LOG_IN
   Slideshow *self = malloc (sizeof (Slideshow));
-  self->fbdev = strdup (fbdev);
-  self->list = list_create ((ListItemFreeFn)free);
+  self->fb = framebuffer_create (fbdev);
+  self->prefetch = prefetch_create (fit_to_width);
+  pthread_mutex_init (&self->mutex, NULL);
+  self->catalogue = catalogue_create ();
   self->index = 0;
+  self->randomize = FALSE;
   self->fit_to_width = fit_to_width;
   LOG_OUT
   return self;
@@ -63,16 +77,22 @@ void slideshow_destroy (Slideshow *self)
   LOG_IN
   if (self)
     {
-    if (self->fbdev) 
+    if (self->prefetch) 
       {
-      free (self->fbdev);
-      self->fbdev = NULL;
+      prefetch_destroy (self->prefetch);
+      self->prefetch = NULL;
       }
-    if (self->list)
+    if (self->fb) 
       {
-      list_destroy (self->list);
-      self->list = NULL;
+      framebuffer_destroy (self->fb);
+      self->fb = NULL;
       }
+    if (self->catalogue)
+      {
+      catalogue_destroy (self->catalogue);
+      self->catalogue = NULL;
+      }
+    pthread_mutex_destroy (&self->mutex);
     free (self);
     }
   LOG_OUT
@@ -82,35 +102,130 @@ void slideshow_destroy (Slideshow *self)
 
   slideshow_add_picture
 
+  Add a picture at the end of the show, unless it's already there. If
+  the show is random, the picture goes anywhere in the rest of the
+  current round -- but not next, because the next picture might 
+  already be being decoded
+
 *==========================================================================*/
 void slideshow_add_picture (Slideshow *self, const char *filename)
   {
   LOG_IN
   log_debug ("Add picture: %s", filename);
-  list_append (self->list, strdup (filename));
+  pthread_mutex_lock (&self->mutex);
+  if (self->randomize)
+    catalogue_add_random (self->catalogue, filename, self->index + 1);
+  else
+    catalogue_add (self->catalogue, filename);
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  slideshow_contains
+
+*==========================================================================*/
+BOOL slideshow_contains (Slideshow *self, const char *filename)
+  {
+  pthread_mutex_lock (&self->mutex);
+  BOOL ret = catalogue_contains (self->catalogue, filename);
+  pthread_mutex_unlock (&self->mutex);
+  return ret;
+  }
+
+/*==========================================================================
+
+  slideshow_remove_pictures
+
+  Remove a picture, or every picture in a directory. The show carries 
+  on from where it was
+
+*==========================================================================*/
+void slideshow_remove_pictures (Slideshow *self, const char *path)
+  {
+  LOG_IN
+  log_debug ("Remove pictures: %s", path);
+  pthread_mutex_lock (&self->mutex);
+  catalogue_remove (self->catalogue, path, &self->index);
+  pthread_mutex_unlock (&self->mutex);
   LOG_OUT
   }
 
+/*==========================================================================
+
+  slideshow_wrap
+
+  Go back to the start of the show, reshuffling it if it's random. 
+  The picture that was shown last is not allowed to come first in the
+  new order. Must be called with the mutex held
+
+*==========================================================================*/
+static void slideshow_wrap (Slideshow *self, const char *last)
+  {
+  self->index = 0;
+  if (self->randomize)
+    {
+    log_debug ("Slideshow reshuffle");
+    catalogue_shuffle (self->catalogue, last);
+    }
+  }
+
 /*==========================================================================
 
   slideshow_show_and_increment
   
-  returns true if the current image in the sequence could be shown
+  Show the current image in the sequence, and move on to the next. 
+  Normally the current image will already have been decoded in the
+  background, and just needs to be copied to the framebuffer. 
+  Decoding of the next image is started before this function 
+  returns. 
+
+  Pictures may still be being added or removed, on another thread, 
+  while the show is running, so the length of the show is checked 
+  afresh every time. The filenames stay valid even if the picture
+  is removed. If there are no pictures at all, nothing is shown.
 
 *==========================================================================*/
 void slideshow_show_and_increment (Slideshow *self, char **error)
   {
   LOG_IN
-  int l = list_length (self->list);
-  const char *filename = list_get (self->list, self->index);
-  log_debug ("show_and_increment l=%d, index=%d, file=%s",
-         l, self->index, filename);
-
-  jpegtofb_putonfb (self->fbdev, filename, self->fit_to_width, error);
+  const char *filename = NULL;
+  pthread_mutex_lock (&self->mutex);
+  int l = catalogue_length (self->catalogue);
+  if (l > 0)
+    {
+    if (self->index >= l)
+      slideshow_wrap (self, NULL);
+    filename = catalogue_get (self->catalogue, self->index);
+    log_debug ("show_and_increment l=%d, index=%d, file=%s",
+           l, self->index, filename);
+    self->index++;
+    }
+  pthread_mutex_unlock (&self->mutex);
 
-  self->index++;
-  if (self->index == l)
-    self->index = 0;
+  if (filename && framebuffer_refresh (self->fb, error))
+    {
+    FbSurface surface;
+    framebuffer_get_surface (self->fb, &surface);
+    if (!prefetch_take (self->prefetch, filename, &surface, error))
+      jpegtofb_render (&surface, filename, self->fit_to_width, error);
+
+    // Wrap here, rather than next time, so that it's the first picture 
+    //   in the new order that gets prefetched
+    const char *next = NULL;
+    pthread_mutex_lock (&self->mutex);
+    l = catalogue_length (self->catalogue);
+    if (l > 1)
+      {
+      if (self->index >= l)
+        slideshow_wrap (self, filename);
+      next = catalogue_get (self->catalogue, self->index);
+      }
+    pthread_mutex_unlock (&self->mutex);
+    if (next)
+      prefetch_request (self->prefetch, next, &surface);
+    }
   LOG_OUT
   }
 
@@ -119,37 +234,31 @@ void slideshow_show_and_increment (Slideshow *self, char **error)
   slideshow_length
   
 *==========================================================================*/
-int slideshow_length (const Slideshow *self)
+int slideshow_length (Slideshow *self)
   {
-  return list_length (self->list);
+  pthread_mutex_lock (&self->mutex);
+  int ret = catalogue_length (self->catalogue);
+  pthread_mutex_unlock (&self->mutex);
+  return ret;
   }
 
 /*==========================================================================
 
   slideshow_randomize
 
-  Shuffle the files in the list, keeping the overall list the same
-  length.
+  Shuffle the pictures now, and every time the show goes back to the
+  start. Pictures that are added in the meantime are put at random
+  places in the rest of the current round.
   
 *==========================================================================*/
 void slideshow_randomize (Slideshow *self)
   {
-  List *newlist = list_create ((ListItemFreeFn)free); 
-
-  while (list_length (self->list) > 0)
-    {
-    // Be aware that list length will shrink as we proceed
-    int l = list_length (self->list);
-    int r = (int) ((double)rand() * l / RAND_MAX);
-    char *s = list_get (self->list, r); 
-    list_append (newlist, strdup (s));
-    list_remove_object (self->list, s);
-    }
-
-  list_destroy (self->list);
-  self->list = newlist;
+  LOG_IN
+  pthread_mutex_lock (&self->mutex);
+  self->randomize = TRUE;
+  catalogue_shuffle (self->catalogue, NULL);
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
   }
 
 
-
-
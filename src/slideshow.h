@@ -18,8 +18,10 @@ BEGIN_DECLS
 Slideshow  *slideshow_create (const char *fbdev, BOOL fit_to_width);
 void        slideshow_destroy (Slideshow *self);
 void        slideshow_add_picture (Slideshow *self, const char *filename);
+void        slideshow_remove_pictures (Slideshow *self, const char *path);
+BOOL        slideshow_contains (Slideshow *self, const char *filename);
 void        slideshow_show_and_increment (Slideshow *self, char **error);
-int         slideshow_length (const Slideshow *self);
+int         slideshow_length (Slideshow *self);
 void        slideshow_randomize (Slideshow *self);
 END_DECLS
 
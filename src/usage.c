@@ -21,13 +21,18 @@
 ==========================================================================*/
 void usage_show (FILE *fout, const char *argv0)
   {
-  fprintf (fout, "Usage: %s [options] {images}\n", argv0);
+  fprintf (fout, "Usage: %s [options] {images|directories}\n", argv0);
   fprintf (fout, "  -d,--fbdev=device    framebuffer device\n");
+  fprintf (fout, "     --dither          dither on 16-bit framebuffers\n");
   fprintf (fout, "  -f,--fit-width       fit image to display width, not height\n");
   fprintf (fout, "  -h,--help            show this message\n");
+  fprintf (fout, "     --include=globs   pictures in directories (*.jpg,*.jpeg)\n");
+  fprintf (fout, "     --index=file      slideshow index (~/.jpegtofb.index)\n");
   fprintf (fout, "  -l,--landscape       only include landscape format in slideshow\n");
   fprintf (fout, "  -r,--randomize       randomize slideshow order\n");
   fprintf (fout, "     --log-level=N     log level, 0-5 (default 2)\n");
+  fprintf (fout, "     --scans=N         read only N scans of progressive JPEGs\n");
+  fprintf (fout, "     --smooth          scale with a filter, not by sampling\n");
   fprintf (fout, "  -s,--sleep=seconds   time between images in slideshow mode (60)\n");
   fprintf (fout, "     --syslog          messages to system log\n");
   fprintf (fout, "  -v,--version         show version\n");
@@ -0,0 +1,476 @@
+/*==========================================================================
+
+  jpegtofb
+  watch.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Finds the pictures in a directory, and all the directories below it,
+  and then keeps track of pictures that are added, removed, or replaced
+  there while the slideshow is running. Pictures are files whose names
+  match one of a list of patterns, like "*.jpg"; hidden files and
+  directories are ignored, which also keeps out the temporary files
+  that most file-synchronization tools write.
+
+  Each directory is watched with inotify, so changes are reported by
+  the kernel as they happen, and nothing is ever scanned twice. The
+  watch on a directory is added before the directory is read, so a
+  file that appears while that's happening is not missed -- although
+  it might be reported twice. A file counts as changed when it is
+  closed after writing, or moved into place, not when it is created,
+  because it might not be complete until then. A directory that goes,
+  or moves, takes its pictures out of the show with it.
+
+  The initial search, watch_add_tree(), is done by the caller. Changes
+  are reported on a background thread, started by watch_start(); until
+  then, the kernel queues them. Only that thread touches the list of
+  watched directories after it starts, so there is no locking. When
+  there have been changes, and then nothing more for a few seconds,
+  the thread calls the quiet function, so that anything that depends
+  on all the changes -- like the index -- is brought up to date once,
+  and not after every file of a large copy.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "log.h"
+#include "list.h"
+#include "string.h"
+#include "file.h"
+#include "watch.h"
+
+// Nice value for the thread that handles changes. Checking a new
+//   picture is not urgent
+#define WATCH_NICE 10
+
+// How long, in milliseconds, there must be no changes before the
+//   quiet function is called
+#define WATCH_QUIET 5000
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM \
+  | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct _Watch
+  {
+  int fd;
+  // Written to by watch_destroy(), to stop the thread
+  int quit_pipe[2];
+  char **patterns;
+  int n_patterns;
+  // The directory watched by each inotify watch descriptor, or NULL
+  char **dirs;
+  int n_dirs;
+  WatchFileFn change_fn;
+  WatchFileFn remove_fn;
+  WatchQuietFn quiet_fn;
+  void *user_data;
+  BOOL started;
+  pthread_t thread;
+  };
+
+// What watch_add_tree() passes to list_foreach()
+typedef struct _WatchFound
+  {
+  Watch *watch;
+  WatchFileFn found_fn;
+  void *user_data;
+  } WatchFound;
+
+
+/*==========================================================================
+
+  watch_create
+
+  patterns is a comma-separated list of filename patterns
+
+==========================================================================*/
+Watch *watch_create (const char *patterns, WatchFileFn change_fn,
+       WatchFileFn remove_fn, WatchQuietFn quiet_fn, void *user_data)
+  {
+  LOG_IN
+  Watch *self = malloc (sizeof (Watch));
+  memset (self, 0, sizeof (Watch));
+  self->change_fn = change_fn;
+  self->remove_fn = remove_fn;
+  self->quiet_fn = quiet_fn;
+  self->user_data = user_data;
+
+  char *s = strdup (patterns);
+  char *saveptr;
+  for (char *p = strtok_r (s, ",", &saveptr); p;
+       p = strtok_r (NULL, ",", &saveptr))
+    {
+    self->patterns = realloc (self->patterns,
+      (self->n_patterns + 1) * sizeof (char *));
+    self->patterns[self->n_patterns++] = strdup (p);
+    }
+  free (s);
+
+  self->quit_pipe[0] = self->quit_pipe[1] = -1;
+  self->fd = inotify_init1 (IN_CLOEXEC);
+  if (self->fd < 0 || pipe (self->quit_pipe) != 0)
+    {
+    log_warning ("Can't watch for new pictures: %s", strerror (errno));
+    if (self->fd >= 0) close (self->fd);
+    self->fd = -1;
+    }
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  watch_destroy
+
+==========================================================================*/
+void watch_destroy (Watch *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    if (self->started)
+      {
+      if (write (self->quit_pipe[1], "", 1) == 1)
+        pthread_join (self->thread, NULL);
+      }
+    if (self->fd >= 0) 
+      {
+      close (self->fd);
+      close (self->quit_pipe[0]);
+      close (self->quit_pipe[1]);
+      }
+    for (int i = 0; i < self->n_dirs; i++)
+      free (self->dirs[i]);
+    free (self->dirs);
+    for (int i = 0; i < self->n_patterns; i++)
+      free (self->patterns[i]);
+    free (self->patterns);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  watch_matches
+
+  Whether a filename, without the directory, is that of a picture
+
+==========================================================================*/
+static BOOL watch_matches (const Watch *self, const char *name)
+  {
+  if (name[0] == '.') return FALSE;
+  for (int i = 0; i < self->n_patterns; i++)
+    if (file_name_matches_pattern (name, self->patterns[i]))
+      return TRUE;
+  return FALSE;
+  }
+
+
+/*==========================================================================
+
+  watch_forget_tree
+
+  Stop watching a directory, and the directories below it, because
+  they have been moved away. If they have been moved somewhere else
+  that is watched, they will be added again, under their new names.
+  Returns the number of directories that were being watched
+
+==========================================================================*/
+static int watch_forget_tree (Watch *self, const char *dir)
+  {
+  int ret = 0;
+  int l = strlen (dir);
+  for (int i = 0; i < self->n_dirs; i++)
+    {
+    const char *d = self->dirs[i];
+    if (d && strncmp (d, dir, l) == 0 && (d[l] == 0 || d[l] == '/'))
+      {
+      log_debug ("watch: forget %s", d);
+      inotify_rm_watch (self->fd, i);
+      free (self->dirs[i]);
+      self->dirs[i] = NULL;
+      ret++;
+      }
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  watch_same_dir
+
+  Whether two pathnames are the same directory -- one might be a link
+  to the other. If the first doesn't exist any more, they aren't
+
+==========================================================================*/
+static BOOL watch_same_dir (const char *dir1, const char *dir2)
+  {
+  struct stat sb1, sb2;
+  return stat (dir1, &sb1) == 0 && stat (dir2, &sb2) == 0
+    && sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino;
+  }
+
+
+/*==========================================================================
+
+  watch_found_file, watch_found_dir
+
+  Called by list_foreach() with the Strings from file_expand_directory()
+
+==========================================================================*/
+static void watch_found_file (void *item, void *user_data)
+  {
+  WatchFound *f = user_data;
+  const char *path = string_cstr (item);
+  const char *name = strrchr (path, '/');
+  if (watch_matches (f->watch, name ? name + 1 : path))
+    f->found_fn (path, f->user_data);
+  }
+
+static void watch_found_dir (void *item, void *user_data)
+  {
+  WatchFound *f = user_data;
+  watch_add_tree (f->watch, string_cstr (item), f->found_fn,
+    f->user_data);
+  }
+
+
+/*==========================================================================
+
+  watch_add_tree
+
+  Watch a directory, and every directory below it, and call found_fn
+  with each picture in them, in alphabetical order, directory by
+  directory. A directory that is already being watched -- because of a
+  link, perhaps -- is skipped, unless it has been moved here, and its
+  old name is out of date
+
+==========================================================================*/
+void watch_add_tree (Watch *self, const char *dir, WatchFileFn found_fn,
+       void *user_data)
+  {
+  LOG_IN
+  // Without a trailing '/', so that the pathnames made from the names
+  //   in inotify events are the same as the ones found here
+  char *d = strdup (dir);
+  int l = strlen (d);
+  while (l > 1 && d[l - 1] == '/')
+    d[--l] = 0;
+  log_debug ("watch: add tree %s", d);
+
+  BOOL seen = FALSE;
+  if (self->fd >= 0)
+    {
+    int wd = inotify_add_watch (self->fd, d, WATCH_EVENTS | IN_ONLYDIR);
+    if (wd >= 0 && wd < self->n_dirs && self->dirs[wd] 
+        && !watch_same_dir (self->dirs[wd], d))
+      {
+      // Moved here from somewhere else, and the event that says it has
+      //   gone from there hasn't been seen yet. Its pictures are found
+      //   again under their new names
+      char *old = strdup (self->dirs[wd]);
+      log_info ("Directory %s has moved to %s", old, d);
+      watch_forget_tree (self, old);
+      self->remove_fn (old, self->user_data);
+      free (old);
+      wd = inotify_add_watch (self->fd, d, WATCH_EVENTS | IN_ONLYDIR);
+      }
+    if (wd >= 0)
+      {
+      if (wd < self->n_dirs && self->dirs[wd])
+        {
+        log_debug ("watch: %s is already watched as %s", d,
+          self->dirs[wd]);
+        seen = TRUE;
+        }
+      else
+        {
+        if (wd >= self->n_dirs)
+          {
+          int n = wd + 64;
+          self->dirs = realloc (self->dirs, n * sizeof (char *));
+          memset (self->dirs + self->n_dirs, 0,
+            (n - self->n_dirs) * sizeof (char *));
+          self->n_dirs = n;
+          }
+        self->dirs[wd] = strdup (d);
+        }
+      }
+    else
+      log_warning ("Can't watch %s: %s", d, strerror (errno));
+    }
+
+  if (!seen)
+    {
+    WatchFound f = { self, found_fn, user_data };
+    List *names;
+    if (file_expand_directory (d, FE_FILES | FE_PREPEND_PATH, &names))
+      {
+      list_sort (names, string_alpha_sort_fn, NULL);
+      list_foreach (names, watch_found_file, &f);
+      list_destroy (names);
+      }
+    else
+      log_warning ("Can't read directory %s: %s", d, strerror (errno));
+    if (file_expand_directory (d, FE_DIRS | FE_PREPEND_PATH, &names))
+      {
+      list_sort (names, string_alpha_sort_fn, NULL);
+      list_foreach (names, watch_found_dir, &f);
+      list_destroy (names);
+      }
+    }
+  free (d);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  watch_event
+
+==========================================================================*/
+static void watch_event (Watch *self, const struct inotify_event *ev)
+  {
+  if (ev->mask & IN_Q_OVERFLOW)
+    {
+    log_warning ("Too many changes at once: some new pictures may "
+      "have been missed");
+    return;
+    }
+  if (ev->wd < 0 || ev->wd >= self->n_dirs || !self->dirs[ev->wd])
+    return;
+  if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+    {
+    // The directory itself has gone, or moved, or can't be watched
+    //   any more -- because it was unmounted, perhaps. Usually the 
+    //   event for its parent has dealt with this already, but there
+    //   is none for a directory named on the command line. If it has
+    //   moved somewhere else that is watched, it is added again, 
+    //   under its new name, by the event for its new parent
+    char *dir = strdup (self->dirs[ev->wd]);
+    log_info ("Directory %s has gone", dir);
+    watch_forget_tree (self, dir);
+    self->remove_fn (dir, self->user_data);
+    free (dir);
+    return;
+    }
+  if (ev->len == 0 || ev->name[0] == '.') return;
+
+  char *path;
+  asprintf (&path, "%s/%s", self->dirs[ev->wd], ev->name);
+  if (ev->mask & IN_ISDIR)
+    {
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+      {
+      log_info ("New directory %s", path);
+      watch_add_tree (self, path, self->change_fn, self->user_data);
+      }
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+      {
+      // The directory's own event might have come first
+      if (watch_forget_tree (self, path) > 0)
+        log_info ("Directory %s has gone", path);
+      self->remove_fn (path, self->user_data);
+      }
+    }
+  else if (watch_matches (self, ev->name))
+    {
+    if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+      {
+      log_debug ("watch: %s changed", path);
+      self->change_fn (path, self->user_data);
+      }
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+      {
+      log_debug ("watch: %s removed", path);
+      self->remove_fn (path, self->user_data);
+      }
+    }
+  free (path);
+  }
+
+
+/*==========================================================================
+
+  watch_thread
+
+==========================================================================*/
+static void *watch_thread (void *arg)
+  {
+  Watch *self = arg;
+  setpriority (PRIO_PROCESS, syscall (SYS_gettid), WATCH_NICE);
+
+  char buf[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  struct pollfd fds[2];
+  fds[0].fd = self->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = self->quit_pipe[0];
+  fds[1].events = POLLIN;
+
+  BOOL changed = FALSE;
+  int n;
+  while ((n = poll (fds, 2, changed ? WATCH_QUIET : -1)) >= 0
+       && !fds[1].revents)
+    {
+    if (n == 0)
+      {
+      changed = FALSE;
+      if (self->quiet_fn) self->quiet_fn (self->user_data);
+      continue;
+      }
+    changed = TRUE;
+    ssize_t len = read (self->fd, buf, sizeof (buf));
+    if (len <= 0) break;
+    const struct inotify_event *ev;
+    for (char *p = buf; p < buf + len;
+         p += sizeof (struct inotify_event) + ev->len)
+      {
+      ev = (const struct inotify_event *)p;
+      watch_event (self, ev);
+      }
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  watch_start
+
+  Start reporting changes, including any that have happened since
+  the directories were added
+
+==========================================================================*/
+void watch_start (Watch *self)
+  {
+  LOG_IN
+  if (self->fd >= 0 && !self->started)
+    {
+    // Signals must go to the main thread
+    sigset_t all, old;
+    sigfillset (&all);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+    if (pthread_create (&self->thread, NULL, watch_thread, self) == 0)
+      self->started = TRUE;
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+    }
+  LOG_OUT
+  }
+
+
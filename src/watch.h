@@ -0,0 +1,36 @@
+/*============================================================================
+
+  jpegtofb
+  watch.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+struct _Watch;
+typedef struct _Watch Watch;
+
+// Called with the pathname of a picture. For a removal, the pathname
+//   might be that of a directory, in which case everything in it has
+//   gone
+typedef void (*WatchFileFn) (const char *path, void *user_data);
+
+// Called when there have been changes, and then none for a while
+typedef void (*WatchQuietFn) (void *user_data);
+
+BEGIN_DECLS
+
+Watch      *watch_create (const char *patterns, WatchFileFn change_fn,
+              WatchFileFn remove_fn, WatchQuietFn quiet_fn, 
+              void *user_data);
+void        watch_destroy (Watch *self);
+void        watch_add_tree (Watch *self, const char *dir, 
+              WatchFileFn found_fn, void *user_data);
+void        watch_start (Watch *self);
+
+END_DECLS
+
+
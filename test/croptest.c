@@ -0,0 +1,198 @@
+/*==========================================================================
+
+  jpegtofb
+  croptest.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Checks that decoding part of a picture -- a band of iMCU rows, and
+  some of the columns -- produces the rows that were asked for, and
+  nothing on stderr. libjpeg complains about "extraneous bytes" if it
+  is asked to finish a file that it has only read part of, which is
+  what happened when a band at the top of the picture was taken to
+  reach the bottom.
+
+  The pictures are made here, with libjpeg's own encoder, so that the
+  sampling factors are known. Build and run with "make test".
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "defs.h"
+#include "jpeglib.h"
+#include "jpegreader.h"
+
+typedef struct _TestCase
+  {
+  const char *name;
+  int width;
+  int height;
+  // Sampling factors of the luminance component
+  int h_samp;
+  int v_samp;
+  // Passed to jpegreader_decode(), to choose the decoder's scale
+  int min_width;
+  int min_height;
+  // The region, in pixels of the decoded picture
+  JpegReaderRegion region;
+  } TestCase;
+
+static const TestCase test_cases[] =
+  {
+  { "4:2:0 at 1/8, top-anchored", 640, 480, 2, 2, 1, 1,
+      { 5, 1, 71, 57 } },
+  { "4:4:4, first row only", 333, 251, 1, 1, 333, 251,
+      { 0, 0, 333, 1 } },
+  { "4:2:0, top half", 640, 480, 2, 2, 640, 480,
+      { 100, 0, 300, 240 } },
+  { "4:2:0, middle band", 640, 480, 2, 2, 640, 480,
+      { 0, 200, 640, 50 } },
+  { "4:2:0, bottom band", 640, 480, 2, 2, 640, 480,
+      { 0, 400, 640, 80 } },
+  { "4:4:4, whole picture", 333, 251, 1, 1, 333, 251,
+      { 0, 0, 333, 251 } },
+  };
+
+// What the start and row functions are given
+typedef struct _TestDecode
+  {
+  JpegReaderRegion region;
+  int rows;
+  int next_y;
+  BOOL in_order;
+  } TestDecode;
+
+
+/*==========================================================================
+
+  test_make_jpeg
+
+==========================================================================*/
+static BOOL test_make_jpeg (const char *filename, const TestCase *c)
+  {
+  FILE *f = fopen (filename, "wb");
+  if (!f) return FALSE;
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error (&jerr);
+  jpeg_create_compress (&cinfo);
+  jpeg_stdio_dest (&cinfo, f);
+  cinfo.image_width = c->width;
+  cinfo.image_height = c->height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults (&cinfo);
+  cinfo.comp_info[0].h_samp_factor = c->h_samp;
+  cinfo.comp_info[0].v_samp_factor = c->v_samp;
+  jpeg_start_compress (&cinfo, TRUE);
+  BYTE *row = malloc (c->width * 3);
+  while (cinfo.next_scanline < cinfo.image_height)
+    {
+    int y = cinfo.next_scanline;
+    for (int x = 0; x < c->width; x++)
+      {
+      row[x * 3] = x + y;
+      row[x * 3 + 1] = x ^ y;
+      row[x * 3 + 2] = x * y >> 4;
+      }
+    JSAMPROW r = row;
+    jpeg_write_scanlines (&cinfo, &r, 1);
+    }
+  jpeg_finish_compress (&cinfo);
+  jpeg_destroy_compress (&cinfo);
+  free (row);
+  return fclose (f) == 0;
+  }
+
+
+/*==========================================================================
+
+  test_start, test_row
+
+==========================================================================*/
+static void test_start (int width, int height, JpegReaderRegion *region,
+      JpegReaderFormat *format, void *user_data)
+  {
+  TestDecode *d = user_data;
+  *region = d->region;
+  d->next_y = region->y;
+  }
+
+static void test_row (const BYTE *row, int y, void *user_data)
+  {
+  TestDecode *d = user_data;
+  if (y != d->next_y) d->in_order = FALSE;
+  d->next_y = y + 1;
+  d->rows++;
+  }
+
+
+/*==========================================================================
+
+  main
+
+==========================================================================*/
+int main (int argc, char **argv)
+  {
+  int failed = 0;
+  char filename[] = "/tmp/croptestXXXXXX";
+  int fd = mkstemp (filename);
+  // libjpeg's messages go to stderr, which is collected here
+  FILE *messages = tmpfile ();
+  int saved_stderr = dup (2);
+  if (fd < 0 || !messages || saved_stderr < 0)
+    {
+    perror ("croptest");
+    return 1;
+    }
+  close (fd);
+
+  for (int i = 0; i < sizeof (test_cases) / sizeof (test_cases[0]); i++)
+    {
+    const TestCase *c = &test_cases[i];
+    if (!test_make_jpeg (filename, c))
+      {
+      perror (filename);
+      failed++;
+      continue;
+      }
+
+    TestDecode d = { c->region, 0, 0, TRUE };
+    char *error = NULL;
+    fflush (stderr);
+    ftruncate (fileno (messages), 0);
+    rewind (messages);
+    dup2 (fileno (messages), 2);
+    jpegreader_decode (filename, c->min_width, c->min_height, test_start,
+      test_row, &d, &error);
+    fflush (stderr);
+    dup2 (saved_stderr, 2);
+
+    char output[256];
+    int n = pread (fileno (messages), output, sizeof (output) - 1, 0);
+    output[n > 0 ? n : 0] = 0;
+    const char *problem = NULL;
+    if (error)
+      problem = error;
+    else if (n > 0)
+      problem = output;
+    else if (d.rows != c->region.height || !d.in_order)
+      problem = "wrong rows delivered";
+    if (problem)
+      {
+      printf ("FAIL %s: %s\n", c->name, problem);
+      failed++;
+      }
+    else
+      printf ("ok   %s\n", c->name);
+    free (error);
+    }
+
+  fclose (messages);
+  unlink (filename);
+  return failed ? 1 : 0;
+  }
+